@@ -0,0 +1,116 @@
+/**
+Lightweight profiler library for c++
+Copyright(C) 2016  Sergey Yagovtsev, Victor Zarubkin
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+GNU General Public License Usage
+Alternatively, this file may be used under the terms of the GNU
+General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+**/
+
+
+#ifndef EASY_PROFILER__ASYMMETRIC_BARRIER__H______
+#define EASY_PROFILER__ASYMMETRIC_BARRIER__H______
+
+#include <atomic>
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace profiler {
+
+    /** Asymmetric memory barrier.
+
+    Used to synchronize the hot path of the profiled threads (light side) with the rare
+    snapshot operation (heavy side) without any atomic read-modify-write instructions
+    or full fences on the hot path.
+
+    If the heavy side is supported by the OS (membarrier() on Linux, FlushProcessWriteBuffers() on Windows)
+    then light side is just a compiler barrier; otherwise light side falls back to a full memory fence.
+    */
+    class asymmetric_barrier
+    {
+        bool m_supported;
+
+#if defined(__linux__) && defined(__NR_membarrier)
+        enum : int {
+            MEMBARRIER_QUERY = 0,
+            MEMBARRIER_PRIVATE_EXPEDITED = 1 << 3,
+            MEMBARRIER_REGISTER_PRIVATE_EXPEDITED = 1 << 4
+        };
+
+        static inline long membarrier(int _cmd) {
+            return syscall(__NR_membarrier, _cmd, 0);
+        }
+#endif
+
+    public:
+
+        asymmetric_barrier() : m_supported(false)
+        {
+#ifdef _WIN32
+            m_supported = true;
+#elif defined(__linux__) && defined(__NR_membarrier)
+            const long commands = membarrier(MEMBARRIER_QUERY);
+            m_supported = commands > 0
+                && (commands & MEMBARRIER_PRIVATE_EXPEDITED) != 0
+                && membarrier(MEMBARRIER_REGISTER_PRIVATE_EXPEDITED) == 0;
+#endif
+        }
+
+        inline bool supported() const {
+            return m_supported;
+        }
+
+        /** Light side: must be executed by profiled thread between publishing a flag and reading shared data. */
+        inline void light() const {
+            if (m_supported)
+                ::std::atomic_signal_fence(::std::memory_order_seq_cst);
+            else
+                ::std::atomic_thread_fence(::std::memory_order_seq_cst);
+        }
+
+        /** Heavy side: guarantees that all previous stores of all threads executing light() are visible. */
+        inline void heavy() const {
+#ifdef _WIN32
+            FlushProcessWriteBuffers();
+#elif defined(__linux__) && defined(__NR_membarrier)
+            if (m_supported)
+                membarrier(MEMBARRIER_PRIVATE_EXPEDITED);
+            else
+                ::std::atomic_thread_fence(::std::memory_order_seq_cst);
+#else
+            ::std::atomic_thread_fence(::std::memory_order_seq_cst);
+#endif
+        }
+    };
+
+} // END of namespace profiler.
+
+#endif // EASY_PROFILER__ASYMMETRIC_BARRIER__H______
@@ -54,24 +54,45 @@ BaseBlockData::BaseBlockData(timestamp_t _begin_time, block_id_t _descriptor_id)
 
 Block::Block(Block&& that)
     : BaseBlockData(that.m_begin, that.m_id)
+    , m_counters(that.m_counters)
+    , m_cpuTime(that.m_cpuTime)
+    , m_lockId(that.m_lockId)
+    , m_flowId(that.m_flowId)
     , m_name(that.m_name)
     , m_status(that.m_status)
+    , m_flags(that.m_flags)
+    , m_sampling(that.m_sampling)
+    , m_minDuration(that.m_minDuration)
 {
     m_end = that.m_end;
 }
 
 Block::Block(timestamp_t _begin_time, block_id_t _descriptor_id, const char* _runtimeName)
     : BaseBlockData(_begin_time, _descriptor_id)
+    , m_counters()
+    , m_cpuTime(0)
+    , m_lockId(0)
+    , m_flowId(0)
     , m_name(_runtimeName)
     , m_status(::profiler::ON)
+    , m_flags(0)
+    , m_sampling(1)
+    , m_minDuration(0)
 {
 
 }
 
 Block::Block(const BaseBlockDescriptor* _descriptor, const char* _runtimeName)
     : BaseBlockData(1ULL, _descriptor->id())
+    , m_counters()
+    , m_cpuTime(0)
+    , m_lockId(0)
+    , m_flowId(0)
     , m_name(_runtimeName)
     , m_status(_descriptor->status())
+    , m_flags(_descriptor->flags())
+    , m_sampling(_descriptor->sampling())
+    , m_minDuration(_descriptor->minDuration())
 {
 
 }
@@ -112,23 +133,44 @@ BaseBlockData::BaseBlockData(timestamp_t, block_id_t)
 
 Block::Block(Block&&)
     : BaseBlockData(0, ~0U)
+    , m_counters()
+    , m_cpuTime(0)
+    , m_lockId(0)
+    , m_flowId(0)
     , m_name("")
     , m_status(::profiler::OFF)
+    , m_flags(0)
+    , m_sampling(1)
+    , m_minDuration(0)
 {
 }
 
 Block::Block(timestamp_t, block_id_t, const char*)
     : BaseBlockData(0, ~0U)
+    , m_counters()
+    , m_cpuTime(0)
+    , m_lockId(0)
+    , m_flowId(0)
     , m_name("")
     , m_status(::profiler::OFF)
+    , m_flags(0)
+    , m_sampling(1)
+    , m_minDuration(0)
 {
 
 }
 
 Block::Block(const BaseBlockDescriptor*, const char*)
     : BaseBlockData(0, ~0U)
+    , m_counters()
+    , m_cpuTime(0)
+    , m_lockId(0)
+    , m_flowId(0)
     , m_name("")
     , m_status(::profiler::OFF)
+    , m_flags(0)
+    , m_sampling(1)
+    , m_minDuration(0)
 {
 
 }
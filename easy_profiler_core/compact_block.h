@@ -0,0 +1,298 @@
+/**
+Lightweight profiler library for c++
+Copyright(C) 2016  Sergey Yagovtsev, Victor Zarubkin
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+GNU General Public License Usage
+Alternatively, this file may be used under the terms of the GNU
+General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+**/
+
+
+#ifndef EASY_PROFILER__COMPACT_BLOCK__H_______
+#define EASY_PROFILER__COMPACT_BLOCK__H_______
+
+#include "easy/profiler.h"
+#include <string.h>
+
+namespace profiler {
+
+    /** Compact block record encoding (.prof format since v1.1.0).
+
+    Record payload (after uint16_t size prefix):
+    - varint: begin time. If the lowest bit is 1 then (value >> 1) is absolute begin time,
+      otherwise (value >> 1) is zigzag-coded difference with the begin time of the previous record
+      in the same list (the first record of every chunk is absolute, so chunks are independent);
+    - varint: zigzag-coded duration (end - begin);
+    - varint: (block descriptor id << 2) | (has_extensions << 1) | has_name;
+    - if has_name == 1: varint runtime name id (index + 1 in the runtime names table written after descriptors);
+    - if has_extensions == 1: varint mask of extensions (see Extension);
+    - if EXTENSION_COUNTERS is set: varints instructions, cycles and cache misses (see HardwareCounters);
+    - if EXTENSION_CPU_TIME is set: varint thread CPU time spent inside the block (in nanoseconds);
+    - if EXTENSION_LOCK is set: varint identity of the lock for lock wait and hold blocks (see profiler::beginLockBlock);
+    - if EXTENSION_FLOW is set: varint identity of the flow for flow events (see EASY_FLOW_BEGIN);
+
+    Reader decodes records back into BaseBlockData layout followed by zero-terminated name
+    and by values of extensions (HardwareCounters, then timestamp_t CPU time, then uint64_t lock id, then uint64_t flow id) present in the record.
+    */
+    namespace compact {
+
+        const uint16_t MAX_VARINT_SIZE = 10;
+        const uint16_t MAX_HEADER_SIZE = MAX_VARINT_SIZE * 8 + 5 * 2 + 2;
+
+        /** Optional values of the record. */
+        enum Extension : uint8_t
+        {
+            EXTENSION_COUNTERS = 1, ///< Hardware counters deltas
+            EXTENSION_CPU_TIME = 2, ///< Thread CPU time
+            EXTENSION_LOCK     = 4, ///< Identity of the lock
+            EXTENSION_FLOW     = 8, ///< Identity of the flow
+        };
+
+        struct header
+        {
+            timestamp_t begin = 0;
+            timestamp_t   end = 0;
+            block_id_t     id = 0;
+            uint32_t  name_id = 0; ///< 0 means that block has no runtime name
+            uint8_t extensions = 0; ///< Combination of Extension values
+            HardwareCounters counters = {0, 0, 0}; ///< Valid only if EXTENSION_COUNTERS is set
+            timestamp_t cpu_time = 0; ///< Valid only if EXTENSION_CPU_TIME is set
+            uint64_t     lock_id = 0; ///< Valid only if EXTENSION_LOCK is set
+            uint64_t     flow_id = 0; ///< Valid only if EXTENSION_FLOW is set
+        };
+
+        inline uint64_t zigzag(int64_t _value) {
+            return (static_cast<uint64_t>(_value) << 1) ^ static_cast<uint64_t>(_value >> 63);
+        }
+
+        inline int64_t unzigzag(uint64_t _value) {
+            return static_cast<int64_t>(_value >> 1) ^ -static_cast<int64_t>(_value & 1);
+        }
+
+        inline uint16_t write_varint(uint8_t* _out, uint64_t _value)
+        {
+            uint16_t n = 0;
+            while (_value >= 0x80) {
+                _out[n++] = static_cast<uint8_t>(_value | 0x80);
+                _value >>= 7;
+            }
+            _out[n++] = static_cast<uint8_t>(_value);
+            return n;
+        }
+
+        /** Returns number of bytes read or 0 if varint is not finished within _size bytes. */
+        inline uint16_t read_varint(const uint8_t* _in, uint16_t _size, uint64_t& _value)
+        {
+            _value = 0;
+            for (uint16_t n = 0, shift = 0; n < _size && n < MAX_VARINT_SIZE; ++n, shift += 7) {
+                _value |= static_cast<uint64_t>(_in[n] & 0x7f) << shift;
+                if ((_in[n] & 0x80) == 0)
+                    return n + 1;
+            }
+            return 0;
+        }
+
+        /** Size of the record decoded into BaseBlockData + zero-terminated name + values of extensions. */
+        inline uint16_t decoded_size(const header& _header, uint16_t _nameLength)
+        {
+            size_t size = sizeof(BaseBlockData) + _nameLength + 1;
+            if (_header.extensions & EXTENSION_COUNTERS)
+                size += sizeof(HardwareCounters);
+            if (_header.extensions & EXTENSION_CPU_TIME)
+                size += sizeof(timestamp_t);
+            if (_header.extensions & EXTENSION_LOCK)
+                size += sizeof(uint64_t);
+            if (_header.extensions & EXTENSION_FLOW)
+                size += sizeof(uint64_t);
+            return static_cast<uint16_t>(size);
+        }
+
+        /** Encodes record header.
+
+        \param _lastBegin Begin time of the previous record or nullptr to write begin time as absolute value.
+        */
+        inline uint16_t encode_header(uint8_t* _out, const header& _header, const timestamp_t* _lastBegin)
+        {
+            const uint64_t begin = _lastBegin == nullptr ? ((_header.begin << 1) | 1)
+                                                         : (zigzag(static_cast<int64_t>(_header.begin - *_lastBegin)) << 1);
+            uint16_t n = write_varint(_out, begin);
+            n += write_varint(_out + n, zigzag(static_cast<int64_t>(_header.end - _header.begin)));
+            n += write_varint(_out + n, (static_cast<uint64_t>(_header.id) << 2) | (_header.extensions != 0 ? 2 : 0) | (_header.name_id != 0 ? 1 : 0));
+            if (_header.name_id != 0)
+                n += write_varint(_out + n, _header.name_id);
+            if (_header.extensions != 0)
+                n += write_varint(_out + n, _header.extensions);
+            if (_header.extensions & EXTENSION_COUNTERS)
+            {
+                n += write_varint(_out + n, _header.counters.instructions);
+                n += write_varint(_out + n, _header.counters.cycles);
+                n += write_varint(_out + n, _header.counters.cache_misses);
+            }
+            if (_header.extensions & EXTENSION_CPU_TIME)
+                n += write_varint(_out + n, _header.cpu_time);
+            if (_header.extensions & EXTENSION_LOCK)
+                n += write_varint(_out + n, _header.lock_id);
+            if (_header.extensions & EXTENSION_FLOW)
+                n += write_varint(_out + n, _header.flow_id);
+            return n;
+        }
+
+        /** Decodes record header.
+
+        \param _lastBegin Begin time of the previous record, updated by this function.
+
+        \retval Size of the header or 0 if record is corrupted.
+        */
+        inline uint16_t decode_header(const char* _record, uint16_t _size, timestamp_t& _lastBegin, header& _header)
+        {
+            auto data = reinterpret_cast<const uint8_t*>(_record);
+            uint64_t value = 0, duration = 0, id = 0;
+
+            uint16_t n = read_varint(data, _size, value);
+            if (n == 0)
+                return 0;
+
+            _header.begin = (value & 1) != 0 ? (value >> 1) : (_lastBegin + static_cast<timestamp_t>(unzigzag(value >> 1)));
+
+            auto bytes = read_varint(data + n, _size - n, duration);
+            if (bytes == 0)
+                return 0;
+            n += bytes;
+
+            bytes = read_varint(data + n, _size - n, id);
+            if (bytes == 0)
+                return 0;
+            n += bytes;
+
+            const bool has_extensions = (id & 2) != 0;
+
+            _header.name_id = 0;
+            if ((id & 1) != 0)
+            {
+                bytes = read_varint(data + n, _size - n, value);
+                if (bytes == 0 || value == 0 || value > 0xffffffffULL)
+                    return 0;
+                n += bytes;
+                _header.name_id = static_cast<uint32_t>(value);
+            }
+
+            id >>= 2;
+
+            _header.extensions = 0;
+            if (has_extensions)
+            {
+                bytes = read_varint(data + n, _size - n, value);
+                if (bytes == 0 || value > 0xff)
+                    return 0;
+                n += bytes;
+                _header.extensions = static_cast<uint8_t>(value);
+            }
+
+            if (_header.extensions & EXTENSION_COUNTERS)
+            {
+                uint64_t* values[] = {&_header.counters.instructions, &_header.counters.cycles, &_header.counters.cache_misses};
+                for (auto counter : values)
+                {
+                    bytes = read_varint(data + n, _size - n, *counter);
+                    if (bytes == 0)
+                        return 0;
+                    n += bytes;
+                }
+            }
+
+            if (_header.extensions & EXTENSION_CPU_TIME)
+            {
+                bytes = read_varint(data + n, _size - n, _header.cpu_time);
+                if (bytes == 0)
+                    return 0;
+                n += bytes;
+            }
+
+            if (_header.extensions & EXTENSION_LOCK)
+            {
+                bytes = read_varint(data + n, _size - n, _header.lock_id);
+                if (bytes == 0)
+                    return 0;
+                n += bytes;
+            }
+
+            if (_header.extensions & EXTENSION_FLOW)
+            {
+                bytes = read_varint(data + n, _size - n, _header.flow_id);
+                if (bytes == 0)
+                    return 0;
+                n += bytes;
+            }
+
+            _header.end = _header.begin + static_cast<timestamp_t>(unzigzag(duration));
+            _header.id = static_cast<block_id_t>(id);
+            _lastBegin = _header.begin;
+
+            return n;
+        }
+
+        /** Writes decoded record (BaseBlockData + zero-terminated name + values of extensions) into _out.
+
+        _out must have at least decoded_size(_header, _nameLength) bytes.
+
+        \retval Size of decoded data.
+        */
+        inline uint16_t write_decoded(const header& _header, const char* _name, uint16_t _nameLength, char* _out)
+        {
+            memcpy(_out, &_header.begin, sizeof(timestamp_t));
+            memcpy(_out + sizeof(timestamp_t), &_header.end, sizeof(timestamp_t));
+            memcpy(_out + sizeof(timestamp_t) * 2, &_header.id, sizeof(block_id_t));
+            if (_nameLength != 0)
+                memcpy(_out + sizeof(BaseBlockData), _name, _nameLength);
+            _out[sizeof(BaseBlockData) + _nameLength] = 0;
+
+            char* extension = _out + sizeof(BaseBlockData) + _nameLength + 1;
+            if (_header.extensions & EXTENSION_COUNTERS)
+            {
+                memcpy(extension, &_header.counters, sizeof(HardwareCounters));
+                extension += sizeof(HardwareCounters);
+            }
+            if (_header.extensions & EXTENSION_CPU_TIME)
+            {
+                memcpy(extension, &_header.cpu_time, sizeof(timestamp_t));
+                extension += sizeof(timestamp_t);
+            }
+            if (_header.extensions & EXTENSION_LOCK)
+            {
+                memcpy(extension, &_header.lock_id, sizeof(uint64_t));
+                extension += sizeof(uint64_t);
+            }
+            if (_header.extensions & EXTENSION_FLOW)
+                memcpy(extension, &_header.flow_id, sizeof(uint64_t));
+
+            return decoded_size(_header, _nameLength);
+        }
+
+    } // END of namespace compact.
+
+} // END of namespace profiler.
+
+#endif // EASY_PROFILER__COMPACT_BLOCK__H_______
@@ -0,0 +1,279 @@
+/**
+Lightweight profiler library for c++
+Copyright(C) 2016  Sergey Yagovtsev, Victor Zarubkin
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+GNU General Public License Usage
+Alternatively, this file may be used under the terms of the GNU
+General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+**/
+
+
+#ifndef EASY_PROFILER__CPU_FREQUENCY__H_______
+#define EASY_PROFILER__CPU_FREQUENCY__H_______
+
+#include "current_time.h"
+#include <atomic>
+#include <thread>
+
+#ifndef _WIN32
+# include <time.h>
+# include <stdio.h>
+#endif
+
+namespace profiler {
+
+    /** Frequency of the clock used by getCurrentTime() (ticks per second).
+
+    Calibration is done once in background thread launched by start() (when the clock source is selected),
+    so dumps do not spend any time on it:
+    - Windows: QueryPerformanceFrequency();
+    - CLOCK_MONOTONIC[_RAW] clock sources: timestamps are nanoseconds already;
+    - x86 with invariant TSC (CPUID 0x80000007): TSC frequency reported by kernel
+      (/sys/devices/system/cpu/cpu0/tsc_freq_khz) or by CPUID leaf 0x15;
+    - ARMv8: CNTFRQ_EL0 register;
+    - otherwise frequency is measured against CLOCK_MONOTONIC over a short sleep (not a busy loop)
+      and then refined by get() over the whole interval passed since start().
+    */
+    class cpu_frequency
+    {
+#ifndef _WIN32
+        enum : int64_t { NANOSECONDS_IN_SECOND = 1000000000LL, CALIBRATION_INTERVAL_MS = 50, ESTIMATION_INTERVAL_MS = 1 };
+
+        mutable std::atomic<int64_t> m_measuredInterval; ///< Interval (ns) of the last measurement
+        std::atomic<int64_t>                m_estimate; ///< Rough frequency measured shortly after start(), used by ticks() until calibration ends
+        std::thread                             m_thread;
+        profiler::timestamp_t                m_baseTicks;
+        int64_t                                 m_baseNs;
+#endif
+        mutable std::atomic<int64_t>         m_frequency; ///< 0 means that frequency is not calibrated yet
+        std::atomic_bool                         m_exact; ///< Frequency is reported by CPU or OS
+
+    public:
+
+        cpu_frequency()
+        {
+            m_frequency = ATOMIC_VAR_INIT(0LL);
+            m_exact = ATOMIC_VAR_INIT(false);
+#ifndef _WIN32
+            m_measuredInterval = ATOMIC_VAR_INIT(0LL);
+            m_estimate = ATOMIC_VAR_INIT(0LL);
+            m_baseTicks = 0;
+            m_baseNs = 0;
+#endif
+        }
+
+        ~cpu_frequency()
+        {
+#ifndef _WIN32
+            if (m_thread.joinable())
+                m_thread.join();
+#endif
+        }
+
+        /** Starts calibration of the current clock source (see profiler::clock::current_source).
+
+        \note Must not be called concurrently with get().
+        */
+        void start()
+        {
+#ifdef _WIN32
+            LARGE_INTEGER freq;
+            QueryPerformanceFrequency(&freq);
+            m_frequency.store(freq.QuadPart, std::memory_order_release);
+            m_exact.store(true, std::memory_order_release);
+#else
+            if (m_thread.joinable())
+                m_thread.join();
+
+            m_frequency.store(0, std::memory_order_release);
+            m_measuredInterval.store(0, std::memory_order_release);
+            m_estimate.store(0, std::memory_order_release);
+
+            const auto source = clock::current_source::get();
+            if (clock::is_nanoseconds(source))
+            {
+                // Frequency 0 means that timestamps are nanoseconds
+                m_exact.store(true, std::memory_order_release);
+                return;
+            }
+
+            // Reported frequency is cheap to read, so thresholds in nanoseconds (see ticks()) work right after the start
+            const auto frequency = reported();
+            if (frequency > 0)
+            {
+                m_frequency.store(frequency, std::memory_order_release);
+                m_exact.store(true, std::memory_order_release);
+                return;
+            }
+
+            m_exact.store(false, std::memory_order_release);
+            sample(m_baseTicks, m_baseNs);
+            m_thread = std::thread([this]() { calibrate(); });
+#endif
+        }
+
+        cpu_frequency(const cpu_frequency&) = delete;
+        cpu_frequency& operator = (const cpu_frequency&) = delete;
+
+        /** Returns true if frequency is reported by CPU or OS (it is not measured). */
+        inline bool exact() const
+        {
+            return m_exact.load(std::memory_order_acquire);
+        }
+
+        /** Converts nanoseconds into clock ticks using the last known frequency (without refinement).
+
+        While frequency is being calibrated the rough estimate is used.
+
+        \retval 0 if frequency is not estimated yet (during the first millisecond after start()).
+        */
+        inline profiler::timestamp_t ticks(uint32_t _nanoseconds) const
+        {
+            auto frequency = m_frequency.load(std::memory_order_relaxed);
+            if (frequency == 0)
+            {
+                if (exact())
+                    return _nanoseconds;
+#ifndef _WIN32
+                frequency = m_estimate.load(std::memory_order_relaxed);
+#endif
+                if (frequency == 0)
+                    return 0;
+            }
+            return static_cast<profiler::timestamp_t>(_nanoseconds) * static_cast<profiler::timestamp_t>(frequency / 1000) / 1000000ULL;
+        }
+
+        /** Returns frequency in ticks per second (0 if getCurrentTime() returns nanoseconds).
+
+        Measured frequency is refined over the whole interval passed since start().
+        Waits for background calibration only if called right after the start.
+        */
+        int64_t get() const
+        {
+#if defined(_WIN32)
+            return m_frequency.load(std::memory_order_acquire);
+#else
+            if (exact())
+                return m_frequency.load(std::memory_order_acquire);
+
+            profiler::timestamp_t ticks = 0;
+            int64_t ns = 0;
+            sample(ticks, ns);
+
+            if (ns - m_baseNs < CALIBRATION_INTERVAL_MS * 1000000LL)
+            {
+                // Too short interval for accurate measurement: wait for background calibration
+                int64_t frequency = 0;
+                while ((frequency = m_frequency.load(std::memory_order_acquire)) == 0)
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                return frequency;
+            }
+
+            if (ns - m_baseNs <= m_measuredInterval.load(std::memory_order_acquire))
+                return m_frequency.load(std::memory_order_acquire);
+
+            const auto frequency = measure(ticks, ns);
+            m_measuredInterval.store(ns - m_baseNs, std::memory_order_release);
+            m_frequency.store(frequency, std::memory_order_release);
+
+            return frequency;
+#endif
+        }
+
+    private:
+
+#ifndef _WIN32
+        static void sample(profiler::timestamp_t& _ticks, int64_t& _ns)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            _ticks = getCurrentTime();
+            _ns = static_cast<int64_t>(ts.tv_sec) * NANOSECONDS_IN_SECOND + ts.tv_nsec;
+        }
+
+        int64_t measure(profiler::timestamp_t _ticks, int64_t _ns) const
+        {
+            const double ticksPerNs = static_cast<double>(_ticks - m_baseTicks) / static_cast<double>(_ns - m_baseNs);
+            return static_cast<int64_t>(ticksPerNs * static_cast<double>(NANOSECONDS_IN_SECOND));
+        }
+
+        /** Returns frequency reported by CPU or OS or 0 if it is not available. */
+        static int64_t reported()
+        {
+#if defined(EASY_CLOCK_RDTSCP_SUPPORTED)
+            // TSC frequency is meaningful only if TSC is invariant (does not depend on P-, C- and T-states)
+            if (!clock::invariant_tsc())
+                return 0;
+
+            // Kernel knows TSC frequency after its own (long) calibration
+            auto file = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "r");
+            if (file != nullptr)
+            {
+                long long khz = 0;
+                const bool ok = fscanf(file, "%lld", &khz) == 1 && khz > 0;
+                fclose(file);
+                if (ok)
+                    return khz * 1000LL;
+            }
+
+            // TSC / core crystal clock ratio (CPUID leaf 0x15)
+            unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+            if (__get_cpuid_max(0, nullptr) >= 0x15)
+            {
+                __get_cpuid(0x15, &eax, &ebx, &ecx, &edx);
+                if (eax != 0 && ebx != 0 && ecx != 0)
+                    return static_cast<int64_t>(ecx) * ebx / eax;
+            }
+#elif defined(__aarch64__)
+            int64_t frequency = 0;
+            asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+            return frequency;
+#endif
+            return 0;
+        }
+
+        void calibrate()
+        {
+            profiler::timestamp_t ticks = 0;
+            int64_t ns = 0;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(ESTIMATION_INTERVAL_MS));
+            sample(ticks, ns);
+            m_estimate.store(measure(ticks, ns), std::memory_order_release);
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(CALIBRATION_INTERVAL_MS - ESTIMATION_INTERVAL_MS));
+            sample(ticks, ns);
+
+            int64_t measuredInterval = 0;
+            if (m_measuredInterval.compare_exchange_strong(measuredInterval, ns - m_baseNs, std::memory_order_acq_rel))
+                m_frequency.store(measure(ticks, ns), std::memory_order_release);
+        }
+#endif
+    };
+
+} // END of namespace profiler.
+
+#endif // EASY_PROFILER__CPU_FREQUENCY__H_______
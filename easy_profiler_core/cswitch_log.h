@@ -0,0 +1,77 @@
+/**
+Lightweight profiler library for c++
+Copyright(C) 2016  Sergey Yagovtsev, Victor Zarubkin
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+GNU General Public License Usage
+Alternatively, this file may be used under the terms of the GNU
+General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+**/
+
+
+#ifndef EASY_PROFILER__CSWITCH_LOG__H_
+#define EASY_PROFILER__CSWITCH_LOG__H_
+
+#include <stdint.h>
+
+/*
+Binary context switch log written by scripts/context_switch_logger_bin.stp
+(legacy text logs can be converted by scripts/convert_context_switch_log.py).
+
+Layout (little-endian):
+- CSwitchLogHeader;
+- sequence of 24-byte CSwitchRecord-s. Record with timestamp == CSWITCH_LOG_NAME_RECORD defines task name:
+  thread_from is name id, thread_to is name length including terminating '\0', the name itself follows the record
+  and is padded with zeros to multiple of 8 bytes. Each name is written once, before the first switch referencing it.
+*/
+
+namespace profiler {
+
+    const uint32_t CSWITCH_LOG_SIGNATURE = 0x53435A45; // "EZCS"
+    const uint32_t CSWITCH_LOG_VERSION = 1;
+    const uint64_t CSWITCH_LOG_NAME_RECORD = ~0ULL;
+
+#pragma pack(push, 1)
+    struct CSwitchLogHeader
+    {
+        uint32_t signature;
+        uint32_t   version;
+    };
+
+    struct CSwitchRecord
+    {
+        uint64_t   timestamp; ///< Nanoseconds (gettimeofday_ns() of SystemTap)
+        uint32_t thread_from;
+        uint32_t   thread_to;
+        uint32_t  process_to; ///< Process id of thread_to
+        uint32_t     name_id; ///< Id of thread_to task name
+    };
+#pragma pack(pop)
+
+    static_assert(sizeof(CSwitchRecord) == 24, "Context switch log record must be 24 bytes");
+
+} // END of namespace profiler.
+
+#endif // EASY_PROFILER__CSWITCH_LOG__H_
@@ -34,27 +34,30 @@ along with this program.If not, see <http://www.gnu.org/licenses/>.
 #define EASY_______CURRENT_TIME_H_____
 
 #include "easy/profiler.h"
+#include <atomic>
+
+class ProfileManager;
 
 #ifdef _WIN32
 #include <Windows.h>
 #else
 #include <chrono>
 #include <time.h>
-#ifdef __ARM_ARCH
 #include <sys/time.h>
-#endif//__ARM_ARCH
+#if defined(__i386__) || defined(__x86_64__) || defined(__amd64__)
+#include <cpuid.h>
+#endif
 #endif
 
-static inline profiler::timestamp_t getCurrentTime()
-{
-#ifdef _WIN32
-    //see https://msdn.microsoft.com/library/windows/desktop/dn553408(v=vs.85).aspx
-    LARGE_INTEGER elapsedMicroseconds;
-    if (!QueryPerformanceCounter(&elapsedMicroseconds))
-        return 0;
-    return (profiler::timestamp_t)elapsedMicroseconds.QuadPart;
-#else// not _WIN32
+namespace profiler {
+
+    namespace clock {
 
+#ifndef _WIN32
+
+        /** Returns value of the CPU cycle counter (TSC on x86) or nanoseconds if there is no such counter. */
+        static inline timestamp_t cpu_counter()
+        {
 #if (defined(__GNUC__) || defined(__ICC))
 
 	// part of code from google/benchmark library (Licensed under the Apache License, Version 2.0)
@@ -127,19 +130,200 @@ static inline profiler::timestamp_t getCurrentTime()
 	  gettimeofday(&tv, nullptr);
 	  return static_cast<int64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
 	#else
-	  #warning You need to define fast getCurrentTime() for your OS and CPU
-	  return std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now()).time_since_epoch().count();
-      #define USE_STD_CHRONO
+	  #define EASY_NO_CPU_COUNTER
+	  return std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()).time_since_epoch().count();
 	#endif
 
 #else // not _WIN32, __GNUC__, __ICC
-	#warning You need to define fast getCurrentTime() for your OS and CPU
-    return std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now()).time_since_epoch().count();
-    #define USE_STD_CHRONO
+    #define EASY_NO_CPU_COUNTER
+    return std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()).time_since_epoch().count();
 #endif
+        }
 
+#if defined(__i386__) || defined(__x86_64__) || defined(__amd64__)
+# define EASY_CLOCK_RDTSCP_SUPPORTED
+        /** Returns TSC value using serializing rdtscp instruction (it waits until all previous instructions are executed). */
+        static inline timestamp_t rdtscp()
+        {
+            uint32_t low, high;
+            __asm__ volatile("rdtscp" : "=a"(low), "=d"(high) :: "ecx");
+            return (static_cast<uint64_t>(high) << 32) | low;
+        }
 #endif
-}
 
+        /** Returns value of POSIX clock in nanoseconds (it goes through vDSO on Linux, so no syscall is made). */
+        static inline timestamp_t posix_clock(clockid_t _clock)
+        {
+            struct timespec ts;
+            clock_gettime(_clock, &ts);
+            return static_cast<timestamp_t>(ts.tv_sec) * 1000000000ULL + static_cast<timestamp_t>(ts.tv_nsec);
+        }
+
+#ifdef CLOCK_MONOTONIC_RAW
+# define EASY_CLOCK_MONOTONIC_RAW CLOCK_MONOTONIC_RAW
+#else
+# define EASY_CLOCK_MONOTONIC_RAW CLOCK_MONOTONIC
+#endif
+
+#endif // _WIN32
+
+        /** Default clock source used until ProfileManager selects the best one. */
+        constexpr ClockSource default_source()
+        {
+#if defined(_WIN32)
+            return CLOCK_SOURCE_QPC;
+#elif defined(EASY_NO_CPU_COUNTER)
+            return CLOCK_SOURCE_MONOTONIC;
+#else
+            return CLOCK_SOURCE_CPU_COUNTER;
+#endif
+        }
+
+        /** Returns true if timestamps of the clock source are nanoseconds (no frequency calibration is needed). */
+        inline bool is_nanoseconds(ClockSource _source)
+        {
+            return _source == CLOCK_SOURCE_MONOTONIC_RAW || _source == CLOCK_SOURCE_MONOTONIC;
+        }
+
+        /** Returns true if clock source can be used on this platform and CPU. */
+        inline bool available(ClockSource _source)
+        {
+            switch (_source)
+            {
+#ifdef _WIN32
+                case CLOCK_SOURCE_QPC:
+                    return true;
+#else
+                case CLOCK_SOURCE_CPU_COUNTER:
+# ifdef EASY_NO_CPU_COUNTER
+                    return false;
+# else
+                    return true;
+# endif
+
+                case CLOCK_SOURCE_RDTSCP:
+# ifdef EASY_CLOCK_RDTSCP_SUPPORTED
+                {
+                    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+                    return __get_cpuid_max(0x80000000, nullptr) >= 0x80000001
+                        && __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) != 0
+                        && (edx & (1U << 27)) != 0;
+                }
+# else
+                    return false;
+# endif
+
+                case CLOCK_SOURCE_MONOTONIC:
+                    return true;
+
+                case CLOCK_SOURCE_MONOTONIC_RAW:
+# ifdef CLOCK_MONOTONIC_RAW
+                    return true;
+# else
+                    return false;
+# endif
+#endif
+
+                default:
+                    return false;
+            }
+        }
+
+        /** Returns true if x86 TSC runs at constant rate in all P-, C- and T-states (CPUID 0x80000007). */
+        inline bool invariant_tsc()
+        {
+#if !defined(_WIN32) && defined(EASY_CLOCK_RDTSCP_SUPPORTED)
+            unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+            return __get_cpuid_max(0x80000000, nullptr) >= 0x80000007
+                && __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) != 0
+                && (edx & (1U << 8)) != 0;
+#else
+            return false;
+#endif
+        }
+
+        /** Returns current time of the given clock source. */
+        static inline timestamp_t read(ClockSource _source)
+        {
+#ifdef _WIN32
+            (void)_source;
+
+            //see https://msdn.microsoft.com/library/windows/desktop/dn553408(v=vs.85).aspx
+            LARGE_INTEGER elapsedMicroseconds;
+            if (!QueryPerformanceCounter(&elapsedMicroseconds))
+                return 0;
+            return (timestamp_t)elapsedMicroseconds.QuadPart;
+#else// not _WIN32
+            switch (_source)
+            {
+                case CLOCK_SOURCE_MONOTONIC_RAW:
+                    return posix_clock(EASY_CLOCK_MONOTONIC_RAW);
+
+                case CLOCK_SOURCE_MONOTONIC:
+                    return posix_clock(CLOCK_MONOTONIC);
+
+#ifdef EASY_CLOCK_RDTSCP_SUPPORTED
+                case CLOCK_SOURCE_RDTSCP:
+                    return rdtscp();
+#endif
+
+                default:
+                    return cpu_counter();
+            }
+#endif
+        }
+
+        /** Returns CPU time consumed by the calling thread (in nanoseconds).
+
+        On Linux it is CLOCK_THREAD_CPUTIME_ID: vDSO does not serve thread CPU clocks, so every call is a syscall
+        (about 0.2-1 us depending on the kernel and mitigations).
+        On Windows it is user + kernel time from GetThreadTimes() (also a syscall) with scheduler tick granularity.
+        */
+        static inline timestamp_t thread_cpu_time()
+        {
+#ifdef _WIN32
+            FILETIME creationTime, exitTime, kernelTime, userTime;
+            if (!GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime))
+                return 0;
+            const auto kernel = (static_cast<timestamp_t>(kernelTime.dwHighDateTime) << 32) | kernelTime.dwLowDateTime;
+            const auto user = (static_cast<timestamp_t>(userTime.dwHighDateTime) << 32) | userTime.dwLowDateTime;
+            return (kernel + user) * 100; // FILETIME is in 100-nanosecond intervals
+#else
+            return posix_clock(CLOCK_THREAD_CPUTIME_ID);
+#endif
+        }
+
+#if defined(__GNUC__) && !defined(_WIN32)
+# define EASY_CLOCK_HIDDEN __attribute__((visibility("hidden")))
+#else
+# define EASY_CLOCK_HIDDEN
+#endif
+
+        /** Clock source used by getCurrentTime() (see profiler::ClockSource).
+
+        It is changed only by ProfileManager (see ProfileManager::selectClockSource) and is not exported from the library.
+        */
+        class EASY_CLOCK_HIDDEN current_source EASY_FINAL
+        {
+            friend class ::ProfileManager;
+            static ::std::atomic<uint8_t> s_source;
+
+        public:
+
+            static inline ClockSource get(::std::memory_order _order = ::std::memory_order_acquire)
+            {
+                return static_cast<ClockSource>(s_source.load(_order));
+            }
+        };
+
+    } // END of namespace clock.
+
+} // END of namespace profiler.
+
+/** Returns current time of the selected clock source (see profiler::ClockSource). */
+static inline profiler::timestamp_t getCurrentTime()
+{
+    return profiler::clock::read(profiler::clock::current_source::get(std::memory_order_relaxed));
+}
 
 #endif // EASY_______CURRENT_TIME_H_____
@@ -0,0 +1,426 @@
+/**
+Lightweight profiler library for c++
+Copyright(C) 2016  Sergey Yagovtsev, Victor Zarubkin
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+GNU General Public License Usage
+Alternatively, this file may be used under the terms of the GNU
+General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+**/
+
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <chrono>
+#include <algorithm>
+#include "profile_manager.h"
+#include "current_time.h"
+#include "event_trace_linux.h"
+
+#if EASY_OPTION_LOG_ENABLED != 0
+# include <iostream>
+
+# ifndef EASY_ERRORLOG
+#  define EASY_ERRORLOG ::std::cerr
+# endif
+
+# ifndef EASY_LOG
+#  define EASY_LOG ::std::cerr
+# endif
+
+# ifndef EASY_ERROR
+#  define EASY_ERROR(LOG_MSG) EASY_ERRORLOG << "EasyProfiler ERROR: " << LOG_MSG
+# endif
+
+# ifndef EASY_LOGMSG
+#  define EASY_LOGMSG(LOG_MSG) EASY_LOG << "EasyProfiler INFO: " << LOG_MSG
+# endif
+
+#else
+
+# ifndef EASY_ERROR
+#  define EASY_ERROR(LOG_MSG) 
+# endif
+
+# ifndef EASY_LOGMSG
+#  define EASY_LOGMSG(LOG_MSG) 
+# endif
+
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#define MANAGER ProfileManager::instance()
+
+namespace profiler {
+
+    // Ring buffer is drained every 10 ms and one page holds about 170 switch records.
+    // Buffers of all threads are accounted in perf_event_mlock_kb (516 KB by default), so they must be small.
+    const size_t RING_BUFFER_PAGES = 2; // must be a power of 2
+
+    /** PERF_RECORD_SWITCH record with sample_id (sample_type == PERF_SAMPLE_TID | PERF_SAMPLE_TIME). */
+    struct SwitchRecord
+    {
+        perf_event_header header;
+        uint32_t             pid;
+        uint32_t             tid;
+        uint64_t            time;
+    };
+
+    static inline size_t pageSize()
+    {
+        static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return size;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
+#ifndef EASY_MAGIC_STATIC_CPP11
+    class EasyEventTracerInstance {
+        friend EasyEventTracer;
+        EasyEventTracer instance;
+    } EASY_EVENT_TRACER;
+#endif
+
+    EasyEventTracer& EasyEventTracer::instance()
+    {
+#ifndef EASY_MAGIC_STATIC_CPP11
+        return EASY_EVENT_TRACER.instance;
+#else
+        static EasyEventTracer tracer;
+        return tracer;
+#endif
+    }
+
+    EasyEventTracer::EasyEventTracer()
+        : m_baseTicks(0), m_baseNs(0), m_ticksPerNs(0), m_clockId(CLOCK_MONOTONIC), m_collectorId(0)
+    {
+        m_lowPriority = ATOMIC_VAR_INIT(EASY_OPTION_LOW_PRIORITY_EVENT_TRACING);
+        m_stop = ATOMIC_VAR_INIT(false);
+    }
+
+    EasyEventTracer::~EasyEventTracer()
+    {
+        disable();
+    }
+
+    bool EasyEventTracer::isLowPriority() const
+    {
+        return m_lowPriority.load(::std::memory_order_acquire);
+    }
+
+    void EasyEventTracer::setLowPriority(bool _value)
+    {
+        m_lowPriority.store(_value, ::std::memory_order_release);
+    }
+
+    bool EasyEventTracer::collected() const
+    {
+        return m_collected;
+    }
+
+    bool EasyEventTracer::complete() const
+    {
+        return m_collected && m_complete;
+    }
+
+    bool EasyEventTracer::traced(pid_t _tid) const
+    {
+        return m_collected && m_traced.find(_tid) != m_traced.end();
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
+    bool EasyEventTracer::openThread(pid_t _tid)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+        attr.sample_type = PERF_SAMPLE_TID | PERF_SAMPLE_TIME;
+        attr.context_switch = 1; // PERF_RECORD_SWITCH records (Linux 4.3+)
+        attr.sample_id_all = 1;
+        attr.use_clockid = 1;
+        attr.clockid = m_clockId;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        const int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, _tid, -1, -1, 0));
+        if (fd < 0)
+        {
+            if (errno != ESRCH) // Thread has finished already otherwise
+                m_failed.insert(_tid);
+            return false;
+        }
+
+        const auto size = (RING_BUFFER_PAGES + 1) * pageSize();
+        auto buffer = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (buffer == MAP_FAILED)
+        {
+            const int error = errno;
+            close(fd);
+            m_failed.insert(_tid);
+            errno = error;
+            return false;
+        }
+
+        m_events.push_back(ThreadEvent {buffer, _tid, fd, true});
+        m_traced.insert(_tid);
+        return true;
+    }
+
+    void EasyEventTracer::scanThreads()
+    {
+        auto dir = opendir("/proc/self/task");
+        if (dir == nullptr)
+            return;
+
+        std::vector<pid_t> tids, known;
+        while (auto entry = readdir(dir))
+        {
+            const auto tid = static_cast<pid_t>(atoi(entry->d_name));
+            if (tid > 0 && tid != m_collectorId)
+                tids.push_back(tid);
+        }
+
+        std::sort(tids.begin(), tids.end());
+        for (auto& event : m_events)
+        {
+            event.alive = std::binary_search(tids.begin(), tids.end(), event.tid);
+            known.push_back(event.tid);
+        }
+
+        // Forget finished threads which events have not been opened (thread id can be reused)
+        for (auto it = m_failed.begin(); it != m_failed.end();)
+        {
+            if (std::binary_search(tids.begin(), tids.end(), *it))
+                ++it;
+            else
+                it = m_failed.erase(it);
+        }
+
+        std::sort(known.begin(), known.end());
+        for (auto tid : tids)
+        {
+            if (!std::binary_search(known.begin(), known.end(), tid) && m_failed.find(tid) == m_failed.end())
+            {
+                if (!openThread(tid) && m_failed.find(tid) != m_failed.end() && m_complete)
+                {
+                    m_complete = false;
+                    EASY_ERROR("Event tracing: perf_event_open() failed for thread " << tid << " with errno " << errno
+                               << ". Context switches of such threads will be read from SystemTap log-file.\n");
+                }
+            }
+        }
+
+        closedir(dir);
+
+        // Ring buffers of finished threads are not going to be written anymore
+        const auto size = (RING_BUFFER_PAGES + 1) * pageSize();
+        for (size_t i = 0; i < m_events.size();)
+        {
+            auto& event = m_events[i];
+            if (event.alive)
+            {
+                ++i;
+                continue;
+            }
+
+            readEvents(event);
+            munmap(event.buffer, size);
+            close(event.fd);
+            event = m_events.back();
+            m_events.pop_back();
+        }
+    }
+
+    void EasyEventTracer::readEvents(ThreadEvent& _event)
+    {
+        auto meta = static_cast<perf_event_mmap_page*>(_event.buffer);
+        auto data = static_cast<const char*>(_event.buffer) + pageSize();
+        const uint64_t mask = RING_BUFFER_PAGES * pageSize() - 1;
+
+        const uint64_t head = __atomic_load_n(&meta->data_head, __ATOMIC_ACQUIRE);
+        uint64_t tail = meta->data_tail;
+
+        const auto processId = static_cast<processid_t>(getpid());
+        while (tail < head)
+        {
+            // Record can wrap around the end of ring buffer: copy it into temporary storage
+            perf_event_header header;
+            for (size_t i = 0; i < sizeof(header); ++i)
+                reinterpret_cast<char*>(&header)[i] = data[(tail + i) & mask];
+
+            if (header.size == 0)
+                break;
+
+            if (header.type == PERF_RECORD_SWITCH && header.size >= sizeof(SwitchRecord))
+            {
+                SwitchRecord record;
+                for (size_t i = 0; i < sizeof(record); ++i)
+                    reinterpret_cast<char*>(&record)[i] = data[(tail + i) & mask];
+
+                auto time = static_cast<profiler::timestamp_t>(record.time);
+                if (m_ticksPerNs != 0)
+                {
+                    const auto ns = static_cast<int64_t>(time - m_baseNs); // Can be negative for events before enable()
+                    time = m_baseTicks + static_cast<profiler::timestamp_t>(static_cast<int64_t>(ns * m_ticksPerNs));
+                }
+
+                // Thread is waiting from switch-out till switch-in, target thread is unknown for per-thread events
+                if (header.misc & PERF_RECORD_MISC_SWITCH_OUT)
+                    MANAGER.beginContextSwitch(record.tid, time, 0, "");
+                else
+                    MANAGER.endContextSwitch(record.tid, processId, time);
+            }
+
+            tail += header.size;
+        }
+
+        __atomic_store_n(&meta->data_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    void EasyEventTracer::closeThreads()
+    {
+        const auto size = (RING_BUFFER_PAGES + 1) * pageSize();
+        for (auto& event : m_events)
+        {
+            readEvents(event);
+            munmap(event.buffer, size);
+            close(event.fd);
+        }
+
+        m_events.clear();
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
+    ::profiler::EventTracingEnableStatus EasyEventTracer::enable(bool)
+    {
+        ::profiler::guard_lock<::profiler::spin_lock> lock(m_spin);
+        if (m_bEnabled)
+            return EVENT_TRACING_LAUNCHED_SUCCESSFULLY;
+
+        m_collected = false;
+        m_complete = true;
+        m_collectorId = 0;
+        m_failed.clear();
+        m_traced.clear();
+
+        // Use the same clock as profiler if it's timestamps are nanoseconds, otherwise convert from CLOCK_MONOTONIC
+        const auto source = MANAGER.clockSource();
+        m_clockId = source == CLOCK_SOURCE_MONOTONIC_RAW ? CLOCK_MONOTONIC_RAW : CLOCK_MONOTONIC;
+        m_ticksPerNs = 0;
+
+        // Check that kernel allows perf events for this process before launching the thread
+        const auto tid = static_cast<pid_t>(syscall(SYS_gettid));
+        if (!openThread(tid))
+        {
+            const int error = errno;
+            EASY_ERROR("Event tracing not launched: perf_event_open() failed with errno " << error
+                       << ". Context switches will be read from SystemTap log-file.\n");
+            return error == EACCES || error == EPERM ? EVENT_TRACING_NOT_ENOUGH_ACCESS_RIGHTS : EVENT_TRACING_MISTERIOUS_ERROR;
+        }
+
+        // Open events of already existing threads here to report if some of them can not be traced
+        scanThreads();
+        const bool complete = m_complete;
+
+        m_stop.store(false, ::std::memory_order_release);
+        m_processThread = ::std::thread([this](bool _lowPriority)
+        {
+            if (_lowPriority) // Set low priority for event tracing thread
+                nice(10);
+            EASY_THREAD_SCOPE("EasyProfiler.PerfEvents");
+
+            m_collectorId = static_cast<pid_t>(syscall(SYS_gettid));
+            scanThreads(); // Kernel starts buffering switches of all threads while waiting for calibration below
+
+            if (!clock::is_nanoseconds(MANAGER.clockSource()))
+            {
+                // Frequency calibration can take some time, so it is done here instead of enable()
+                const auto frequency = MANAGER.cpuFrequency();
+                m_baseTicks = getCurrentTime();
+                m_baseNs = clock::posix_clock(m_clockId);
+                m_ticksPerNs = frequency * 1e-9;
+            }
+
+            while (!m_stop.load(::std::memory_order_acquire))
+            {
+                scanThreads();
+
+                for (auto& event : m_events)
+                    readEvents(event);
+
+                ::std::this_thread::sleep_for(::std::chrono::milliseconds(10));
+            }
+
+        }, m_lowPriority.load(::std::memory_order_acquire));
+
+        m_bEnabled = true;
+        m_collected = true;
+
+        if (!complete)
+            return EVENT_TRACING_LAUNCHED_PARTIALLY;
+
+        EASY_LOGMSG("Event tracing launched\n");
+        return EVENT_TRACING_LAUNCHED_SUCCESSFULLY;
+    }
+
+    void EasyEventTracer::disable()
+    {
+        ::profiler::guard_lock<::profiler::spin_lock> lock(m_spin);
+        if (!m_bEnabled)
+            return;
+
+        EASY_LOGMSG("Event tracing is stopping...\n");
+
+        m_stop.store(true, ::std::memory_order_release);
+        if (m_processThread.joinable())
+            m_processThread.join();
+
+        // Collector thread is stopped: read the rest of events here
+        closeThreads();
+
+        m_bEnabled = false;
+
+        EASY_LOGMSG("Event tracing stopped\n");
+    }
+
+} // END of namespace profiler.
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif // __linux__
@@ -0,0 +1,132 @@
+/**
+Lightweight profiler library for c++
+Copyright(C) 2016  Sergey Yagovtsev, Victor Zarubkin
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+GNU General Public License Usage
+Alternatively, this file may be used under the terms of the GNU
+General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+**/
+
+
+#ifndef EASY_PROFILER__EVENT_TRACE_LINUX__H_
+#define EASY_PROFILER__EVENT_TRACE_LINUX__H_
+#ifdef __linux__
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <unordered_set>
+#include <sys/types.h>
+#include "easy/profiler.h"
+#include "event_trace_status.h"
+#include "spin_lock.h"
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+namespace profiler {
+
+    /** Collects context switches of the current process threads using perf_event_open().
+
+    Each thread of the process gets software event PERF_COUNT_SW_CONTEXT_SWITCHES with PERF_RECORD_SWITCH records
+    enabled and it's own mmap ring buffer. Background thread drains ring buffers, passes switches directly into
+    ProfileManager::beginContextSwitch()/endContextSwitch() and opens events for threads created after enable().
+
+    If kernel refuses to open events (see /proc/sys/kernel/perf_event_paranoid) enable() fails and context switches
+    are read from SystemTap log-file on dump (see scripts/context_switch_logger.stp).
+    If events can not be opened only for some threads (for example, because of perf_event_mlock_kb limit)
+    then context switches of these threads are read from the log-file (see complete() and traced()).
+    */
+    class EasyEventTracer EASY_FINAL
+    {
+#ifndef EASY_MAGIC_STATIC_CPP11
+        friend class EasyEventTracerInstance;
+#endif
+
+        struct ThreadEvent
+        {
+            void*  buffer; ///< Metadata page followed by ring buffer pages
+            pid_t     tid;
+            int        fd;
+            bool    alive; ///< Thread has been found in /proc/self/task during the last scan
+        };
+
+        std::vector<ThreadEvent>   m_events; ///< Accessed only by m_processThread and by enable()/disable() when it is not running
+        std::unordered_set<pid_t>  m_failed; ///< Alive threads which events can not be opened for (are not retried on each scan)
+        std::unordered_set<pid_t>  m_traced; ///< All threads traced during the last profiling session
+        ::std::thread       m_processThread;
+        ::profiler::spin_lock        m_spin;
+        ::std::atomic_bool    m_lowPriority;
+        ::std::atomic_bool           m_stop;
+        profiler::timestamp_t   m_baseTicks; ///< getCurrentTime() and perf clock values sampled at the same moment
+        profiler::timestamp_t      m_baseNs; ///< (used to convert perf timestamps if clock source is not nanoseconds)
+        double                m_ticksPerNs; ///< 0 if perf timestamps are used as is
+        int                      m_clockId;
+        pid_t                 m_collectorId;
+        bool                     m_bEnabled = false;
+        bool                   m_collected = false;
+        bool                    m_complete = false; ///< Events of all threads have been opened
+
+    public:
+
+        static EasyEventTracer& instance();
+        ~EasyEventTracer();
+
+        bool isLowPriority() const;
+
+        ::profiler::EventTracingEnableStatus enable(bool _force = false);
+        void disable();
+        void setLowPriority(bool _value);
+
+        /** Returns true if context switches of the last profiling session have been gathered by perf events. */
+        bool collected() const;
+
+        /** Returns true if context switches of all threads of the last profiling session have been gathered by perf events. */
+        bool complete() const;
+
+        /** Returns true if context switches of the thread have been gathered by perf events during the last profiling session.
+
+        \note Must be used only when event tracing is disabled. */
+        bool traced(pid_t _tid) const;
+
+    private:
+
+        EasyEventTracer();
+
+        bool openThread(pid_t _tid);
+        void scanThreads();
+        void readEvents(ThreadEvent& _event);
+        void closeThreads();
+
+    }; // END of class EasyEventTracer.
+
+} // END of namespace profiler.
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+#endif // __linux__
+#endif // EASY_PROFILER__EVENT_TRACE_LINUX__H_
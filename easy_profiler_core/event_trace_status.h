@@ -17,6 +17,7 @@ namespace profiler {
         EVENT_TRACING_BAD_PROPERTIES_SIZE,
         EVENT_TRACING_OPEN_TRACE_ERROR,
         EVENT_TRACING_MISTERIOUS_ERROR,
+        EVENT_TRACING_LAUNCHED_PARTIALLY, ///< Events of some threads can not be traced
     };
 
 } // END of namespace profiler.
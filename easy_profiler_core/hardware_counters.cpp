@@ -0,0 +1,228 @@
+/**
+Lightweight profiler library for c++
+Copyright(C) 2016  Sergey Yagovtsev, Victor Zarubkin
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+GNU General Public License Usage
+Alternatively, this file may be used under the terms of the GNU
+General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+**/
+
+
+
+#include "hardware_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <atomic>
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+namespace profiler {
+
+#ifdef __linux__
+
+    const uint64_t COUNTERS_CONFIG[] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+
+# if defined(__x86_64__) || defined(__i386__)
+    static inline uint64_t rdpmc(uint32_t _counter)
+    {
+        uint32_t low, high;
+        __asm__ __volatile__("rdpmc" : "=a" (low), "=d" (high) : "c" (_counter));
+        return static_cast<uint64_t>(low) | (static_cast<uint64_t>(high) << 32);
+    }
+
+    /** Reads counter in user-space using it's perf_event_mmap_page (see linux/perf_event.h).
+
+    \retval false if user-space access is not allowed or counter is not scheduled on PMU right now.
+    */
+    static inline bool readUserCounter(const void* _page, uint64_t& _value)
+    {
+        auto page = static_cast<volatile const perf_event_mmap_page*>(_page);
+
+        uint32_t sequence;
+        do {
+            sequence = page->lock;
+            ::std::atomic_signal_fence(::std::memory_order_acq_rel);
+
+            const uint32_t index = page->index;
+            if (!page->cap_user_rdpmc || index == 0)
+                return false;
+
+            const uint32_t width = page->pmc_width;
+            auto pmc = static_cast<int64_t>(rdpmc(index - 1));
+            pmc <<= 64 - width;
+            pmc >>= 64 - width; // sign-extend
+            _value = static_cast<uint64_t>(page->offset + pmc);
+
+            ::std::atomic_signal_fence(::std::memory_order_acq_rel);
+        } while (page->lock != sequence);
+
+        return true;
+    }
+# endif
+
+#endif // __linux__
+
+    hardware_counters::hardware_counters() : m_opened(false), m_failed(false)
+    {
+        for (uint32_t i = 0; i < COUNTERS_NUMBER; ++i)
+        {
+            m_pages[i] = nullptr;
+            m_fds[i] = -1;
+        }
+    }
+
+    hardware_counters::~hardware_counters()
+    {
+        close();
+    }
+
+    bool hardware_counters::supported()
+    {
+#ifdef __linux__
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool hardware_counters::read(HardwareCounters& _values)
+    {
+        if (!m_opened)
+        {
+            if (m_failed || !open())
+            {
+                m_failed = true;
+                return false;
+            }
+        }
+
+#if defined(__linux__) && (defined(__x86_64__) || defined(__i386__))
+        if (m_pages[CYCLES] != nullptr && m_pages[INSTRUCTIONS] != nullptr && m_pages[CACHE_MISSES] != nullptr &&
+            readUserCounter(m_pages[CYCLES], _values.cycles) &&
+            readUserCounter(m_pages[INSTRUCTIONS], _values.instructions) &&
+            readUserCounter(m_pages[CACHE_MISSES], _values.cache_misses))
+        {
+            return true;
+        }
+#endif
+
+        return readGroup(_values);
+    }
+
+    bool hardware_counters::readGroup(HardwareCounters& _values) const
+    {
+#ifdef __linux__
+        // PERF_FORMAT_GROUP: number of counters followed by values in the order of opening
+        uint64_t buffer[1 + COUNTERS_NUMBER];
+        if (::read(m_fds[CYCLES], buffer, sizeof(buffer)) != static_cast<ssize_t>(sizeof(buffer)) || buffer[0] != COUNTERS_NUMBER)
+            return false;
+
+        _values.cycles = buffer[1 + CYCLES];
+        _values.instructions = buffer[1 + INSTRUCTIONS];
+        _values.cache_misses = buffer[1 + CACHE_MISSES];
+
+        return true;
+#else
+        (void)_values;
+        return false;
+#endif
+    }
+
+    bool hardware_counters::open()
+    {
+#ifdef __linux__
+        const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+        unsigned long flags = 0;
+# ifdef PERF_FLAG_FD_CLOEXEC
+        flags |= PERF_FLAG_FD_CLOEXEC;
+# endif
+
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        for (uint32_t i = 0; i < COUNTERS_NUMBER; ++i)
+        {
+            attr.config = COUNTERS_CONFIG[i];
+
+            const int groupFd = i == CYCLES ? -1 : m_fds[CYCLES];
+            m_fds[i] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, flags));
+            if (m_fds[i] < 0)
+            {
+                close();
+                return false;
+            }
+
+            // Metadata page is needed only for rdpmc, counter is still read by read() without it
+            auto page = mmap(nullptr, pageSize, PROT_READ, MAP_SHARED, m_fds[i], 0);
+            m_pages[i] = page != MAP_FAILED ? page : nullptr;
+        }
+
+        m_opened = true;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void hardware_counters::close()
+    {
+#ifdef __linux__
+        const auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+
+        // Group members are closed before the leader
+        for (uint32_t i = COUNTERS_NUMBER; i-- > 0;)
+        {
+            if (m_pages[i] != nullptr)
+                munmap(m_pages[i], pageSize);
+
+            if (m_fds[i] >= 0)
+                ::close(m_fds[i]);
+        }
+#endif
+
+        for (uint32_t i = 0; i < COUNTERS_NUMBER; ++i)
+        {
+            m_pages[i] = nullptr;
+            m_fds[i] = -1;
+        }
+
+        m_opened = false;
+    }
+
+} // END of namespace profiler.
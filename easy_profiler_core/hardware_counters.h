@@ -0,0 +1,98 @@
+/**
+Lightweight profiler library for c++
+Copyright(C) 2016  Sergey Yagovtsev, Victor Zarubkin
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+GNU General Public License Usage
+Alternatively, this file may be used under the terms of the GNU
+General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+**/
+
+
+
+#ifndef EASY_PROFILER__HARDWARE_COUNTERS__H_______
+#define EASY_PROFILER__HARDWARE_COUNTERS__H_______
+
+#include <easy/profiler.h>
+#include <stdint.h>
+
+namespace profiler {
+
+    /** Hardware performance counters of the current thread (see BLOCK_FLAG_HARDWARE_COUNTERS).
+
+    On Linux counters are opened by the first read() as one perf_event_open() group (cycles, instructions,
+    last level cache misses) counting only user-space events of the calling thread. If kernel allows user-space
+    access to PMU then counters are read by rdpmc instruction without system calls, otherwise the whole group
+    is read by one read() call.
+
+    Object must be used by it's owner thread only. If counters can not be opened (or on other platforms)
+    read() fails and all next calls fail immediately.
+    */
+    class hardware_counters EASY_FINAL
+    {
+        enum : uint32_t
+        {
+            CYCLES = 0, ///< Group leader
+            INSTRUCTIONS,
+            CACHE_MISSES,
+
+            COUNTERS_NUMBER
+        };
+
+        void*   m_pages[COUNTERS_NUMBER]; ///< perf_event_mmap_page of every counter (used for rdpmc)
+        int       m_fds[COUNTERS_NUMBER];
+        bool                     m_opened;
+        bool                     m_failed;
+
+    public:
+
+        hardware_counters();
+        ~hardware_counters();
+
+        /** Reads current values of counters opening them if necessary.
+
+        \retval false if hardware counters are not available for the current thread.
+        */
+        bool read(HardwareCounters& _values);
+
+        /** Closes counters. They are opened again by the next read(). */
+        void close();
+
+        /** Returns true if hardware counters can be supported on this platform. */
+        static bool supported();
+
+    private:
+
+        bool open();
+        bool readGroup(HardwareCounters& _values) const;
+
+        hardware_counters(const hardware_counters&) = delete;
+        hardware_counters& operator = (const hardware_counters&) = delete;
+
+    }; // END of class hardware_counters.
+
+} // END of namespace profiler.
+
+#endif // EASY_PROFILER__HARDWARE_COUNTERS__H_______
@@ -0,0 +1,446 @@
+/**
+Lightweight profiler library for c++
+Copyright(C) 2016  Sergey Yagovtsev, Victor Zarubkin
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+GNU General Public License Usage
+Alternatively, this file may be used under the terms of the GNU
+General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+**/
+
+
+#ifndef EASY_PROFILER__HISTOGRAM__H_______
+#define EASY_PROFILER__HISTOGRAM__H_______
+
+#include <easy/profiler.h>
+#include <atomic>
+#include <stdint.h>
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+namespace profiler {
+
+    /** Log-linear (HDR-style) histogram of blocks durations.
+
+    Values are split into power-of-two ranges and each range is split into SUB_BUCKETS linear buckets,
+    so relative error of any percentile is less than 1 / SUB_BUCKETS (about 3%) for any duration.
+    Buckets of a range are allocated when the first value of this range is added: durations of one block
+    usually cover a few ranges, so histogram takes about 0.5 KB instead of BUCKETS counters.
+
+    Histogram is written by one thread only (owner of ThreadStorage) and can be read by another thread
+    at the same time: counters are atomics updated with relaxed load + store (which are plain moves on x86).
+    Reset can be requested by any thread: it is applied by the owner thread on the next add() or merge(),
+    until then the histogram is read as empty.
+    */
+    class duration_histogram EASY_FINAL
+    {
+    public:
+
+        enum : uint32_t
+        {
+            SUB_BUCKET_BITS = 5,
+            SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+            MAX_VALUE_BITS = 48, ///< Greater values are written into the last bucket
+            RANGES = MAX_VALUE_BITS - SUB_BUCKET_BITS + 1,
+            BUCKETS = RANGES * SUB_BUCKETS
+        };
+
+    private:
+
+        typedef std::atomic<uint32_t> counter_t;
+
+        std::atomic<counter_t*> m_ranges[RANGES]; ///< SUB_BUCKETS counters of each range (nullptr if range is empty)
+        std::atomic<uint64_t>    m_calls;
+        std::atomic<uint64_t>    m_total;
+        std::atomic<uint64_t>      m_min;
+        std::atomic<uint64_t>      m_max;
+        std::atomic<uint32_t> m_resetEpoch; ///< Number of requested resets (see reset())
+        std::atomic<uint32_t>      m_epoch; ///< Number of resets applied by the owner thread
+
+    public:
+
+        duration_histogram()
+        {
+            for (auto& range : m_ranges)
+                range.store(nullptr, std::memory_order_relaxed);
+            m_resetEpoch = ATOMIC_VAR_INIT(0U);
+            m_epoch = ATOMIC_VAR_INIT(0U);
+            clear(0);
+        }
+
+        ~duration_histogram()
+        {
+            for (auto& range : m_ranges)
+                delete [] range.load(std::memory_order_acquire);
+        }
+
+        /** Requests reset of the histogram. Can be called by any thread. */
+        void reset()
+        {
+            m_resetEpoch.fetch_add(1, std::memory_order_acq_rel);
+        }
+
+        /** Adds _weight calls with given duration. Must be called by owner thread only. */
+        inline void add(timestamp_t _duration, uint32_t _weight = 1)
+        {
+            applyReset();
+            increment(counter(bucket(_duration)), _weight);
+            increment(m_calls, _weight);
+            increment(m_total, _duration * _weight);
+            if (_duration < m_min.load(std::memory_order_relaxed))
+                m_min.store(_duration, std::memory_order_relaxed);
+            if (_duration > m_max.load(std::memory_order_relaxed))
+                m_max.store(_duration, std::memory_order_relaxed);
+        }
+
+        /** Adds all values of another histogram. Must be called by owner thread only. */
+        void merge(const duration_histogram& _other)
+        {
+            applyReset();
+            if (_other.resetPending())
+                return;
+
+            for (uint32_t r = 0; r < RANGES; ++r)
+            {
+                auto otherRange = _other.m_ranges[r].load(std::memory_order_acquire);
+                if (otherRange == nullptr)
+                    continue;
+                for (uint32_t i = 0; i < SUB_BUCKETS; ++i)
+                {
+                    const auto count = otherRange[i].load(std::memory_order_relaxed);
+                    if (count != 0)
+                        increment(counter(r * SUB_BUCKETS + i), count);
+                }
+            }
+            increment(m_calls, _other.m_calls.load(std::memory_order_relaxed));
+            increment(m_total, _other.m_total.load(std::memory_order_relaxed));
+            const auto otherMin = _other.m_min.load(std::memory_order_relaxed);
+            if (otherMin < m_min.load(std::memory_order_relaxed))
+                m_min.store(otherMin, std::memory_order_relaxed);
+            const auto otherMax = _other.m_max.load(std::memory_order_relaxed);
+            if (otherMax > m_max.load(std::memory_order_relaxed))
+                m_max.store(otherMax, std::memory_order_relaxed);
+        }
+
+        /** Returns value at given percentile (0 < _percentile <= 1). */
+        timestamp_t percentile(double _percentile) const
+        {
+            const auto calls = resetPending() ? 0 : m_calls.load(std::memory_order_relaxed);
+            if (calls == 0)
+                return 0;
+
+            const auto minValue = m_min.load(std::memory_order_relaxed);
+            const auto maxValue = m_max.load(std::memory_order_relaxed);
+            auto rank = static_cast<uint64_t>(_percentile * static_cast<double>(calls) + 0.5);
+            if (rank == 0)
+                rank = 1;
+
+            uint64_t passed = 0;
+            for (uint32_t r = 0; r < RANGES; ++r)
+            {
+                auto range = m_ranges[r].load(std::memory_order_acquire);
+                if (range == nullptr)
+                    continue;
+                for (uint32_t i = 0; i < SUB_BUCKETS; ++i)
+                {
+                    passed += range[i].load(std::memory_order_relaxed);
+                    if (passed >= rank)
+                    {
+                        const auto b = r * SUB_BUCKETS + i;
+                        const auto value = lowest(b) + (width(b) >> 1);
+                        return value < minValue ? minValue : (value > maxValue ? maxValue : value);
+                    }
+                }
+            }
+
+            return maxValue;
+        }
+
+        /** Adds values of this histogram into plain counters (_counts must have BUCKETS elements). */
+        void collect(uint64_t* _counts, uint64_t& _calls, uint64_t& _total, timestamp_t& _min, timestamp_t& _max) const
+        {
+            if (resetPending())
+                return;
+
+            for (uint32_t r = 0; r < RANGES; ++r)
+            {
+                auto range = m_ranges[r].load(std::memory_order_acquire);
+                if (range == nullptr)
+                    continue;
+                for (uint32_t i = 0; i < SUB_BUCKETS; ++i)
+                    _counts[r * SUB_BUCKETS + i] += range[i].load(std::memory_order_relaxed);
+            }
+            _calls += m_calls.load(std::memory_order_relaxed);
+            _total += m_total.load(std::memory_order_relaxed);
+            const auto minValue = m_min.load(std::memory_order_relaxed);
+            if (minValue < _min)
+                _min = minValue;
+            const auto maxValue = m_max.load(std::memory_order_relaxed);
+            if (maxValue > _max)
+                _max = maxValue;
+        }
+
+        /** Returns value at given percentile (0 < _percentile <= 1) using plain counters gathered by collect(). */
+        static timestamp_t percentile(const uint64_t* _counts, uint64_t _calls, timestamp_t _min, timestamp_t _max, double _percentile)
+        {
+            if (_calls == 0)
+                return 0;
+
+            auto rank = static_cast<uint64_t>(_percentile * static_cast<double>(_calls) + 0.5);
+            if (rank == 0)
+                rank = 1;
+
+            uint64_t passed = 0;
+            for (uint32_t i = 0; i < BUCKETS; ++i)
+            {
+                passed += _counts[i];
+                if (passed >= rank)
+                {
+                    // Middle of the bucket bounded by known min and max values
+                    const auto value = lowest(i) + (width(i) >> 1);
+                    return value < _min ? _min : (value > _max ? _max : value);
+                }
+            }
+
+            return _max;
+        }
+
+        static inline uint32_t bucket(timestamp_t _value)
+        {
+            if (_value < SUB_BUCKETS)
+                return static_cast<uint32_t>(_value);
+
+            const uint32_t msb = highestBit(_value);
+            if (msb >= MAX_VALUE_BITS)
+                return BUCKETS - 1;
+
+            const uint32_t shift = msb - SUB_BUCKET_BITS;
+            const auto subBucket = static_cast<uint32_t>(_value >> shift) - SUB_BUCKETS;
+            return (shift + 1) * SUB_BUCKETS + subBucket;
+        }
+
+        static inline timestamp_t lowest(uint32_t _bucket)
+        {
+            if (_bucket < SUB_BUCKETS)
+                return _bucket;
+            const uint32_t shift = _bucket / SUB_BUCKETS - 1;
+            return static_cast<timestamp_t>(SUB_BUCKETS + _bucket % SUB_BUCKETS) << shift;
+        }
+
+        static inline timestamp_t width(uint32_t _bucket)
+        {
+            return _bucket < SUB_BUCKETS ? 1 : (1ULL << (_bucket / SUB_BUCKETS - 1));
+        }
+
+    private:
+
+        inline bool resetPending() const
+        {
+            return m_resetEpoch.load(std::memory_order_acquire) != m_epoch.load(std::memory_order_acquire);
+        }
+
+        inline void applyReset()
+        {
+            const auto epoch = m_resetEpoch.load(std::memory_order_acquire);
+            if (epoch != m_epoch.load(std::memory_order_relaxed))
+                clear(epoch);
+        }
+
+        /** Returns counter of the bucket allocating buckets of it's range if necessary. Must be called by owner thread only. */
+        inline counter_t& counter(uint32_t _bucket)
+        {
+            auto& rangePtr = m_ranges[_bucket / SUB_BUCKETS];
+            auto range = rangePtr.load(std::memory_order_relaxed);
+            if (range == nullptr)
+            {
+                range = new counter_t[SUB_BUCKETS];
+                for (uint32_t i = 0; i < SUB_BUCKETS; ++i)
+                    range[i].store(0, std::memory_order_relaxed);
+                rangePtr.store(range, std::memory_order_release);
+            }
+
+            return range[_bucket % SUB_BUCKETS];
+        }
+
+        void clear(uint32_t _epoch)
+        {
+            for (auto& rangePtr : m_ranges)
+            {
+                auto range = rangePtr.load(std::memory_order_relaxed);
+                if (range == nullptr)
+                    continue;
+                for (uint32_t i = 0; i < SUB_BUCKETS; ++i)
+                    range[i].store(0, std::memory_order_relaxed);
+            }
+            m_calls.store(0, std::memory_order_relaxed);
+            m_total.store(0, std::memory_order_relaxed);
+            m_min.store(~0ULL, std::memory_order_relaxed);
+            m_max.store(0, std::memory_order_relaxed);
+            m_epoch.store(_epoch, std::memory_order_release); // Counters are published as cleared
+        }
+
+        template <class T>
+        static inline void increment(std::atomic<T>& _counter, uint64_t _value)
+        {
+            _counter.store(static_cast<T>(_counter.load(std::memory_order_relaxed) + _value), std::memory_order_relaxed);
+        }
+
+        static inline uint32_t highestBit(uint64_t _value)
+        {
+#ifdef _MSC_VER
+            unsigned long index = 0;
+            _BitScanReverse64(&index, _value);
+            return static_cast<uint32_t>(index);
+#else
+            return 63U - static_cast<uint32_t>(__builtin_clzll(_value));
+#endif
+        }
+
+        duration_histogram(const duration_histogram&) = delete;
+        duration_histogram& operator = (const duration_histogram&) = delete;
+
+    }; // END of class duration_histogram.
+
+    //////////////////////////////////////////////////////////////////////////
+
+    /** Table of durations histograms indexed by block descriptor id.
+
+    Pages of the table are allocated on demand by owner thread and published with release semantics,
+    so another thread can read histograms without locks. Pages and histograms are freed only in destructor.
+    */
+    class histograms_table EASY_FINAL
+    {
+        enum : uint32_t { PAGE_SIZE = 256, MAX_PAGES = 256 }; ///< Up to 65536 block descriptors
+
+        typedef std::atomic<duration_histogram*> entry_t;
+
+        std::atomic<entry_t*> m_pages[MAX_PAGES];
+
+    public:
+
+        histograms_table()
+        {
+            for (auto& page : m_pages)
+                page.store(nullptr, std::memory_order_relaxed);
+        }
+
+        ~histograms_table()
+        {
+            for (auto& pagePtr : m_pages)
+            {
+                auto page = pagePtr.load(std::memory_order_acquire);
+                if (page == nullptr)
+                    continue;
+                for (uint32_t i = 0; i < PAGE_SIZE; ++i)
+                    delete page[i].load(std::memory_order_acquire);
+                delete [] page;
+            }
+        }
+
+        /** Returns histogram for given descriptor creating it if necessary. Must be called by owner thread only.
+
+        \retval nullptr if descriptor id is too big.
+        */
+        duration_histogram* get(block_id_t _id)
+        {
+            if (_id >= PAGE_SIZE * MAX_PAGES)
+                return nullptr;
+
+            auto page = m_pages[_id / PAGE_SIZE].load(std::memory_order_relaxed);
+            if (page == nullptr)
+            {
+                page = new entry_t[PAGE_SIZE];
+                for (uint32_t i = 0; i < PAGE_SIZE; ++i)
+                    page[i].store(nullptr, std::memory_order_relaxed);
+                m_pages[_id / PAGE_SIZE].store(page, std::memory_order_release);
+            }
+
+            auto& entry = page[_id % PAGE_SIZE];
+            auto histogram = entry.load(std::memory_order_relaxed);
+            if (histogram == nullptr)
+            {
+                histogram = new duration_histogram();
+                entry.store(histogram, std::memory_order_release);
+            }
+
+            return histogram;
+        }
+
+        /** Returns histogram for given descriptor or nullptr if there is no one. Can be called by any thread. */
+        const duration_histogram* find(block_id_t _id) const
+        {
+            if (_id >= PAGE_SIZE * MAX_PAGES)
+                return nullptr;
+            auto page = m_pages[_id / PAGE_SIZE].load(std::memory_order_acquire);
+            return page != nullptr ? page[_id % PAGE_SIZE].load(std::memory_order_acquire) : nullptr;
+        }
+
+        /** Calls _func(id, histogram) for each existing histogram. */
+        template <class TFunc>
+        void forEach(TFunc _func) const
+        {
+            for (uint32_t p = 0; p < MAX_PAGES; ++p)
+            {
+                auto page = m_pages[p].load(std::memory_order_acquire);
+                if (page == nullptr)
+                    continue;
+                for (uint32_t i = 0; i < PAGE_SIZE; ++i)
+                {
+                    auto histogram = page[i].load(std::memory_order_acquire);
+                    if (histogram != nullptr)
+                        _func(p * PAGE_SIZE + i, *histogram);
+                }
+            }
+        }
+
+        /** Requests reset of all existing histograms (see duration_histogram::reset()). Can be called by any thread. */
+        void reset()
+        {
+            for (auto& pagePtr : m_pages)
+            {
+                auto page = pagePtr.load(std::memory_order_acquire);
+                if (page == nullptr)
+                    continue;
+                for (uint32_t i = 0; i < PAGE_SIZE; ++i)
+                {
+                    auto histogram = page[i].load(std::memory_order_acquire);
+                    if (histogram != nullptr)
+                        histogram->reset();
+                }
+            }
+        }
+
+    private:
+
+        histograms_table(const histograms_table&) = delete;
+        histograms_table& operator = (const histograms_table&) = delete;
+
+    }; // END of class histograms_table.
+
+} // END of namespace profiler.
+
+#endif // EASY_PROFILER__HISTOGRAM__H_______
@@ -64,7 +64,11 @@ enum MessageType : uint8_t
 
     MESSAGE_TYPE_EVENT_TRACING_STATUS,
     MESSAGE_TYPE_EVENT_TRACING_PRIORITY,
-    MESSAGE_TYPE_CHECK_CONNECTION
+    MESSAGE_TYPE_CHECK_CONNECTION,
+
+    MESSAGE_TYPE_EDIT_BLOCK_SAMPLING,
+    MESSAGE_TYPE_EDIT_BLOCK_MIN_DURATION,
+    MESSAGE_TYPE_MIN_BLOCK_DURATION
 };
 
 struct Message
@@ -96,6 +100,22 @@ private:
     BlockStatusMessage() = delete;
 };
 
+struct BlockSamplingMessage : public Message {
+    uint32_t       id;
+    uint16_t sampling;
+    BlockSamplingMessage(uint32_t _id, uint16_t _sampling) : Message(MESSAGE_TYPE_EDIT_BLOCK_SAMPLING), id(_id), sampling(_sampling) { }
+private:
+    BlockSamplingMessage() = delete;
+};
+
+struct BlockMinDurationMessage : public Message {
+    uint32_t          id;
+    uint32_t minDuration; ///< nanoseconds
+    BlockMinDurationMessage(uint32_t _id, uint32_t _minDuration) : Message(MESSAGE_TYPE_EDIT_BLOCK_MIN_DURATION), id(_id), minDuration(_minDuration) { }
+private:
+    BlockMinDurationMessage() = delete;
+};
+
 struct EasyProfilerStatus : public Message
 {
     bool         isProfilerEnabled;
@@ -121,6 +141,12 @@ struct BoolMessage : public Message {
     BoolMessage() = default;
 };
 
+struct Uint32Message : public Message {
+    uint32_t value = 0;
+    Uint32Message(MessageType _t, uint32_t _value = 0) : Message(_t), value(_value) { }
+    Uint32Message() = default;
+};
+
 #pragma pack(pop)
 
 }//net
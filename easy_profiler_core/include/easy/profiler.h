@@ -34,6 +34,7 @@ along with this program.If not, see <http://www.gnu.org/licenses/>.
 #define EASY_PROFILER____H_______
 
 #include "easy/profiler_aux.h"
+#include <atomic>
 
 #if defined ( __clang__ )
 # pragma clang diagnostic push
@@ -167,6 +168,45 @@ will end previously opened EASY_BLOCK or EASY_FUNCTION.
             ::std::is_base_of<::profiler::ForceConstStr, decltype(name)>::value));\
     ::profiler::storeEvent(EASY_UNIQUE_DESC(__LINE__), EASY_RUNTIME_NAME(name));
 
+/** Macro for beginning of a flow which links blocks of different threads (for example, enqueue of a task).
+
+Flow is identified by integer or pointer id which must be passed to EASY_FLOW_END on the thread which
+continues the flow (for example, executes the task). Reader links flow events with the same id
+into edges (see collectFlows), so latency between threads can be measured.
+
+Flow begin and end are events with zero duration and special types.
+
+\code
+    void enqueue(Task* task) {
+        EASY_FLOW_BEGIN(task);
+        queue.push(task);
+    }
+
+    void worker() {
+        Task* task = queue.pop();
+        EASY_FLOW_END(task);
+        task->run();
+    }
+\endcode
+
+\ingroup profiler
+*/
+# define EASY_FLOW_BEGIN(id, ...)\
+    EASY_LOCAL_STATIC_PTR(const ::profiler::BaseBlockDescriptor*, EASY_UNIQUE_DESC(__LINE__), ::profiler::registerDescription(\
+        ::profiler::extract_enable_flag(__VA_ARGS__), EASY_UNIQUE_LINE_ID, "Flow begin",\
+            __FILE__, __LINE__, ::profiler::BLOCK_TYPE_FLOW_BEGIN, ::profiler::extract_color(__VA_ARGS__), false));\
+    ::profiler::storeFlow(EASY_UNIQUE_DESC(__LINE__), ::profiler::flow_id(id));
+
+/** Macro for ending of a flow begun by EASY_FLOW_BEGIN with the same id (usually on another thread).
+
+\ingroup profiler
+*/
+# define EASY_FLOW_END(id, ...)\
+    EASY_LOCAL_STATIC_PTR(const ::profiler::BaseBlockDescriptor*, EASY_UNIQUE_DESC(__LINE__), ::profiler::registerDescription(\
+        ::profiler::extract_enable_flag(__VA_ARGS__), EASY_UNIQUE_LINE_ID, "Flow end",\
+            __FILE__, __LINE__, ::profiler::BLOCK_TYPE_FLOW_END, ::profiler::extract_color(__VA_ARGS__), false));\
+    ::profiler::storeFlow(EASY_UNIQUE_DESC(__LINE__), ::profiler::flow_id(id));
+
 /** Macro for enabling profiler.
 
 \ingroup profiler
@@ -257,6 +297,87 @@ breakdown, but if you care about that then you change set event tracing priority
 */
 # define EASY_EVENT_TRACING_LOG ::profiler::getContextSwitchLogFilename();
 
+/** Macro for enabling flight-recorder mode.
+
+Each thread will keep at most chunksNumber chunks of blocks and will overwrite the oldest
+chunk with new blocks when this limit is reached. This lets you keep profiler always enabled
+with fixed memory consumption and dump only the latest blocks when you need them.
+
+\note Pass 0 to disable flight-recorder mode (memory grows until dump).
+
+\sa EASY_OPTION_FLIGHT_RECORDER_CHUNKS
+
+\ingroup profiler
+*/
+# define EASY_SET_FLIGHT_RECORDER_CHUNKS(chunksNumber) ::profiler::setFlightRecorderChunks(chunksNumber);
+
+/** Macro for setting minimum duration (in nanoseconds) of stored blocks.
+
+Blocks which are shorter than this threshold are dropped and do not consume capture memory.
+
+\note Pass 0 to store all blocks.
+
+\sa EASY_OPTION_MIN_BLOCK_DURATION, profiler::setBlockMinDuration
+
+\ingroup profiler
+*/
+# define EASY_SET_MIN_BLOCK_DURATION(nanoseconds) ::profiler::setMinBlockDuration(nanoseconds);
+
+/** Macro for switching capture mode (see profiler::CaptureMode).
+
+In profiler::CAPTURE_MODE_STATISTICS every finished block only updates per-thread histogram of durations
+for it's descriptor, so memory consumption does not depend on calls number. Use profiler::aggregatedStatistics()
+to get calls number and p50/p90/p99/p999 durations.
+
+\sa EASY_OPTION_CAPTURE_MODE
+
+\ingroup profiler
+*/
+# define EASY_SET_CAPTURE_MODE(mode) ::profiler::setCaptureMode(mode);
+
+/** Macro for firing triggered capture explicitly.
+
+If triggered capture is started (see profiler::startTriggeredCapture()) then blocks of all threads gathered
+around this moment are written into the next file of the rotating set. Triggers fired while previous capture
+is being written are ignored.
+
+\sa profiler::setBlockTrigger
+
+\ingroup profiler
+*/
+# define EASY_TRIGGER() ::profiler::trigger();
+
+/** Macro for setting maximum number of stored blocks per second per descriptor in each thread.
+
+When some descriptor exceeds this budget (for example, if a tight loop has been instrumented by mistake)
+it is automatically downgraded to sampling or even turned OFF if sampling rate becomes too large.
+Each downgrade is marked by internal "Throttled" event.
+
+\note Throttling does not modify block descriptors: statuses and sampling set by user are stored
+into file unchanged. Throttling is reset when profiler is enabled or network capture starts.
+
+\note Pass 0 to disable the governor.
+
+\sa EASY_OPTION_EVENTS_BUDGET
+
+\ingroup profiler
+*/
+# define EASY_SET_EVENTS_BUDGET(eventsPerSecond) ::profiler::setEventsBudget(eventsPerSecond);
+
+/** Macro for enabling measurement of thread CPU time for top-level blocks (frames) of all threads.
+
+CPU time is stored beside wall-clock duration of the block, so on-CPU and off-CPU time of frames can be
+seen without context switch tracing.
+
+\note Thread CPU time is read by syscall (it is not served by vDSO on Linux), so every frame costs two more syscalls
+(about 0.2-1 us each). It is negligible for frames of milliseconds, but not for threads with short top-level blocks.
+
+\sa EASY_OPTION_FRAME_CPU_TIME, profiler::setBlockCpuTime
+
+\ingroup profiler
+*/
+# define EASY_SET_FRAME_CPU_TIME(isEnabled) ::profiler::setFrameCpuTime(isEnabled);
+
 // EasyProfiler settings:
 
 /** If != 0 then EasyProfiler will measure time for blocks storage expansion.
@@ -328,6 +449,70 @@ Otherwise, no log messages will be printed.
 #  define EASY_OPTION_START_LISTEN_ON_STARTUP 0
 # endif
 
+/** Default maximum number of blocks chunks per thread (see EASY_SET_FLIGHT_RECORDER_CHUNKS).
+
+If 0 then flight-recorder mode is disabled by default.
+
+\ingroup profiler
+*/
+# ifndef EASY_OPTION_FLIGHT_RECORDER_CHUNKS
+#  define EASY_OPTION_FLIGHT_RECORDER_CHUNKS 0
+# endif
+
+/** Interval in milliseconds between flushes of gathered blocks into file (see startStreamingBlocksToFile).
+
+\ingroup profiler
+*/
+# ifndef EASY_OPTION_STREAM_FLUSH_INTERVAL
+#  define EASY_OPTION_STREAM_FLUSH_INTERVAL 100
+# endif
+
+/** Default clock source (see profiler::ClockSource).
+
+If 0 (profiler::CLOCK_SOURCE_AUTO) then the best source is selected by self-test when profiler is enabled first time.
+
+\ingroup profiler
+*/
+# ifndef EASY_OPTION_CLOCK_SOURCE
+#  define EASY_OPTION_CLOCK_SOURCE 0
+# endif
+
+/** Default minimum duration (in nanoseconds) of stored blocks (see EASY_SET_MIN_BLOCK_DURATION).
+
+If 0 then all blocks are stored.
+
+\ingroup profiler
+*/
+# ifndef EASY_OPTION_MIN_BLOCK_DURATION
+#  define EASY_OPTION_MIN_BLOCK_DURATION 0
+# endif
+
+/** Default capture mode (see profiler::CaptureMode).
+
+\ingroup profiler
+*/
+# ifndef EASY_OPTION_CAPTURE_MODE
+#  define EASY_OPTION_CAPTURE_MODE 0
+# endif
+
+/** Default maximum number of stored blocks per second per descriptor in each thread (0 - unlimited).
+
+\sa EASY_SET_EVENTS_BUDGET
+
+\ingroup profiler
+*/
+# ifndef EASY_OPTION_EVENTS_BUDGET
+#  define EASY_OPTION_EVENTS_BUDGET 0
+# endif
+
+/** If true then thread CPU time is measured for top-level blocks by default (see EASY_SET_FRAME_CPU_TIME).
+
+\ingroup profiler
+*/
+# ifndef EASY_OPTION_FRAME_CPU_TIME
+#  define EASY_OPTION_FRAME_CPU_TIME false
+# endif
+
 #else // #ifdef BUILD_WITH_EASY_PROFILER
 
 # define EASY_BLOCK(...)
@@ -336,11 +521,19 @@ Otherwise, no log messages will be printed.
 # define EASY_PROFILER_ENABLE 
 # define EASY_PROFILER_DISABLE 
 # define EASY_EVENT(...)
+# define EASY_FLOW_BEGIN(...)
+# define EASY_FLOW_END(...)
 # define EASY_THREAD(...)
 # define EASY_THREAD_SCOPE(...)
 # define EASY_MAIN_THREAD 
 # define EASY_SET_EVENT_TRACING_ENABLED(isEnabled) 
 # define EASY_SET_LOW_PRIORITY_EVENT_TRACING(isLowPriority) 
+# define EASY_SET_FLIGHT_RECORDER_CHUNKS(chunksNumber) 
+# define EASY_SET_MIN_BLOCK_DURATION(nanoseconds) 
+# define EASY_SET_CAPTURE_MODE(mode) 
+# define EASY_TRIGGER() 
+# define EASY_SET_EVENTS_BUDGET(eventsPerSecond) 
+# define EASY_SET_FRAME_CPU_TIME(isEnabled) 
 
 # ifndef _WIN32
 #  define EASY_EVENT_TRACING_SET_LOG(filename) 
@@ -367,6 +560,34 @@ Otherwise, no log messages will be printed.
 #  define EASY_OPTION_START_LISTEN_ON_STARTUP 0
 # endif
 
+# ifndef EASY_OPTION_FLIGHT_RECORDER_CHUNKS
+#  define EASY_OPTION_FLIGHT_RECORDER_CHUNKS 0
+# endif
+
+# ifndef EASY_OPTION_STREAM_FLUSH_INTERVAL
+#  define EASY_OPTION_STREAM_FLUSH_INTERVAL 100
+# endif
+
+# ifndef EASY_OPTION_CLOCK_SOURCE
+#  define EASY_OPTION_CLOCK_SOURCE 0
+# endif
+
+# ifndef EASY_OPTION_MIN_BLOCK_DURATION
+#  define EASY_OPTION_MIN_BLOCK_DURATION 0
+# endif
+
+# ifndef EASY_OPTION_CAPTURE_MODE
+#  define EASY_OPTION_CAPTURE_MODE 0
+# endif
+
+# ifndef EASY_OPTION_EVENTS_BUDGET
+#  define EASY_OPTION_EVENTS_BUDGET 0
+# endif
+
+# ifndef EASY_OPTION_FRAME_CPU_TIME
+#  define EASY_OPTION_FRAME_CPU_TIME false
+# endif
+
 #endif // #ifndef BUILD_WITH_EASY_PROFILER
 
 # ifndef EASY_DEFAULT_PORT
@@ -394,11 +615,100 @@ namespace profiler {
     {
         BLOCK_TYPE_EVENT = 0,
         BLOCK_TYPE_BLOCK,
+        BLOCK_TYPE_FLOW_BEGIN, ///< Event which begins a flow between threads (see EASY_FLOW_BEGIN)
+        BLOCK_TYPE_FLOW_END, ///< Event which ends a flow between threads (see EASY_FLOW_END)
 
         BLOCK_TYPES_NUMBER
     };
     typedef BlockType block_type_t;
 
+    /** Source of blocks timestamps (see setClockSource).
+
+    \ingroup profiler
+    */
+    enum ClockSource : uint8_t
+    {
+        CLOCK_SOURCE_AUTO = 0, ///< Select the best available source using self-test (cost per call and cross-core monotonicity)
+        CLOCK_SOURCE_CPU_COUNTER, ///< CPU cycle counter: rdtsc on x86, cntvct on ARMv8 (the cheapest one)
+        CLOCK_SOURCE_RDTSCP, ///< x86 only: serializing rdtscp instruction
+        CLOCK_SOURCE_MONOTONIC_RAW, ///< CLOCK_MONOTONIC_RAW (nanoseconds, not adjusted by NTP)
+        CLOCK_SOURCE_MONOTONIC, ///< CLOCK_MONOTONIC (nanoseconds)
+        CLOCK_SOURCE_QPC, ///< Windows only: QueryPerformanceCounter
+
+        CLOCK_SOURCES_NUMBER
+    };
+
+    /** What profiler gathers for finished blocks (see setCaptureMode).
+
+    \ingroup profiler
+    */
+    enum CaptureMode : uint8_t
+    {
+        CAPTURE_MODE_BLOCKS = 0, ///< Every block is stored and can be dumped into .prof file
+        CAPTURE_MODE_STATISTICS, ///< Only per-descriptor durations histograms and calls numbers are gathered (see aggregatedStatistics)
+
+        CAPTURE_MODES_NUMBER
+    };
+
+    /** Optional features of blocks with the same descriptor.
+
+    \ingroup profiler
+    */
+    enum BlockFlag : uint8_t
+    {
+        BLOCK_FLAG_HARDWARE_COUNTERS = 1, ///< Hardware performance counters are read on block begin and end (see setBlockHardwareCounters)
+        BLOCK_FLAG_CPU_TIME = 2, ///< Thread CPU time is read on block begin and end (see setBlockCpuTime)
+        BLOCK_FLAG_LOCK_WAIT = 4, ///< Block is a wait for the lock acquisition (see beginLockBlock)
+        BLOCK_FLAG_LOCK_HOLD = 8, ///< Block is a time while the lock is held (see beginLockBlock)
+    };
+
+    /** Kinds of blocks written by instrumented locks (see easy/profiler_locks.h).
+
+    \ingroup profiler
+    */
+    enum LockBlock : uint8_t
+    {
+        LOCK_BLOCK_WAIT = 0, ///< Exclusive acquisition is blocked by another owner
+        LOCK_BLOCK_HOLD, ///< Lock is exclusively held
+        LOCK_BLOCK_SHARED_WAIT, ///< Shared acquisition is blocked by exclusive owner
+        LOCK_BLOCK_SHARED_HOLD, ///< Lock is held in shared mode
+
+        LOCK_BLOCKS_NUMBER
+    };
+
+#pragma pack(push,1)
+    /** Values of hardware performance counters.
+
+    For a stored block these are differences between values read at the end and at the beginning of the block.
+
+    \ingroup profiler
+    */
+    struct HardwareCounters
+    {
+        uint64_t instructions; ///< Retired instructions
+        uint64_t       cycles; ///< CPU cycles
+        uint64_t cache_misses; ///< Last level cache misses
+    };
+#pragma pack(pop)
+
+    /** Aggregated statistics of blocks with the same descriptor gathered in profiler::CAPTURE_MODE_STATISTICS.
+
+    All durations are in nanoseconds. Percentiles are estimated by log-linear histogram with relative error about 3%.
+
+    \ingroup profiler
+    */
+    struct AggregatedStatistics
+    {
+        uint64_t    calls_number; ///< Number of finished blocks (scaled by sampling rate, see setBlockSampling)
+        timestamp_t total_duration;
+        timestamp_t min_duration;
+        timestamp_t max_duration;
+        timestamp_t          p50;
+        timestamp_t          p90;
+        timestamp_t          p99;
+        timestamp_t         p999;
+    };
+
     //***********************************************
 
 #pragma pack(push,1)
@@ -409,11 +719,14 @@ namespace profiler {
 
     protected:
 
-        block_id_t          m_id; ///< This descriptor id (We can afford this spending because there are much more blocks than descriptors)
-        int               m_line; ///< Line number in the source file
-        color_t          m_color; ///< Color of the block packed into 1-byte structure
-        block_type_t      m_type; ///< Type of the block (See BlockType)
-        EasyBlockStatus m_status; ///< If false then blocks with such id() will not be stored by profiler during profile session
+        block_id_t                     m_id; ///< This descriptor id (We can afford this spending because there are much more blocks than descriptors)
+        int                          m_line; ///< Line number in the source file
+        color_t                     m_color; ///< Color of the block packed into 1-byte structure
+        block_type_t                 m_type; ///< Type of the block (See BlockType)
+        EasyBlockStatus            m_status; ///< If false then blocks with such id() will not be stored by profiler during profile session
+        std::atomic<uint16_t>    m_sampling; ///< Only 1 of m_sampling invocations of this block is stored by profiler (0 and 1 mean "store all invocations")
+        std::atomic<uint32_t> m_minDuration; ///< Blocks shorter than m_minDuration nanoseconds are not stored by profiler (0 means "store all blocks")
+        uint8_t                     m_flags; ///< Combination of BlockFlag values
 
         BaseBlockDescriptor(block_id_t _id, EasyBlockStatus _status, int _line, block_type_t _block_type, color_t _color);
 
@@ -424,6 +737,9 @@ namespace profiler {
         inline color_t color() const { return m_color; }
         inline block_type_t type() const { return m_type; }
         inline EasyBlockStatus status() const { return m_status; }
+        inline uint16_t sampling() const { const auto sampling = m_sampling.load(std::memory_order_relaxed); return sampling > 1 ? sampling : 1; }
+        inline uint32_t minDuration() const { return m_minDuration.load(std::memory_order_relaxed); }
+        inline uint8_t flags() const { return m_flags; }
 
     }; // END of class BaseBlockDescriptor.
 
@@ -465,8 +781,15 @@ namespace profiler {
         friend ::ProfileManager;
         friend ::ThreadStorage;
 
-        const char*       m_name;
-        EasyBlockStatus m_status;
+        HardwareCounters m_counters; ///< Counters values at block begin and their deltas after block end (if BLOCK_FLAG_HARDWARE_COUNTERS is set)
+        timestamp_t       m_cpuTime; ///< Thread CPU time at block begin and CPU time spent inside the block after block end (in nanoseconds)
+        uint64_t           m_lockId; ///< Identity of the lock for lock wait and hold blocks (0 for other blocks)
+        uint64_t           m_flowId; ///< Identity of the flow for flow events
+        const char*          m_name;
+        EasyBlockStatus     m_status;
+        uint8_t              m_flags;
+        uint16_t          m_sampling;
+        uint32_t       m_minDuration;
 
     private:
 
@@ -486,6 +809,11 @@ namespace profiler {
         ~Block();
 
         inline const char* name() const { return m_name; }
+        inline uint8_t flags() const { return m_flags; }
+        inline const HardwareCounters& counters() const { return m_counters; }
+        inline timestamp_t cpuTime() const { return m_cpuTime; }
+        inline uint64_t lockId() const { return m_lockId; }
+        inline uint64_t flowId() const { return m_flowId; }
 
     private:
 
@@ -530,6 +858,17 @@ namespace profiler {
         */
         PROFILER_API void storeEvent(const BaseBlockDescriptor* _desc, const char* _runtimeName);
 
+        /** Stores flow event (descriptor type must be BLOCK_TYPE_FLOW_BEGIN or BLOCK_TYPE_FLOW_END).
+
+        \param _desc Reference to the previously registered description.
+        \param _flowId Identity of the flow which is written with the event.
+
+        \sa EASY_FLOW_BEGIN, EASY_FLOW_END
+
+        \ingroup profiler
+        */
+        PROFILER_API void storeFlow(const BaseBlockDescriptor* _desc, uint64_t _flowId);
+
         /** Begins block.
 
         \ingroup profiler
@@ -556,6 +895,44 @@ namespace profiler {
         */
         PROFILER_API uint32_t dumpBlocksToFile(const char* _filename);
 
+        /** Save all blocks gathered since previous snapshot (or since profiler was enabled) into file
+        without stopping the profiler.
+
+        Current blocks buffers of all threads are replaced by empty ones and the old buffers
+        are written into the file on a background thread, so profiled threads are not interrupted.
+        Returns number of blocks in the snapshot or 0 if file can not be opened.
+
+        \note Context switch events are written only by dumpBlocksToFile() on Linux.
+
+        \ingroup profiler
+        */
+        PROFILER_API uint32_t dumpSnapshotToFile(const char* _filename);
+
+        /** Start writing gathered blocks into file incrementally while profiler is working.
+
+        Background thread periodically (see EASY_OPTION_STREAM_FLUSH_INTERVAL) moves closed blocks of all threads
+        into the file, so memory usage does not grow during long profiling sessions.
+        The file becomes valid only after stopStreamingBlocksToFile() call.
+
+        \note This does not enable profiler.
+
+        \note Stream file owns gathered blocks: dumpBlocksToFile(), dumpSnapshotToFile() and capture from GUI
+        are refused until stopStreamingBlocksToFile() call.
+
+        \ingroup profiler
+        */
+        PROFILER_API bool startStreamingBlocksToFile(const char* _filename);
+
+        /** Stop streaming started by startStreamingBlocksToFile(): write the rest of blocks and finish the file.
+
+        Returns total number of blocks written into the file.
+
+        \note This also disables profiler.
+
+        \ingroup profiler
+        */
+        PROFILER_API uint32_t stopStreamingBlocksToFile();
+
         /** Register current thread and give it a name.
 
         \note Only first call of registerThread() for the current thread will have an effect.
@@ -609,6 +986,283 @@ namespace profiler {
         PROFILER_API void startListen(uint16_t _port = ::profiler::DEFAULT_PORT);
         PROFILER_API void stopListen();
 
+        /** Set maximum number of blocks chunks per thread (flight-recorder mode).
+
+        When the limit is reached the oldest chunk of the thread is overwritten.
+
+        \note Pass 0 to disable flight-recorder mode.
+
+        \sa EASY_SET_FLIGHT_RECORDER_CHUNKS
+
+        \ingroup profiler
+        */
+        PROFILER_API void setFlightRecorderChunks(uint32_t _chunksNumber);
+
+        /** Returns maximum number of blocks chunks per thread (0 if flight-recorder mode is disabled).
+
+        \ingroup profiler
+        */
+        PROFILER_API uint32_t flightRecorderChunks();
+
+        /** Set source of blocks timestamps.
+
+        profiler::CLOCK_SOURCE_AUTO runs self-test of all available sources (cost per call and
+        cross-core monotonicity) and selects the best one. The chosen source is written into .prof file header.
+
+        \note Clock source can be changed only while profiler is disabled. Blocks gathered with the previous
+        clock source are dropped.
+
+        \retval false if clock source is not available or profiler is enabled.
+
+        \sa EASY_OPTION_CLOCK_SOURCE
+
+        \ingroup profiler
+        */
+        PROFILER_API bool setClockSource(ClockSource _source);
+
+        /** Returns currently used clock source (never profiler::CLOCK_SOURCE_AUTO).
+
+        \note Until profiler is enabled first time the platform default source is returned, self-test of profiler::CLOCK_SOURCE_AUTO
+        runs on enabling.
+
+        \ingroup profiler
+        */
+        PROFILER_API ClockSource clockSource();
+
+        /** Set sampling rate for blocks with given descriptor id: only 1 of _sampling invocations will be stored.
+
+        Skipped invocations cost one thread-local counter increment. Their children are stored as usual.
+        The rate is written into .prof file with the block descriptor, so the reader can scale calls number
+        and total duration in blocks statistics.
+
+        \note Pass 0 or 1 to store every invocation (default).
+
+        \ingroup profiler
+        */
+        PROFILER_API void setBlockSampling(block_id_t _id, uint16_t _sampling);
+
+        /** Set minimum duration (in nanoseconds) of stored blocks for all blocks.
+
+        Blocks which are shorter than this threshold are dropped in endBlock() and are not written
+        into .prof file (their time remains in the parent block). Short block is kept if some of it's children
+        have been stored. Events are not affected.
+
+        \note Pass 0 to store all blocks (default).
+
+        \sa setBlockMinDuration
+
+        \ingroup profiler
+        */
+        PROFILER_API void setMinBlockDuration(uint32_t _nanoseconds);
+
+        /** Returns global minimum duration (in nanoseconds) of stored blocks.
+
+        \ingroup profiler
+        */
+        PROFILER_API uint32_t minBlockDuration();
+
+        /** Set minimum duration (in nanoseconds) of stored blocks with given descriptor id.
+
+        Greater of this threshold and the global one (see setMinBlockDuration) is used.
+        The threshold is written into .prof file with the block descriptor.
+
+        \note Pass 0 to use only the global threshold (default).
+
+        \ingroup profiler
+        */
+        PROFILER_API void setBlockMinDuration(block_id_t _id, uint32_t _nanoseconds);
+
+        /** Enable or disable reading of hardware performance counters (instructions, cycles, last level cache misses)
+        for blocks with given descriptor id.
+
+        Counters deltas are written into .prof file with every stored block and are summed up by reader
+        into BlockStatistics (see BlockStatistics::ipc() and BlockStatistics::cache_miss_rate()).
+
+        \note Counters are supported only on Linux (perf_event_open). Threads which can not open counters
+        (see /proc/sys/kernel/perf_event_paranoid) store blocks without them.
+
+        \retval false if there is no descriptor with given id or hardware counters are not supported on this platform.
+
+        \ingroup profiler
+        */
+        PROFILER_API bool setBlockHardwareCounters(block_id_t _id, bool _enable);
+
+        /** Enable or disable measurement of thread CPU time for blocks with given descriptor id.
+
+        CPU time spent by the thread inside the block is written into .prof file beside wall-clock duration.
+        Reader sums it into BlockStatistics (see BlockStatistics::total_cpu_time) and estimates wait time
+        of threads without context switches as off-CPU time of their frames (see BlocksTreeRoot::cpu_time).
+
+        \note Thread CPU time is read by syscall on block begin and end (about 0.2-1 us each, it is not served
+        by vDSO on Linux unlike timestamps), so enable it for coarse blocks only.
+
+        \retval false if there is no descriptor with given id.
+
+        \sa setFrameCpuTime
+
+        \ingroup profiler
+        */
+        PROFILER_API bool setBlockCpuTime(block_id_t _id, bool _enable);
+
+        /** Enable or disable measurement of thread CPU time for top-level blocks (frames) of all threads.
+
+        \note Every frame costs two thread CPU time syscalls (see setBlockCpuTime).
+
+        \sa EASY_SET_FRAME_CPU_TIME, setBlockCpuTime
+
+        \ingroup profiler
+        */
+        PROFILER_API void setFrameCpuTime(bool _enable);
+
+        /** Returns true if thread CPU time is measured for top-level blocks.
+
+        \ingroup profiler
+        */
+        PROFILER_API bool frameCpuTime();
+
+        /** Begins wait or hold block of the lock.
+
+        Block is stored with lock identity (address of the lock) which is used by reader to gather
+        per-lock contention statistics. Block must be ended by endLockBlock() with the same lock called by the same thread.
+
+        \note Locks can be released in any order. Blocks begun and ended while the lock is held are nested into the lock block,
+        blocks which are still opened when the lock is released (for example, by std::unique_lock::unlock()) overlap it.
+
+        \sa easy/profiler_locks.h
+
+        \ingroup profiler
+        */
+        PROFILER_API void beginLockBlock(LockBlock _type, const void* _lock);
+
+        /** Ends the last lock block of given lock begun by beginLockBlock().
+
+        \ingroup profiler
+        */
+        PROFILER_API void endLockBlock(const void* _lock);
+
+        /** Set capture mode (see profiler::CaptureMode).
+
+        \note Histograms are cleared when profiler is enabled.
+
+        \ingroup profiler
+        */
+        PROFILER_API void setCaptureMode(CaptureMode _mode);
+
+        /** Returns current capture mode.
+
+        \ingroup profiler
+        */
+        PROFILER_API CaptureMode captureMode();
+
+        /** Merges durations histograms of all threads for given block descriptor.
+
+        Threads which are recording blocks are not blocked. Histograms of finished threads are kept.
+
+        \retval false if there were no finished blocks with such descriptor in profiler::CAPTURE_MODE_STATISTICS.
+
+        \ingroup profiler
+        */
+        PROFILER_API bool aggregatedStatistics(block_id_t _id, AggregatedStatistics* _stats);
+
+        /** Enable tail-based sampling of frames with fixed threshold.
+
+        Frame is a top-level block of the thread. With tail sampling blocks of the current frame are buffered
+        per-thread and are stored only if the frame is not shorter than _nanoseconds, otherwise they are discarded.
+
+        \note Pass 0 to disable (default). Can be combined with setTailSamplingPercentile(): the frame is stored
+        if it is slow according to any of the rules.
+
+        \ingroup profiler
+        */
+        PROFILER_API void setTailSamplingThreshold(uint32_t _nanoseconds);
+
+        /** Returns fixed threshold of tail-based sampling in nanoseconds (0 if disabled).
+
+        \ingroup profiler
+        */
+        PROFILER_API uint32_t tailSamplingThreshold();
+
+        /** Enable tail-based sampling of frames with running percentile threshold.
+
+        Frame is stored only if it is not faster than _percentile (for example 0.99) of the previous frames
+        of the same thread. First 100 frames of each thread are always stored.
+
+        \note Pass 0 to disable (default).
+
+        \sa setTailSamplingThreshold
+
+        \ingroup profiler
+        */
+        PROFILER_API void setTailSamplingPercentile(double _percentile);
+
+        /** Returns running percentile of tail-based sampling (0 if disabled).
+
+        \ingroup profiler
+        */
+        PROFILER_API double tailSamplingPercentile();
+
+        /** Start triggered capture.
+
+        While profiler is enabled, blocks of the last _beforeMs milliseconds are kept in memory. When a trigger fires
+        (see trigger() and setBlockTrigger()) profiler waits _afterMs milliseconds more and writes blocks of all threads
+        from the window [trigger - _beforeMs, trigger + _afterMs] into file "<_filenamePrefix>_<N>.prof",
+        where N cycles through [0, _filesNumber).
+
+        \note Triggered capture detaches gathered blocks periodically, so it can not be combined with other
+        captures: dumpBlocksToFile(), dumpSnapshotToFile(), streaming into file and capture from GUI
+        are refused while triggered capture is started.
+
+        \retval false if triggered capture is already started, blocks are being streamed into file
+        or capture from GUI is running.
+
+        \ingroup profiler
+        */
+        PROFILER_API bool startTriggeredCapture(const char* _filenamePrefix, uint32_t _beforeMs, uint32_t _afterMs, uint32_t _filesNumber);
+
+        /** Stop triggered capture. Pending capture is written immediately.
+
+        Returns number of files written since startTriggeredCapture().
+
+        \ingroup profiler
+        */
+        PROFILER_API uint32_t stopTriggeredCapture();
+
+        /** Fire triggered capture explicitly.
+
+        \retval true if new capture has been started by this call.
+
+        \sa EASY_TRIGGER
+
+        \ingroup profiler
+        */
+        PROFILER_API bool trigger();
+
+        /** Fire triggered capture when block with given descriptor is not shorter than _nanoseconds.
+
+        \note Pass 0 to remove the trigger. Up to 16 block triggers can be set at the same time.
+
+        \retval false if there are too many block triggers.
+
+        \ingroup profiler
+        */
+        PROFILER_API bool setBlockTrigger(block_id_t _id, uint32_t _nanoseconds);
+
+        /** Set maximum number of stored blocks per second per descriptor in each thread.
+
+        \note Pass 0 to disable the governor.
+
+        \sa EASY_SET_EVENTS_BUDGET
+
+        \ingroup profiler
+        */
+        PROFILER_API void setEventsBudget(uint32_t _eventsPerSecond);
+
+        /** Returns maximum number of stored blocks per second per descriptor (0 if the governor is disabled).
+
+        \ingroup profiler
+        */
+        PROFILER_API uint32_t eventsBudget();
+
         /** Returns current major version.
         
         \ingroup profiler
@@ -646,8 +1300,12 @@ namespace profiler {
     inline void endBlock() { }
     inline void setEnabled(bool) { }
     inline void storeEvent(const BaseBlockDescriptor*, const char*) { }
+    inline void storeFlow(const BaseBlockDescriptor*, uint64_t) { }
     inline void beginBlock(Block&) { }
     inline uint32_t dumpBlocksToFile(const char*) { return 0; }
+    inline uint32_t dumpSnapshotToFile(const char*) { return 0; }
+    inline bool startStreamingBlocksToFile(const char*) { return false; }
+    inline uint32_t stopStreamingBlocksToFile() { return 0; }
     inline const char* registerThreadScoped(const char*, ThreadGuard&) { return ""; }
     inline const char* registerThread(const char*) { return ""; }
     inline void setEventTracingEnabled(bool) { }
@@ -656,6 +1314,39 @@ namespace profiler {
     inline const char* getContextSwitchLogFilename() { return ""; }
     inline void startListen(uint16_t = ::profiler::DEFAULT_PORT) { }
     inline void stopListen() { }
+    inline void setFlightRecorderChunks(uint32_t) { }
+    inline uint32_t flightRecorderChunks() { return 0; }
+    inline bool setClockSource(ClockSource) { return false; }
+    inline ClockSource clockSource() {
+#ifdef _WIN32
+        return CLOCK_SOURCE_QPC;
+#else
+        return CLOCK_SOURCE_MONOTONIC;
+#endif
+    }
+    inline void setBlockSampling(block_id_t, uint16_t) { }
+    inline void setMinBlockDuration(uint32_t) { }
+    inline uint32_t minBlockDuration() { return 0; }
+    inline void setBlockMinDuration(block_id_t, uint32_t) { }
+    inline bool setBlockHardwareCounters(block_id_t, bool) { return false; }
+    inline bool setBlockCpuTime(block_id_t, bool) { return false; }
+    inline void setFrameCpuTime(bool) { }
+    inline bool frameCpuTime() { return false; }
+    inline void beginLockBlock(LockBlock, const void*) { }
+    inline void endLockBlock(const void*) { }
+    inline void setCaptureMode(CaptureMode) { }
+    inline CaptureMode captureMode() { return CAPTURE_MODE_BLOCKS; }
+    inline bool aggregatedStatistics(block_id_t, AggregatedStatistics*) { return false; }
+    inline void setTailSamplingThreshold(uint32_t) { }
+    inline uint32_t tailSamplingThreshold() { return 0; }
+    inline void setTailSamplingPercentile(double) { }
+    inline double tailSamplingPercentile() { return 0; }
+    inline bool startTriggeredCapture(const char*, uint32_t, uint32_t, uint32_t) { return false; }
+    inline uint32_t stopTriggeredCapture() { return 0; }
+    inline bool trigger() { return false; }
+    inline bool setBlockTrigger(block_id_t, uint32_t) { return false; }
+    inline void setEventsBudget(uint32_t) { }
+    inline uint32_t eventsBudget() { return 0; }
     inline uint8_t versionMajor() { return 0; }
     inline uint8_t versionMinor() { return 0; }
     inline uint16_t versionPatch() { return 0; }
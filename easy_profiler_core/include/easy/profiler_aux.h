@@ -179,6 +179,17 @@ namespace profiler {
 
     //***********************************************
 
+    template <class T>
+    inline uint64_t flow_id(T* _pointer) {
+        return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(_pointer));
+    }
+
+    inline uint64_t flow_id(uint64_t _id) {
+        return _id;
+    }
+
+    //***********************************************
+
 } // END of namespace profiler.
 
 # define EASY_UNIQUE_LINE_ID __FILE__ ":" EASY_STRINGIFICATION(__LINE__)
@@ -0,0 +1,208 @@
+/**
+Lightweight profiler library for c++
+Copyright(C) 2016  Sergey Yagovtsev, Victor Zarubkin
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+GNU General Public License Usage
+Alternatively, this file may be used under the terms of the GNU
+General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+**/
+
+
+
+#ifndef EASY_PROFILER__LOCKS__H_______
+#define EASY_PROFILER__LOCKS__H_______
+
+#include <easy/profiler.h>
+#include <mutex>
+#include <atomic>
+
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+# include <shared_mutex>
+# define EASY_SHARED_MUTEX ::std::shared_mutex
+#elif __cplusplus >= 201402L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201402L)
+# include <shared_mutex>
+# define EASY_SHARED_MUTEX ::std::shared_timed_mutex
+#endif
+
+/** \file
+Locks which write their contention into profile (drop-in replacements of std::mutex and std::shared_mutex).
+
+If acquisition blocks then "Lock wait" block is written, uncontended acquisition is a single try_lock()
+without any blocks. "Lock hold" block is written from acquisition till release. Both blocks store
+identity of the lock (it's address), so reader can gather per-lock statistics (see collectLockStatistics).
+
+\code
+    profiler::mutex jobsMutex;
+
+    void push(Job job) {
+        std::lock_guard<profiler::mutex> lock(jobsMutex);
+        jobs.push_back(job);
+    }
+\endcode
+
+\note Hold block is nested into current block of the thread and blocks begun while the lock is held
+are nested into hold block. Locks can be released in any order: if the lock is released while such blocks are still opened
+(std::unique_lock::unlock(), std::condition_variable_any::wait()) then hold block overlaps them.
+
+\note Use std::condition_variable_any for waiting with these locks.
+
+Without BUILD_WITH_EASY_PROFILER these names are aliases of standard locks.
+*/
+
+namespace profiler {
+
+    /** Spin lock based on std::atomic_flag. */
+    class spin_mutex EASY_FINAL
+    {
+        ::std::atomic_flag m_flag;
+
+    public:
+
+        spin_mutex() { m_flag.clear(); }
+
+        inline void lock() {
+            while (m_flag.test_and_set(::std::memory_order_acquire));
+        }
+
+        inline bool try_lock() {
+            return !m_flag.test_and_set(::std::memory_order_acquire);
+        }
+
+        inline void unlock() {
+            m_flag.clear(::std::memory_order_release);
+        }
+
+    private:
+
+        spin_mutex(const spin_mutex&) = delete;
+        spin_mutex& operator = (const spin_mutex&) = delete;
+
+    }; // END of class spin_mutex.
+
+#ifdef BUILD_WITH_EASY_PROFILER
+
+    /** Exclusive lock writing wait and hold blocks (TMutex must have lock(), try_lock() and unlock()). */
+    template <class TMutex>
+    class profiled_mutex
+    {
+    protected:
+
+        TMutex m_mutex;
+
+    public:
+
+        profiled_mutex() = default;
+
+        void lock() {
+            if (!m_mutex.try_lock()) {
+                ::profiler::beginLockBlock(::profiler::LOCK_BLOCK_WAIT, this);
+                m_mutex.lock();
+                ::profiler::endLockBlock(this);
+            }
+            ::profiler::beginLockBlock(::profiler::LOCK_BLOCK_HOLD, this);
+        }
+
+        bool try_lock() {
+            if (!m_mutex.try_lock())
+                return false;
+            ::profiler::beginLockBlock(::profiler::LOCK_BLOCK_HOLD, this);
+            return true;
+        }
+
+        void unlock() {
+            ::profiler::endLockBlock(this);
+            m_mutex.unlock();
+        }
+
+        inline TMutex& native() {
+            return m_mutex;
+        }
+
+    private:
+
+        profiled_mutex(const profiled_mutex&) = delete;
+        profiled_mutex& operator = (const profiled_mutex&) = delete;
+
+    }; // END of class profiled_mutex.
+
+    /** Reader-writer lock writing wait and hold blocks for both exclusive and shared ownership. */
+    template <class TMutex>
+    class profiled_shared_mutex : public profiled_mutex<TMutex>
+    {
+        typedef profiled_mutex<TMutex> Parent;
+
+    public:
+
+        profiled_shared_mutex() = default;
+
+        void lock_shared() {
+            if (!Parent::m_mutex.try_lock_shared()) {
+                ::profiler::beginLockBlock(::profiler::LOCK_BLOCK_SHARED_WAIT, this);
+                Parent::m_mutex.lock_shared();
+                ::profiler::endLockBlock(this);
+            }
+            ::profiler::beginLockBlock(::profiler::LOCK_BLOCK_SHARED_HOLD, this);
+        }
+
+        bool try_lock_shared() {
+            if (!Parent::m_mutex.try_lock_shared())
+                return false;
+            ::profiler::beginLockBlock(::profiler::LOCK_BLOCK_SHARED_HOLD, this);
+            return true;
+        }
+
+        void unlock_shared() {
+            ::profiler::endLockBlock(this);
+            Parent::m_mutex.unlock_shared();
+        }
+
+    }; // END of class profiled_shared_mutex.
+
+    typedef profiled_mutex<::std::mutex>                     mutex;
+    typedef profiled_mutex<::std::recursive_mutex> recursive_mutex;
+    typedef profiled_mutex<spin_mutex>          profiled_spin_lock;
+# ifdef EASY_SHARED_MUTEX
+    typedef profiled_shared_mutex<EASY_SHARED_MUTEX>  shared_mutex;
+# endif
+
+#else
+
+    typedef ::std::mutex                     mutex;
+    typedef ::std::recursive_mutex recursive_mutex;
+    typedef spin_mutex          profiled_spin_lock;
+# ifdef EASY_SHARED_MUTEX
+    typedef EASY_SHARED_MUTEX         shared_mutex;
+# endif
+
+#endif // BUILD_WITH_EASY_PROFILER
+
+} // END of namespace profiler.
+
+#ifdef EASY_SHARED_MUTEX
+# undef EASY_SHARED_MUTEX
+#endif
+
+#endif // EASY_PROFILER__LOCKS__H_______
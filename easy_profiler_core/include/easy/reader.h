@@ -53,18 +53,30 @@ namespace profiler {
     struct BlockStatistics EASY_FINAL
     {
         ::profiler::timestamp_t        total_duration; ///< Total duration of all block calls
+        ::profiler::timestamp_t          min_duration; ///< Duration of the shortest call (the same as duration of min_duration_block)
+        ::profiler::timestamp_t          max_duration; ///< Duration of the longest call (the same as duration of max_duration_block)
         ::profiler::block_index_t  min_duration_block; ///< Will be used in GUI to jump to the block with min duration
         ::profiler::block_index_t  max_duration_block; ///< Will be used in GUI to jump to the block with max duration
         ::profiler::block_index_t        parent_block; ///< Index of block which is "parent" for "per_parent_stats" or "frame" for "per_frame_stats" or thread-id for "per_thread_stats"
         ::profiler::calls_number_t       calls_number; ///< Block calls number
+        ::profiler::HardwareCounters         counters; ///< Sums of hardware counters of calls which have them (see BLOCK_FLAG_HARDWARE_COUNTERS)
+        ::profiler::timestamp_t        total_cpu_time; ///< Total thread CPU time of calls which have it (see BLOCK_FLAG_CPU_TIME)
+        ::profiler::timestamp_t    cpu_timed_duration; ///< Total duration of calls which have thread CPU time
 
         explicit BlockStatistics(::profiler::timestamp_t _duration, ::profiler::block_index_t _block_index, ::profiler::block_index_t _parent_index)
             : total_duration(_duration)
+            , min_duration(_duration)
+            , max_duration(_duration)
             , min_duration_block(_block_index)
             , max_duration_block(_block_index)
             , parent_block(_parent_index)
             , calls_number(1)
+            , total_cpu_time(0)
+            , cpu_timed_duration(0)
         {
+            counters.instructions = 0;
+            counters.cycles = 0;
+            counters.cache_misses = 0;
         }
 
         //BlockStatistics() = default;
@@ -74,10 +86,96 @@ namespace profiler {
             return total_duration / calls_number;
         }
 
+        /** Instructions per cycle (0 if blocks have no hardware counters). */
+        inline double ipc() const
+        {
+            return counters.cycles != 0 ? static_cast<double>(counters.instructions) / static_cast<double>(counters.cycles) : 0.;
+        }
+
+        /** Last level cache misses per instruction (0 if blocks have no hardware counters). */
+        inline double cache_miss_rate() const
+        {
+            return counters.instructions != 0 ? static_cast<double>(counters.cache_misses) / static_cast<double>(counters.instructions) : 0.;
+        }
+
+        /** Time when thread was not running on CPU (waiting, sleeping or preempted) during calls which have thread CPU time. */
+        inline ::profiler::timestamp_t off_cpu_time() const
+        {
+            return cpu_timed_duration - total_cpu_time;
+        }
+
     }; // END of struct BlockStatistics.
 #pragma pack(pop)
 
-    extern "C" PROFILER_API void release_stats(BlockStatistics*& _stats);
+    /** Storage of blocks statistics of one thread (see BlocksTreeRoot::statistics).
+
+    Statistics are allocated by chunks and never move, so blocks keep plain pointers to them
+    (BlocksTree::per_parent_stats, per_frame_stats, per_thread_stats). All statistics are destroyed at once
+    together with the storage, blocks do not own them.
+    */
+    class BlockStatisticsStorage EASY_FINAL
+    {
+        typedef BlockStatisticsStorage This;
+        typedef ::std::vector<BlockStatistics> chunk_t;
+
+        enum : size_t { MIN_CHUNK_SIZE = 64, MAX_CHUNK_SIZE = 4096 };
+
+        ::std::vector<chunk_t> m_chunks;
+        size_t                   m_size;
+
+    public:
+
+        BlockStatisticsStorage() : m_size(0)
+        {
+        }
+
+        BlockStatisticsStorage(This&& that) : m_chunks(::std::move(that.m_chunks)), m_size(that.m_size)
+        {
+            that.m_size = 0;
+        }
+
+        This& operator = (This&& that)
+        {
+            m_chunks = ::std::move(that.m_chunks);
+            m_size = that.m_size;
+            that.m_size = 0;
+            return *this;
+        }
+
+        inline size_t size() const
+        {
+            return m_size;
+        }
+
+        inline void clear()
+        {
+            m_chunks.clear();
+            m_size = 0;
+        }
+
+        /** Creates new statistics with one call of the block. */
+        BlockStatistics* emplace(::profiler::timestamp_t _duration, ::profiler::block_index_t _block_index, ::profiler::block_index_t _parent_index)
+        {
+            if (m_chunks.empty() || m_chunks.back().size() == m_chunks.back().capacity())
+            {
+                // Chunk is never reallocated, so pointers to statistics stay valid
+                m_chunks.emplace_back();
+                m_chunks.back().reserve(m_size < MIN_CHUNK_SIZE ? MIN_CHUNK_SIZE : m_size < MAX_CHUNK_SIZE ? m_size : MAX_CHUNK_SIZE);
+            }
+
+            auto& chunk = m_chunks.back();
+            chunk.emplace_back(_duration, _block_index, _parent_index);
+            ++m_size;
+
+            return &chunk.back();
+        }
+
+    private:
+
+        BlockStatisticsStorage(const This&) = delete;
+        This& operator = (const This&) = delete;
+
+    }; // END of class BlockStatisticsStorage.
 
     //////////////////////////////////////////////////////////////////////////
 
@@ -96,6 +194,10 @@ namespace profiler {
         ::profiler::BlockStatistics*  per_frame_stats; ///< Pointer to statistics for this block within the frame (may be nullptr for top-level blocks)
         ::profiler::BlockStatistics* per_thread_stats; ///< Pointer to statistics for this block within the bounds of all frames per current thread
         uint16_t                                depth; ///< Maximum number of sublevels (maximum children depth)
+        bool                             has_counters; ///< Serialized data contains hardware counters of the block
+        bool                             has_cpu_time; ///< Serialized data contains thread CPU time of the block
+        bool                                 has_lock; ///< Serialized data contains lock identity (for lock wait and hold blocks)
+        bool                                 has_flow; ///< Serialized data contains flow identity (for flow events)
 
         BlocksTree()
             : node(nullptr)
@@ -103,6 +205,10 @@ namespace profiler {
             , per_frame_stats(nullptr)
             , per_thread_stats(nullptr)
             , depth(0)
+            , has_counters(false)
+            , has_cpu_time(false)
+            , has_lock(false)
+            , has_flow(false)
         {
 
         }
@@ -118,11 +224,28 @@ namespace profiler {
             return *this;
         }
 
-        ~BlocksTree()
+        /** Returns hardware counters deltas of the block or nullptr if block has no counters. */
+        inline const ::profiler::HardwareCounters* counters() const
+        {
+            return has_counters ? node->counters() : nullptr;
+        }
+
+        /** Returns thread CPU time spent inside the block (0 if block has no CPU time). */
+        inline ::profiler::timestamp_t cpu_time() const
+        {
+            return has_cpu_time ? node->extension<::profiler::timestamp_t>(cpu_time_offset()) : 0;
+        }
+
+        /** Returns identity of the lock for lock wait and hold blocks (0 for other blocks). */
+        inline uint64_t lock_id() const
         {
-            release_stats(per_thread_stats);
-            release_stats(per_parent_stats);
-            release_stats(per_frame_stats);
+            return has_lock ? node->extension<uint64_t>(lock_id_offset()) : 0;
+        }
+
+        /** Returns identity of the flow for flow events (0 for other blocks). */
+        inline uint64_t flow_id() const
+        {
+            return has_flow ? node->extension<uint64_t>(lock_id_offset() + (has_lock ? sizeof(uint64_t) : 0)) : 0;
         }
 
         bool operator < (const This& other) const
@@ -149,26 +272,31 @@ namespace profiler {
 
     private:
 
+        inline size_t cpu_time_offset() const
+        {
+            return has_counters ? sizeof(::profiler::HardwareCounters) : 0;
+        }
+
+        inline size_t lock_id_offset() const
+        {
+            return cpu_time_offset() + (has_cpu_time ? sizeof(::profiler::timestamp_t) : 0);
+        }
+
         BlocksTree(const This&) = delete;
         This& operator = (const This&) = delete;
 
         void make_move(This&& that)
         {
-            if (per_thread_stats != that.per_thread_stats)
-                release_stats(per_thread_stats);
-
-            if (per_parent_stats != that.per_parent_stats)
-                release_stats(per_parent_stats);
-
-            if (per_frame_stats != that.per_frame_stats)
-                release_stats(per_frame_stats);
-
             children = ::std::move(that.children);
             node = that.node;
             per_parent_stats = that.per_parent_stats;
             per_frame_stats = that.per_frame_stats;
             per_thread_stats = that.per_thread_stats;
             depth = that.depth;
+            has_counters = that.has_counters;
+            has_cpu_time = that.has_cpu_time;
+            has_lock = that.has_lock;
+            has_flow = that.has_flow;
 
             that.node = nullptr;
             that.per_parent_stats = nullptr;
@@ -189,14 +317,16 @@ namespace profiler {
         BlocksTree::children_t         children; ///< List of children indexes
         BlocksTree::children_t             sync; ///< List of context-switch events
         BlocksTree::children_t           events; ///< List of events indexes
+        BlockStatisticsStorage       statistics; ///< Statistics of this thread blocks (see BlocksTree::per_thread_stats etc.)
         std::string                 thread_name; ///< Name of this thread
         ::profiler::timestamp_t   profiled_time; ///< Profiled time of this thread (sum of all children duration)
-        ::profiler::timestamp_t       wait_time; ///< Wait time of this thread (sum of all context switches)
+        ::profiler::timestamp_t       wait_time; ///< Wait time of this thread (sum of all context switches or off-CPU time of frames if there are no context switches)
+        ::profiler::timestamp_t        cpu_time; ///< Thread CPU time of frames which have it (see EASY_SET_FRAME_CPU_TIME)
         ::profiler::thread_id_t       thread_id; ///< System Id of this thread
         ::profiler::block_index_t blocks_number; ///< Total blocks number including their children
         uint16_t                          depth; ///< Maximum stack depth (number of levels)
 
-        BlocksTreeRoot() : profiled_time(0), wait_time(0), thread_id(0), blocks_number(0), depth(0)
+        BlocksTreeRoot() : profiled_time(0), wait_time(0), cpu_time(0), thread_id(0), blocks_number(0), depth(0)
         {
         }
 
@@ -204,9 +334,11 @@ namespace profiler {
             : children(::std::move(that.children))
             , sync(::std::move(that.sync))
             , events(::std::move(that.events))
+            , statistics(::std::move(that.statistics))
             , thread_name(::std::move(that.thread_name))
             , profiled_time(that.profiled_time)
             , wait_time(that.wait_time)
+            , cpu_time(that.cpu_time)
             , thread_id(that.thread_id)
             , blocks_number(that.blocks_number)
             , depth(that.depth)
@@ -218,9 +350,11 @@ namespace profiler {
             children = ::std::move(that.children);
             sync = ::std::move(that.sync);
             events = ::std::move(that.events);
+            statistics = ::std::move(that.statistics);
             thread_name = ::std::move(that.thread_name);
             profiled_time = that.profiled_time;
             wait_time = that.wait_time;
+            cpu_time = that.cpu_time;
             thread_id = that.thread_id;
             blocks_number = that.blocks_number;
             depth = that.depth;
@@ -347,6 +481,113 @@ namespace profiler {
 
     typedef ::std::vector<SerializedBlockDescriptor*> descriptors_list_t;
 
+    //////////////////////////////////////////////////////////////////////////
+
+    /** Contention statistics of one lock (see easy/profiler_locks.h). */
+    struct LockStatistics EASY_FINAL
+    {
+        uint64_t                          lock_id; ///< Identity of the lock (address of the lock in profiled application)
+        ::profiler::calls_number_t   acquisitions; ///< Number of times the lock was held
+        ::profiler::calls_number_t    contentions; ///< Number of acquisitions which had to wait for the lock
+        ::profiler::timestamp_t        total_wait; ///< Total time of waiting for the lock
+        ::profiler::timestamp_t          max_wait; ///< Maximum time of one wait
+        ::profiler::timestamp_t        total_hold; ///< Total time while the lock was held
+        ::profiler::timestamp_t          max_hold; ///< Maximum time of one hold
+        ::profiler::block_index_t  max_wait_block; ///< Will be used in GUI to jump to the longest wait
+
+        explicit LockStatistics(uint64_t _lock_id)
+            : lock_id(_lock_id)
+            , acquisitions(0)
+            , contentions(0)
+            , total_wait(0)
+            , max_wait(0)
+            , total_hold(0)
+            , max_hold(0)
+            , max_wait_block(0)
+        {
+        }
+
+        /** Part of acquisitions which had to wait for the lock. */
+        inline double contention_rate() const
+        {
+            return acquisitions != 0 ? static_cast<double>(contentions) / static_cast<double>(acquisitions) : 0.;
+        }
+
+    }; // END of struct LockStatistics.
+
+    typedef ::std::vector<LockStatistics> locks_statistics_t;
+
+    //////////////////////////////////////////////////////////////////////////
+
+    /** Edge between flow begin and flow end events with the same flow id (see EASY_FLOW_BEGIN). */
+    struct Flow EASY_FINAL
+    {
+        uint64_t                       flow_id; ///< Identity of the flow
+        ::profiler::block_index_t  begin_block; ///< Index of flow begin event
+        ::profiler::block_index_t    end_block; ///< Index of flow end event
+        ::profiler::thread_id_t   begin_thread; ///< Thread which has begun the flow
+        ::profiler::thread_id_t     end_thread; ///< Thread which has ended the flow
+        ::profiler::timestamp_t        latency; ///< Time between flow begin and flow end (for example, time of the task in the queue)
+
+    }; // END of struct Flow.
+
+    typedef ::std::vector<Flow> flows_t;
+
+    //////////////////////////////////////////////////////////////////////////
+
+    /** Summary of .prof file passed to ProfileVisitor before any other data. */
+    struct ProfileHeader EASY_FINAL
+    {
+        ::profiler::timestamp_t      begin_time; ///< Capture begin time (in nanoseconds)
+        ::profiler::timestamp_t        end_time; ///< Capture end time (in nanoseconds)
+        uint64_t                  cpu_frequency; ///< CPU frequency used to convert ticks into nanoseconds (0 if times were written in nanoseconds)
+        uint32_t                        version; ///< File format version
+        uint32_t                     process_id; ///< Id of profiled process
+        uint32_t                  blocks_number; ///< Summary number of blocks and context switches
+        uint32_t             descriptors_number; ///< Number of block descriptors
+
+    }; // END of struct ProfileHeader.
+
+    /** Block passed to ProfileVisitor::onBlock(). */
+    struct VisitedBlock EASY_FINAL
+    {
+        ::profiler::SerializedBlock*       node; ///< Decoded block data (valid only until onBlock() returns)
+        uint32_t                children_number; ///< Number of previously visited blocks of this thread which are direct children of this block
+        uint32_t                runtime_name_id; ///< Interned runtime name id (0 if the name is written inside block record or the block has no runtime name)
+        uint16_t                          depth; ///< Nesting level of the block (0 for top-level blocks)
+        bool                       has_counters; ///< Block stores hardware counters deltas (see SerializedBlock::counters())
+        bool                       has_cpu_time; ///< Block stores thread CPU time (see SerializedBlock::cpuTime())
+        bool                           has_lock; ///< Block stores lock identity (lock wait or hold block)
+        bool                           has_flow; ///< Block stores flow id (flow begin or flow end event)
+
+    }; // END of struct VisitedBlock.
+
+    /** Receiver of readProfile() events.
+
+    File is read in one pass without building blocks trees, decoded data of the current block only is kept in memory.
+    Blocks of the thread are passed in the order they have been closed: children before their parent.
+    Nesting is given by VisitedBlock::children_number: the last children_number visited blocks of the thread
+    which have no parent yet are children of the block (as in depth-first post-order traversal).
+    Data passed by reference is valid only inside the callback, copy it if it has to be kept.
+    Threads could be split into several sections (onThreadBegin() ... onThreadEnd() for each section),
+    children of the block could be passed in previous sections of the thread.
+    Blocks with runtime names keep their original descriptor id, runtime name can be taken from block's name().
+    */
+    class ProfileVisitor
+    {
+    public:
+
+        virtual ~ProfileVisitor() {}
+
+        virtual void onHeader(const ProfileHeader&) {}
+        virtual void onDescriptors(const descriptors_list_t&) {}
+        virtual void onThreadBegin(::profiler::thread_id_t, const char* /*_name*/) {}
+        virtual void onContextSwitch(::profiler::thread_id_t, const ::profiler::SerializedBlock&) {}
+        virtual void onBlock(::profiler::thread_id_t, const VisitedBlock&) {}
+        virtual void onThreadEnd(::profiler::thread_id_t) {}
+
+    }; // END of class ProfileVisitor.
+
 } // END of namespace profiler.
 
 extern "C" {
@@ -371,10 +612,77 @@ extern "C" {
                                                                bool gather_statistics,
                                                                ::std::stringstream& _log);
 
+    /** Loads only blocks and context switches of the file which are inside time window [begin, end].
+
+    Since v1.1.0 threads data is written as sections with their own time ranges (about 256 KB of decoded records each).
+    Only sections which overlap the window (and belong to one of threads, all threads if threads is empty) are decoded,
+    so memory usage is proportional to the window instead of the whole capture. Sections are loaded entirely,
+    so some loaded blocks could be partially or entirely out of the window. Statistics are gathered for loaded blocks only.
+
+    \note Parent block is written after all it's children, so sections after the window are loaded too until the section
+    which closes top-level blocks of the window: loaded blocks never lose their parents (long top-level blocks
+    make the loaded range longer). Children of loaded blocks from sections before the window are not loaded.
+
+    \param begin Window begin in nanoseconds from the capture begin.
+    \param end Window end in nanoseconds from the capture begin.
+    \param capture_begin Receives begin time of the whole capture (the same units as blocks times).
+    \param capture_end Receives end time of the whole capture.
+
+    \retval 0 if there are no blocks inside the window or the file has no sections table (see _log), use fillTreesFromFile for old files.
+    */
+    PROFILER_API ::profiler::block_index_t loadRange(::std::atomic<int>& progress, const char* filename,
+                                                     ::profiler::timestamp_t begin, ::profiler::timestamp_t end,
+                                                     const ::std::vector<::profiler::thread_id_t>& threads,
+                                                     ::profiler::SerializedData& serialized_blocks,
+                                                     ::profiler::SerializedData& serialized_descriptors,
+                                                     ::profiler::descriptors_list_t& descriptors,
+                                                     ::profiler::blocks_t& _blocks,
+                                                     ::profiler::thread_blocks_tree_t& threaded_trees,
+                                                     uint32_t& total_descriptors_number,
+                                                     ::profiler::timestamp_t& capture_begin,
+                                                     ::profiler::timestamp_t& capture_end,
+                                                     bool gather_statistics,
+                                                     ::std::stringstream& _log);
+
+    /** Reads profile in one pass passing descriptors, threads, context switches and blocks to visitor (see ProfileVisitor).
+
+    Blocks trees are not built and blocks are not kept in memory: every record is decoded into the same small buffer.
+    Only begin/end times of blocks which have no parent yet are kept to find parents, they are dropped after the section
+    when no block of the next sections of the thread begins earlier (for files with sections table, since v1.1.0).
+    Use it for command-line analysis of huge captures.
+
+    \retval false if the stream is corrupted or reading was interrupted (see _log).
+    */
+    PROFILER_API bool readProfile(::std::atomic<int>& progress, ::std::stringstream& str,
+                                  ::profiler::ProfileVisitor& visitor, ::std::stringstream& _log);
+
+    /** The same as readProfile() for the file (the file is read through memory mapping if possible). */
+    PROFILER_API bool readProfileFromFile(::std::atomic<int>& progress, const char* filename,
+                                          ::profiler::ProfileVisitor& visitor, ::std::stringstream& _log);
+
     PROFILER_API bool readDescriptionsFromStream(::std::atomic<int>& progress, ::std::stringstream& str,
                                                  ::profiler::SerializedData& serialized_descriptors,
                                                  ::profiler::descriptors_list_t& descriptors,
                                                  ::std::stringstream& _log);
+
+    /** Gathers per-lock statistics from lock wait and hold blocks of all threads.
+
+    Locks are sorted by total wait time (the most contended lock is the first).
+    Calls number and durations of sampled blocks are scaled by sampling rate (see BaseBlockDescriptor::sampling()).
+    */
+    PROFILER_API void collectLockStatistics(const ::profiler::blocks_t& _blocks,
+                                            const ::profiler::descriptors_list_t& _descriptors,
+                                            ::profiler::locks_statistics_t& _locks);
+
+    /** Links flow begin and flow end events of all threads into flows.
+
+    Flow end is linked with the earliest not linked flow begin with the same id which is not later than flow end,
+    so ids can be reused after flow end. Flows are sorted by begin time, flow events without pair are skipped.
+    */
+    PROFILER_API void collectFlows(const ::profiler::blocks_t& _blocks,
+                                   const ::profiler::descriptors_list_t& _descriptors,
+                                   const ::profiler::thread_blocks_tree_t& _trees,
+                                   ::profiler::flows_t& _flows);
 }
 
 inline ::profiler::block_index_t fillTreesFromFile(const char* filename, ::profiler::SerializedData& serialized_blocks,
@@ -389,6 +697,12 @@ inline ::profiler::block_index_t fillTreesFromFile(const char* filename, ::profi
     return fillTreesFromFile(progress, filename, serialized_blocks, serialized_descriptors, descriptors, _blocks, threaded_trees, total_descriptors_number, gather_statistics, _log);
 }
 
+inline bool readProfileFromFile(const char* filename, ::profiler::ProfileVisitor& visitor, ::std::stringstream& _log)
+{
+    ::std::atomic<int> progress = ATOMIC_VAR_INIT(0);
+    return readProfileFromFile(progress, filename, visitor, _log);
+}
+
 inline bool readDescriptionsFromStream(::std::stringstream& str,
                                        ::profiler::SerializedData& serialized_descriptors,
                                        ::profiler::descriptors_list_t& descriptors,
@@ -34,6 +34,7 @@ along with this program.If not, see <http://www.gnu.org/licenses/>.
 #define EASY_PROFILER_SERIALIZED_BLOCK__H_______
 
 #include "easy/profiler.h"
+#include <string.h>
 
 namespace profiler {
 
@@ -49,6 +50,22 @@ namespace profiler {
         inline const char* data() const { return reinterpret_cast<const char*>(this); }
         inline const char* name() const { return data() + sizeof(BaseBlockData); }
 
+        /** Returns hardware counters written after the name. Valid only if block has counters (see BlocksTree::counters()). */
+        inline const HardwareCounters* counters() const {
+            return reinterpret_cast<const HardwareCounters*>(name() + strlen(name()) + 1);
+        }
+
+        /** Returns value of extension written after the name (see BlocksTree::cpu_time(), BlocksTree::lock_id(), BlocksTree::flow_id()).
+
+        \param _offset Size of extensions written before required one.
+        */
+        template <class T>
+        inline T extension(size_t _offset) const {
+            T value;
+            memcpy(&value, name() + strlen(name()) + 1 + _offset, sizeof(T));
+            return value;
+        }
+
     private:
 
         SerializedBlock(const ::profiler::Block& block, uint16_t name_length);
@@ -86,6 +103,16 @@ namespace profiler {
             m_status = _status;
         }
 
+        inline void setSampling(uint16_t _sampling)
+        {
+            m_sampling.store(_sampling, std::memory_order_relaxed);
+        }
+
+        inline void setMinDuration(uint32_t _nanoseconds)
+        {
+            m_minDuration.store(_nanoseconds, std::memory_order_relaxed);
+        }
+
     private:
 
         SerializedBlockDescriptor(const SerializedBlockDescriptor&) = delete;
@@ -0,0 +1,248 @@
+/**
+Lightweight profiler library for c++
+Copyright(C) 2016  Sergey Yagovtsev, Victor Zarubkin
+
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+
+
+GNU General Public License Usage
+Alternatively, this file may be used under the terms of the GNU
+General Public License as published by the Free Software Foundation,
+either version 3 of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.If not, see <http://www.gnu.org/licenses/>.
+**/
+
+
+#ifndef EASY_PROFILER__MAPPED_FILE__H_
+#define EASY_PROFILER__MAPPED_FILE__H_
+
+#include <easy/easy_compiler_support.h>
+#include <stdint.h>
+#include <string.h>
+#include <ios>
+
+#ifdef _WIN32
+# include <Windows.h>
+#else
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+namespace profiler {
+
+    /** Read-only memory mapping of the whole file.
+
+    Reader parses .prof file directly from the mapping instead of reading it record by record through std::istream,
+    so opening a capture costs only decoding of the records. Mapping is read-only: timestamps conversion and
+    block ids rewrites are applied to the decoded blocks (see fillTreesFromFile).
+    */
+    class MappedFile EASY_FINAL
+    {
+        const char* m_data = nullptr;
+        uint64_t    m_size = 0;
+
+#ifdef _WIN32
+        HANDLE      m_file = INVALID_HANDLE_VALUE;
+        HANDLE   m_mapping = nullptr;
+#endif
+
+    public:
+
+        MappedFile() = default;
+
+        ~MappedFile()
+        {
+            close();
+        }
+
+        /** Maps the file. Returns false if the file can not be opened or mapped (for example, it is empty
+        or it does not fit into address space), in this case it should be read via std::ifstream. */
+        bool open(const char* _filename)
+        {
+            close();
+
+#ifdef _WIN32
+            m_file = CreateFileA(_filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (m_file == INVALID_HANDLE_VALUE)
+                return false;
+
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0 || static_cast<uint64_t>(size.QuadPart) > static_cast<uint64_t>(SIZE_MAX))
+            {
+                close();
+                return false;
+            }
+
+            m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (m_mapping == nullptr)
+            {
+                close();
+                return false;
+            }
+
+            m_data = static_cast<const char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+            if (m_data == nullptr)
+            {
+                close();
+                return false;
+            }
+
+            m_size = static_cast<uint64_t>(size.QuadPart);
+#else
+            const int fd = ::open(_filename, O_RDONLY);
+            if (fd < 0)
+                return false;
+
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size <= 0 || static_cast<uint64_t>(st.st_size) > static_cast<uint64_t>(SIZE_MAX))
+            {
+                ::close(fd);
+                return false;
+            }
+
+            void* data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd); // mapping keeps the file referenced
+
+            if (data == MAP_FAILED)
+                return false;
+
+            madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+            m_data = static_cast<const char*>(data);
+            m_size = static_cast<uint64_t>(st.st_size);
+#endif
+
+            return true;
+        }
+
+        void close()
+        {
+#ifdef _WIN32
+            if (m_data != nullptr)
+                UnmapViewOfFile(m_data);
+            if (m_mapping != nullptr)
+                CloseHandle(m_mapping);
+            if (m_file != INVALID_HANDLE_VALUE)
+                CloseHandle(m_file);
+            m_mapping = nullptr;
+            m_file = INVALID_HANDLE_VALUE;
+#else
+            if (m_data != nullptr)
+                munmap(const_cast<char*>(m_data), static_cast<size_t>(m_size));
+#endif
+
+            m_data = nullptr;
+            m_size = 0;
+        }
+
+        const char* data() const
+        {
+            return m_data;
+        }
+
+        uint64_t size() const
+        {
+            return m_size;
+        }
+
+    private:
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator = (const MappedFile&) = delete;
+
+    }; // END of class MappedFile.
+
+    /** Subset of std::istream interface used by reader over the memory range.
+
+    Besides read() it provides take() which returns pointer to the next bytes without copying them.
+    Reading past the end sets eof flag like std::istream does.
+    */
+    class MemoryStream EASY_FINAL
+    {
+        const char* m_data;
+        uint64_t    m_size;
+        uint64_t     m_pos = 0;
+        bool         m_eof = false;
+
+    public:
+
+        MemoryStream(const char* _data, uint64_t _size) : m_data(_data), m_size(_size)
+        {
+        }
+
+        MemoryStream& read(char* _dst, uint64_t _size)
+        {
+            const char* src = take(_size);
+            if (src != nullptr)
+                memcpy(_dst, src, static_cast<size_t>(_size));
+            return *this;
+        }
+
+        /** Returns pointer to next _size bytes and skips them, or nullptr if there are not enough bytes. */
+        const char* take(uint64_t _size)
+        {
+            if (_size > m_size - m_pos)
+            {
+                m_pos = m_size;
+                m_eof = true;
+                return nullptr;
+            }
+
+            const char* data = m_data + m_pos;
+            m_pos += _size;
+            return data;
+        }
+
+        const char* data() const
+        {
+            return m_data;
+        }
+
+        uint64_t size() const
+        {
+            return m_size;
+        }
+
+        ::std::streampos tellg() const
+        {
+            return static_cast<::std::streamoff>(m_pos);
+        }
+
+        MemoryStream& seekg(::std::streampos _pos)
+        {
+            const auto pos = static_cast<uint64_t>(static_cast<::std::streamoff>(_pos));
+            m_pos = pos < m_size ? pos : m_size;
+            m_eof = false;
+            return *this;
+        }
+
+        bool eof() const
+        {
+            return m_eof;
+        }
+
+    }; // END of class MemoryStream.
+
+} // END of namespace profiler.
+
+#endif // EASY_PROFILER__MAPPED_FILE__H_
@@ -40,12 +40,27 @@
 
 #include <algorithm>
 #include <fstream>
+#include <memory>
+#include <unordered_set>
 #include "profile_manager.h"
 #include "easy/serialized_block.h"
 #include "easy/easy_net.h"
 #include "easy/easy_socket.h"
 #include "event_trace_win.h"
+#include "event_trace_linux.h"
 #include "current_time.h"
+#include "asymmetric_barrier.h"
+#include "cswitch_log.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+#ifdef __linux__
+# include <sched.h>
+#endif
 
 #if EASY_OPTION_LOG_ENABLED != 0
 # include <iostream>
@@ -133,21 +148,28 @@ extern const uint32_t EASY_CURRENT_VERSION = EASY_VERSION_INT(EASY_PROFILER_VERS
 //auto& MANAGER = ProfileManager::instance();
 # define MANAGER ProfileManager::instance()
 const uint8_t FORCE_ON_FLAG = profiler::FORCE_ON & ~profiler::ON;
-
-#ifdef _WIN32
-decltype(LARGE_INTEGER::QuadPart) const CPU_FREQUENCY = ([](){ LARGE_INTEGER freq; QueryPerformanceFrequency(&freq); return freq.QuadPart; })();
-#endif
+const uint8_t COUNTERS_STARTED_FLAG = 0x80; ///< Block::m_flags bit: hardware counters have been read on block begin
+const uint8_t CPU_TIME_STARTED_FLAG = 0x40; ///< Block::m_flags bit: thread CPU time has been read on block begin
+const uint8_t FLOW_ID_FLAG = 0x20; ///< Block::m_flags bit: block is a flow event and has flow id (which can be 0)
+const uint8_t CHILDREN_STORED_FLAG = 0x10; ///< Block::m_flags bit: some children of the opened block have been stored
 
 extern const profiler::color_t EASY_COLOR_INTERNAL_EVENT = 0xffffffff; // profiler::colors::White
 const profiler::color_t EASY_COLOR_THREAD_END = 0xff212121; // profiler::colors::Dark
 const profiler::color_t EASY_COLOR_START = 0xff4caf50; // profiler::colors::Green
 const profiler::color_t EASY_COLOR_END = 0xfff44336; // profiler::colors::Red
+const profiler::color_t EASY_COLOR_TRIGGER = 0xffff9800; // profiler::colors::Orange
 
 //////////////////////////////////////////////////////////////////////////
 
 EASY_THREAD_LOCAL static ::ThreadStorage* THREAD_STORAGE = nullptr;
 EASY_THREAD_LOCAL static int32_t THREAD_STACK_SIZE = 0;
 
+// Synchronizes ThreadStorage::storeBlock() with closed lists replacement in ProfileManager::dumpSnapshotToFile()
+static const profiler::asymmetric_barrier SNAPSHOT_BARRIER;
+
+// Selected by ProfileManager when profiler is enabled first time (see ProfileManager::selectClockSourceOnce)
+std::atomic<uint8_t> profiler::clock::current_source::s_source(profiler::clock::default_source());
+
 //////////////////////////////////////////////////////////////////////////
 
 #ifdef BUILD_WITH_EASY_PROFILER
@@ -206,6 +228,11 @@ extern "C" {
         MANAGER.storeBlock(_desc, _runtimeName);
     }
 
+    PROFILER_API void storeFlow(const BaseBlockDescriptor* _desc, uint64_t _flowId)
+    {
+        MANAGER.storeBlock(_desc, "", &_flowId);
+    }
+
     PROFILER_API void beginBlock(Block& _block)
     {
         MANAGER.beginBlock(_block);
@@ -216,6 +243,21 @@ extern "C" {
         return MANAGER.dumpBlocksToFile(filename);
     }
 
+    PROFILER_API uint32_t dumpSnapshotToFile(const char* filename)
+    {
+        return MANAGER.dumpSnapshotToFile(filename);
+    }
+
+    PROFILER_API bool startStreamingBlocksToFile(const char* filename)
+    {
+        return MANAGER.startStreamingBlocksToFile(filename);
+    }
+
+    PROFILER_API uint32_t stopStreamingBlocksToFile()
+    {
+        return MANAGER.stopStreamingBlocksToFile();
+    }
+
     PROFILER_API const char* registerThreadScoped(const char* name, ThreadGuard& threadGuard)
     {
         return MANAGER.registerThread(name, threadGuard);
@@ -231,7 +273,7 @@ extern "C" {
         MANAGER.setEventTracingEnabled(_isEnable);
     }
 
-# ifdef _WIN32
+# if defined(_WIN32) || defined(__linux__)
     PROFILER_API void setLowPriorityEventTracing(bool _isLowPriority)
     {
         EasyEventTracer::instance().setLowPriority(_isLowPriority);
@@ -255,6 +297,141 @@ extern "C" {
         return MANAGER.startListen(_port);
     }
 
+    PROFILER_API void setFlightRecorderChunks(uint32_t _chunksNumber)
+    {
+        MANAGER.setFlightRecorderChunks(_chunksNumber);
+    }
+
+    PROFILER_API uint32_t flightRecorderChunks()
+    {
+        return MANAGER.flightRecorderChunks();
+    }
+
+    PROFILER_API bool setClockSource(ClockSource _source)
+    {
+        return MANAGER.setClockSource(_source);
+    }
+
+    PROFILER_API ClockSource clockSource()
+    {
+        return MANAGER.clockSource();
+    }
+
+    PROFILER_API void setBlockSampling(block_id_t _id, uint16_t _sampling)
+    {
+        MANAGER.setBlockSampling(_id, _sampling);
+    }
+
+    PROFILER_API void setMinBlockDuration(uint32_t _nanoseconds)
+    {
+        MANAGER.setMinBlockDuration(_nanoseconds);
+    }
+
+    PROFILER_API uint32_t minBlockDuration()
+    {
+        return MANAGER.minBlockDuration();
+    }
+
+    PROFILER_API void setBlockMinDuration(block_id_t _id, uint32_t _nanoseconds)
+    {
+        MANAGER.setBlockMinDuration(_id, _nanoseconds);
+    }
+
+    PROFILER_API bool setBlockHardwareCounters(block_id_t _id, bool _enable)
+    {
+        return MANAGER.setBlockHardwareCounters(_id, _enable);
+    }
+
+    PROFILER_API bool setBlockCpuTime(block_id_t _id, bool _enable)
+    {
+        return MANAGER.setBlockCpuTime(_id, _enable);
+    }
+
+    PROFILER_API void setFrameCpuTime(bool _enable)
+    {
+        MANAGER.setFrameCpuTime(_enable);
+    }
+
+    PROFILER_API bool frameCpuTime()
+    {
+        return MANAGER.frameCpuTime();
+    }
+
+    PROFILER_API void beginLockBlock(LockBlock _type, const void* _lock)
+    {
+        MANAGER.beginLockBlock(_type, _lock);
+    }
+
+    PROFILER_API void endLockBlock(const void* _lock)
+    {
+        MANAGER.endLockBlock(_lock);
+    }
+
+    PROFILER_API void setCaptureMode(CaptureMode _mode)
+    {
+        MANAGER.setCaptureMode(_mode);
+    }
+
+    PROFILER_API CaptureMode captureMode()
+    {
+        return MANAGER.captureMode();
+    }
+
+    PROFILER_API bool aggregatedStatistics(block_id_t _id, AggregatedStatistics* _stats)
+    {
+        return _stats != nullptr && MANAGER.aggregatedStatistics(_id, *_stats);
+    }
+
+    PROFILER_API void setTailSamplingThreshold(uint32_t _nanoseconds)
+    {
+        MANAGER.setTailSamplingThreshold(_nanoseconds);
+    }
+
+    PROFILER_API uint32_t tailSamplingThreshold()
+    {
+        return MANAGER.tailSamplingThreshold();
+    }
+
+    PROFILER_API void setTailSamplingPercentile(double _percentile)
+    {
+        MANAGER.setTailSamplingPercentile(_percentile);
+    }
+
+    PROFILER_API double tailSamplingPercentile()
+    {
+        return MANAGER.tailSamplingPercentile();
+    }
+
+    PROFILER_API bool startTriggeredCapture(const char* _filenamePrefix, uint32_t _beforeMs, uint32_t _afterMs, uint32_t _filesNumber)
+    {
+        return MANAGER.startTriggeredCapture(_filenamePrefix, _beforeMs, _afterMs, _filesNumber);
+    }
+
+    PROFILER_API uint32_t stopTriggeredCapture()
+    {
+        return MANAGER.stopTriggeredCapture();
+    }
+
+    PROFILER_API bool trigger()
+    {
+        return MANAGER.trigger();
+    }
+
+    PROFILER_API bool setBlockTrigger(block_id_t _id, uint32_t _nanoseconds)
+    {
+        return MANAGER.setBlockTrigger(_id, _nanoseconds);
+    }
+
+    PROFILER_API void setEventsBudget(uint32_t _eventsPerSecond)
+    {
+        MANAGER.setEventsBudget(_eventsPerSecond);
+    }
+
+    PROFILER_API uint32_t eventsBudget()
+    {
+        return MANAGER.eventsBudget();
+    }
+
     PROFILER_API void   stopListen()
     {
         return MANAGER.stopListen();
@@ -264,8 +441,12 @@ extern "C" {
     PROFILER_API void endBlock() { }
     PROFILER_API void setEnabled(bool) { }
     PROFILER_API void storeEvent(const BaseBlockDescriptor*, const char*) { }
+    PROFILER_API void storeFlow(const BaseBlockDescriptor*, uint64_t) { }
     PROFILER_API void beginBlock(Block&) { }
     PROFILER_API uint32_t dumpBlocksToFile(const char*) { return 0; }
+    PROFILER_API uint32_t dumpSnapshotToFile(const char*) { return 0; }
+    PROFILER_API bool startStreamingBlocksToFile(const char*) { return false; }
+    PROFILER_API uint32_t stopStreamingBlocksToFile() { return 0; }
     PROFILER_API const char* registerThreadScoped(const char*, ThreadGuard&) { return ""; }
     PROFILER_API const char* registerThread(const char*) { return ""; }
     PROFILER_API void setEventTracingEnabled(bool) { }
@@ -273,6 +454,39 @@ extern "C" {
     PROFILER_API void setContextSwitchLogFilename(const char*) { }
     PROFILER_API const char* getContextSwitchLogFilename() { return ""; }
     PROFILER_API void   startListen(uint16_t) { }
+    PROFILER_API void setFlightRecorderChunks(uint32_t) { }
+    PROFILER_API uint32_t flightRecorderChunks() { return 0; }
+    PROFILER_API bool setClockSource(ClockSource) { return false; }
+    PROFILER_API ClockSource clockSource() {
+#ifdef _WIN32
+        return CLOCK_SOURCE_QPC;
+#else
+        return CLOCK_SOURCE_MONOTONIC;
+#endif
+    }
+    PROFILER_API void setBlockSampling(block_id_t, uint16_t) { }
+    PROFILER_API void setMinBlockDuration(uint32_t) { }
+    PROFILER_API uint32_t minBlockDuration() { return 0; }
+    PROFILER_API void setBlockMinDuration(block_id_t, uint32_t) { }
+    PROFILER_API bool setBlockHardwareCounters(block_id_t, bool) { return false; }
+    PROFILER_API bool setBlockCpuTime(block_id_t, bool) { return false; }
+    PROFILER_API void setFrameCpuTime(bool) { }
+    PROFILER_API bool frameCpuTime() { return false; }
+    PROFILER_API void beginLockBlock(LockBlock, const void*) { }
+    PROFILER_API void endLockBlock(const void*) { }
+    PROFILER_API void setCaptureMode(CaptureMode) { }
+    PROFILER_API CaptureMode captureMode() { return CAPTURE_MODE_BLOCKS; }
+    PROFILER_API bool aggregatedStatistics(block_id_t, AggregatedStatistics*) { return false; }
+    PROFILER_API void setTailSamplingThreshold(uint32_t) { }
+    PROFILER_API uint32_t tailSamplingThreshold() { return 0; }
+    PROFILER_API void setTailSamplingPercentile(double) { }
+    PROFILER_API double tailSamplingPercentile() { return 0; }
+    PROFILER_API bool startTriggeredCapture(const char*, uint32_t, uint32_t, uint32_t) { return false; }
+    PROFILER_API uint32_t stopTriggeredCapture() { return 0; }
+    PROFILER_API bool trigger() { return false; }
+    PROFILER_API bool setBlockTrigger(block_id_t, uint32_t) { return false; }
+    PROFILER_API void setEventsBudget(uint32_t) { }
+    PROFILER_API uint32_t eventsBudget() { return 0; }
     PROFILER_API void   stopListen() { }
 #endif
 
@@ -322,12 +536,19 @@ SerializedBlock::SerializedBlock(const Block& block, uint16_t name_length)
 
 //////////////////////////////////////////////////////////////////////////
 
+// Descriptors are written into .prof file as is: atomic fields must have the same layout as plain ones
+static_assert(sizeof(std::atomic<uint16_t>) == sizeof(uint16_t), "std::atomic<uint16_t> must have the same size as uint16_t");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "std::atomic<uint32_t> must have the same size as uint32_t");
+
 BaseBlockDescriptor::BaseBlockDescriptor(block_id_t _id, EasyBlockStatus _status, int _line, block_type_t _block_type, color_t _color)
     : m_id(_id)
     , m_line(_line)
     , m_type(_block_type)
     , m_color(_color)
     , m_status(_status)
+    , m_sampling(1)
+    , m_minDuration(0)
+    , m_flags(0)
 {
 
 }
@@ -384,7 +605,7 @@ public:
 
 //////////////////////////////////////////////////////////////////////////
 
-ThreadStorage::ThreadStorage() : id(getCurrentThreadId()), allowChildren(true), named(false), guarded(false)
+ThreadStorage::ThreadStorage(profiler::thread_id_t _id) : frameThreshold(0), framesNumber(0), eventsWindowBegin(0), eventsWindowEnd(0), id(_id), allowChildren(true), named(false), guarded(false), bufferFrame(false), keepFrame(false)
 #ifndef _WIN32
 , pthread_id(pthread_self())
 #endif
@@ -392,490 +613,1890 @@ ThreadStorage::ThreadStorage() : id(getCurrentThreadId()), allowChildren(true),
 {
     expired = ATOMIC_VAR_INIT(0);
     frame = ATOMIC_VAR_INIT(false);
+    storing = ATOMIC_VAR_INIT(false);
 }
 
-void ThreadStorage::storeBlock(const profiler::Block& block)
+ThreadStorage::~ThreadStorage()
 {
-#if EASY_OPTION_MEASURE_STORAGE_EXPAND != 0
-    EASY_LOCAL_STATIC_PTR(const BaseBlockDescriptor*, desc,\
-        MANAGER.addBlockDescriptor(EASY_OPTION_STORAGE_EXPAND_BLOCKS_ON ? profiler::ON : profiler::OFF, EASY_UNIQUE_LINE_ID, "EasyProfiler.ExpandStorage",\
-            __FILE__, __LINE__, profiler::BLOCK_TYPE_BLOCK, EASY_COLOR_INTERNAL_EVENT));
-
-    EASY_THREAD_LOCAL static profiler::timestamp_t beginTime = 0ULL;
-    EASY_THREAD_LOCAL static profiler::timestamp_t endTime = 0ULL;
-#endif
-
-    auto name_length = static_cast<uint16_t>(strlen(block.name()));
-    auto size = static_cast<uint16_t>(sizeof(BaseBlockData) + name_length + 1);
-
-#if EASY_OPTION_MEASURE_STORAGE_EXPAND != 0
-    const bool expanded = (desc->m_status & profiler::ON) && blocks.closedList.need_expand(size);
-    if (expanded) beginTime = getCurrentTime();
-#endif
-
-    auto data = blocks.closedList.allocate(size);
-
-#if EASY_OPTION_MEASURE_STORAGE_EXPAND != 0
-    if (expanded) endTime = getCurrentTime();
-#endif
-
-    ::new (data) SerializedBlock(block, name_length);
-    blocks.usedMemorySize += size;
-
-#if EASY_OPTION_MEASURE_STORAGE_EXPAND != 0
-    if (expanded)
+    // Storage can be destroyed by another thread: lock blocks which were not released
+    // by the owner thread must not call endBlock() from their destructors.
+    for (auto& block : lockBlocks)
     {
-        profiler::Block b(beginTime, desc->id(), "");
-        b.finish(endTime);
-
-        size = static_cast<uint16_t>(sizeof(BaseBlockData) + 1);
-        data = blocks.closedList.allocate(size);
-        ::new (data) SerializedBlock(b, 0);
-        blocks.usedMemorySize += size;
+        if (!block.finished())
+            block.m_end = block.m_begin;
     }
-#endif
 }
 
-void ThreadStorage::storeCSwitch(const profiler::Block& block)
+//////////////////////////////////////////////////////////////////////////
+
+SamplingCounters::SamplingCounters()
 {
-    auto name_length = static_cast<uint16_t>(strlen(block.name()));
-    auto size = static_cast<uint16_t>(sizeof(BaseBlockData) + name_length + 1);
-    auto data = sync.closedList.allocate(size);
-    ::new (data) SerializedBlock(block, name_length);
-    sync.usedMemorySize += size;
+    for (auto& page : m_pages)
+        page.store(nullptr, std::memory_order_relaxed);
 }
 
-void ThreadStorage::clearClosed()
+SamplingCounters::~SamplingCounters()
 {
-    blocks.clearClosed();
-    sync.clearClosed();
+    for (auto& page : m_pages)
+        delete [] page.load(std::memory_order_acquire);
 }
 
-//////////////////////////////////////////////////////////////////////////
-
-ThreadGuard::~ThreadGuard()
+uint16_t* SamplingCounters::reserve(profiler::block_id_t _id)
 {
-#ifndef EASY_PROFILER_API_DISABLED
-    if (m_id != 0 && THREAD_STORAGE != nullptr && THREAD_STORAGE->id == m_id)
+    if (_id >= PAGE_SIZE * MAX_PAGES)
+        return nullptr;
+
+    auto& pagePtr = m_pages[_id / PAGE_SIZE];
+    auto page = pagePtr.load(std::memory_order_acquire);
+    if (page == nullptr)
     {
-        bool isMarked = false;
-        EASY_EVENT_RES(isMarked, "ThreadFinished", EASY_COLOR_THREAD_END, ::profiler::FORCE_ON);
-        THREAD_STORAGE->frame.store(false, std::memory_order_release);
-        THREAD_STORAGE->expired.store(isMarked ? 2 : 1, std::memory_order_release);
-        THREAD_STORAGE = nullptr;
+        auto newPage = new uint16_t[PAGE_SIZE]();
+        if (pagePtr.compare_exchange_strong(page, newPage, std::memory_order_acq_rel, std::memory_order_acquire))
+            page = newPage;
+        else
+            delete [] newPage; // Page has been allocated concurrently
     }
-#endif
+
+    return page + _id % PAGE_SIZE;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-ProfileManager::ProfileManager() :
-#ifdef _WIN32
-    m_processId(GetProcessId(GetCurrentProcess()))
-#else
-    m_processId((processid_t)getpid())
-#endif
-    , m_usedMemorySize(0)
-    , m_beginTime(0)
-    , m_endTime(0)
+GovernorTable::GovernorTable()
 {
-    m_profilerStatus = ATOMIC_VAR_INIT(EASY_PROF_DISABLED);
-    m_isEventTracingEnabled = ATOMIC_VAR_INIT(EASY_OPTION_EVENT_TRACING_ENABLED);
-    m_isAlreadyListening = ATOMIC_VAR_INIT(false);
-    m_stopListen = ATOMIC_VAR_INIT(false);
+    for (auto& page : m_pages)
+        page.store(nullptr, std::memory_order_relaxed);
+}
 
-#if !defined(EASY_PROFILER_API_DISABLED) && EASY_OPTION_START_LISTEN_ON_STARTUP != 0
-    startListen(profiler::DEFAULT_PORT);
-#endif
+GovernorTable::~GovernorTable()
+{
+    for (auto& page : m_pages)
+        delete [] page.load(std::memory_order_acquire);
 }
 
-ProfileManager::~ProfileManager()
+void GovernorTable::add(const BlockDescriptor* _descriptor, profiler::block_id_t _id)
 {
-#ifndef EASY_PROFILER_API_DISABLED
-    stopListen();
-#endif
+    if (_id >= PAGE_SIZE * MAX_PAGES)
+        return;
 
-    for (auto desc : m_descriptors) {
-#if EASY_BLOCK_DESC_FULL_COPY == 0
-        if (desc)
-            desc->~BlockDescriptor();
-        free(desc);
-#else
-        delete desc;
-#endif
+    auto& pagePtr = m_pages[_id / PAGE_SIZE];
+    auto page = pagePtr.load(std::memory_order_relaxed);
+    if (page == nullptr)
+    {
+        page = new entry[PAGE_SIZE];
+        for (uint32_t i = 0; i < PAGE_SIZE; ++i)
+        {
+            page[i].descriptor.store(nullptr, std::memory_order_relaxed);
+            page[i].factor.store(0, std::memory_order_relaxed);
+        }
     }
-}
-
-#ifndef EASY_MAGIC_STATIC_CPP11
-class ProfileManagerInstance {
-    friend ProfileManager;
-    ProfileManager instance;
-} PROFILE_MANAGER;
-#endif
 
-//////////////////////////////////////////////////////////////////////////
+    page[_id % PAGE_SIZE].descriptor.store(_descriptor, std::memory_order_release);
+    pagePtr.store(page, std::memory_order_release);
+}
 
-ProfileManager& ProfileManager::instance()
+void GovernorTable::reset()
 {
-#ifndef EASY_MAGIC_STATIC_CPP11
-    return PROFILE_MANAGER.instance;
-#else
-    ///C++11 makes possible to create Singleton without any warry about thread-safeness
-    ///http://preshing.com/20130930/double-checked-locking-is-fixed-in-cpp11/
-    static ProfileManager profileManager;
-    return profileManager;
-#endif
-}
+    for (auto& pagePtr : m_pages)
+    {
+        auto page = pagePtr.load(std::memory_order_acquire);
+        if (page == nullptr)
+            continue;
 
-//////////////////////////////////////////////////////////////////////////
+        for (uint32_t i = 0; i < PAGE_SIZE; ++i)
+            page[i].factor.store(0, std::memory_order_relaxed);
+    }
+}
 
-ThreadStorage& ProfileManager::_threadStorage(profiler::thread_id_t _thread_id)
+const BlockDescriptor* GovernorTable::descriptor(profiler::block_id_t _id) const
 {
-    return m_threads[_thread_id];
+    if (_id >= PAGE_SIZE * MAX_PAGES)
+        return nullptr;
+    auto page = m_pages[_id / PAGE_SIZE].load(std::memory_order_acquire);
+    return page != nullptr ? page[_id % PAGE_SIZE].descriptor.load(std::memory_order_acquire) : nullptr;
 }
 
-ThreadStorage* ProfileManager::_findThreadStorage(profiler::thread_id_t _thread_id)
+bool GovernorTable::replace(profiler::block_id_t _id, uint16_t& _expected, uint16_t _factor)
 {
-    auto it = m_threads.find(_thread_id);
-    return it != m_threads.end() ? &it->second : nullptr;
+    if (_id >= PAGE_SIZE * MAX_PAGES)
+        return true;
+    auto page = m_pages[_id / PAGE_SIZE].load(std::memory_order_acquire);
+    return page == nullptr || page[_id % PAGE_SIZE].factor.compare_exchange_strong(_expected, _factor, std::memory_order_relaxed);
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-const BaseBlockDescriptor* ProfileManager::addBlockDescriptor(EasyBlockStatus _defaultStatus,
-                                                        const char* _autogenUniqueId,
-                                                        const char* _name,
-                                                        const char* _filename,
-                                                        int _line,
-                                                        block_type_t _block_type,
-                                                        color_t _color,
-                                                        bool _copyName)
+uint32_t RuntimeNamesTable::intern(const char* _name, size_t _hash)
 {
-    guard_lock_t lock(m_storedSpin);
+    profiler::hashed_stdstring key(_name, _hash);
 
-    descriptors_map_t::key_type key(_autogenUniqueId);
-    auto it = m_descriptorsMap.find(key);
-    if (it != m_descriptorsMap.end())
-        return m_descriptors[it->second];
+    profiler::guard_lock<profiler::spin_lock> lock(m_spin);
 
-    const auto nameLen = strlen(_name);
-    m_usedMemorySize += sizeof(profiler::SerializedBlockDescriptor) + nameLen + strlen(_filename) + 2;
-
-#if EASY_BLOCK_DESC_FULL_COPY == 0
-    BlockDescriptor* desc = nullptr;
+    auto it = m_namesMap.find(key);
+    if (it != m_namesMap.end())
+        return it->second;
 
-    if (_copyName)
-    {
-        void* data = malloc(sizeof(BlockDescriptor) + nameLen + 1);
-        char* name = reinterpret_cast<char*>(data) + sizeof(BlockDescriptor);
-        strncpy(name, _name, nameLen);
-        desc = ::new (data)BlockDescriptor(static_cast<block_id_t>(m_descriptors.size()), _defaultStatus, name, _filename, _line, _block_type, _color);
-    }
-    else
+    if (m_names.size() >= RUNTIME_NAMES_MAX_NUMBER || m_usedMemorySize + key.size() + 1 > RUNTIME_NAMES_MAX_MEMORY)
     {
-        void* data = malloc(sizeof(BlockDescriptor));
-        desc = ::new (data)BlockDescriptor(static_cast<block_id_t>(m_descriptors.size()), _defaultStatus, _name, _filename, _line, _block_type, _color);
+        if (!m_full)
+        {
+            m_full = true;
+            EASY_ERROR("Runtime names table is full (" << m_names.size() << " names), new runtime names are dropped\n");
+        }
+
+        return 0;
     }
-#else
-    auto desc = new BlockDescriptor(static_cast<block_id_t>(m_descriptors.size()), _defaultStatus, _name, _filename, _line, _block_type, _color);
-#endif
 
-    m_descriptors.emplace_back(desc);
-    m_descriptorsMap.emplace(key, desc->id());
+    m_storage.emplace_back(key.c_str(), key.size());
+    const auto name = &m_storage.back();
+    m_names.push_back(name);
+    m_usedMemorySize += name->size() + 1;
 
-    return desc;
-}
+    const auto id = static_cast<uint32_t>(m_names.size());
+    m_namesMap.emplace(std::move(key), id);
 
-//////////////////////////////////////////////////////////////////////////
+    return id;
+}
 
-bool ProfileManager::storeBlock(const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName)
+void RuntimeNamesTable::copy(names_t& _names, uint64_t& _usedMemorySize) const
 {
-    const auto state = m_profilerStatus.load(std::memory_order_acquire);
-    if (state == EASY_PROF_DISABLED || !(_desc->m_status & profiler::ON))
-        return false;
+    profiler::guard_lock<profiler::spin_lock> lock(m_spin);
+    _names = m_names;
+    _usedMemorySize = m_usedMemorySize;
+}
 
-    if (state == EASY_PROF_DUMP)
+void RuntimeNamesTable::reset()
+{
+    profiler::guard_lock<profiler::spin_lock> lock(m_spin);
+
+    m_namesMap.clear();
+    m_names.clear();
+    m_storage.clear();
+    m_usedMemorySize = 0;
+    m_full = false;
+
+    m_generation.fetch_add(1, std::memory_order_release);
+}
+
+uint32_t RuntimeNamesCache::id(const char* _name, uint16_t& _length)
+{
+    if (*_name == 0)
     {
-        if (THREAD_STORAGE == nullptr || THREAD_STORAGE->blocks.openedList.empty())
-            return false;
+        _length = 0;
+        return 0;
     }
-    else if (THREAD_STORAGE == nullptr)
+
+    // FNV-1a hash (name length is calculated at the same pass)
+    uint64_t hash = 14695981039346656037ULL;
+    const char* c = _name;
+    for (; *c != 0; ++c)
     {
-        THREAD_STORAGE = &threadStorage(getCurrentThreadId());
+        hash ^= static_cast<uint8_t>(*c);
+        hash *= 1099511628211ULL;
     }
 
-#if EASY_ENABLE_BLOCK_STATUS != 0
-    if (!THREAD_STORAGE->allowChildren && !(_desc->m_status & FORCE_ON_FLAG))
-        return false;
-#endif
+    const auto length = static_cast<size_t>(c - _name);
+    _length = static_cast<uint16_t>(length);
 
-    profiler::Block b(_desc, _runtimeName);
-    b.start();
-    b.m_end = b.m_begin;
+    const auto generation = MANAGER.runtimeNamesGeneration();
+    if (m_generation != generation)
+    {
+        // Table has been reset: cached ids are not valid anymore
+        m_names.clear();
+        m_generation = generation;
+    }
 
-    THREAD_STORAGE->storeBlock(b);
+    const auto key = static_cast<size_t>(hash);
+    auto it = m_names.find(key);
+    if (it != m_names.end() && it->second.name.size() == length && memcmp(it->second.name.data(), _name, length) == 0)
+    {
+        if (it->second.id == 0)
+            _length = 0; // Name has been dropped: block is stored without runtime name
+        return it->second.id;
+    }
 
-    return true;
+    const auto id = MANAGER.internRuntimeName(_name, key);
+
+    if (it != m_names.end())
+    {
+        // Hash collision: the newest name replaces the old one
+        it->second.name.assign(_name, length);
+        it->second.id = id;
+    }
+    else
+    {
+        if (m_names.size() >= RUNTIME_NAMES_CACHE_SIZE)
+            m_names.clear();
+        m_names.emplace(key, entry {std::string(_name, length), id});
+    }
+
+    if (id == 0)
+        _length = 0;
+
+    return id;
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void ProfileManager::storeBlockForce(const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName, ::profiler::timestamp_t& _timestamp)
-{
-    if (!(_desc->m_status & profiler::ON))
-        return;
+typedef decltype(ThreadStorage::blocks)::closed_list_t closed_list_t;
 
-    if (THREAD_STORAGE == nullptr)
-        THREAD_STORAGE = &threadStorage(getCurrentThreadId());
+/** Fills compact record header of the block interning it's runtime name. */
+static void makeRecord(BufferedBlock& _record, RuntimeNamesCache& _names, const profiler::Block& _block)
+{
+    auto& header = _record.header;
+    header.begin = _block.begin();
+    header.end = _block.end();
+    header.id = _block.id();
+    header.name_id = _names.id(_block.name(), _record.nameLength);
+
+    header.extensions = 0;
+    if (_block.flags() & COUNTERS_STARTED_FLAG)
+    {
+        header.extensions |= profiler::compact::EXTENSION_COUNTERS;
+        header.counters = _block.counters();
+    }
 
-#if EASY_ENABLE_BLOCK_STATUS != 0
-    if (!THREAD_STORAGE->allowChildren && !(_desc->m_status & FORCE_ON_FLAG))
-        return;
-#endif
+    if (_block.flags() & CPU_TIME_STARTED_FLAG)
+    {
+        header.extensions |= profiler::compact::EXTENSION_CPU_TIME;
+        header.cpu_time = _block.cpuTime();
+    }
 
-    profiler::Block b(_desc, _runtimeName);
-    b.start();
-    b.m_end = b.m_begin;
+    if (_block.lockId() != 0)
+    {
+        header.extensions |= profiler::compact::EXTENSION_LOCK;
+        header.lock_id = _block.lockId();
+    }
 
-    _timestamp = b.m_begin;
-    THREAD_STORAGE->storeBlock(b);
+    if (_block.flags() & FLOW_ID_FLAG)
+    {
+        header.extensions |= profiler::compact::EXTENSION_FLOW;
+        header.flow_id = _block.flowId();
+    }
 }
 
-void ProfileManager::storeBlockForce2(const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName, ::profiler::timestamp_t _timestamp)
+/** Encodes block with already interned runtime name into compact record (see profiler::compact) and stores it into the closed list. */
+static void storeCompactRecord(closed_list_t& _closedList, profiler::timestamp_t& _lastBegin, const BufferedBlock& _block, uint32_t _chunksLimit)
 {
-    if (!(_desc->m_status & profiler::ON))
-        return;
-
-    if (THREAD_STORAGE == nullptr)
-        THREAD_STORAGE = &threadStorage(getCurrentThreadId());
-
-#if EASY_ENABLE_BLOCK_STATUS != 0
-    if (!THREAD_STORAGE->allowChildren && !(_desc->m_status & FORCE_ON_FLAG))
-        return;
-#endif
+    uint8_t header[profiler::compact::MAX_HEADER_SIZE];
+    auto size = profiler::compact::encode_header(header, _block.header, &_lastBegin);
+    if (_closedList.starts_chunk(size))
+        size = profiler::compact::encode_header(header, _block.header, nullptr);
 
-    profiler::Block b(_desc, _runtimeName);
-    b.m_end = b.m_begin = _timestamp;
+    auto data = _closedList.allocate(size, profiler::compact::decoded_size(_block.header, _block.nameLength), _chunksLimit);
+    memcpy(data, header, size);
 
-    THREAD_STORAGE->storeBlock(b);
+    _lastBegin = _block.header.begin;
 }
 
-void ProfileManager::storeBlockForce2(ThreadStorage& _registeredThread, const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName, ::profiler::timestamp_t _timestamp)
+/** Encodes block into compact record (see profiler::compact) and stores it into the closed list.
+
+Runtime name is not copied into the record: it is interned and only its id is stored.
+*/
+static void storeCompactBlock(closed_list_t& _closedList, profiler::timestamp_t& _lastBegin, RuntimeNamesCache& _names,
+                              const profiler::Block& _block, uint32_t _chunksLimit)
 {
-    profiler::Block b(_desc, _runtimeName);
-    b.m_end = b.m_begin = _timestamp;
-    _registeredThread.storeBlock(b);
+    BufferedBlock record;
+    makeRecord(record, _names, _block);
+    storeCompactRecord(_closedList, _lastBegin, record, _chunksLimit);
 }
 
-//////////////////////////////////////////////////////////////////////////
-
-void ProfileManager::beginBlock(Block& _block)
+void ThreadStorage::storeBlock(const profiler::Block& block)
 {
-    if (++THREAD_STACK_SIZE > 1)
-        return;
+#if EASY_OPTION_MEASURE_STORAGE_EXPAND != 0
+    EASY_LOCAL_STATIC_PTR(const BaseBlockDescriptor*, desc,\
+        MANAGER.addBlockDescriptor(EASY_OPTION_STORAGE_EXPAND_BLOCKS_ON ? profiler::ON : profiler::OFF, EASY_UNIQUE_LINE_ID, "EasyProfiler.ExpandStorage",\
+            __FILE__, __LINE__, profiler::BLOCK_TYPE_BLOCK, EASY_COLOR_INTERNAL_EVENT));
 
-    const auto state = m_profilerStatus.load(std::memory_order_acquire);
-    if (state == EASY_PROF_DISABLED)
-        return;
+    EASY_THREAD_LOCAL static profiler::timestamp_t beginTime = 0ULL;
+    EASY_THREAD_LOCAL static profiler::timestamp_t endTime = 0ULL;
+#endif
 
-    THREAD_STACK_SIZE = 0;
-    bool empty = true;
-    if (state == EASY_PROF_DUMP)
-    {
-        if (THREAD_STORAGE == nullptr || THREAD_STORAGE->blocks.openedList.empty())
-            return;
-        empty = false;
-    }
-    else if (THREAD_STORAGE == nullptr)
-    {
-        THREAD_STORAGE = &threadStorage(getCurrentThreadId());
-    }
-    else
-    {
-        empty = THREAD_STORAGE->blocks.openedList.empty();
-    }
+    // Closed list can be replaced by snapshot: it waits while storing flag is set
+    // for all threads which could have read the old list pointer.
+    storing.store(true, std::memory_order_relaxed);
+    SNAPSHOT_BARRIER.light();
+    auto& closedList = blocks.closed();
 
-#if EASY_ENABLE_BLOCK_STATUS != 0
-    if (THREAD_STORAGE->allowChildren)
-    {
+#if EASY_OPTION_MEASURE_STORAGE_EXPAND != 0
+    const bool expanded = (desc->m_status & profiler::ON) && closedList.need_expand(profiler::compact::MAX_HEADER_SIZE);
+    if (expanded) beginTime = getCurrentTime();
 #endif
-        if (_block.m_status & profiler::ON)
-            _block.start();
-#if EASY_ENABLE_BLOCK_STATUS != 0
-        THREAD_STORAGE->allowChildren = !(_block.m_status & profiler::OFF_RECURSIVE);
-    } 
-    else if (_block.m_status & FORCE_ON_FLAG)
-    {
-        _block.start();
-        _block.m_status = profiler::FORCE_ON_WITHOUT_CHILDREN;
-    }
-    else
+
+    const auto chunksLimit = MANAGER.flightRecorderChunks();
+    storeCompactBlock(closedList, blocks.lastBegin, blocks.names, block, chunksLimit);
+
+#if EASY_OPTION_MEASURE_STORAGE_EXPAND != 0
+    if (expanded) endTime = getCurrentTime();
+
+    if (expanded)
     {
-        _block.m_status = profiler::OFF_RECURSIVE;
+        profiler::Block b(beginTime, desc->id(), "");
+        b.finish(endTime);
+        storeCompactBlock(closedList, blocks.lastBegin, blocks.names, b, chunksLimit);
     }
 #endif
 
-    if (empty)
-        THREAD_STORAGE->frame.store(true, std::memory_order_release);
-    THREAD_STORAGE->blocks.openedList.emplace(_block);
+    storing.store(false, std::memory_order_release);
 }
 
-void ProfileManager::beginContextSwitch(profiler::thread_id_t _thread_id, profiler::timestamp_t _time, profiler::thread_id_t _target_thread_id, const char* _target_process, bool _lockSpin)
+void ThreadStorage::storeCSwitch(const profiler::Block& block)
 {
-    auto ts = _lockSpin ? findThreadStorage(_thread_id) : _findThreadStorage(_thread_id);
-    if (ts != nullptr)
-        // Dirty hack: _target_thread_id will be written to the field "block_id_t m_id"
-        // and will be available calling method id().
-        ts->sync.openedList.emplace(_time, _target_thread_id, _target_process);
+    storeCompactBlock(sync.closed(), sync.lastBegin, sync.names, block, MANAGER.flightRecorderChunks());
 }
 
-//////////////////////////////////////////////////////////////////////////
-
-void ProfileManager::endBlock()
+void ThreadStorage::bufferBlock(const profiler::Block& _block)
 {
-    if (--THREAD_STACK_SIZE > 0 || m_profilerStatus.load(std::memory_order_acquire) == EASY_PROF_DISABLED)
-        return;
+    // Runtime name is interned right now because it's pointer could be invalid when the frame ends
+    BufferedBlock record;
+    makeRecord(record, blocks.names, _block);
+    frameBlocks.push_back(record);
+}
 
-    THREAD_STACK_SIZE = 0;
-    if (THREAD_STORAGE == nullptr || THREAD_STORAGE->blocks.openedList.empty())
-        return;
+void ThreadStorage::startCounters(profiler::Block& _block)
+{
+    if (counters.read(_block.m_counters))
+        _block.m_flags |= COUNTERS_STARTED_FLAG;
+}
 
-    Block& lastBlock = THREAD_STORAGE->blocks.openedList.top();
-    if (lastBlock.m_status & profiler::ON)
-    {
-        if (!lastBlock.finished())
-            lastBlock.finish();
-        THREAD_STORAGE->storeBlock(lastBlock);
-    }
-    else
+void ThreadStorage::stopCounters(profiler::Block& _block)
+{
+    profiler::HardwareCounters values;
+    if (!counters.read(values))
     {
-        lastBlock.m_end = lastBlock.m_begin; // this is to restrict endBlock() call inside ~Block()
+        _block.m_flags &= ~COUNTERS_STARTED_FLAG;
+        return;
     }
 
-    THREAD_STORAGE->blocks.openedList.pop();
-    const bool empty = THREAD_STORAGE->blocks.openedList.empty();
-    if (empty)
-        THREAD_STORAGE->frame.store(false, std::memory_order_release);
-
-#if EASY_ENABLE_BLOCK_STATUS != 0
-    THREAD_STORAGE->allowChildren = empty || !(THREAD_STORAGE->blocks.openedList.top().get().m_status & profiler::OFF_RECURSIVE);
-#endif
+    // Started values are replaced by deltas which are stored with the block
+    _block.m_counters.instructions = values.instructions - _block.m_counters.instructions;
+    _block.m_counters.cycles = values.cycles - _block.m_counters.cycles;
+    _block.m_counters.cache_misses = values.cache_misses - _block.m_counters.cache_misses;
 }
 
-void ProfileManager::endContextSwitch(profiler::thread_id_t _thread_id, processid_t _process_id, profiler::timestamp_t _endtime, bool _lockSpin)
+void ThreadStorage::commitFrame()
 {
-    ThreadStorage* ts = nullptr;
-    if (_process_id == m_processId)
-        // If thread owned by current process then create new ThreadStorage if there is no one
-        ts = _lockSpin ? &threadStorage(_thread_id) : &_threadStorage(_thread_id);
-    else
-        // If thread owned by another process OR _process_id IS UNKNOWN then do not create ThreadStorage for this
-        ts = _lockSpin ? findThreadStorage(_thread_id) : _findThreadStorage(_thread_id);
+    storing.store(true, std::memory_order_relaxed);
+    SNAPSHOT_BARRIER.light();
+    auto& closedList = blocks.closed();
 
-    if (ts == nullptr || ts->sync.openedList.empty())
-        return;
+    const auto chunksLimit = MANAGER.flightRecorderChunks();
+    for (const auto& record : frameBlocks)
+        storeCompactRecord(closedList, blocks.lastBegin, record, chunksLimit);
 
-    Block& lastBlock = ts->sync.openedList.top();
-    lastBlock.finish(_endtime);
+    storing.store(false, std::memory_order_release);
+
+    frameBlocks.clear();
+}
 
-    ts->storeCSwitch(lastBlock);
-    ts->sync.openedList.pop();
+void ThreadStorage::clearClosed()
+{
+    blocks.clearClosed();
+    sync.clearClosed();
 }
 
 //////////////////////////////////////////////////////////////////////////
 
-void ProfileManager::enableEventTracer()
+ThreadStorageRegistry::ThreadStorageRegistry() : m_index(new index_entry_t[EASY_THREADS_INDEX_CAPACITY])
 {
-#ifdef _WIN32
-    if (m_isEventTracingEnabled.load(std::memory_order_acquire))
-        EasyEventTracer::instance().enable(true);
-#endif
+    static_assert((EASY_THREADS_INDEX_CAPACITY & (EASY_THREADS_INDEX_CAPACITY - 1)) == 0, "EASY_THREADS_INDEX_CAPACITY must be a power of 2");
+
+    m_size = ATOMIC_VAR_INIT(0U);
+    m_freeHead = ATOMIC_VAR_INIT(0ULL);
+
+    for (auto& seg : m_segments)
+        seg.store(nullptr, std::memory_order_relaxed);
+
+    for (uint32_t i = 0; i < EASY_THREADS_INDEX_CAPACITY; ++i)
+        m_index[i].store(0ULL, std::memory_order_relaxed);
 }
 
-void ProfileManager::disableEventTracer()
+ThreadStorageRegistry::~ThreadStorageRegistry()
 {
-#ifdef _WIN32
-    EasyEventTracer::instance().disable();
-#endif
+    const auto n = size();
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        auto ts = at(i);
+        if (ts != nullptr)
+            ts->~ThreadStorage();
+    }
+
+    for (auto& seg : m_segments)
+        delete seg.load(std::memory_order_acquire);
+
+    delete [] m_index;
 }
 
-void ProfileManager::setEnabled(bool isEnable)
+ThreadStorage* ThreadStorageRegistry::find(profiler::thread_id_t _id) const
 {
-    guard_lock_t lock(m_dumpSpin);
-
-    auto time = getCurrentTime();
-    const auto status = isEnable ? EASY_PROF_ENABLED : EASY_PROF_DISABLED;
-    const auto prev = m_profilerStatus.exchange(status, std::memory_order_release);
-    if (prev == status)
-        return;
+    if (_id == 0)
+        return nullptr;
 
-    if (isEnable)
-    {
-        EASY_LOGMSG("Enabled profiling\n");
-        enableEventTracer();
-        m_beginTime = time;
-    }
-    else
+    auto h = hash(_id);
+    for (uint32_t n = 0; n < EASY_THREADS_INDEX_CAPACITY; ++n, h = (h + 1) & (EASY_THREADS_INDEX_CAPACITY - 1))
     {
-        EASY_LOGMSG("Disabled profiling\n");
-        disableEventTracer();
-        m_endTime = time;
+        const auto entry = m_index[h].load(std::memory_order_acquire);
+        if (entry == 0)
+            return nullptr;
+
+        if (static_cast<profiler::thread_id_t>(entry >> 32) == _id)
+        {
+            const auto s = static_cast<uint32_t>(entry);
+            return s != 0 ? &usedSlot(s - 1).get() : nullptr;
+        }
     }
-}
 
-void ProfileManager::setEventTracingEnabled(bool _isEnable)
-{
-    m_isEventTracingEnabled.store(_isEnable, std::memory_order_release);
+    return nullptr;
 }
 
-//////////////////////////////////////////////////////////////////////////
-
-char ProfileManager::checkThreadExpired(ThreadStorage& _registeredThread)
+ThreadStorage* ThreadStorageRegistry::get(profiler::thread_id_t _id)
 {
-    const char val = _registeredThread.expired.load(std::memory_order_acquire);
-    if (val != 0)
-        return val;
+    auto ts = find(_id);
+    if (ts != nullptr || _id == 0)
+        return ts;
 
-    if (_registeredThread.guarded)
-        return 0;
+    uint32_t s = 0;
+    if (!allocate(s))
+    {
+        EASY_ERROR("Can not register thread " << _id << ": all " << (EASY_THREADS_MAX_SEGMENTS * EASY_THREADS_SEGMENT_SIZE) << " thread slots are in use\n");
+        return nullptr;
+    }
 
-#ifdef _WIN32
+    auto& newSlot = usedSlot(s);
+    ts = ::new (&newSlot.storage) ThreadStorage(_id);
 
-    // Check thread for Windows
+    const uint64_t desired = (static_cast<uint64_t>(_id) << 32) | (s + 1);
 
-    DWORD exitCode = 0;
-    auto hThread = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, _registeredThread.id);
-    if (hThread == nullptr || GetExitCodeThread(hThread, &exitCode) == FALSE || exitCode != STILL_ACTIVE)
     {
-        // Thread has been expired
-        _registeredThread.expired.store(1, std::memory_order_release);
-        if (hThread != nullptr)
-            CloseHandle(hThread);
-        return 1;
-    }
+        // Claim first empty or released index entry unless an entry has been inserted for the same thread concurrently
+        profiler::guard_lock<profiler::spin_lock> lock(m_indexSpin);
 
-    if (hThread != nullptr)
-        CloseHandle(hThread);
+        index_entry_t* claimed = nullptr;
+        auto h = hash(_id);
+        for (uint32_t n = 0; n < EASY_THREADS_INDEX_CAPACITY; ++n, h = (h + 1) & (EASY_THREADS_INDEX_CAPACITY - 1))
+        {
+            const auto entry = m_index[h].load(std::memory_order_acquire);
+            const auto entrySlot = static_cast<uint32_t>(entry);
 
-    return 0;
+            if (entrySlot != 0)
+            {
+                if (static_cast<profiler::thread_id_t>(entry >> 32) != _id)
+                    continue; // entry is used by another live thread
+
+                // Thread has been registered concurrently
+                lock.unlock();
+                ts->~ThreadStorage();
+                deallocate(s);
+                return &usedSlot(entrySlot - 1).get();
+            }
 
-#else
+            if (claimed == nullptr)
+                claimed = m_index + h;
 
-    return 0;//pthread_kill(_registeredThread.pthread_id, 0) != 0;
+            if (entry == 0)
+                break; // there are no entries of this thread after empty one
+        }
 
-#endif
+        if (claimed != nullptr)
+        {
+            claimed->store(desired, std::memory_order_release);
+            newSlot.live.store(1, std::memory_order_release);
+            return ts;
+        }
+    }
 
-}
+    // Index is full: slot which is not linked into the index could never be found and released
+    EASY_ERROR("Can not register thread " << _id << ": threads index is full\n");
+    ts->~ThreadStorage();
+    deallocate(s);
 
-//////////////////////////////////////////////////////////////////////////
+    return nullptr;
+}
 
-uint32_t ProfileManager::dumpBlocksToStream(profiler::OStream& _outputStream, bool _lockSpin)
+void ThreadStorageRegistry::release(uint32_t _slot)
 {
-    EASY_LOGMSG("dumpBlocksToStream(_lockSpin = " << _lockSpin << ")...\n");
+    auto& freed = usedSlot(_slot);
+    auto& storage = freed.get();
 
-    if (_lockSpin)
+    const uint64_t live = (static_cast<uint64_t>(storage.id) << 32) | (_slot + 1);
+    const uint32_t mask = EASY_THREADS_INDEX_CAPACITY - 1;
+
+    profiler::guard_lock<profiler::spin_lock> lock(m_indexSpin);
+
+    auto h = hash(storage.id);
+    for (uint32_t n = 0; n < EASY_THREADS_INDEX_CAPACITY; ++n, h = (h + 1) & mask)
+    {
+        const auto entry = m_index[h].load(std::memory_order_acquire);
+        if (entry == 0)
+            break;
+
+        if (entry == live)
+        {
+            // Keep thread id in the entry to preserve probing sequence for other threads
+            m_index[h].store(live & 0xffffffff00000000ULL, std::memory_order_release);
+
+            // Released entries followed by empty one are not on the probing sequence of any live thread:
+            // they are emptied, so lookups of unregistered threads stop early.
+            if (m_index[(h + 1) & mask].load(std::memory_order_acquire) == 0)
+            {
+                for (uint32_t k = 0; k < EASY_THREADS_INDEX_CAPACITY; ++k, h = (h - 1) & mask)
+                {
+                    const auto released = m_index[h].load(std::memory_order_acquire);
+                    if (released == 0 || static_cast<uint32_t>(released) != 0)
+                        break;
+                    m_index[h].store(0ULL, std::memory_order_release);
+                }
+            }
+
+            break;
+        }
+    }
+
+    lock.unlock();
+
+    freed.live.store(0, std::memory_order_release);
+    storage.~ThreadStorage();
+    deallocate(_slot);
+}
+
+bool ThreadStorageRegistry::allocate(uint32_t& _slot)
+{
+    // Try to pop expired thread slot from the free-list
+    auto head = m_freeHead.load(std::memory_order_acquire);
+    while (static_cast<uint32_t>(head) != 0)
+    {
+        const auto s = static_cast<uint32_t>(head) - 1;
+        const uint64_t next = ((head >> 32) + 1) << 32 | usedSlot(s).nextFree.load(std::memory_order_relaxed);
+        if (m_freeHead.compare_exchange_weak(head, next, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            _slot = s;
+            return true;
+        }
+    }
+
+    // Take new slot from the end
+    const auto s = m_size.fetch_add(1, std::memory_order_acq_rel);
+    const auto n = s / EASY_THREADS_SEGMENT_SIZE;
+    if (n >= EASY_THREADS_MAX_SEGMENTS)
+    {
+        m_size.fetch_sub(1, std::memory_order_acq_rel);
+        return false;
+    }
+
+    if (m_segments[n].load(std::memory_order_acquire) == nullptr)
+    {
+        segment* expected = nullptr;
+        auto seg = new segment();
+        if (!m_segments[n].compare_exchange_strong(expected, seg, std::memory_order_acq_rel, std::memory_order_acquire))
+            delete seg; // segment has been allocated by another thread
+    }
+
+    _slot = s;
+    return true;
+}
+
+void ThreadStorageRegistry::deallocate(uint32_t _slot)
+{
+    auto& freed = usedSlot(_slot);
+    auto head = m_freeHead.load(std::memory_order_acquire);
+    do {
+        freed.nextFree.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+    } while (!m_freeHead.compare_exchange_weak(head, ((head >> 32) + 1) << 32 | (_slot + 1), std::memory_order_acq_rel, std::memory_order_acquire));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+ThreadGuard::~ThreadGuard()
+{
+#ifndef EASY_PROFILER_API_DISABLED
+    if (m_id != 0 && THREAD_STORAGE != nullptr && THREAD_STORAGE->id == m_id)
+    {
+        bool isMarked = false;
+        EASY_EVENT_RES(isMarked, "ThreadFinished", EASY_COLOR_THREAD_END, ::profiler::FORCE_ON);
+        THREAD_STORAGE->frame.store(false, std::memory_order_release);
+        THREAD_STORAGE->expired.store(isMarked ? 2 : 1, std::memory_order_release);
+        THREAD_STORAGE = nullptr;
+    }
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+ProfileManager::ProfileManager() :
+#ifdef _WIN32
+    m_processId(GetProcessId(GetCurrentProcess()))
+#else
+    m_processId((processid_t)getpid())
+#endif
+    , m_usedMemorySize(0)
+    , m_beginTime(0)
+    , m_endTime(0)
+{
+    m_profilerStatus = ATOMIC_VAR_INIT(EASY_PROF_DISABLED);
+    m_isEventTracingEnabled = ATOMIC_VAR_INIT(EASY_OPTION_EVENT_TRACING_ENABLED);
+    m_isAlreadyListening = ATOMIC_VAR_INIT(false);
+    m_stopListen = ATOMIC_VAR_INIT(false);
+    m_flightRecorderChunks = ATOMIC_VAR_INIT(EASY_OPTION_FLIGHT_RECORDER_CHUNKS);
+    m_minBlockDuration = ATOMIC_VAR_INIT(EASY_OPTION_MIN_BLOCK_DURATION);
+    m_captureMode = ATOMIC_VAR_INIT(EASY_OPTION_CAPTURE_MODE);
+    m_tailThreshold = ATOMIC_VAR_INIT(0U);
+    m_tailPercentile = ATOMIC_VAR_INIT(0U);
+    m_triggerTime = ATOMIC_VAR_INIT(0ULL);
+    m_triggerArmed = ATOMIC_VAR_INIT(false);
+    m_stopTrigger = ATOMIC_VAR_INIT(false);
+    m_triggerCaptureOn = false;
+    m_streamOn = false;
+    m_networkCapture = false;
+    m_blockTriggersNumber = ATOMIC_VAR_INIT(0U);
+    m_eventsBudget = ATOMIC_VAR_INIT(EASY_OPTION_EVENTS_BUDGET);
+    m_frameCpuTime = ATOMIC_VAR_INIT(EASY_OPTION_FRAME_CPU_TIME);
+    for (auto& blockTrigger : m_blockTriggers)
+    {
+        blockTrigger.id = ATOMIC_VAR_INIT(0U);
+        blockTrigger.duration = ATOMIC_VAR_INIT(0U);
+    }
+    m_stopFlush = ATOMIC_VAR_INIT(false);
+
+    // Self-test of clock sources is expensive, it is postponed until profiler is enabled (see selectClockSourceOnce)
+    const auto preferredClock = static_cast<profiler::ClockSource>(EASY_OPTION_CLOCK_SOURCE);
+    const bool clockSelected = preferredClock != profiler::CLOCK_SOURCE_AUTO && preferredClock < profiler::CLOCK_SOURCES_NUMBER
+                               && profiler::clock::available(preferredClock);
+    if (clockSelected)
+        profiler::clock::current_source::s_source.store(preferredClock, std::memory_order_release);
+    m_clockSourceSelected = ATOMIC_VAR_INIT(clockSelected);
+    m_cpuFrequency.start();
+
+#if !defined(EASY_PROFILER_API_DISABLED) && EASY_OPTION_START_LISTEN_ON_STARTUP != 0
+    startListen(profiler::DEFAULT_PORT);
+#endif
+}
+
+ProfileManager::~ProfileManager()
+{
+#ifndef EASY_PROFILER_API_DISABLED
+    stopListen();
+#endif
+
+    if (m_snapshotThread.joinable())
+        m_snapshotThread.join();
+
+    stopTriggeredCapture();
+
+    if (m_streamFile != nullptr)
+        stopStreamingBlocksToFile();
+
+    for (auto desc : m_descriptors) {
+#if EASY_BLOCK_DESC_FULL_COPY == 0
+        if (desc)
+            desc->~BlockDescriptor();
+        free(desc);
+#else
+        delete desc;
+#endif
+    }
+}
+
+#ifndef EASY_MAGIC_STATIC_CPP11
+class ProfileManagerInstance {
+    friend ProfileManager;
+    ProfileManager instance;
+} PROFILE_MANAGER;
+#endif
+
+//////////////////////////////////////////////////////////////////////////
+
+ProfileManager& ProfileManager::instance()
+{
+#ifndef EASY_MAGIC_STATIC_CPP11
+    return PROFILE_MANAGER.instance;
+#else
+    ///C++11 makes possible to create Singleton without any warry about thread-safeness
+    ///http://preshing.com/20130930/double-checked-locking-is-fixed-in-cpp11/
+    static ProfileManager profileManager;
+    return profileManager;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+const BaseBlockDescriptor* ProfileManager::addBlockDescriptor(EasyBlockStatus _defaultStatus,
+                                                        const char* _autogenUniqueId,
+                                                        const char* _name,
+                                                        const char* _filename,
+                                                        int _line,
+                                                        block_type_t _block_type,
+                                                        color_t _color,
+                                                        bool _copyName)
+{
+    guard_lock_t lock(m_storedSpin);
+
+    descriptors_map_t::key_type key(_autogenUniqueId);
+    auto it = m_descriptorsMap.find(key);
+    if (it != m_descriptorsMap.end())
+        return m_descriptors[it->second];
+
+    const auto nameLen = strlen(_name);
+    m_usedMemorySize += sizeof(profiler::SerializedBlockDescriptor) + nameLen + strlen(_filename) + 2;
+
+#if EASY_BLOCK_DESC_FULL_COPY == 0
+    BlockDescriptor* desc = nullptr;
+
+    if (_copyName)
+    {
+        void* data = malloc(sizeof(BlockDescriptor) + nameLen + 1);
+        char* name = reinterpret_cast<char*>(data) + sizeof(BlockDescriptor);
+        strncpy(name, _name, nameLen);
+        desc = ::new (data)BlockDescriptor(static_cast<block_id_t>(m_descriptors.size()), _defaultStatus, name, _filename, _line, _block_type, _color);
+    }
+    else
+    {
+        void* data = malloc(sizeof(BlockDescriptor));
+        desc = ::new (data)BlockDescriptor(static_cast<block_id_t>(m_descriptors.size()), _defaultStatus, _name, _filename, _line, _block_type, _color);
+    }
+#else
+    auto desc = new BlockDescriptor(static_cast<block_id_t>(m_descriptors.size()), _defaultStatus, _name, _filename, _line, _block_type, _color);
+#endif
+
+    m_descriptors.emplace_back(desc);
+    m_descriptorsMap.emplace(key, desc->id());
+    m_governor.add(desc, desc->id());
+
+    return desc;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool ProfileManager::storeBlock(const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName, const uint64_t* _flowId)
+{
+    const auto state = m_profilerStatus.load(std::memory_order_acquire);
+    if (state == EASY_PROF_DISABLED || !(_desc->m_status & profiler::ON))
+        return false;
+
+    if (state == EASY_PROF_DUMP)
+    {
+        if (THREAD_STORAGE == nullptr || THREAD_STORAGE->blocks.openedList.empty())
+            return false;
+    }
+    else if (THREAD_STORAGE == nullptr)
+    {
+        THREAD_STORAGE = threadStorage(getCurrentThreadId());
+        if (THREAD_STORAGE == nullptr)
+            return false;
+    }
+
+#if EASY_ENABLE_BLOCK_STATUS != 0
+    if (!THREAD_STORAGE->allowChildren && !(_desc->m_status & FORCE_ON_FLAG))
+        return false;
+#endif
+
+    auto sampling = _desc->sampling();
+    if (!governed(_desc->m_id, sampling))
+        return false;
+
+    if (sampling > 1 && !THREAD_STORAGE->sampled(_desc->m_id, sampling))
+        return false;
+
+    if (m_captureMode.load(std::memory_order_relaxed) == profiler::CAPTURE_MODE_STATISTICS)
+    {
+        auto histogram = THREAD_STORAGE->histograms.get(_desc->m_id);
+        if (histogram != nullptr)
+            histogram->add(0, sampling);
+        return true;
+    }
+
+    profiler::Block b(_desc, _runtimeName);
+    b.m_sampling = sampling;
+    b.start();
+    b.m_end = b.m_begin;
+    if (_flowId != nullptr)
+    {
+        b.m_flowId = *_flowId;
+        b.m_flags |= FLOW_ID_FLAG;
+    }
+
+    const auto budget = m_eventsBudget.load(std::memory_order_relaxed);
+    if (budget != 0)
+        governEvents(*THREAD_STORAGE, b, budget);
+
+    if (THREAD_STORAGE->bufferFrame)
+        THREAD_STORAGE->bufferBlock(b);
+    else
+        THREAD_STORAGE->storeBlock(b);
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void ProfileManager::storeBlockForce(const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName, ::profiler::timestamp_t& _timestamp)
+{
+    if (!(_desc->m_status & profiler::ON))
+        return;
+
+    if (THREAD_STORAGE == nullptr)
+    {
+        THREAD_STORAGE = threadStorage(getCurrentThreadId());
+        if (THREAD_STORAGE == nullptr)
+            return;
+    }
+
+#if EASY_ENABLE_BLOCK_STATUS != 0
+    if (!THREAD_STORAGE->allowChildren && !(_desc->m_status & FORCE_ON_FLAG))
+        return;
+#endif
+
+    profiler::Block b(_desc, _runtimeName);
+    b.start();
+    b.m_end = b.m_begin;
+
+    _timestamp = b.m_begin;
+    storeInternalEvent(b);
+}
+
+void ProfileManager::storeBlockForce2(const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName, ::profiler::timestamp_t _timestamp)
+{
+    if (!(_desc->m_status & profiler::ON))
+        return;
+
+    if (THREAD_STORAGE == nullptr)
+    {
+        THREAD_STORAGE = threadStorage(getCurrentThreadId());
+        if (THREAD_STORAGE == nullptr)
+            return;
+    }
+
+#if EASY_ENABLE_BLOCK_STATUS != 0
+    if (!THREAD_STORAGE->allowChildren && !(_desc->m_status & FORCE_ON_FLAG))
+        return;
+#endif
+
+    profiler::Block b(_desc, _runtimeName);
+    b.m_end = b.m_begin = _timestamp;
+
+    storeInternalEvent(b);
+}
+
+void ProfileManager::storeInternalEvent(const profiler::Block& _event)
+{
+    if (THREAD_STORAGE->bufferFrame)
+    {
+        // Event must not be stored before blocks of the frame which have been closed earlier.
+        // Internal events are always visible, so the frame containing them is not dropped by tail sampling.
+        THREAD_STORAGE->bufferBlock(_event);
+        THREAD_STORAGE->keepFrame = true;
+    }
+    else
+    {
+        THREAD_STORAGE->storeBlock(_event);
+    }
+}
+
+void ProfileManager::storeBlockForce2(ThreadStorage& _registeredThread, const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName, ::profiler::timestamp_t _timestamp)
+{
+    profiler::Block b(_desc, _runtimeName);
+    b.m_end = b.m_begin = _timestamp;
+    _registeredThread.storeBlock(b);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void ProfileManager::beginBlock(Block& _block)
+{
+    if (++THREAD_STACK_SIZE > 1)
+        return;
+
+    const auto state = m_profilerStatus.load(std::memory_order_acquire);
+    if (state == EASY_PROF_DISABLED)
+        return;
+
+    THREAD_STACK_SIZE = 0;
+    bool empty = true;
+    if (state == EASY_PROF_DUMP)
+    {
+        if (THREAD_STORAGE == nullptr || THREAD_STORAGE->blocks.openedList.empty())
+            return;
+        empty = false;
+    }
+    else if (THREAD_STORAGE == nullptr)
+    {
+        THREAD_STORAGE = threadStorage(getCurrentThreadId());
+        if (THREAD_STORAGE == nullptr)
+            return;
+    }
+    else
+    {
+        empty = THREAD_STORAGE->blocks.openedList.empty();
+    }
+
+    if (!governed(_block.m_id, _block.m_sampling))
+        _block.m_status = profiler::OFF;
+
+#if EASY_ENABLE_BLOCK_STATUS != 0
+    if (THREAD_STORAGE->allowChildren)
+    {
+#endif
+        if (_block.m_status & profiler::ON)
+        {
+            if (_block.m_sampling < 2 || THREAD_STORAGE->sampled(_block.m_id, _block.m_sampling))
+                _block.start();
+            else // Skipped invocation is not stored, but it's children are processed as usual
+                _block.m_status = static_cast<profiler::EasyBlockStatus>(_block.m_status & ~(profiler::ON | FORCE_ON_FLAG));
+        }
+#if EASY_ENABLE_BLOCK_STATUS != 0
+        THREAD_STORAGE->allowChildren = !(_block.m_status & profiler::OFF_RECURSIVE);
+    } 
+    else if (_block.m_status & FORCE_ON_FLAG)
+    {
+        if (_block.m_sampling < 2 || THREAD_STORAGE->sampled(_block.m_id, _block.m_sampling))
+        {
+            _block.start();
+            _block.m_status = profiler::FORCE_ON_WITHOUT_CHILDREN;
+        }
+        else
+        {
+            _block.m_status = profiler::OFF_RECURSIVE;
+        }
+    }
+    else
+    {
+        _block.m_status = profiler::OFF_RECURSIVE;
+    }
+#endif
+
+    if (_block.m_status & profiler::ON)
+    {
+        if ((_block.m_flags & profiler::BLOCK_FLAG_CPU_TIME) || (empty && m_frameCpuTime.load(std::memory_order_relaxed)))
+        {
+            _block.m_cpuTime = profiler::clock::thread_cpu_time();
+            _block.m_flags |= CPU_TIME_STARTED_FLAG;
+        }
+
+        if (_block.m_flags & profiler::BLOCK_FLAG_HARDWARE_COUNTERS)
+            THREAD_STORAGE->startCounters(_block);
+    }
+
+    if (empty)
+    {
+        // New frame: with tail sampling it's blocks are buffered until the frame ends
+        THREAD_STORAGE->frameBlocks.clear();
+        THREAD_STORAGE->keepFrame = false;
+        THREAD_STORAGE->bufferFrame = m_tailThreshold.load(std::memory_order_relaxed) != 0 || m_tailPercentile.load(std::memory_order_relaxed) != 0;
+        THREAD_STORAGE->frame.store(true, std::memory_order_release);
+    }
+    THREAD_STORAGE->blocks.openedList.emplace(_block);
+}
+
+void ProfileManager::beginContextSwitch(profiler::thread_id_t _thread_id, profiler::timestamp_t _time, profiler::thread_id_t _target_thread_id, const char* _target_process, bool _lockSpin)
+{
+    // Context switches are injected from event tracing thread (or from dump), so m_spin is
+    // used only to synchronize them with dump, registration of threads does not use it.
+    if (_lockSpin)
+        m_spin.lock();
+
+    auto ts = findThreadStorage(_thread_id);
+    if (ts != nullptr)
+        // Dirty hack: _target_thread_id will be written to the field "block_id_t m_id"
+        // and will be available calling method id().
+        ts->sync.openedList.emplace(_time, _target_thread_id, _target_process);
+
+    if (_lockSpin)
+        m_spin.unlock();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/** Finishes opened block of the current thread and stores it. Returns true if block has been stored. */
+bool ProfileManager::closeBlock(Block& _block)
+{
+    bool stored = false;
+    if (_block.m_status & profiler::ON)
+    {
+        if (!_block.finished())
+        {
+            if (_block.m_flags & COUNTERS_STARTED_FLAG)
+                THREAD_STORAGE->stopCounters(_block);
+            if (_block.m_flags & CPU_TIME_STARTED_FLAG)
+                _block.m_cpuTime = profiler::clock::thread_cpu_time() - _block.m_cpuTime;
+            _block.finish();
+        }
+
+        if (m_blockTriggersNumber.load(std::memory_order_relaxed) != 0)
+            checkBlockTriggers(_block);
+
+        if (m_captureMode.load(std::memory_order_relaxed) == profiler::CAPTURE_MODE_STATISTICS)
+        {
+            // Only durations distribution is gathered: memory does not depend on calls number
+            auto histogram = THREAD_STORAGE->histograms.get(_block.m_id);
+            if (histogram != nullptr)
+                histogram->add(_block.duration(), _block.m_sampling);
+        }
+        else
+        {
+            // Blocks shorter than per-descriptor or global threshold are folded into their parent (it's duration
+            // already includes them). Short block with stored children is kept: children must not lose their parent.
+            const auto minDuration = std::max(_block.m_minDuration, m_minBlockDuration.load(std::memory_order_relaxed));
+            stored = minDuration == 0 || (_block.m_flags & CHILDREN_STORED_FLAG) || _block.duration() >= m_cpuFrequency.ticks(minDuration);
+            if (stored)
+            {
+                const auto budget = m_eventsBudget.load(std::memory_order_relaxed);
+                if (budget != 0)
+                    governEvents(*THREAD_STORAGE, _block, budget);
+
+                if (THREAD_STORAGE->bufferFrame)
+                    THREAD_STORAGE->bufferBlock(_block);
+                else
+                    THREAD_STORAGE->storeBlock(_block);
+            }
+        }
+    }
+    else
+    {
+        _block.m_end = _block.m_begin; // this is to restrict endBlock() call inside ~Block()
+    }
+
+    return stored;
+}
+
+void ProfileManager::endBlock()
+{
+    if (--THREAD_STACK_SIZE > 0 || m_profilerStatus.load(std::memory_order_acquire) == EASY_PROF_DISABLED)
+        return;
+
+    THREAD_STACK_SIZE = 0;
+    if (THREAD_STORAGE == nullptr || THREAD_STORAGE->blocks.openedList.empty())
+        return;
+
+    Block& lastBlock = THREAD_STORAGE->blocks.openedList.top();
+    const bool stored = closeBlock(lastBlock);
+
+    THREAD_STORAGE->blocks.openedList.pop();
+    const bool empty = THREAD_STORAGE->blocks.openedList.empty();
+    if (empty)
+    {
+        if (THREAD_STORAGE->bufferFrame)
+            finishFrame(*THREAD_STORAGE, lastBlock);
+        THREAD_STORAGE->frame.store(false, std::memory_order_release);
+    }
+    else if (stored)
+    {
+        THREAD_STORAGE->blocks.openedList.top().get().m_flags |= CHILDREN_STORED_FLAG;
+    }
+
+#if EASY_ENABLE_BLOCK_STATUS != 0
+    THREAD_STORAGE->allowChildren = empty || !(THREAD_STORAGE->blocks.openedList.top().get().m_status & profiler::OFF_RECURSIVE);
+#endif
+}
+
+const profiler::BaseBlockDescriptor* ProfileManager::addLockDescriptor(const char* _autogenUniqueId, const char* _name, int _line, profiler::color_t _color, uint8_t _flag)
+{
+    auto desc = addBlockDescriptor(profiler::ON, _autogenUniqueId, _name, __FILE__, _line, profiler::BLOCK_TYPE_BLOCK, _color);
+
+    guard_lock_t lock(m_storedSpin);
+    m_descriptors[desc->id()]->m_flags |= _flag;
+
+    return desc;
+}
+
+const profiler::BaseBlockDescriptor* ProfileManager::lockDescriptor(profiler::LockBlock _type)
+{
+    // Descriptors are registered on first use, so there are no lock descriptors in profiles of applications without locks
+    switch (_type)
+    {
+        case profiler::LOCK_BLOCK_WAIT:
+        {
+            EASY_LOCAL_STATIC_PTR(const profiler::BaseBlockDescriptor*, desc, addLockDescriptor(EASY_UNIQUE_LINE_ID, "Lock wait", __LINE__,
+                profiler::colors::Red, profiler::BLOCK_FLAG_LOCK_WAIT));
+            return desc;
+        }
+
+        case profiler::LOCK_BLOCK_HOLD:
+        {
+            EASY_LOCAL_STATIC_PTR(const profiler::BaseBlockDescriptor*, desc, addLockDescriptor(EASY_UNIQUE_LINE_ID, "Lock hold", __LINE__,
+                profiler::colors::Amber, profiler::BLOCK_FLAG_LOCK_HOLD));
+            return desc;
+        }
+
+        case profiler::LOCK_BLOCK_SHARED_WAIT:
+        {
+            EASY_LOCAL_STATIC_PTR(const profiler::BaseBlockDescriptor*, desc, addLockDescriptor(EASY_UNIQUE_LINE_ID, "Shared lock wait", __LINE__,
+                profiler::colors::DeepOrange, profiler::BLOCK_FLAG_LOCK_WAIT));
+            return desc;
+        }
+
+        default:
+        {
+            EASY_LOCAL_STATIC_PTR(const profiler::BaseBlockDescriptor*, desc, addLockDescriptor(EASY_UNIQUE_LINE_ID, "Shared lock hold", __LINE__,
+                profiler::colors::Yellow, profiler::BLOCK_FLAG_LOCK_HOLD));
+            return desc;
+        }
+    }
+}
+
+void ProfileManager::beginLockBlock(profiler::LockBlock _type, const void* _lock)
+{
+    const auto state = m_profilerStatus.load(std::memory_order_acquire);
+    if (THREAD_STORAGE == nullptr)
+    {
+        // Thread is not registered only if it has never been profiled: the block is not counted at all
+        // and endLockBlock() will find no opened lock blocks for this thread.
+        if (state != EASY_PROF_ENABLED)
+            return;
+
+        THREAD_STORAGE = threadStorage(getCurrentThreadId());
+        if (THREAD_STORAGE == nullptr)
+            return;
+    }
+
+    // Lock block is begun and ended in different functions of the lock, so it is kept by thread storage.
+    // It is not pushed into blocks.openedList: lock can be released while blocks begun after it's acquisition
+    // are still opened (unique_lock::unlock(), condition_variable_any::wait() or locks released not in reverse order).
+    // Reader makes stored blocks which are nested into lock block it's children, the others just overlap it.
+    THREAD_STORAGE->lockBlocks.emplace_back(lockDescriptor(_type), "");
+    auto& block = THREAD_STORAGE->lockBlocks.back();
+    block.m_lockId = reinterpret_cast<uintptr_t>(_lock);
+
+    bool started = state == EASY_PROF_ENABLED || (state == EASY_PROF_DUMP && !THREAD_STORAGE->blocks.openedList.empty());
+#if EASY_ENABLE_BLOCK_STATUS != 0
+    started = started && (THREAD_STORAGE->allowChildren || (block.m_status & FORCE_ON_FLAG));
+#endif
+    started = started && (block.m_status & profiler::ON) && governed(block.m_id, block.m_sampling) &&
+        (block.m_sampling < 2 || THREAD_STORAGE->sampled(block.m_id, block.m_sampling));
+
+    if (!started)
+    {
+        block.m_status = profiler::OFF;
+        return;
+    }
+
+    block.start();
+
+    if (block.m_flags & profiler::BLOCK_FLAG_CPU_TIME)
+    {
+        block.m_cpuTime = profiler::clock::thread_cpu_time();
+        block.m_flags |= CPU_TIME_STARTED_FLAG;
+    }
+
+    if (block.m_flags & profiler::BLOCK_FLAG_HARDWARE_COUNTERS)
+        THREAD_STORAGE->startCounters(block);
+}
+
+void ProfileManager::endLockBlock(const void* _lock)
+{
+    if (THREAD_STORAGE == nullptr || THREAD_STORAGE->lockBlocks.empty())
+        return;
+
+    // Block of the last acquisition of the lock (recursive lock can be acquired several times)
+    const auto lockId = reinterpret_cast<uintptr_t>(_lock);
+    auto& lockBlocks = THREAD_STORAGE->lockBlocks;
+    auto it = lockBlocks.end();
+    do {
+        if (it == lockBlocks.begin())
+            return; // Lock has been acquired before thread registration
+    } while ((--it)->m_lockId != lockId);
+
+    auto& block = *it;
+    if (m_profilerStatus.load(std::memory_order_acquire) != EASY_PROF_DISABLED)
+    {
+        // Opened block (if any) is either a parent of the lock block or overlaps it: in both cases it must be kept
+        auto& openedList = THREAD_STORAGE->blocks.openedList;
+        if (closeBlock(block) && !openedList.empty())
+            openedList.top().get().m_flags |= CHILDREN_STORED_FLAG;
+    }
+
+    // Block must be marked as finished because closeBlock() is not called if profiler is disabled
+    if (!block.finished())
+        block.m_end = block.m_begin;
+    lockBlocks.erase(it);
+}
+
+void ProfileManager::endContextSwitch(profiler::thread_id_t _thread_id, processid_t _process_id, profiler::timestamp_t _endtime, bool _lockSpin)
+{
+    if (_lockSpin)
+        m_spin.lock();
+
+    ThreadStorage* ts = nullptr;
+    if (_process_id == m_processId)
+        // If thread owned by current process then create new ThreadStorage if there is no one
+        ts = threadStorage(_thread_id);
+    else
+        // If thread owned by another process OR _process_id IS UNKNOWN then do not create ThreadStorage for this
+        ts = findThreadStorage(_thread_id);
+
+    if (ts != nullptr && !ts->sync.openedList.empty())
+    {
+        Block& lastBlock = ts->sync.openedList.top();
+        lastBlock.finish(_endtime);
+
+        ts->storeCSwitch(lastBlock);
+        ts->sync.openedList.pop();
+    }
+
+    if (_lockSpin)
+        m_spin.unlock();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void ProfileManager::enableEventTracer()
+{
+#if defined(_WIN32) || defined(__linux__)
+    if (m_isEventTracingEnabled.load(std::memory_order_acquire))
+        EasyEventTracer::instance().enable(true);
+#endif
+}
+
+void ProfileManager::disableEventTracer()
+{
+#if defined(_WIN32) || defined(__linux__)
+    EasyEventTracer::instance().disable();
+#endif
+}
+
+void ProfileManager::setEnabled(bool isEnable)
+{
+    guard_lock_t lock(m_dumpSpin);
+
+    if (isEnable)
+        selectClockSourceOnce();
+
+    auto time = getCurrentTime();
+    const auto status = isEnable ? EASY_PROF_ENABLED : EASY_PROF_DISABLED;
+    const auto prev = m_profilerStatus.exchange(status, std::memory_order_release);
+    if (prev == status)
+        return;
+
+    if (isEnable)
+    {
+        EASY_LOGMSG("Enabled profiling\n");
+        enableEventTracer();
+        m_beginTime = time;
+        resetHistograms();
+        m_governor.reset();
+    }
+    else
+    {
+        EASY_LOGMSG("Disabled profiling\n");
+        disableEventTracer();
+        m_endTime = time;
+    }
+}
+
+void ProfileManager::setEventTracingEnabled(bool _isEnable)
+{
+    m_isEventTracingEnabled.store(_isEnable, std::memory_order_release);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void ProfileManager::releaseThread(uint32_t _slot)
+{
+    // Keep statistics of finished thread (m_spin is locked by caller)
+    auto ts = m_threads.at(_slot);
+    if (ts != nullptr)
+    {
+        ts->histograms.forEach([this](profiler::block_id_t _id, const profiler::duration_histogram& _histogram) {
+            auto retired = m_retiredHistograms.get(_id);
+            if (retired != nullptr)
+                retired->merge(_histogram);
+        });
+    }
+
+    m_threads.release(_slot);
+}
+
+void ProfileManager::finishFrame(ThreadStorage& _registeredThread, const profiler::Block& _frame)
+{
+    const uint32_t WARMUP_FRAMES = 100; ///< All frames are kept until running percentile becomes meaningful
+    const uint32_t PERCENTILE_UPDATE_PERIOD = 64; ///< Number of frames between running percentile updates
+
+    _registeredThread.bufferFrame = false;
+
+    // Frame duration is known only if the top-level block is stored
+    bool keep = !(_frame.m_status & profiler::ON) || _registeredThread.keepFrame;
+    const auto duration = _frame.duration();
+
+    const auto threshold = m_tailThreshold.load(std::memory_order_relaxed);
+    if (threshold != 0 && duration >= m_cpuFrequency.ticks(threshold))
+        keep = true;
+
+    const auto percentile = m_tailPercentile.load(std::memory_order_relaxed);
+    if (percentile != 0 && (_frame.m_status & profiler::ON))
+    {
+        if (_registeredThread.frameDurations == nullptr)
+            _registeredThread.frameDurations.reset(new profiler::duration_histogram());
+
+        if (_registeredThread.framesNumber < WARMUP_FRAMES || duration >= _registeredThread.frameThreshold)
+            keep = true;
+
+        _registeredThread.frameDurations->add(duration);
+        if (++_registeredThread.framesNumber % PERCENTILE_UPDATE_PERIOD == 0)
+            _registeredThread.frameThreshold = _registeredThread.frameDurations->percentile(percentile * 1e-6);
+    }
+
+    if (keep)
+        _registeredThread.commitFrame();
+    else
+        _registeredThread.frameBlocks.clear();
+}
+
+void ProfileManager::setTailSamplingPercentile(double _percentile)
+{
+    const auto ppm = _percentile > 0 && _percentile < 1 ? static_cast<uint32_t>(_percentile * 1e6 + 0.5) : 0U;
+    m_tailPercentile.store(ppm, std::memory_order_release);
+}
+
+double ProfileManager::tailSamplingPercentile() const
+{
+    return m_tailPercentile.load(std::memory_order_relaxed) * 1e-6;
+}
+
+void ProfileManager::governEvents(ThreadStorage& _registeredThread, const profiler::Block& _block, uint32_t _budget)
+{
+    const uint32_t WINDOW_NS = 1000000000U; ///< Events rate is measured per second
+
+    auto& counters = _registeredThread.eventsCounters;
+    if (_block.m_end >= _registeredThread.eventsWindowEnd)
+    {
+        const auto window = m_cpuFrequency.ticks(WINDOW_NS);
+        if (window == 0)
+            return; // Frequency is not calibrated yet
+
+        counters.next();
+        _registeredThread.eventsWindowBegin = _block.m_end;
+        _registeredThread.eventsWindowEnd = _block.m_end + window;
+    }
+
+    if (counters.increment(_block.m_id) < _budget)
+        return;
+
+    // Budget is exhausted before the end of window: reduce events rate at least twice,
+    // estimating it on the elapsed part of the window
+    counters.reset(_block.m_id);
+    const auto window = _registeredThread.eventsWindowEnd - _registeredThread.eventsWindowBegin;
+    const auto elapsed = _block.m_end - _registeredThread.eventsWindowBegin + 1;
+    const auto factor = static_cast<uint32_t>(std::min<profiler::timestamp_t>((window + elapsed - 1) / elapsed, 0xffff));
+    throttleDescriptor(_block.m_id, std::max(factor, 2U));
+}
+
+void ProfileManager::throttleDescriptor(profiler::block_id_t _id, uint32_t _factor)
+{
+    // Called from endBlock(): no locks are taken, descriptor itself is not changed (see GovernorTable)
+    const auto desc = m_governor.descriptor(_id);
+    if (desc == nullptr)
+        return;
+
+    char name[128];
+    uint16_t factor = m_governor.factor(_id);
+    uint16_t throttled = 0;
+    uint32_t sampling = 0;
+    do {
+        if (factor == GovernorTable::THROTTLED_OFF)
+            return; // Already turned OFF by another thread
+
+        // Too rare sampling is useless: turn the block OFF
+        const uint32_t total = std::max<uint32_t>(factor, 1) * _factor;
+        sampling = desc->sampling() * total;
+        throttled = sampling >= GovernorTable::THROTTLED_OFF ? static_cast<uint16_t>(GovernorTable::THROTTLED_OFF) : static_cast<uint16_t>(total);
+    } while (!m_governor.replace(_id, factor, throttled));
+
+    if (throttled == GovernorTable::THROTTLED_OFF)
+        snprintf(name, sizeof(name), "Throttled %s: OFF", desc->name());
+    else
+        snprintf(name, sizeof(name), "Throttled %s: 1/%u", desc->name(), sampling);
+
+    EASY_LOGMSG(name << "\n");
+
+    profiler::timestamp_t time = 0;
+    EASY_FORCE_EVENT(time, name, EASY_COLOR_INTERNAL_EVENT, profiler::FORCE_ON);
+    (void)time;
+}
+
+void ProfileManager::reserveSamplingCounters(profiler::block_id_t _id)
+{
+    // m_spin prevents releasing threads, recording threads are not blocked
+    guard_lock_t lock(m_spin);
+    for (uint32_t i = 0, n = m_threads.size(); i < n; ++i)
+    {
+        auto ts = m_threads.at(i);
+        if (ts != nullptr)
+            ts->samplingCounters.reserve(_id);
+    }
+}
+
+void ProfileManager::resetHistograms()
+{
+    guard_lock_t lock(m_spin);
+
+    m_retiredHistograms.reset();
+    for (uint32_t i = 0, n = m_threads.size(); i < n; ++i)
+    {
+        auto ts = m_threads.at(i);
+        if (ts != nullptr)
+            ts->histograms.reset();
+    }
+}
+
+bool ProfileManager::aggregatedStatistics(profiler::block_id_t _id, profiler::AggregatedStatistics& _stats)
+{
+    std::vector<uint64_t> counts(profiler::duration_histogram::BUCKETS, 0);
+    uint64_t calls = 0, total = 0;
+    profiler::timestamp_t minDuration = ~0ULL, maxDuration = 0;
+
+    {
+        // m_spin prevents releasing threads, recording threads are not blocked
+        guard_lock_t lock(m_spin);
+
+        auto retired = m_retiredHistograms.find(_id);
+        if (retired != nullptr)
+            retired->collect(counts.data(), calls, total, minDuration, maxDuration);
+
+        for (uint32_t i = 0, n = m_threads.size(); i < n; ++i)
+        {
+            auto ts = m_threads.at(i);
+            if (ts == nullptr)
+                continue;
+
+            auto histogram = ts->histograms.find(_id);
+            if (histogram != nullptr)
+                histogram->collect(counts.data(), calls, total, minDuration, maxDuration);
+        }
+    }
+
+    if (calls == 0)
+        return false;
+
+    typedef profiler::duration_histogram histogram_t;
+    const auto frequency = m_cpuFrequency.get();
+    const auto toNs = [frequency](profiler::timestamp_t _ticks) -> profiler::timestamp_t {
+        return frequency == 0 ? _ticks : static_cast<profiler::timestamp_t>(static_cast<double>(_ticks) * 1e9 / static_cast<double>(frequency));
+    };
+
+    _stats.calls_number = calls;
+    _stats.total_duration = toNs(total);
+    _stats.min_duration = toNs(minDuration);
+    _stats.max_duration = toNs(maxDuration);
+    _stats.p50 = toNs(histogram_t::percentile(counts.data(), calls, minDuration, maxDuration, 0.5));
+    _stats.p90 = toNs(histogram_t::percentile(counts.data(), calls, minDuration, maxDuration, 0.9));
+    _stats.p99 = toNs(histogram_t::percentile(counts.data(), calls, minDuration, maxDuration, 0.99));
+    _stats.p999 = toNs(histogram_t::percentile(counts.data(), calls, minDuration, maxDuration, 0.999));
+
+    return true;
+}
+
+char ProfileManager::checkThreadExpired(ThreadStorage& _registeredThread)
+{
+    const char val = _registeredThread.expired.load(std::memory_order_acquire);
+    if (val != 0)
+        return val;
+
+    if (_registeredThread.guarded)
+        return 0;
+
+#ifdef _WIN32
+
+    // Check thread for Windows
+
+    DWORD exitCode = 0;
+    auto hThread = OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, _registeredThread.id);
+    if (hThread == nullptr || GetExitCodeThread(hThread, &exitCode) == FALSE || exitCode != STILL_ACTIVE)
+    {
+        // Thread has been expired
+        _registeredThread.expired.store(1, std::memory_order_release);
+        if (hThread != nullptr)
+            CloseHandle(hThread);
+        return 1;
+    }
+
+    if (hThread != nullptr)
+        CloseHandle(hThread);
+
+    return 0;
+
+#else
+
+    return 0;//pthread_kill(_registeredThread.pthread_id, 0) != 0;
+
+#endif
+
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/** Position and time range of the part of the thread data written by writeThread().
+
+Table of sections is written at the end of .prof file (since v1.1.0), it lets reader to parse threads concurrently.
+*/
+struct ThreadSection
+{
+    profiler::timestamp_t beginTime; ///< Minimum begin time of blocks and context switches
+    profiler::timestamp_t   endTime; ///< Maximum end time of blocks and context switches
+    uint64_t                 offset; ///< Position of the thread data relative to the header begin
+    uint64_t             memorySize; ///< Summary size of decoded blocks and context switches
+    uint32_t             syncNumber; ///< Number of context switches
+    uint32_t           blocksNumber; ///< Number of blocks
+    profiler::thread_id_t        id;
+};
+
+/** Summary size of decoded records of one thread section (thread data is split into several sections, see writeThread). */
+const uint64_t THREAD_SECTION_MEMORY_SIZE = 256 * 1024;
+
+struct ProfileManager::Snapshot
+{
+    struct Thread
+    {
+        std::string                     name;
+        std::unique_ptr<closed_list_t>  sync;
+        std::unique_ptr<closed_list_t> blocks;
+        profiler::thread_id_t              id;
+    };
+
+    std::vector<Thread>               threads;
+    std::vector<ThreadSection>       sections;
+    block_descriptors_t           descriptors;
+    RuntimeNamesTable::names_t   runtimeNames;
+    std::unique_ptr<std::ofstream> outputFile;
+    profiler::timestamp_t           beginTime;
+    profiler::timestamp_t             endTime;
+    uint64_t               descriptorsMemory;
+    uint64_t              runtimeNamesMemory;
+    uint64_t                  usedMemorySize;
+    uint32_t                    blocksNumber;
+
+    Snapshot() : beginTime(0), endTime(0), descriptorsMemory(0), runtimeNamesMemory(0), usedMemorySize(0), blocksNumber(0) {}
+};
+
+struct ProfileManager::StreamFile
+{
+    typedef ::std::basic_iostream<std::stringstream::char_type, std::stringstream::traits_type> stringstream_parent;
+
+    std::ofstream          file;
+    profiler::OStream    stream;
+    std::streambuf*      oldbuf;
+    std::vector<ThreadSection> sections;
+    uint64_t     usedMemorySize;
+    uint32_t       blocksNumber;
+
+    StreamFile(const char* _filename)
+        : file(_filename, std::fstream::binary), oldbuf(nullptr), usedMemorySize(0), blocksNumber(0)
+    {
+        // Replace stream buffer to file buffer to avoid redundant copying
+        if (file.is_open())
+            oldbuf = static_cast<stringstream_parent&>(stream.stream()).rdbuf(file.rdbuf());
+    }
+
+    ~StreamFile()
+    {
+        // Restore old stream buffer to avoid possible second memory free on stringstream destructor
+        if (oldbuf != nullptr)
+            static_cast<stringstream_parent&>(stream.stream()).rdbuf(oldbuf);
+    }
+};
+
+struct ProfileManager::TriggerCapture
+{
+    std::string filenamePrefix;
+    Snapshot          previous; ///< Blocks detached during the previous window (with the current window they cover at least beforeMs)
+    std::thread         thread;
+    uint32_t          beforeMs;
+    uint32_t           afterMs;
+    uint32_t       filesNumber;
+    uint32_t      filesWritten;
+
+    TriggerCapture(const char* _filenamePrefix, uint32_t _beforeMs, uint32_t _afterMs, uint32_t _filesNumber)
+        : filenamePrefix(_filenamePrefix), beforeMs(_beforeMs), afterMs(_afterMs)
+        , filesNumber(std::max(_filesNumber, 1U)), filesWritten(0)
+    {
+    }
+};
+
+/** Returns minimum begin time and maximum end time of records (closed list or range of its chunks). */
+template <class TRecords>
+static void recordsTimeRange(const TRecords& _records, profiler::timestamp_t& _beginTime, profiler::timestamp_t& _endTime)
+{
+    profiler::timestamp_t lastBegin = 0;
+    _records.for_each([&](const char* _record, uint16_t _size)
+    {
+        profiler::compact::header header;
+        if (profiler::compact::decode_header(_record, _size, lastBegin, header) == 0)
+            return;
+
+        if (header.begin < _beginTime)
+            _beginTime = header.begin;
+        if (header.end > _endTime)
+            _endTime = header.end;
+    });
+}
+
+static void writeSection(profiler::OStream& _outputStream, std::streamoff _headerPosition, std::vector<ThreadSection>& _sections,
+                         profiler::thread_id_t _id, const std::string& _name, const closed_list_t::chunks_range* _sync,
+                         const closed_list_t::chunks_range* _blocks)
+{
+    ThreadSection section;
+    section.beginTime = ~0ULL;
+    section.endTime = 0;
+    section.offset = static_cast<uint64_t>(static_cast<std::streamoff>(_outputStream.stream().tellp()) - _headerPosition);
+    section.memorySize = 0;
+    section.syncNumber = 0;
+    section.blocksNumber = 0;
+    section.id = _id;
+
+    if (_sync != nullptr)
+    {
+        section.memorySize += _sync->usedMemorySize();
+        section.syncNumber = _sync->size();
+        recordsTimeRange(*_sync, section.beginTime, section.endTime);
+    }
+
+    if (_blocks != nullptr)
+    {
+        section.memorySize += _blocks->usedMemorySize();
+        section.blocksNumber = _blocks->size();
+        recordsTimeRange(*_blocks, section.beginTime, section.endTime);
+    }
+
+    if (section.beginTime > section.endTime)
+        section.beginTime = section.endTime;
+    _sections.push_back(section);
+
+    _outputStream.write(_id);
+
+    const auto name_size = static_cast<uint16_t>(_name.size() + 1);
+    _outputStream.write(name_size);
+    _outputStream.write(name_size > 1 ? _name.c_str() : "", name_size);
+
+    _outputStream.write(section.syncNumber);
+    if (_sync != nullptr)
+        _sync->serialize(_outputStream);
+
+    _outputStream.write(section.blocksNumber);
+    if (_blocks != nullptr)
+        _blocks->serialize(_outputStream);
+}
+
+/** Writes thread data as several sections with their own time ranges.
+
+Context switches and blocks are split into sections of about THREAD_SECTION_MEMORY_SIZE bytes of decoded records,
+so reader can decode only sections which overlap requested time window (see loadRange).
+
+\warning Data will be cleared after writing.
+*/
+static void writeThread(profiler::OStream& _outputStream, std::streamoff _headerPosition, std::vector<ThreadSection>& _sections,
+                        profiler::thread_id_t _id, const std::string& _name, closed_list_t& _sync, closed_list_t& _blocks)
+{
+    const auto sectionsNumber = _sections.size();
+
+    _sync.for_each_range(THREAD_SECTION_MEMORY_SIZE, [&](const closed_list_t::chunks_range& _range)
+    {
+        writeSection(_outputStream, _headerPosition, _sections, _id, _name, &_range, nullptr);
+    });
+
+    _blocks.for_each_range(THREAD_SECTION_MEMORY_SIZE, [&](const closed_list_t::chunks_range& _range)
+    {
+        writeSection(_outputStream, _headerPosition, _sections, _id, _name, nullptr, &_range);
+    });
+
+    // Thread with no profiled information is written too (to keep its name)
+    if (_sections.size() == sectionsNumber)
+        writeSection(_outputStream, _headerPosition, _sections, _id, _name, nullptr, nullptr);
+
+    _sync.clear();
+    _blocks.clear();
+}
+
+static void writeSections(profiler::OStream& _outputStream, const std::vector<ThreadSection>& _sections)
+{
+    for (const auto& section : _sections)
+    {
+        _outputStream.write(section.id);
+        _outputStream.write(section.offset);
+        _outputStream.write(section.memorySize);
+        _outputStream.write(section.syncNumber);
+        _outputStream.write(section.blocksNumber);
+        _outputStream.write(section.beginTime);
+        _outputStream.write(section.endTime);
+    }
+}
+
+static void writeDescriptors(profiler::OStream& _outputStream, const std::vector<BlockDescriptor*>& _descriptors,
+                             const RuntimeNamesTable::names_t& _runtimeNames)
+{
+    for (const auto descriptor : _descriptors)
+    {
+        const auto name_size = descriptor->nameSize();
+        const auto filename_size = descriptor->filenameSize();
+        const auto size = static_cast<uint16_t>(sizeof(profiler::SerializedBlockDescriptor) + name_size + filename_size);
+
+        _outputStream.write(size);
+        _outputStream.write<profiler::BaseBlockDescriptor>(*descriptor);
+        _outputStream.write(name_size);
+        _outputStream.write(descriptor->name(), name_size);
+        _outputStream.write(descriptor->filename(), filename_size);
+    }
+
+    // Runtime names table (name id - 1 -> name)
+    for (const auto name : _runtimeNames)
+    {
+        const auto name_size = static_cast<uint16_t>(name->size() + 1);
+        _outputStream.write(name_size);
+        _outputStream.write(name->c_str(), name_size);
+    }
+}
+
+// Size of the header written by ProfileManager::writeHeader()
+const std::streamoff HEADER_SIZE = sizeof(uint32_t) * 2 + sizeof(processid_t) + sizeof(int64_t) + sizeof(profiler::timestamp_t) * 2
+                                 + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t) * 2
+                                 + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint8_t)
+                                 + sizeof(uint32_t) + sizeof(uint64_t);
+
+void ProfileManager::writeHeader(profiler::OStream& _outputStream, const Snapshot& _info, uint64_t _descriptorsOffset, uint64_t _sectionsOffset) const
+{
+    // Write profiler signature and version
+    _outputStream.write(PROFILER_SIGNATURE);
+    _outputStream.write(EASY_CURRENT_VERSION);
+    _outputStream.write(m_processId);
+
+    // Write CPU frequency to let GUI calculate real time value from CPU clocks
+    // (it is calibrated in background at startup, see profiler::cpu_frequency)
+    const int64_t cpu_frequency = m_cpuFrequency.get();
+    _outputStream.write(cpu_frequency);
+
+    // Write begin and end time
+    _outputStream.write(_info.beginTime);
+    _outputStream.write(_info.endTime);
+
+    // Write blocks number and used memory size
+    _outputStream.write(_info.blocksNumber);
+    _outputStream.write(_info.usedMemorySize);
+    _outputStream.write(static_cast<uint32_t>(_info.descriptors.size()));
+    _outputStream.write(_info.descriptorsMemory);
+
+    // Write position of block descriptors relative to the header begin
+    // (0 means that descriptors are written right after the header)
+    _outputStream.write(_descriptorsOffset);
+
+    // Write runtime names number and memory size (names table follows block descriptors)
+    _outputStream.write(static_cast<uint32_t>(_info.runtimeNames.size()));
+    _outputStream.write(_info.runtimeNamesMemory);
+
+    // Write clock source used for timestamps (see profiler::ClockSource)
+    _outputStream.write(static_cast<uint8_t>(profiler::clock::current_source::get()));
+
+    // Write threads sections table number and position relative to the header begin (see ThreadSection)
+    _outputStream.write(static_cast<uint32_t>(_info.sections.size()));
+    _outputStream.write(_sectionsOffset);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef _WIN32
+void ProfileManager::readContextSwitchLog()
+{
+    // Read thread context switch events from temporary file
+
+    EASY_LOGMSG("Writing context switch events...\n");
+    EASY_LOG_ONLY(uint32_t num = 0);
+
+    const int fd = open(m_csInfoFilename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        EASY_ERROR("Can not open context switch log-file \"" << m_csInfoFilename << "\"\n");
+        return;
+    }
+
+    struct stat info;
+    const size_t size = fstat(fd, &info) == 0 ? static_cast<size_t>(info.st_size) : 0;
+    auto data = size >= sizeof(profiler::CSwitchLogHeader) ? static_cast<const char*>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)) : nullptr;
+    close(fd);
+
+    if (data == MAP_FAILED)
+        data = nullptr;
+
+#ifdef __linux__
+    // Context switches of threads traced by perf events have been already gathered
+    const auto& tracer = EasyEventTracer::instance();
+    auto traced = [&tracer](profiler::thread_id_t _id) { return tracer.traced(static_cast<pid_t>(_id)); };
+#else
+    auto traced = [](profiler::thread_id_t) { return false; };
+#endif
+
+    auto header = reinterpret_cast<const profiler::CSwitchLogHeader*>(data);
+    if (header != nullptr && header->signature == profiler::CSWITCH_LOG_SIGNATURE && header->version == profiler::CSWITCH_LOG_VERSION)
+    {
+        // Binary log: single pass over mapped records, names are referenced right in the mapped memory
+        std::vector<const char*> names;
+        for (size_t offset = sizeof(profiler::CSwitchLogHeader); offset + sizeof(profiler::CSwitchRecord) <= size;)
+        {
+            profiler::CSwitchRecord record;
+            memcpy(&record, data + offset, sizeof(record));
+            offset += sizeof(record);
+
+            if (record.timestamp == profiler::CSWITCH_LOG_NAME_RECORD)
+            {
+                const size_t length = record.thread_to;
+                if (length == 0 || offset + length > size || data[offset + length - 1] != 0)
+                    break; // Log is truncated
+
+                if (record.thread_from >= names.size())
+                    names.resize(record.thread_from + 1, "");
+                names[record.thread_from] = data + offset;
+                offset += (length + 7) & ~static_cast<size_t>(7);
+                continue;
+            }
+
+            const char* name = record.name_id < names.size() ? names[record.name_id] : "";
+            if (!traced(record.thread_from))
+                beginContextSwitch(record.thread_from, record.timestamp, record.thread_to, name, false);
+            if (!traced(record.thread_to))
+                endContextSwitch(record.thread_to, record.process_to, record.timestamp, false);
+            EASY_LOG_ONLY(++num);
+        }
+    }
+    else
+    {
+        // Legacy text log: "timestamp thread_from thread_to next_task_name process_to" per line
+        uint64_t timestamp = 0;
+        uint32_t thread_from = 0, thread_to = 0;
+
+        // Opened context switch keeps pointer to the name until it is closed, so names must not be overwritten
+        std::unordered_set<std::string> names;
+
+        std::ifstream infile(m_csInfoFilename.c_str());
+        std::string next_task_name;
+        pid_t process_to = 0;
+        while (infile >> timestamp >> thread_from >> thread_to >> next_task_name >> process_to)
+        {
+            const auto& name = *names.insert(next_task_name).first;
+            if (!traced(thread_from))
+                beginContextSwitch(thread_from, timestamp, thread_to, name.c_str(), false);
+            if (!traced(thread_to))
+                endContextSwitch(thread_to, (processid_t)process_to, timestamp, false);
+            EASY_LOG_ONLY(++num);
+        }
+    }
+
+    if (data != nullptr)
+        munmap(const_cast<char*>(data), size);
+
+    EASY_LOGMSG("Done, " << num << " context switch events wrote\n");
+}
+#endif
+
+uint32_t ProfileManager::dumpBlocksToStream(profiler::OStream& _outputStream, bool _lockSpin, const StreamFile* _streamFile)
+{
+    EASY_LOGMSG("dumpBlocksToStream(_lockSpin = " << _lockSpin << ")...\n");
+
+    if (_lockSpin)
         m_dumpSpin.lock();
 
+    if (m_triggerCaptureOn || (m_streamOn && _streamFile == nullptr))
+    {
+        // Blocks are owned by triggered capture (see watchTriggers) or by the stream file (see flushStream)
+        EASY_ERROR("Blocks can not be dumped while " << (m_triggerCaptureOn ? "triggered capture is started\n" : "blocks are being streamed into file\n"));
+        if (_lockSpin)
+            m_dumpSpin.unlock();
+        return 0;
+    }
+
     const auto state = m_profilerStatus.load(std::memory_order_acquire);
 
 #ifndef _WIN32
@@ -901,11 +2522,12 @@ uint32_t ProfileManager::dumpBlocksToStream(profiler::OStream& _outputStream, bo
 
     // wait for all threads finish opened frames
     EASY_LOG_ONLY(bool logged = false);
-    for (auto it = m_threads.begin(), end = m_threads.end(); it != end;)
+    for (uint32_t i = 0, n = m_threads.size(); i < n;)
     {
-        if (!it->second.frame.load(std::memory_order_acquire))
+        auto t = m_threads.at(i);
+        if (t == nullptr || !t->frame.load(std::memory_order_acquire))
         {
-            ++it;
+            ++i;
             EASY_LOG_ONLY(logged = false);
         }
         else
@@ -914,10 +2536,10 @@ uint32_t ProfileManager::dumpBlocksToStream(profiler::OStream& _outputStream, bo
                 if (!logged)
                 {
                     logged = true;
-                    if (it->second.named)
-                        EASY_WARNING("Waiting for thread \"" << it->second.name << "\" finish opened frame (which is top EASY_BLOCK for this thread)...\n");
+                    if (t->named)
+                        EASY_WARNING("Waiting for thread \"" << t->name << "\" finish opened frame (which is top EASY_BLOCK for this thread)...\n");
                     else
-                        EASY_WARNING("Waiting for thread " << it->first << " finish opened frame (which is top EASY_BLOCK for this thread)...\n");
+                        EASY_WARNING("Waiting for thread " << t->id << " finish opened frame (which is top EASY_BLOCK for this thread)...\n");
                 }
             );
 
@@ -938,203 +2560,633 @@ uint32_t ProfileManager::dumpBlocksToStream(profiler::OStream& _outputStream, bo
     const profiler::timestamp_t endtime = m_endTime == 0 ? now : std::min(now, m_endTime);
 
 #ifndef _WIN32
+# ifdef __linux__
+    // Context switches have been already gathered via perf events if kernel allowed it for all threads
+    if (eventTracingEnabled && !EasyEventTracer::instance().complete())
+# else
     if (eventTracingEnabled)
+# endif
+        readContextSwitchLog();
+#endif
+
+    // Calculate used memory total size and total blocks number
+    uint64_t usedMemorySize = 0;
+    uint32_t blocks_number = 0;
+    const uint32_t threads_number = m_threads.size();
+    for (uint32_t i = 0; i < threads_number; ++i)
     {
-        // Read thread context switch events from temporary file
+        auto ts = m_threads.at(i);
+        if (ts == nullptr)
+            continue;
 
-        EASY_LOGMSG("Writing context switch events...\n");
+        auto& t = *ts;
+        uint32_t num = static_cast<uint32_t>(t.blocks.closed().size()) + static_cast<uint32_t>(t.sync.closed().size());
 
-        uint64_t timestamp = 0;
-        uint32_t thread_from = 0, thread_to = 0;
+        const char expired = checkThreadExpired(t);
+        if (num == 0 && expired != 0) {
+            // Remove thread if it contains no profiled information and has been finished.
+            // Live threads are kept because they are still referencing their storages.
+            releaseThread(i);
+            continue;
+        }
 
-        std::ifstream infile(m_csInfoFilename.c_str());
-        if(infile.is_open())
+        if (expired == 1) {
+            EASY_FORCE_EVENT3(t, endtime, "ThreadExpired", EASY_COLOR_THREAD_END);
+            ++num;
+        }
+
+        usedMemorySize += t.blocks.closed().usedMemorySize() + t.sync.closed().usedMemorySize();
+        blocks_number += num;
+    }
+
+    Snapshot info;
+    info.beginTime = m_beginTime;
+    info.endTime = m_endTime;
+    info.blocksNumber = blocks_number;
+    info.usedMemorySize = usedMemorySize;
+    info.descriptors = m_descriptors;
+    info.descriptorsMemory = m_usedMemorySize;
+    m_runtimeNames.copy(info.runtimeNames, info.runtimeNamesMemory);
+
+    auto& stream = _outputStream.stream();
+    const std::streamoff headerPosition = _streamFile == nullptr ? static_cast<std::streamoff>(stream.tellp()) : 0;
+    if (_streamFile == nullptr)
+    {
+        writeHeader(_outputStream, info, 0, 0);
+        writeDescriptors(_outputStream, info.descriptors, info.runtimeNames);
+    }
+    else
+    {
+        info.sections = _streamFile->sections;
+    }
+
+    // Write blocks and context switch events for each thread
+    for (uint32_t i = 0; i < threads_number; ++i)
+    {
+        auto ts = m_threads.at(i);
+        if (ts == nullptr)
+            continue;
+
+        auto& t = *ts;
+        auto& blocks = t.blocks.closed();
+        auto& sync = t.sync.closed();
+        if (!t.guarded && blocks.empty() && sync.empty())
+            continue; // Do not write not guarded threads with no profiled information
+
+        writeThread(_outputStream, headerPosition, info.sections, t.id, t.name, sync, blocks);
+
+        t.clearClosed();
+        t.blocks.openedList.clear();
+        t.sync.openedList.clear();
+
+        if (t.expired.load(std::memory_order_acquire) != 0)
+            releaseThread(i); // Remove expired thread after writing all profiled information
+    }
+
+    if (_streamFile != nullptr)
+    {
+        // Thread data has been already written after the header placeholder:
+        // write block descriptors at the end and fill the header
+        blocks_number += _streamFile->blocksNumber;
+        info.blocksNumber = blocks_number;
+        info.usedMemorySize += _streamFile->usedMemorySize;
+
+        const auto descriptorsOffset = static_cast<uint64_t>(stream.tellp());
+        writeDescriptors(_outputStream, info.descriptors, info.runtimeNames);
+
+        const auto sectionsOffset = static_cast<uint64_t>(stream.tellp());
+        writeSections(_outputStream, info.sections);
+
+        stream.seekp(0);
+        writeHeader(_outputStream, info, descriptorsOffset, sectionsOffset);
+        stream.seekp(0, std::ios_base::end);
+    }
+    else
+    {
+        // Sections table follows threads data: rewrite the header with it's position
+        const auto sectionsOffset = static_cast<uint64_t>(static_cast<std::streamoff>(stream.tellp()) - headerPosition);
+        writeSections(_outputStream, info.sections);
+
+        stream.seekp(headerPosition);
+        writeHeader(_outputStream, info, 0, sectionsOffset);
+        stream.seekp(0, std::ios_base::end);
+    }
+
+    // All stored blocks have been written and cleared: runtime names are not referenced anymore
+    m_runtimeNames.reset();
+
+    m_storedSpin.unlock();
+    m_spin.unlock();
+
+    if (_lockSpin)
+        m_dumpSpin.unlock();
+
+    EASY_LOGMSG("Done dumpBlocksToStream(). Dumped " << blocks_number << " blocks\n");
+
+    return blocks_number;
+}
+
+uint32_t ProfileManager::dumpBlocksToFile(const char* _filename)
+{
+    EASY_LOGMSG("dumpBlocksToFile(\"" << _filename << "\")...\n");
+
+    std::ofstream outputFile(_filename, std::fstream::binary);
+    if (!outputFile.is_open())
+    {
+        EASY_ERROR("Can not open \"" << _filename << "\" for writing\n");
+        return 0;
+    }
+
+    profiler::OStream outputStream;
+
+    // Replace outputStream buffer to outputFile buffer to avoid redundant copying
+    typedef ::std::basic_iostream<std::stringstream::char_type, std::stringstream::traits_type> stringstream_parent;
+    stringstream_parent& s = outputStream.stream();
+    auto oldbuf = s.rdbuf(outputFile.rdbuf());
+
+    // Write data directly to file
+    const auto blocksNumber = dumpBlocksToStream(outputStream, true);
+
+    // Restore old outputStream buffer to avoid possible second memory free on stringstream destructor
+    s.rdbuf(oldbuf);
+
+    EASY_LOGMSG("Done dumpBlocksToFile()\n");
+
+    return blocksNumber;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void ProfileManager::detachThreads(Snapshot& _snapshot, profiler::timestamp_t _now)
+{
+    // m_spin prevents context switch events storing and releasing threads by other operations
+    m_spin.lock();
+
+    const uint32_t threads_number = m_threads.size();
+    std::vector<ThreadStorage*> detached;
+    std::vector<uint32_t> expiredSlots;
+    detached.reserve(threads_number);
+    for (uint32_t i = 0; i < threads_number; ++i)
+    {
+        auto ts = m_threads.at(i);
+        if (ts == nullptr)
+            continue;
+
+        auto& t = *ts;
+        const char expired = checkThreadExpired(t);
+        if (expired == 1) {
+            EASY_FORCE_EVENT3(t, _now, "ThreadExpired", EASY_COLOR_THREAD_END);
+        }
+
+        if (t.blocks.closed().empty() && t.sync.closed().empty())
         {
-            EASY_LOG_ONLY(uint32_t num = 0);
-            std::string next_task_name;
-            pid_t process_to = 0;
-            while (infile >> timestamp >> thread_from >> thread_to >> next_task_name >> process_to)
-            {
-                beginContextSwitch(thread_from, timestamp, thread_to, next_task_name.c_str(), false);
-                endContextSwitch(thread_to, (processid_t)process_to, timestamp, false);
-                EASY_LOG_ONLY(++num);
-            }
+            if (expired != 0)
+                releaseThread(i);
+            continue;
+        }
+
+        Snapshot::Thread thread;
+        thread.id = t.id;
+        thread.name = t.name;
+        thread.sync.reset(t.sync.detachClosed());
+        thread.blocks.reset(t.blocks.detachClosed());
+        _snapshot.threads.emplace_back(std::move(thread));
+
+        if (expired != 0)
+            expiredSlots.push_back(i); // Expired thread is not storing anything, it can be removed right after detaching
+        else
+            detached.push_back(ts);
+    }
+
+    // After heavy barrier every thread which is still storing a block into the old list
+    // has its storing flag visible here, so wait for it.
+    SNAPSHOT_BARRIER.heavy();
+    for (auto ts : detached)
+    {
+        while (ts->storing.load(std::memory_order_acquire))
+            std::this_thread::yield();
+    }
+
+    for (auto i : expiredSlots)
+        releaseThread(i);
+
+    m_spin.unlock();
+
+    for (const auto& thread : _snapshot.threads)
+    {
+        _snapshot.blocksNumber += static_cast<uint32_t>(thread.sync->size() + thread.blocks->size());
+        _snapshot.usedMemorySize += thread.sync->usedMemorySize() + thread.blocks->usedMemorySize();
+    }
+}
+
+uint32_t ProfileManager::dumpSnapshotToFile(const char* _filename)
+{
+    EASY_LOGMSG("dumpSnapshotToFile(\"" << _filename << "\")...\n");
+
+    std::unique_ptr<Snapshot> snapshot(new Snapshot());
+    snapshot->outputFile.reset(new std::ofstream(_filename, std::fstream::binary));
+    if (!snapshot->outputFile->is_open())
+    {
+        EASY_ERROR("Can not open \"" << _filename << "\" for writing\n");
+        return 0;
+    }
+
+    guard_lock_t lock(m_dumpSpin);
+
+    if (m_triggerCaptureOn || m_streamOn)
+    {
+        EASY_ERROR("Snapshot can not be dumped while " << (m_triggerCaptureOn ? "triggered capture is started\n" : "blocks are being streamed into file\n"));
+        return 0;
+    }
+
+    // Previous snapshot must be written before starting the new one
+    if (m_snapshotThread.joinable())
+        m_snapshotThread.join();
+
+    // Blocks which have been finished before previous snapshot could be stored after it,
+    // so begin time is the profiling session begin time (reader drops blocks finished before begin time).
+    const profiler::timestamp_t now = getCurrentTime();
+    snapshot->beginTime = m_beginTime;
+    snapshot->endTime = now;
+
+    detachThreads(*snapshot, now);
+
+    m_storedSpin.lock();
+    snapshot->descriptors = m_descriptors;
+    snapshot->descriptorsMemory = m_usedMemorySize;
+    m_storedSpin.unlock();
+
+    // Detached blocks can reference only names which have been already interned
+    m_runtimeNames.copy(snapshot->runtimeNames, snapshot->runtimeNamesMemory);
+
+    const auto blocksNumber = snapshot->blocksNumber;
+
+    auto snapshotPtr = snapshot.release();
+    m_snapshotThread = std::thread([this, snapshotPtr]()
+    {
+        std::unique_ptr<Snapshot> s(snapshotPtr);
+        writeSnapshot(*s);
+    });
+
+    EASY_LOGMSG("Done dumpSnapshotToFile(). " << blocksNumber << " blocks are being written\n");
+
+    return blocksNumber;
+}
+
+void ProfileManager::writeSnapshot(Snapshot& _snapshot) const
+{
+    profiler::OStream outputStream;
+
+    // Replace outputStream buffer to outputFile buffer to avoid redundant copying
+    typedef ::std::basic_iostream<std::stringstream::char_type, std::stringstream::traits_type> stringstream_parent;
+    stringstream_parent& s = outputStream.stream();
+    auto oldbuf = s.rdbuf(_snapshot.outputFile->rdbuf());
+
+    writeHeader(outputStream, _snapshot, 0, 0);
+    writeDescriptors(outputStream, _snapshot.descriptors, _snapshot.runtimeNames);
+
+    for (auto& thread : _snapshot.threads)
+        writeThread(outputStream, 0, _snapshot.sections, thread.id, thread.name, *thread.sync, *thread.blocks);
+
+    // Sections table follows threads data: rewrite the header with it's position
+    const auto sectionsOffset = static_cast<uint64_t>(s.tellp());
+    writeSections(outputStream, _snapshot.sections);
+
+    s.seekp(0);
+    writeHeader(outputStream, _snapshot, 0, sectionsOffset);
+    s.seekp(0, std::ios_base::end);
+
+    // Restore old outputStream buffer to avoid possible second memory free on stringstream destructor
+    s.rdbuf(oldbuf);
+
+    EASY_LOGMSG("Done writeSnapshot(). Written " << _snapshot.blocksNumber << " blocks\n");
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool ProfileManager::startStreamingBlocksToFile(const char* _filename)
+{
+    EASY_LOGMSG("startStreamingBlocksToFile(\"" << _filename << "\")...\n");
+
+    guard_lock_t lock(m_streamSpin);
+
+    if (m_streamFile != nullptr)
+    {
+        EASY_ERROR("Blocks are already being streamed into file\n");
+        return false;
+    }
+
+    std::unique_ptr<StreamFile> streamFile(new StreamFile(_filename));
+    if (!streamFile->file.is_open())
+    {
+        EASY_ERROR("Can not open \"" << _filename << "\" for writing\n");
+        return false;
+    }
+
+    {
+        guard_lock_t dumpLock(m_dumpSpin);
+        if (m_triggerCaptureOn || m_networkCapture)
+        {
+            EASY_ERROR("Blocks can not be streamed into file while " << (m_triggerCaptureOn ? "triggered capture is started\n" : "capture from GUI is running\n"));
+            return false;
+        }
+        m_streamOn = true;
+    }
+
+    // Reserve place for the header: it will be written by stopStreamingBlocksToFile()
+    const char header[HEADER_SIZE] = {};
+    streamFile->stream.write(header, HEADER_SIZE);
+
+    m_streamFile = std::move(streamFile);
+    m_stopFlush.store(false, std::memory_order_release);
+    m_flushThread = std::thread([this]()
+    {
+        while (!m_stopFlush.load(std::memory_order_acquire))
+        {
+            for (uint32_t slept = 0; slept < EASY_OPTION_STREAM_FLUSH_INTERVAL && !m_stopFlush.load(std::memory_order_acquire); slept += 10)
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            flushStream();
+        }
+    });
+
+    return true;
+}
+
+void ProfileManager::flushStream()
+{
+    Snapshot snapshot;
+
+    {
+        guard_lock_t lock(m_dumpSpin);
+        detachThreads(snapshot, getCurrentTime());
+    }
+
+    for (auto& thread : snapshot.threads)
+        writeThread(m_streamFile->stream, 0, m_streamFile->sections, thread.id, thread.name, *thread.sync, *thread.blocks);
+
+    m_streamFile->blocksNumber += snapshot.blocksNumber;
+    m_streamFile->usedMemorySize += snapshot.usedMemorySize;
+}
+
+uint32_t ProfileManager::stopStreamingBlocksToFile()
+{
+    EASY_LOGMSG("stopStreamingBlocksToFile()...\n");
+
+    guard_lock_t lock(m_streamSpin);
+
+    if (m_streamFile == nullptr)
+        return 0;
+
+    m_stopFlush.store(true, std::memory_order_release);
+    if (m_flushThread.joinable())
+        m_flushThread.join();
+
+    // Stop profiling the same way as dumpBlocksToFile() does and write the rest of blocks into the file
+    const auto blocksNumber = dumpBlocksToStream(m_streamFile->stream, true, m_streamFile.get());
+    m_streamFile.reset();
+
+    m_dumpSpin.lock();
+    m_streamOn = false;
+    m_dumpSpin.unlock();
+
+    EASY_LOGMSG("Done stopStreamingBlocksToFile()\n");
+
+    return blocksNumber;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool ProfileManager::startTriggeredCapture(const char* _filenamePrefix, uint32_t _beforeMs, uint32_t _afterMs, uint32_t _filesNumber)
+{
+    guard_lock_t lock(m_triggerSpin);
+
+    if (m_triggerCapture != nullptr)
+    {
+        EASY_ERROR("Triggered capture is already started\n");
+        return false;
+    }
+
+    {
+        // Triggered capture detaches blocks periodically: other captures would lose them
+        guard_lock_t dumpLock(m_dumpSpin);
+        if (m_streamOn || m_networkCapture)
+        {
+            EASY_ERROR("Triggered capture can not be started while " << (m_streamOn ? "blocks are being streamed into file\n" : "capture from GUI is running\n"));
+            return false;
+        }
+        m_triggerCaptureOn = true;
+    }
+
+    m_triggerCapture.reset(new TriggerCapture(_filenamePrefix, _beforeMs, _afterMs, _filesNumber));
+    m_triggerTime.store(0, std::memory_order_release);
+    m_stopTrigger.store(false, std::memory_order_release);
+    m_triggerCapture->thread = std::thread([this]() { watchTriggers(); });
+    m_triggerArmed.store(true, std::memory_order_release);
+
+    return true;
+}
+
+uint32_t ProfileManager::stopTriggeredCapture()
+{
+    guard_lock_t lock(m_triggerSpin);
+
+    if (m_triggerCapture == nullptr)
+        return 0;
+
+    m_triggerArmed.store(false, std::memory_order_release);
+    m_stopTrigger.store(true, std::memory_order_release);
+    if (m_triggerCapture->thread.joinable())
+        m_triggerCapture->thread.join();
+
+    const auto filesWritten = m_triggerCapture->filesWritten;
+    m_triggerCapture.reset();
+
+    m_dumpSpin.lock();
+    m_triggerCaptureOn = false;
+    m_dumpSpin.unlock();
+
+    return filesWritten;
+}
+
+bool ProfileManager::trigger()
+{
+    if (!m_triggerArmed.load(std::memory_order_acquire) || m_profilerStatus.load(std::memory_order_acquire) == EASY_PROF_DISABLED)
+        return false;
+
+    // Only one capture at a time: triggers fired while it is pending are ignored
+    profiler::timestamp_t expected = 0;
+    if (!m_triggerTime.compare_exchange_strong(expected, getCurrentTime(), std::memory_order_acq_rel))
+        return false;
+
+    profiler::timestamp_t time = 0;
+    EASY_FORCE_EVENT(time, "Trigger", EASY_COLOR_TRIGGER, profiler::FORCE_ON);
+    (void)time;
+
+    return true;
+}
+
+bool ProfileManager::setBlockTrigger(profiler::block_id_t _id, uint32_t _nanoseconds)
+{
+    guard_lock_t lock(m_triggerSpin);
 
-            EASY_LOGMSG("Done, " << num << " context switch events wrote\n");
-        }
-        EASY_LOG_ONLY(
-            else {
-                EASY_ERROR("Can not open context switch log-file \"" << m_csInfoFilename << "\"\n");
-            }
-        )
+    const auto triggersNumber = m_blockTriggersNumber.load(std::memory_order_relaxed);
+    uint32_t slot = MAX_BLOCK_TRIGGERS, freeSlot = triggersNumber;
+    for (uint32_t i = 0; i < triggersNumber; ++i)
+    {
+        const auto& blockTrigger = m_blockTriggers[i];
+        if (blockTrigger.duration.load(std::memory_order_relaxed) == 0)
+            freeSlot = std::min(freeSlot, i);
+        else if (blockTrigger.id.load(std::memory_order_relaxed) == _id)
+            slot = i;
     }
-#endif
 
-    // Calculate used memory total size and total blocks number
-    uint64_t usedMemorySize = 0;
-    uint32_t blocks_number = 0;
-    for (auto it = m_threads.begin(), end = m_threads.end(); it != end;)
+    if (slot == MAX_BLOCK_TRIGGERS)
     {
-        auto& t = it->second;
-        uint32_t num = static_cast<uint32_t>(t.blocks.closedList.size()) + static_cast<uint32_t>(t.sync.closedList.size());
+        if (_nanoseconds == 0)
+            return true;
 
-        const char expired = checkThreadExpired(t);
-        if (num == 0 && (expired != 0 || !t.guarded)) {
-            // Remove thread if it contains no profiled information and has been finished or is not guarded.
-            m_threads.erase(it++);
-            continue;
-        }
-
-        if (expired == 1) {
-            EASY_FORCE_EVENT3(t, endtime, "ThreadExpired", EASY_COLOR_THREAD_END);
-            ++num;
+        if (freeSlot == MAX_BLOCK_TRIGGERS)
+        {
+            EASY_ERROR("Too many block triggers\n");
+            return false;
         }
 
-        usedMemorySize += t.blocks.usedMemorySize + t.sync.usedMemorySize;
-        blocks_number += num;
-        ++it;
+        slot = freeSlot;
     }
 
-    // Write profiler signature and version
-    _outputStream.write(PROFILER_SIGNATURE);
-    _outputStream.write(EASY_CURRENT_VERSION);
-    _outputStream.write(m_processId);
-
-    // Write CPU frequency to let GUI calculate real time value from CPU clocks
-#ifdef _WIN32
-    _outputStream.write(CPU_FREQUENCY);
-#else
-
-#if !defined(USE_STD_CHRONO)
-    EASY_LOGMSG("Calculating CPU frequency\n");
-    double g_TicksPerNanoSec;
-    struct timespec begints, endts;
-    uint64_t begin = 0, end = 0;
-    clock_gettime(CLOCK_MONOTONIC, &begints);
-    begin = getCurrentTime();
-    volatile uint64_t i;
-    for (i = 0; i < 100000000; i++); /* must be CPU intensive */
-    end = getCurrentTime();
-    clock_gettime(CLOCK_MONOTONIC, &endts);
-    struct timespec tmpts;
-    const int NANO_SECONDS_IN_SEC = 1000000000;
-    tmpts.tv_sec = endts.tv_sec - begints.tv_sec;
-    tmpts.tv_nsec = endts.tv_nsec - begints.tv_nsec;
-    if (tmpts.tv_nsec < 0) {
-        tmpts.tv_sec--;
-        tmpts.tv_nsec += NANO_SECONDS_IN_SEC;
-    }
-
-    uint64_t nsecElapsed = tmpts.tv_sec * 1000000000LL + tmpts.tv_nsec;
-    g_TicksPerNanoSec = (double)(end - begin)/(double)nsecElapsed;
-
-
-
-    int64_t cpu_frequency = int(g_TicksPerNanoSec*1000000);
-     _outputStream.write(cpu_frequency*1000LL);
-     EASY_LOGMSG("Done calculating CPU frequency\n");
-#else
-    _outputStream.write(0LL);
-#endif
-#endif
+    auto& blockTrigger = m_blockTriggers[slot];
+    blockTrigger.duration.store(0, std::memory_order_relaxed);
+    blockTrigger.id.store(_id, std::memory_order_relaxed);
+    blockTrigger.duration.store(_nanoseconds, std::memory_order_release);
 
-    // Write begin and end time
-    _outputStream.write(m_beginTime);
-    _outputStream.write(m_endTime);
+    if (slot == triggersNumber)
+        m_blockTriggersNumber.store(triggersNumber + 1, std::memory_order_release);
 
-    // Write blocks number and used memory size
-    _outputStream.write(blocks_number);
-    _outputStream.write(usedMemorySize);
-    _outputStream.write(static_cast<uint32_t>(m_descriptors.size()));
-    _outputStream.write(m_usedMemorySize);
+    return true;
+}
 
-    // Write block descriptors
-    for (const auto descriptor : m_descriptors)
+void ProfileManager::checkBlockTriggers(const profiler::Block& _block)
+{
+    const auto triggersNumber = m_blockTriggersNumber.load(std::memory_order_acquire);
+    for (uint32_t i = 0; i < triggersNumber; ++i)
     {
-        const auto name_size = descriptor->nameSize();
-        const auto filename_size = descriptor->filenameSize();
-        const auto size = static_cast<uint16_t>(sizeof(profiler::SerializedBlockDescriptor) + name_size + filename_size);
-
-        _outputStream.write(size);
-        _outputStream.write<profiler::BaseBlockDescriptor>(*descriptor);
-        _outputStream.write(name_size);
-        _outputStream.write(descriptor->name(), name_size);
-        _outputStream.write(descriptor->filename(), filename_size);
+        const auto& blockTrigger = m_blockTriggers[i];
+        const auto duration = m_cpuFrequency.ticks(blockTrigger.duration.load(std::memory_order_acquire));
+        if (duration != 0 && blockTrigger.id.load(std::memory_order_relaxed) == _block.m_id && _block.duration() >= duration)
+        {
+            trigger();
+            return;
+        }
     }
+}
 
-    // Write blocks and context switch events for each thread
-    for (auto it = m_threads.begin(), end = m_threads.end(); it != end;)
+void ProfileManager::watchTriggers()
+{
+    auto& capture = *m_triggerCapture;
+
+    const auto ticksPerMs = [this]() -> profiler::timestamp_t
     {
-        auto& t = it->second;
+        const auto frequency = m_cpuFrequency.get();
+        return frequency != 0 ? static_cast<profiler::timestamp_t>(frequency / 1000) : 1000000ULL; // ns clock if frequency is 0
+    };
 
-        _outputStream.write(it->first);
+    const auto writeCapture = [&](profiler::timestamp_t _triggerTime)
+    {
+        const profiler::timestamp_t before = capture.beforeMs * ticksPerMs();
+        writeTriggerCapture(capture, _triggerTime > before ? _triggerTime - before : 0);
+    };
 
-        const auto name_size = static_cast<uint16_t>(t.name.size() + 1);
-        _outputStream.write(name_size);
-        _outputStream.write(name_size > 1 ? t.name.c_str() : "", name_size);
+    auto windowBegin = std::chrono::steady_clock::now();
+    while (!m_stopTrigger.load(std::memory_order_acquire))
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
-        _outputStream.write(t.sync.closedList.size());
-        if (!t.sync.closedList.empty())
-            t.sync.closedList.serialize(_outputStream);
+        const auto triggerTime = m_triggerTime.load(std::memory_order_acquire);
+        if (triggerTime == 0)
+        {
+            // Keep blocks of two last windows only, so memory does not grow while waiting for the trigger
+            const auto now = std::chrono::steady_clock::now();
+            if (now - windowBegin >= std::chrono::milliseconds(capture.beforeMs))
+            {
+                Snapshot snapshot;
+                {
+                    guard_lock_t lock(m_dumpSpin);
+                    detachThreads(snapshot, getCurrentTime());
+                }
+                capture.previous = std::move(snapshot);
+                windowBegin = now;
+            }
+            continue;
+        }
 
-        _outputStream.write(t.blocks.closedList.size());
-        if (!t.blocks.closedList.empty())
-            t.blocks.closedList.serialize(_outputStream);
+        // Pending capture is written right away if triggered capture is being stopped
+        const auto endTime = triggerTime + capture.afterMs * ticksPerMs();
+        while (!m_stopTrigger.load(std::memory_order_acquire) && getCurrentTime() < endTime)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
 
-        t.clearClosed();
-        t.blocks.openedList.clear();
-        t.sync.openedList.clear();
+        writeCapture(triggerTime);
 
-        if (t.expired.load(std::memory_order_acquire) != 0)
-            m_threads.erase(it++); // Remove expired thread after writing all profiled information
-        else
-            ++it;
+        windowBegin = std::chrono::steady_clock::now();
+        m_triggerTime.store(0, std::memory_order_release);
     }
 
-    m_storedSpin.unlock();
-    m_spin.unlock();
-
-    if (_lockSpin)
-        m_dumpSpin.unlock();
-
-    EASY_LOGMSG("Done dumpBlocksToStream(). Dumped " << blocks_number << " blocks\n");
-
-    return blocks_number;
+    // Trigger could be fired right before stop
+    const auto triggerTime = m_triggerTime.load(std::memory_order_acquire);
+    if (triggerTime != 0)
+        writeCapture(triggerTime);
 }
 
-uint32_t ProfileManager::dumpBlocksToFile(const char* _filename)
+void ProfileManager::writeTriggerCapture(TriggerCapture& _capture, profiler::timestamp_t _beginTime)
 {
-    EASY_LOGMSG("dumpBlocksToFile(\"" << _filename << "\")...\n");
+    const auto filename = _capture.filenamePrefix + "_" + std::to_string(_capture.filesWritten % _capture.filesNumber) + ".prof";
+    EASY_LOGMSG("writeTriggerCapture(\"" << filename << "\")...\n");
+
+    Snapshot snapshot;
+    snapshot.outputFile.reset(new std::ofstream(filename, std::fstream::binary));
 
-    std::ofstream outputFile(_filename, std::fstream::binary);
-    if (!outputFile.is_open())
     {
-        EASY_ERROR("Can not open \"" << _filename << "\" for writing\n");
-        return 0;
-    }
+        guard_lock_t lock(m_dumpSpin);
 
-    profiler::OStream outputStream;
+        snapshot.beginTime = std::max(m_beginTime, _beginTime);
+        snapshot.endTime = getCurrentTime();
+        detachThreads(snapshot, snapshot.endTime);
 
-    // Replace outputStream buffer to outputFile buffer to avoid redundant copying
-    typedef ::std::basic_iostream<std::stringstream::char_type, std::stringstream::traits_type> stringstream_parent;
-    stringstream_parent& s = outputStream.stream();
-    auto oldbuf = s.rdbuf(outputFile.rdbuf());
+        m_storedSpin.lock();
+        snapshot.descriptors = m_descriptors;
+        snapshot.descriptorsMemory = m_usedMemorySize;
+        m_storedSpin.unlock();
 
-    // Write data directly to file
-    const auto blocksNumber = dumpBlocksToStream(outputStream, true);
+        m_runtimeNames.copy(snapshot.runtimeNames, snapshot.runtimeNamesMemory);
+    }
 
-    // Restore old outputStream buffer to avoid possible second memory free on stringstream destructor
-    s.rdbuf(oldbuf);
+    // Blocks of the previous window go first to keep per-thread order of blocks
+    auto& previous = _capture.previous;
+    snapshot.threads.insert(snapshot.threads.begin(), std::make_move_iterator(previous.threads.begin()),
+                            std::make_move_iterator(previous.threads.end()));
+    snapshot.blocksNumber += previous.blocksNumber;
+    snapshot.usedMemorySize += previous.usedMemorySize;
+    previous = Snapshot();
 
-    EASY_LOGMSG("Done dumpBlocksToFile()\n");
+    if (!snapshot.outputFile->is_open())
+    {
+        EASY_ERROR("Can not open \"" << filename << "\" for writing\n");
+        return;
+    }
 
-    return blocksNumber;
+    writeSnapshot(snapshot);
+    ++_capture.filesWritten;
 }
 
+//////////////////////////////////////////////////////////////////////////
+
 const char* ProfileManager::registerThread(const char* name, ThreadGuard& threadGuard)
 {
     if (THREAD_STORAGE == nullptr)
-        THREAD_STORAGE = &threadStorage(getCurrentThreadId());
+    {
+        THREAD_STORAGE = threadStorage(getCurrentThreadId());
+        if (THREAD_STORAGE == nullptr)
+            return name;
+    }
 
     THREAD_STORAGE->guarded = true;
     if (!THREAD_STORAGE->named) {
@@ -1150,7 +3202,11 @@ const char* ProfileManager::registerThread(const char* name, ThreadGuard& thread
 const char* ProfileManager::registerThread(const char* name)
 {
     if (THREAD_STORAGE == nullptr)
-        THREAD_STORAGE = &threadStorage(getCurrentThreadId());
+    {
+        THREAD_STORAGE = threadStorage(getCurrentThreadId());
+        if (THREAD_STORAGE == nullptr)
+            return name;
+    }
 
     if (!THREAD_STORAGE->named) {
         THREAD_STORAGE->named = true;
@@ -1174,6 +3230,238 @@ void ProfileManager::setBlockStatus(block_id_t _id, EasyBlockStatus _status)
     }
 }
 
+void ProfileManager::setBlockSampling(block_id_t _id, uint16_t _sampling)
+{
+    // Counters are allocated before sampling is turned on, so blocks hot path does not allocate them
+    if (_sampling > 1)
+        reserveSamplingCounters(_id);
+
+    guard_lock_t lock(m_storedSpin);
+    if (_id < m_descriptors.size())
+    {
+        auto desc = m_descriptors[_id];
+        lock.unlock();
+        desc->m_sampling.store(_sampling > 1 ? _sampling : 1, std::memory_order_relaxed);
+    }
+}
+
+void ProfileManager::setBlockMinDuration(block_id_t _id, uint32_t _nanoseconds)
+{
+    guard_lock_t lock(m_storedSpin);
+    if (_id < m_descriptors.size())
+    {
+        auto desc = m_descriptors[_id];
+        lock.unlock();
+        desc->m_minDuration.store(_nanoseconds, std::memory_order_relaxed);
+    }
+}
+
+bool ProfileManager::setBlockHardwareCounters(block_id_t _id, bool _enable)
+{
+    if (!profiler::hardware_counters::supported())
+        return false;
+
+    guard_lock_t lock(m_storedSpin);
+    if (_id >= m_descriptors.size())
+        return false;
+
+    // Flags are shared with other setters and lock descriptors registration, so they are changed under the lock
+    auto desc = m_descriptors[_id];
+    if (_enable)
+        desc->m_flags |= profiler::BLOCK_FLAG_HARDWARE_COUNTERS;
+    else
+        desc->m_flags &= ~profiler::BLOCK_FLAG_HARDWARE_COUNTERS;
+
+    return true;
+}
+
+bool ProfileManager::setBlockCpuTime(block_id_t _id, bool _enable)
+{
+    guard_lock_t lock(m_storedSpin);
+    if (_id >= m_descriptors.size())
+        return false;
+
+    // Flags are changed under the lock (see setBlockHardwareCounters)
+    auto desc = m_descriptors[_id];
+    if (_enable)
+        desc->m_flags |= profiler::BLOCK_FLAG_CPU_TIME;
+    else
+        desc->m_flags &= ~profiler::BLOCK_FLAG_CPU_TIME;
+
+    return true;
+}
+
+#ifndef _WIN32
+/** Measures average cost of one clock source call (in nanoseconds) and checks that clock source
+is monotonic within one core and across all cores available for the process.
+
+Migration through cores is made by a helper thread, affinity of the calling thread is never changed.
+*/
+static bool testClockSource(profiler::ClockSource _source, double& _cost)
+{
+    const int CALLS_NUMBER = 10000;
+    const int MAX_CPUS = 64;
+
+    bool monotonic = true;
+    const auto begin = profiler::clock::posix_clock(CLOCK_MONOTONIC);
+    auto previous = profiler::clock::read(_source);
+    for (int i = 0; i < CALLS_NUMBER; ++i)
+    {
+        const auto time = profiler::clock::read(_source);
+        monotonic = monotonic && time >= previous;
+        previous = time;
+    }
+    _cost = static_cast<double>(profiler::clock::posix_clock(CLOCK_MONOTONIC) - begin) / CALLS_NUMBER;
+
+#ifdef __linux__
+    // Migrate helper thread through available cores: unsynchronized counters go backwards on some of them
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (monotonic && sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        std::thread([&]()
+        {
+            for (int round = 0; round < 3 && monotonic; ++round)
+            {
+                for (int cpu = 0, tested = 0; cpu < CPU_SETSIZE && tested < MAX_CPUS && monotonic; ++cpu)
+                {
+                    if (!CPU_ISSET(cpu, &allowed))
+                        continue;
+
+                    cpu_set_t current;
+                    CPU_ZERO(&current);
+                    CPU_SET(cpu, &current);
+                    if (sched_setaffinity(0, sizeof(current), &current) != 0)
+                        continue;
+
+                    ++tested;
+                    const auto time = profiler::clock::read(_source);
+                    monotonic = time >= previous;
+                    previous = time;
+                }
+            }
+        }).join();
+    }
+#endif
+
+    return monotonic;
+}
+#endif
+
+profiler::ClockSource ProfileManager::selectClockSource(profiler::ClockSource _preferred)
+{
+#ifdef _WIN32
+    (void)_preferred;
+    return profiler::CLOCK_SOURCE_QPC;
+#else
+    if (_preferred != profiler::CLOCK_SOURCE_AUTO)
+    {
+        if (profiler::clock::available(_preferred))
+            return _preferred;
+        EASY_WARNING("Clock source " << (int)_preferred << " is not available, selecting the best one\n");
+    }
+
+    // Sources in order of preference (CPU counter is used only if it runs at constant rate)
+    std::vector<profiler::ClockSource> candidates;
+#ifdef EASY_CLOCK_RDTSCP_SUPPORTED
+    if (profiler::clock::invariant_tsc())
+    {
+        candidates.push_back(profiler::CLOCK_SOURCE_CPU_COUNTER);
+    }
+    else
+    {
+        EASY_WARNING("TSC is not invariant, it will not be used as clock source\n");
+    }
+#else
+    candidates.push_back(profiler::CLOCK_SOURCE_CPU_COUNTER);
+#endif
+    candidates.push_back(profiler::CLOCK_SOURCE_MONOTONIC_RAW);
+    candidates.push_back(profiler::CLOCK_SOURCE_MONOTONIC);
+
+    std::vector<double> costs(candidates.size(), -1);
+
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        const auto source = candidates[i];
+        if (!profiler::clock::available(source))
+            continue;
+
+        double cost = 0;
+        const bool monotonic = testClockSource(source, cost);
+        EASY_LOGMSG("Clock source " << (int)source << ": " << cost << " ns per call, " << (monotonic ? "monotonic" : "NOT monotonic") << "\n");
+        if (monotonic)
+            costs[i] = cost;
+    }
+
+    double minCost = -1;
+    for (auto cost : costs)
+    {
+        if (cost >= 0 && (minCost < 0 || cost < minCost))
+            minCost = cost;
+    }
+
+    // Take the most preferable source which is not much slower than the fastest one
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        if (costs[i] >= 0 && costs[i] <= minCost * 1.5 + 2)
+        {
+            EASY_LOGMSG("Selected clock source " << (int)candidates[i] << "\n");
+            return candidates[i];
+        }
+    }
+
+    return profiler::CLOCK_SOURCE_MONOTONIC;
+#endif
+}
+
+void ProfileManager::selectClockSourceOnce()
+{
+    // Must be called under m_dumpSpin before profiler is enabled: no blocks are stored with the previous source
+    if (m_clockSourceSelected.load(std::memory_order_acquire))
+        return;
+
+    const auto source = selectClockSource(static_cast<profiler::ClockSource>(EASY_OPTION_CLOCK_SOURCE));
+    const auto prev = profiler::clock::current_source::s_source.exchange(source, std::memory_order_release);
+    m_clockSourceSelected.store(true, std::memory_order_release);
+
+    if (prev != source)
+        m_cpuFrequency.start();
+}
+
+bool ProfileManager::setClockSource(profiler::ClockSource _source)
+{
+    if (_source >= profiler::CLOCK_SOURCES_NUMBER || (_source != profiler::CLOCK_SOURCE_AUTO && !profiler::clock::available(_source)))
+    {
+        EASY_ERROR("Clock source " << (int)_source << " is not available\n");
+        return false;
+    }
+
+    guard_lock_t lock(m_dumpSpin);
+
+    if (m_profilerStatus.load(std::memory_order_acquire) != EASY_PROF_DISABLED)
+    {
+        EASY_ERROR("Clock source can not be changed while profiler is enabled\n");
+        return false;
+    }
+
+    // Snapshot writer reads cpu frequency which is going to be recalibrated
+    if (m_snapshotThread.joinable())
+        m_snapshotThread.join();
+
+    // Blocks gathered with different clock sources can not be mixed in one file
+    {
+        Snapshot dropped;
+        detachThreads(dropped, getCurrentTime());
+    }
+
+    profiler::clock::current_source::s_source.store(selectClockSource(_source), std::memory_order_release);
+    m_clockSourceSelected.store(true, std::memory_order_release);
+    m_cpuFrequency.start();
+    resetHistograms(); // Histograms contain durations in ticks of the previous clock source
+
+    return true;
+}
+
 void ProfileManager::startListen(uint16_t _port)
 {
     if (!m_isAlreadyListening.exchange(true, std::memory_order_release))
@@ -1221,7 +3509,7 @@ void ProfileManager::listen(uint16_t _port)
         // Send reply
         {
             const bool wasLowPriorityET =
-#ifdef _WIN32
+#if defined(_WIN32) || defined(__linux__)
                 EasyEventTracer::instance().isLowPriority();
 #else
                 false;
@@ -1259,14 +3547,25 @@ void ProfileManager::listen(uint16_t _port)
                     {
                         EASY_LOGMSG("receive REQUEST_START_CAPTURE\n");
 
-                        ::profiler::timestamp_t t = 0;
-                        EASY_FORCE_EVENT(t, "StartCapture", EASY_COLOR_START, profiler::OFF);
-
                         m_dumpSpin.lock();
-                        const auto prev = m_profilerStatus.exchange(EASY_PROF_ENABLED, std::memory_order_release);
-                        if (prev != EASY_PROF_ENABLED) {
-                            enableEventTracer();
-                            m_beginTime = t;
+                        if (m_triggerCaptureOn || m_streamOn)
+                        {
+                            EASY_ERROR("Capture can not be started while " << (m_triggerCaptureOn ? "triggered capture is started\n" : "blocks are being streamed into file\n"));
+                        }
+                        else
+                        {
+                            selectClockSourceOnce();
+
+                            ::profiler::timestamp_t t = 0;
+                            EASY_FORCE_EVENT(t, "StartCapture", EASY_COLOR_START, profiler::OFF);
+
+                            const auto prev = m_profilerStatus.exchange(EASY_PROF_ENABLED, std::memory_order_release);
+                            if (prev != EASY_PROF_ENABLED) {
+                                enableEventTracer();
+                                m_beginTime = t;
+                                m_governor.reset();
+                            }
+                            m_networkCapture = true;
                         }
                         m_dumpSpin.unlock();
 
@@ -1281,20 +3580,30 @@ void ProfileManager::listen(uint16_t _port)
                     {
                         EASY_LOGMSG("receive REQUEST_STOP_CAPTURE\n");
 
+                        profiler::OStream os;
+
                         m_dumpSpin.lock();
-                        auto time = getCurrentTime();
-                        const auto prev = m_profilerStatus.exchange(EASY_PROF_DUMP, std::memory_order_release);
-                        if (prev == EASY_PROF_ENABLED) {
-                            disableEventTracer();
-                            m_endTime = time;
+                        if (m_triggerCaptureOn || m_streamOn)
+                        {
+                            // Profiler is not stopped: blocks are owned by triggered capture or by the stream file
+                            EASY_ERROR("Capture can not be dumped while " << (m_triggerCaptureOn ? "triggered capture is started\n" : "blocks are being streamed into file\n"));
                         }
-                        EASY_FORCE_EVENT2(m_endTime, "StopCapture", EASY_COLOR_END, profiler::OFF);
-
-                        //TODO
-                        //if connection aborted - ignore this part
-
-                        profiler::OStream os;
-                        dumpBlocksToStream(os, false);
+                        else
+                        {
+                            auto time = getCurrentTime();
+                            const auto prev = m_profilerStatus.exchange(EASY_PROF_DUMP, std::memory_order_release);
+                            if (prev == EASY_PROF_ENABLED) {
+                                disableEventTracer();
+                                m_endTime = time;
+                            }
+                            EASY_FORCE_EVENT2(m_endTime, "StopCapture", EASY_COLOR_END, profiler::OFF);
+
+                            //TODO
+                            //if connection aborted - ignore this part
+
+                            dumpBlocksToStream(os, false);
+                        }
+                        m_networkCapture = false;
                         m_dumpSpin.unlock();
 
                         profiler::net::DataMessage dm;
@@ -1386,6 +3695,39 @@ void ProfileManager::listen(uint16_t _port)
                         break;
                     }
 
+                    case profiler::net::MESSAGE_TYPE_EDIT_BLOCK_SAMPLING:
+                    {
+                        auto data = reinterpret_cast<const profiler::net::BlockSamplingMessage*>(message);
+
+                        EASY_LOGMSG("receive EDIT_BLOCK_SAMPLING id=" << data->id << " sampling=" << data->sampling << std::endl);
+
+                        setBlockSampling(data->id, data->sampling);
+
+                        break;
+                    }
+
+                    case profiler::net::MESSAGE_TYPE_EDIT_BLOCK_MIN_DURATION:
+                    {
+                        auto data = reinterpret_cast<const profiler::net::BlockMinDurationMessage*>(message);
+
+                        EASY_LOGMSG("receive EDIT_BLOCK_MIN_DURATION id=" << data->id << " min_duration=" << data->minDuration << std::endl);
+
+                        setBlockMinDuration(data->id, data->minDuration);
+
+                        break;
+                    }
+
+                    case profiler::net::MESSAGE_TYPE_MIN_BLOCK_DURATION:
+                    {
+                        auto data = reinterpret_cast<const profiler::net::Uint32Message*>(message);
+
+                        EASY_LOGMSG("receive MIN_BLOCK_DURATION value=" << data->value << std::endl);
+
+                        setMinBlockDuration(data->value);
+
+                        break;
+                    }
+
                     case profiler::net::MESSAGE_TYPE_EVENT_TRACING_STATUS:
                     {
                         auto data = reinterpret_cast<const profiler::net::BoolMessage*>(message);
@@ -1398,13 +3740,13 @@ void ProfileManager::listen(uint16_t _port)
 
                     case profiler::net::MESSAGE_TYPE_EVENT_TRACING_PRIORITY:
                     {
-#if defined(_WIN32) || EASY_OPTION_LOG_ENABLED != 0
+#if defined(_WIN32) || defined(__linux__) || EASY_OPTION_LOG_ENABLED != 0
                         auto data = reinterpret_cast<const profiler::net::BoolMessage*>(message);
 #endif
 
                         EASY_LOGMSG("receive EVENT_TRACING_PRIORITY low=" << data->flag << std::endl);
 
-#ifdef _WIN32
+#if defined(_WIN32) || defined(__linux__)
                         EasyEventTracer::instance().setLowPriority(data->flag);
 #endif
                         break;
@@ -1418,7 +3760,10 @@ void ProfileManager::listen(uint16_t _port)
             }
         }
 
-        
+        // Capture of disconnected GUI will never be finished
+        m_dumpSpin.lock();
+        m_networkCapture = false;
+        m_dumpSpin.unlock();
 
     }
 
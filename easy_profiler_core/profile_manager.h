@@ -38,11 +38,19 @@ along with this program.If not, see <http://www.gnu.org/licenses/>.
 #include "spin_lock.h"
 #include "outstream.h"
 #include "hashed_cstr.h"
-#include <map>
+#include "compact_block.h"
+#include "cpu_frequency.h"
+#include "histogram.h"
+#include "hardware_counters.h"
 #include <vector>
+#include <deque>
+#include <list>
 #include <unordered_map>
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <type_traits>
+#include <algorithm>
 //#include <list>
 
 //////////////////////////////////////////////////////////////////////////
@@ -111,14 +119,23 @@ namespace profiler {
 # endif
 #endif
 
+/** Chunked storage for compact block records (see profiler::compact). */
 template <const uint16_t N>
 class chunk_allocator
 {
-    struct chunk { EASY_ALIGNED(int8_t, data[N], EASY_ALIGNMENT_SIZE); chunk* prev = nullptr; };
+    struct chunk
+    {
+        EASY_ALIGNED(int8_t, data[N], EASY_ALIGNMENT_SIZE);
+        chunk*         next = nullptr;
+        uint64_t decodedSize = 0; ///< Summary size of decoded records stored in this chunk
+        uint32_t     records = 0; ///< Number of records stored in this chunk
+    };
 
     struct chunk_list
     {
-        chunk* last = nullptr;
+        chunk*  first = nullptr;
+        chunk*   last = nullptr;
+        uint32_t size = 0; ///< Number of allocated chunks
 
         ~chunk_list()
         {
@@ -127,11 +144,19 @@ class chunk_allocator
 
         void clear()
         {
-            do {
-                auto p = last;
-                last = last->prev;
+            while (first != nullptr) {
+                auto p = first;
+                first = first->next;
                 EASY_FREE(p);
-            } while (last != nullptr);
+            }
+
+            last = nullptr;
+            size = 0;
+        }
+
+        chunk& front()
+        {
+            return *first;
         }
 
         chunk& back()
@@ -141,47 +166,66 @@ class chunk_allocator
 
         void emplace_back()
         {
-            auto prev = last;
-            last = ::new (EASY_MALLOC(sizeof(chunk), EASY_ALIGNMENT_SIZE)) chunk();
-            last->prev = prev;
-            *(uint16_t*)last->data = 0;
-        }
+            auto c = ::new (EASY_MALLOC(sizeof(chunk), EASY_ALIGNMENT_SIZE)) chunk();
+            *(uint16_t*)c->data = 0;
 
-        void invert()
-        {
-            chunk* next = nullptr;
+            if (last != nullptr)
+                last->next = c;
+            else
+                first = c;
 
-            while (last->prev != nullptr) {
-                auto p = last->prev;
-                last->prev = next;
-                next = last;
-                last = p;
-            }
+            last = c;
+            ++size;
+        }
 
-            last->prev = next;
+        /** Moves the oldest chunk to the end of the list and marks it empty. */
+        void rotate()
+        {
+            auto c = first;
+            *(uint16_t*)c->data = 0;
+            c->decodedSize = 0;
+            c->records = 0;
+
+            if (c == last)
+                return;
+
+            first = c->next;
+            c->next = nullptr;
+            last->next = c;
+            last = c;
         }
     };
 
-    //typedef std::list<chunk> chunk_list;
-
     chunk_list m_chunks;
+    uint64_t   m_usedMemorySize; ///< Summary size of decoded records
     uint32_t     m_size;
     uint16_t    m_shift;
 
 public:
 
-    chunk_allocator() : m_size(0), m_shift(0)
+    chunk_allocator() : m_usedMemorySize(0), m_size(0), m_shift(0)
     {
         m_chunks.emplace_back();
     }
 
-    void* allocate(uint16_t n)
+    /** Allocates n bytes.
+
+    \param _decodedSize Size of the record after decoding (see profiler::compact::decoded_size).
+    \param _chunksLimit If != 0 then the oldest chunk will be recycled instead of allocating a new one
+    when number of chunks reaches this limit (flight-recorder mode). Data stored in the oldest chunk is lost.
+    */
+    void* allocate(uint16_t n, uint16_t _decodedSize, uint32_t _chunksLimit = 0)
     {
         ++m_size;
+        m_usedMemorySize += _decodedSize;
 
         if (!need_expand(n))
         {
-            int8_t* data = m_chunks.back().data + m_shift;
+            auto& current = m_chunks.back();
+            current.decodedSize += _decodedSize;
+            ++current.records;
+
+            int8_t* data = current.data + m_shift;
             m_shift += n + sizeof(uint16_t);
 
             *(uint16_t*)data = n;
@@ -194,8 +238,17 @@ public:
         }
 
         m_shift = n + sizeof(uint16_t);
-        m_chunks.emplace_back();
-        auto data = m_chunks.back().data;
+
+        if (_chunksLimit != 0 && m_chunks.size >= _chunksLimit)
+            recycle();
+        else
+            m_chunks.emplace_back();
+
+        auto& current = m_chunks.back();
+        current.decodedSize = _decodedSize;
+        current.records = 1;
+
+        auto data = current.data;
 
         *(uint16_t*)data = n;
         data = data + sizeof(uint16_t);
@@ -209,11 +262,23 @@ public:
         return (m_shift + n + sizeof(uint16_t)) > N;
     }
 
+    /** Returns true if allocation of n bytes will place data at the beginning of a chunk. */
+    inline bool starts_chunk(uint16_t n) const
+    {
+        return m_shift == 0 || need_expand(n);
+    }
+
     inline uint32_t size() const
     {
         return m_size;
     }
 
+    /** Returns summary size of all records after decoding. */
+    inline uint64_t usedMemorySize() const
+    {
+        return m_usedMemorySize;
+    }
+
     inline bool empty() const
     {
         return m_size == 0;
@@ -221,47 +286,234 @@ public:
 
     void clear()
     {
+        m_usedMemorySize = 0;
         m_size = 0;
         m_shift = 0;
         m_chunks.clear();
         m_chunks.emplace_back();
     }
 
+    /** Consecutive chunks of the allocator (see for_each_range). */
+    class chunks_range
+    {
+        friend chunk_allocator;
+
+        const chunk*          m_first;
+        const chunk*            m_end;
+        uint64_t     m_usedMemorySize; ///< Summary size of decoded records
+        uint32_t               m_size;
+
+        chunks_range(const chunk* _first, const chunk* _end, uint64_t _usedMemorySize, uint32_t _size)
+            : m_first(_first), m_end(_end), m_usedMemorySize(_usedMemorySize), m_size(_size)
+        {
+        }
+
+    public:
+
+        inline uint32_t size() const
+        {
+            return m_size;
+        }
+
+        /** Returns summary size of records of the range after decoding. */
+        inline uint64_t usedMemorySize() const
+        {
+            return m_usedMemorySize;
+        }
+
+        inline bool empty() const
+        {
+            return m_size == 0;
+        }
+
+        /** Calls _func(record, size) for every record in the order of allocation. */
+        template <class TFunc>
+        void for_each(TFunc _func) const
+        {
+            for (auto current = m_first; current != m_end; current = current->next)
+            {
+                const int8_t* data = current->data;
+                uint16_t i = 0;
+                while (i + 1 < N && *(uint16_t*)data != 0) {
+                    const uint16_t size = *(uint16_t*)data;
+                    _func((const char*)data + sizeof(uint16_t), size);
+                    data = data + sizeof(uint16_t) + size;
+                    i += sizeof(uint16_t) + size;
+                }
+            }
+        }
+
+        /** Serialize data of the range to stream. */
+        void serialize(profiler::OStream& _outputStream) const
+        {
+            for (auto current = m_first; current != m_end; current = current->next)
+            {
+                const int8_t* data = current->data;
+                uint16_t i = 0;
+                while (i + 1 < N && *(uint16_t*)data != 0) {
+                    const uint16_t size = sizeof(uint16_t) + *(uint16_t*)data;
+                    _outputStream.write((const char*)data, size);
+                    data = data + size;
+                    i += size;
+                }
+            }
+        }
+    };
+
+    /** Calls _func(record, size) for every record in the order of allocation. */
+    template <class TFunc>
+    void for_each(TFunc _func) const
+    {
+        all().for_each(_func);
+    }
+
+    /** Splits records into consecutive ranges of whole chunks and calls _func(const chunks_range&) for every non-empty range.
+
+    Every range except the last one has at least _rangeMemorySize bytes of decoded records.
+    The first record of every chunk is encoded without previous record (see profiler::compact::encode_header),
+    so every range can be decoded independently.
+    */
+    template <class TFunc>
+    void for_each_range(uint64_t _rangeMemorySize, TFunc _func) const
+    {
+        const chunk* first = m_chunks.first;
+        uint64_t usedMemorySize = 0;
+        uint32_t size = 0;
+
+        for (auto current = m_chunks.first; current != nullptr; current = current->next)
+        {
+            usedMemorySize += current->decodedSize;
+            size += current->records;
+
+            if (usedMemorySize >= _rangeMemorySize || current->next == nullptr)
+            {
+                if (size != 0)
+                    _func(chunks_range(first, current->next, usedMemorySize, size));
+                first = current->next;
+                usedMemorySize = 0;
+                size = 0;
+            }
+        }
+    }
+
     /** Serialize data to stream.
 
     \warning Data will be cleared after serialization.
     */
     void serialize(profiler::OStream& _outputStream)
     {
-        m_chunks.invert();
-
-        auto current = m_chunks.last;
-        do {
-            const int8_t* data = current->data;
-            uint16_t i = 0;
-            while (i + 1 < N && *(uint16_t*)data != 0) {
-                const uint16_t size = sizeof(uint16_t) + *(uint16_t*)data;
-                _outputStream.write((const char*)data, size);
-                data = data + size;
-                i += size;
-            }
-            current = current->prev;
-        } while (current != nullptr);
-
+        all().serialize(_outputStream);
         clear();
     }
+
+private:
+
+    inline chunks_range all() const
+    {
+        return chunks_range(m_chunks.first, nullptr, m_usedMemorySize, m_size);
+    }
+
+    /** Drops all data from the oldest chunk and reuses it as the last one. */
+    void recycle()
+    {
+        const auto& oldest = m_chunks.front();
+        m_usedMemorySize -= oldest.decodedSize;
+        m_size -= oldest.records;
+
+        m_chunks.rotate();
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+/** Global table of runtime block names interned at capture time.
+
+Every unique runtime name is stored only once and blocks keep 32-bit name id
+(index in the table + 1, 0 means that block has no runtime name).
+The table is written into .prof file once, right after block descriptors.
+Names are kept until the full dump clears stored blocks (see reset), so the table is limited by
+RUNTIME_NAMES_MAX_NUMBER names and RUNTIME_NAMES_MAX_MEMORY bytes: when it is full,
+new runtime names are dropped and blocks are displayed with their descriptor names.
+*/
+class RuntimeNamesTable EASY_FINAL
+{
+    typedef std::unordered_map<profiler::hashed_stdstring, uint32_t> names_map_t;
+
+    std::deque<std::string>          m_storage; ///< Names storage (deque never moves already stored strings)
+    std::vector<const std::string*>    m_names; ///< Name id - 1 -> name
+    names_map_t                     m_namesMap;
+    uint64_t                  m_usedMemorySize; ///< Summary size of all names including terminating zeros
+    std::atomic<uint32_t>         m_generation; ///< Incremented on each reset to invalidate RuntimeNamesCache-s
+    mutable profiler::spin_lock         m_spin;
+    bool                                m_full; ///< Table has reached its limits (error has been reported)
+
+public:
+
+    typedef std::vector<const std::string*> names_t;
+
+    RuntimeNamesTable() : m_usedMemorySize(0), m_generation(0), m_full(false) {}
+
+    /** Returns id of the name (adds the name into table if there is no such name yet).
+
+    \retval 0 if there is no such name and the table is full. */
+    uint32_t intern(const char* _name, size_t _hash);
+
+    /** Copies the list of names (stored strings are not moved or freed until reset, so they can be used without lock). */
+    void copy(names_t& _names, uint64_t& _usedMemorySize) const;
+
+    /** Removes all names and increments generation.
+
+    \note Must be called only when there are no stored blocks referencing names (after the full dump). */
+    void reset();
+
+    uint32_t generation() const
+    {
+        return m_generation.load(std::memory_order_acquire);
+    }
+};
+
+const uint32_t RUNTIME_NAMES_MAX_NUMBER = 1U << 16; ///< Maximum number of unique runtime names (see RuntimeNamesTable)
+const uint64_t RUNTIME_NAMES_MAX_MEMORY = 16ULL << 20; ///< Maximum summary size of unique runtime names
+const uint32_t RUNTIME_NAMES_CACHE_SIZE = 4096; ///< Maximum number of names in one RuntimeNamesCache
+
+/** Cache of interned runtime names (name hash -> name id).
+
+Lookup does not take any lock: RuntimeNamesTable is used only when the name is met for the first time.
+Cache keeps it's own copies of names, so it never touches the table storage, and it is cleared
+when the table has been reset or when it contains more than RUNTIME_NAMES_CACHE_SIZE names.
+Each cache must be used by one thread at a time (see BlocksList::names).
+*/
+class RuntimeNamesCache EASY_FINAL
+{
+    struct entry { std::string name; uint32_t id; }; ///< id == 0 if the name was dropped (table is full)
+    std::unordered_map<size_t, entry, profiler::do_not_calc_hash> m_names;
+    uint32_t m_generation = 0;
+
+public:
+
+    /** Returns runtime name id (0 for empty name) and length of the name. */
+    uint32_t id(const char* _name, uint16_t& _length);
 };
 
 //////////////////////////////////////////////////////////////////////////
 
 const uint16_t SIZEOF_CSWITCH = sizeof(profiler::BaseBlockData) + 1 + sizeof(uint16_t);
+const uint16_t BLOCKS_CHUNK_SIZE = SIZEOF_CSWITCH * (uint16_t)128U;
 
 typedef std::vector<profiler::SerializedBlock*> serialized_list_t;
 
 template <class T, const uint16_t N>
 struct BlocksList
 {
-    BlocksList() = default;
+    typedef chunk_allocator<N> closed_list_t;
+
+    BlocksList() : closedList(new closed_list_t), lastBegin(0) {}
+    BlocksList(const BlocksList&) = delete;
+    BlocksList& operator = (const BlocksList&) = delete;
+
+    ~BlocksList() {
+        delete closedList.load(std::memory_order_relaxed);
+    }
 
     class Stack {
         //std::stack<T> m_stack;
@@ -298,21 +550,141 @@ struct BlocksList
         }
     };
 
-    Stack                     openedList;
-    chunk_allocator<N>        closedList;
-    uint64_t          usedMemorySize = 0;
+    Stack                          openedList;
+    std::atomic<closed_list_t*>    closedList; ///< Can be replaced by snapshot (see ProfileManager::dumpSnapshotToFile)
+    profiler::timestamp_t           lastBegin; ///< Begin time of the last stored block (base for compact encoding)
+    RuntimeNamesCache                   names; ///< Runtime names cache used by the thread storing into this list
+
+    inline closed_list_t& closed() {
+        return *closedList.load(std::memory_order_acquire);
+    }
+
+    /** Replaces closed list with the new (empty) one and returns the old one. */
+    inline closed_list_t* detachClosed() {
+        return closedList.exchange(new closed_list_t, std::memory_order_acq_rel);
+    }
 
     void clearClosed() {
-        //closedList.clear();
-        usedMemorySize = 0;
+        auto& list = closed();
+        if (!list.empty())
+            list.clear();
     }
 };
 
 
+/** Per-descriptor invocations counters of sampled blocks (see BaseBlockDescriptor::sampling()).
+
+Pages are allocated by ProfileManager for all threads before sampling rate of a descriptor is set,
+so the owner thread only increments counters. Owner thread allocates a page itself only if it was started
+after sampling rate had been set. Pages are freed only in destructor.
+*/
+class SamplingCounters EASY_FINAL
+{
+    enum : uint32_t { PAGE_SIZE = 256, MAX_PAGES = 256 }; ///< Up to 65536 block descriptors
+
+    std::atomic<uint16_t*> m_pages[MAX_PAGES];
+
+public:
+
+    SamplingCounters();
+    ~SamplingCounters();
+
+    /** Allocates counter for given descriptor. Can be called by any thread.
+
+    \retval nullptr if descriptor id is too big.
+    */
+    uint16_t* reserve(profiler::block_id_t _id);
+
+    /** Returns counter for given descriptor allocating it if necessary. Must be called by owner thread only. */
+    inline uint16_t* get(profiler::block_id_t _id)
+    {
+        if (_id >= PAGE_SIZE * MAX_PAGES)
+            return nullptr;
+        auto page = m_pages[_id / PAGE_SIZE].load(std::memory_order_acquire);
+        return page != nullptr ? page + _id % PAGE_SIZE : reserve(_id);
+    }
+
+private:
+
+    SamplingCounters(const SamplingCounters&) = delete;
+    SamplingCounters& operator = (const SamplingCounters&) = delete;
+};
+
+/** Per-descriptor numbers of stored blocks in the current events governor window (see ProfileManager::governEvents).
+
+Counter is valid only for the window it has been counted in, so counters are not cleared when a new window begins.
+Must be used by owner thread only.
+*/
+class EventsCounters EASY_FINAL
+{
+    enum : uint32_t { PAGE_SIZE = 256, MAX_PAGES = 256 }; ///< Up to 65536 block descriptors
+
+    struct counter { uint32_t window; uint32_t value; };
+
+    std::unique_ptr<counter[]> m_pages[MAX_PAGES];
+    uint32_t                           m_window = 1; ///< Number of the current window (pages are allocated with zero windows)
+
+public:
+
+    /** Starts new window. */
+    inline void next()
+    {
+        ++m_window;
+    }
+
+    /** Increments counter of given descriptor and returns it's new value.
+
+    \retval 0 if descriptor id is too big.
+    */
+    inline uint32_t increment(profiler::block_id_t _id)
+    {
+        if (_id >= PAGE_SIZE * MAX_PAGES)
+            return 0;
+
+        auto& page = m_pages[_id / PAGE_SIZE];
+        if (page == nullptr)
+            page.reset(new counter[PAGE_SIZE]());
+
+        auto& c = page[_id % PAGE_SIZE];
+        if (c.window != m_window)
+        {
+            c.window = m_window;
+            c.value = 0;
+        }
+
+        return ++c.value;
+    }
+
+    /** Resets counter of given descriptor in the current window. */
+    inline void reset(profiler::block_id_t _id)
+    {
+        if (_id < PAGE_SIZE * MAX_PAGES && m_pages[_id / PAGE_SIZE] != nullptr)
+            m_pages[_id / PAGE_SIZE][_id % PAGE_SIZE].value = 0;
+    }
+};
+
+/** Block of the current frame waiting for tail sampling decision (see ProfileManager::finishFrame). */
+struct BufferedBlock
+{
+    profiler::compact::header header;
+    uint16_t              nameLength;
+};
+
 struct ThreadStorage
 {
-    BlocksList<std::reference_wrapper<profiler::Block>, SIZEOF_CSWITCH * (uint16_t)128U> blocks;
-    BlocksList<profiler::Block, SIZEOF_CSWITCH * (uint16_t)128U>                           sync;
+    BlocksList<std::reference_wrapper<profiler::Block>, BLOCKS_CHUNK_SIZE> blocks;
+    BlocksList<profiler::Block, BLOCKS_CHUNK_SIZE>                         sync;
+    SamplingCounters      samplingCounters; ///< Per-descriptor invocations counters for blocks with sampling rate > 1 (see BaseBlockDescriptor::sampling())
+    profiler::histograms_table  histograms; ///< Per-descriptor durations histograms for profiler::CAPTURE_MODE_STATISTICS
+    profiler::hardware_counters   counters; ///< Hardware performance counters of this thread (see profiler::BLOCK_FLAG_HARDWARE_COUNTERS)
+    std::vector<BufferedBlock> frameBlocks; ///< Blocks of the current frame if tail sampling is enabled (see setTailSamplingThreshold)
+    std::list<profiler::Block>  lockBlocks; ///< Opened lock blocks, they are not in blocks.openedList (see ProfileManager::beginLockBlock)
+    std::unique_ptr<profiler::duration_histogram> frameDurations; ///< Durations of previous frames for the running percentile
+    profiler::timestamp_t   frameThreshold; ///< Cached running percentile of frames durations (in ticks)
+    uint32_t                  framesNumber; ///< Number of frames added into frameDurations
+    EventsCounters          eventsCounters; ///< Per-descriptor numbers of stored blocks in the current governor window (see setEventsBudget)
+    profiler::timestamp_t eventsWindowBegin;
+    profiler::timestamp_t   eventsWindowEnd;
     std::string name;
 
 #ifndef _WIN32
@@ -322,23 +694,211 @@ struct ThreadStorage
     const profiler::thread_id_t id;
     std::atomic<char> expired;
     std::atomic_bool frame; ///< is new frame working
+    std::atomic_bool storing; ///< is storing block into blocks.closedList right now (see ProfileManager::dumpSnapshotToFile)
     bool allowChildren;
     bool named;
     bool guarded;
+    bool bufferFrame; ///< Blocks of the current frame are stored into frameBlocks
+    bool keepFrame; ///< Buffered frame contains internal events and must be committed (see ProfileManager::finishFrame)
 
     void storeBlock(const profiler::Block& _block);
     void storeCSwitch(const profiler::Block& _block);
+    void bufferBlock(const profiler::Block& _block);
+    void startCounters(profiler::Block& _block);
+    void stopCounters(profiler::Block& _block);
+    void commitFrame();
     void clearClosed();
 
-    ThreadStorage();
+    /** Returns true if current invocation of the block with given id must be stored (only 1 of _sampling invocations is stored). */
+    inline bool sampled(profiler::block_id_t _id, uint16_t _sampling)
+    {
+        auto counter = samplingCounters.get(_id);
+        if (counter == nullptr)
+            return true;
+        const bool result = *counter == 0;
+        if (++*counter >= _sampling)
+            *counter = 0;
+        return result;
+    }
+
+    explicit ThreadStorage(profiler::thread_id_t _id);
+    ~ThreadStorage();
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+#ifndef EASY_THREADS_INDEX_CAPACITY
+# define EASY_THREADS_INDEX_CAPACITY 8192 // must be a power of 2
+#endif
+
+#ifndef EASY_THREADS_SEGMENT_SIZE
+# define EASY_THREADS_SEGMENT_SIZE 64
+#endif
+
+#ifndef EASY_THREADS_MAX_SEGMENTS
+# define EASY_THREADS_MAX_SEGMENTS 4096
+#endif
+
+/** Registry of thread storages with lock-free lookups.
+
+ThreadStorage objects are placed into fixed-size segments which are never moved or freed
+until the registry is destroyed, so the address of a storage is stable.
+
+New storage takes a slot from the free-list (slots of expired threads) or from the end of
+the slots array and is published in the open-addressing index (thread id -> slot number).
+Lookups are lock-free, index entries are changed under m_indexSpin (threads are registered rarely):
+released entries are reused by registration and are emptied when they are not needed for probing,
+so lookup of unregistered thread does not walk through entries of all expired threads.
+
+\note release() must not be called concurrently with get() for the same thread id
+(ProfileManager calls it only for expired threads while holding m_spin).
+*/
+class ThreadStorageRegistry EASY_FINAL
+{
+    struct slot
+    {
+        typename std::aligned_storage<sizeof(ThreadStorage), alignof(ThreadStorage)>::type storage;
+        std::atomic<uint32_t> nextFree;
+        std::atomic<char>         live;
+
+        slot() : nextFree(0), live(0) {}
+
+        inline ThreadStorage& get() { return *reinterpret_cast<ThreadStorage*>(&storage); }
+    };
+
+    struct segment { slot slots[EASY_THREADS_SEGMENT_SIZE]; };
+
+    typedef std::atomic<uint64_t> index_entry_t; ///< (thread_id << 32) | (slot number + 1), 0 means empty entry, (thread_id << 32) means released entry
+
+    std::atomic<segment*> m_segments[EASY_THREADS_MAX_SEGMENTS];
+    index_entry_t*                                       m_index;
+    std::atomic<uint32_t>                                 m_size; ///< Number of ever used slots
+    std::atomic<uint64_t>                             m_freeHead; ///< (ABA tag << 32) | (slot number + 1)
+    profiler::spin_lock                              m_indexSpin; ///< Serializes changes of index entries (see release())
+
+public:
+
+    ThreadStorageRegistry();
+    ~ThreadStorageRegistry();
+
+    /** Returns storage for the thread or nullptr if there is no one. */
+    ThreadStorage* find(profiler::thread_id_t _id) const;
+
+    /** Returns storage for the thread creating it if there is no one.
+
+    \note Returns nullptr only if there are no free slots or no free index entries left. */
+    ThreadStorage* get(profiler::thread_id_t _id);
+
+    /** Destroys storage in the slot and returns the slot to the free-list. */
+    void release(uint32_t _slot);
+
+    /** Returns number of slots which can be iterated with at(). */
+    inline uint32_t size() const
+    {
+        return m_size.load(std::memory_order_acquire);
+    }
+
+    /** Returns live storage in the slot or nullptr if slot is free. */
+    inline ThreadStorage* at(uint32_t _slot) const
+    {
+        auto s = slotAt(_slot);
+        return s != nullptr && s->live.load(std::memory_order_acquire) != 0 ? &s->get() : nullptr;
+    }
+
+private:
+
+    ThreadStorageRegistry(const ThreadStorageRegistry&) = delete;
+    ThreadStorageRegistry& operator = (const ThreadStorageRegistry&) = delete;
+
+    static inline uint32_t hash(profiler::thread_id_t _id)
+    {
+        return (_id * 2654435761U) & (EASY_THREADS_INDEX_CAPACITY - 1);
+    }
+
+    inline slot* slotAt(uint32_t _slot) const
+    {
+        auto seg = m_segments[_slot / EASY_THREADS_SEGMENT_SIZE].load(std::memory_order_acquire);
+        return seg != nullptr ? seg->slots + (_slot % EASY_THREADS_SEGMENT_SIZE) : nullptr;
+    }
+
+    /** Returns slot which is known to be allocated. */
+    inline slot& usedSlot(uint32_t _slot) const
+    {
+        return m_segments[_slot / EASY_THREADS_SEGMENT_SIZE].load(std::memory_order_acquire)->slots[_slot % EASY_THREADS_SEGMENT_SIZE];
+    }
+
+    bool allocate(uint32_t& _slot);
+    void deallocate(uint32_t _slot);
 };
 
 //////////////////////////////////////////////////////////////////////////
 
 typedef uint32_t processid_t;
 
+/** Fires triggered capture when block with descriptor id is not shorter than duration.
+
+Slots are written under ProfileManager::m_triggerSpin and read without locks by endBlock().
+*/
+struct BlockTrigger
+{
+    std::atomic<profiler::block_id_t>    id;
+    std::atomic<uint32_t>          duration; ///< Nanoseconds, 0 - free slot
+};
+
 class BlockDescriptor;
 
+/** Per-descriptor throttling state of the events governor (see ProfileManager::governEvents).
+
+Governor does not change descriptors (their status and sampling rate are set by user and written into files):
+throttling factor multiplies descriptor sampling rate and it is reset when profiling is enabled.
+Descriptors are added on registration, pages are freed only in destructor, so entries are read without locks.
+*/
+class GovernorTable EASY_FINAL
+{
+    enum : uint32_t { PAGE_SIZE = 256, MAX_PAGES = 256 }; ///< Up to 65536 block descriptors
+
+    struct entry
+    {
+        std::atomic<const BlockDescriptor*> descriptor;
+        std::atomic<uint16_t>                   factor; ///< 0 or 1 - not throttled, THROTTLED_OFF - turned OFF
+    };
+
+    std::atomic<entry*> m_pages[MAX_PAGES];
+
+public:
+
+    enum : uint16_t { THROTTLED_OFF = 0xffff };
+
+    GovernorTable();
+    ~GovernorTable();
+
+    /** Adds registered descriptor. Must be called under the lock of descriptors registration. */
+    void add(const BlockDescriptor* _descriptor, profiler::block_id_t _id);
+
+    /** Resets throttling factors of all descriptors. */
+    void reset();
+
+    /** Returns added descriptor or nullptr. */
+    const BlockDescriptor* descriptor(profiler::block_id_t _id) const;
+
+    /** Returns throttling factor of the descriptor (0 if it has not been throttled). */
+    inline uint16_t factor(profiler::block_id_t _id) const
+    {
+        if (_id >= PAGE_SIZE * MAX_PAGES)
+            return 0;
+        auto page = m_pages[_id / PAGE_SIZE].load(std::memory_order_acquire);
+        return page != nullptr ? page[_id % PAGE_SIZE].factor.load(std::memory_order_relaxed) : static_cast<uint16_t>(0);
+    }
+
+    /** Replaces throttling factor if it has not been changed by another thread (_expected is updated otherwise). */
+    bool replace(profiler::block_id_t _id, uint16_t& _expected, uint16_t _factor);
+
+private:
+
+    GovernorTable(const GovernorTable&) = delete;
+    GovernorTable& operator = (const GovernorTable&) = delete;
+};
+
 class ProfileManager
 {
 #ifndef EASY_MAGIC_STATIC_CPP11
@@ -350,7 +910,6 @@ class ProfileManager
     ProfileManager& operator=(const ProfileManager&) = delete;
 
     typedef profiler::guard_lock<profiler::spin_lock> guard_lock_t;
-    typedef std::map<profiler::thread_id_t, ThreadStorage> map_of_threads_stacks;
     typedef std::vector<BlockDescriptor*> block_descriptors_t;
 
 #ifdef EASY_PROFILER_HASHED_CSTR_DEFINED
@@ -361,7 +920,7 @@ class ProfileManager
 
     const processid_t               m_processId;
 
-    map_of_threads_stacks             m_threads;
+    ThreadStorageRegistry             m_threads;
     block_descriptors_t           m_descriptors;
     descriptors_map_t          m_descriptorsMap;
     uint64_t                   m_usedMemorySize;
@@ -373,11 +932,57 @@ class ProfileManager
     std::atomic<char>          m_profilerStatus;
     std::atomic_bool    m_isEventTracingEnabled;
     std::atomic_bool       m_isAlreadyListening;
+    std::atomic<uint32_t> m_flightRecorderChunks;
+    std::atomic<uint32_t>     m_minBlockDuration; ///< Global minimum duration of stored blocks (nanoseconds)
+    std::atomic<uint8_t>           m_captureMode; ///< See profiler::CaptureMode
+    profiler::histograms_table m_retiredHistograms; ///< Histograms of released threads (guarded by m_spin)
+    std::atomic<uint32_t>        m_tailThreshold; ///< Frames shorter than this (nanoseconds) are discarded, 0 - disabled
+    std::atomic<uint32_t>       m_tailPercentile; ///< Frames faster than this running percentile (parts per million) are discarded, 0 - disabled
+
+    enum : uint32_t { MAX_BLOCK_TRIGGERS = 16 };
+
+    struct TriggerCapture;
+
+    std::unique_ptr<TriggerCapture> m_triggerCapture; ///< Guarded by m_triggerSpin
+    profiler::spin_lock                m_triggerSpin;
+    std::atomic<profiler::timestamp_t> m_triggerTime; ///< Time of the pending trigger, 0 - there is no pending trigger
+    std::atomic_bool                  m_triggerArmed;
+    std::atomic_bool                   m_stopTrigger;
+    std::atomic<uint32_t>      m_blockTriggersNumber;
+    bool                         m_triggerCaptureOn; ///< Triggered capture is started (guarded by m_dumpSpin)
+    bool                                m_streamOn; ///< Blocks are being streamed into file (guarded by m_dumpSpin)
+    bool                          m_networkCapture; ///< Capture requested by GUI is running (guarded by m_dumpSpin)
+    BlockTrigger m_blockTriggers[MAX_BLOCK_TRIGGERS];
+    std::atomic<uint32_t>         m_eventsBudget; ///< Maximum number of stored blocks per second per descriptor in each thread, 0 - unlimited
+    GovernorTable                     m_governor; ///< Descriptors throttled by governEvents()
+    std::atomic_bool              m_frameCpuTime; ///< Thread CPU time is measured for top-level blocks
+    std::atomic_bool       m_clockSourceSelected; ///< Clock source self-test is done or source is set explicitly (guarded by m_dumpSpin)
 
     std::string m_csInfoFilename = "/tmp/cs_profiling_info.log";
 
-    uint32_t dumpBlocksToStream(profiler::OStream& _outputStream, bool _lockSpin);
+    struct Snapshot;
+    struct StreamFile;
+
+    std::thread                  m_snapshotThread;
+    std::thread                     m_flushThread;
+    std::unique_ptr<StreamFile>      m_streamFile;
+    profiler::spin_lock              m_streamSpin;
+    std::atomic_bool                  m_stopFlush;
+    RuntimeNamesTable              m_runtimeNames;
+    profiler::cpu_frequency        m_cpuFrequency;
+
+    uint32_t dumpBlocksToStream(profiler::OStream& _outputStream, bool _lockSpin, const StreamFile* _streamFile = nullptr);
+    void detachThreads(Snapshot& _snapshot, profiler::timestamp_t _now);
+    void writeSnapshot(Snapshot& _snapshot) const;
+    void flushStream();
+    void watchTriggers();
+    void writeTriggerCapture(TriggerCapture& _capture, profiler::timestamp_t _beginTime);
+    void writeHeader(profiler::OStream& _outputStream, const Snapshot& _info, uint64_t _descriptorsOffset, uint64_t _sectionsOffset) const;
     void setBlockStatus(profiler::block_id_t _id, profiler::EasyBlockStatus _status);
+    const profiler::BaseBlockDescriptor* lockDescriptor(profiler::LockBlock _type);
+    const profiler::BaseBlockDescriptor* addLockDescriptor(const char* _autogenUniqueId, const char* _name, int _line, profiler::color_t _color, uint8_t _flag);
+    static profiler::ClockSource selectClockSource(profiler::ClockSource _preferred);
+    void selectClockSourceOnce();
 
     std::thread m_listenThread;
     void listen(uint16_t _port);
@@ -398,15 +1003,30 @@ public:
                                                             profiler::color_t _color,
                                                             bool _copyName = false);
 
-    bool storeBlock(const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName);
+    bool storeBlock(const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName, const uint64_t* _flowId = nullptr);
     void beginBlock(profiler::Block& _block);
     void endBlock();
+    void beginLockBlock(profiler::LockBlock _type, const void* _lock);
+    void endLockBlock(const void* _lock);
     void setEnabled(bool isEnable);
     void setEventTracingEnabled(bool _isEnable);
     uint32_t dumpBlocksToFile(const char* filename);
+    uint32_t dumpSnapshotToFile(const char* filename);
+    bool startStreamingBlocksToFile(const char* filename);
+    uint32_t stopStreamingBlocksToFile();
     const char* registerThread(const char* name, profiler::ThreadGuard& threadGuard);
     const char* registerThread(const char* name);
 
+    inline uint32_t internRuntimeName(const char* _name, size_t _hash)
+    {
+        return m_runtimeNames.intern(_name, _hash);
+    }
+
+    inline uint32_t runtimeNamesGeneration() const
+    {
+        return m_runtimeNames.generation();
+    }
+
     void setContextSwitchLogFilename(const char* name)
     {
         m_csInfoFilename = name;
@@ -417,6 +1037,93 @@ public:
         return m_csInfoFilename.c_str();
     }
 
+    void setFlightRecorderChunks(uint32_t _chunksNumber)
+    {
+        m_flightRecorderChunks.store(_chunksNumber, std::memory_order_release);
+    }
+
+    inline uint32_t flightRecorderChunks() const
+    {
+        return m_flightRecorderChunks.load(std::memory_order_relaxed);
+    }
+
+    bool setClockSource(profiler::ClockSource _source);
+    void setBlockSampling(profiler::block_id_t _id, uint16_t _sampling);
+    void setBlockMinDuration(profiler::block_id_t _id, uint32_t _nanoseconds);
+    bool setBlockHardwareCounters(profiler::block_id_t _id, bool _enable);
+    bool setBlockCpuTime(profiler::block_id_t _id, bool _enable);
+
+    inline void setMinBlockDuration(uint32_t _nanoseconds)
+    {
+        m_minBlockDuration.store(_nanoseconds, std::memory_order_release);
+    }
+
+    inline uint32_t minBlockDuration() const
+    {
+        return m_minBlockDuration.load(std::memory_order_relaxed);
+    }
+
+    inline void setCaptureMode(profiler::CaptureMode _mode)
+    {
+        if (_mode < profiler::CAPTURE_MODES_NUMBER)
+            m_captureMode.store(_mode, std::memory_order_release);
+    }
+
+    inline profiler::CaptureMode captureMode() const
+    {
+        return static_cast<profiler::CaptureMode>(m_captureMode.load(std::memory_order_acquire));
+    }
+
+    bool aggregatedStatistics(profiler::block_id_t _id, profiler::AggregatedStatistics& _stats);
+
+    inline void setTailSamplingThreshold(uint32_t _nanoseconds)
+    {
+        m_tailThreshold.store(_nanoseconds, std::memory_order_release);
+    }
+
+    inline uint32_t tailSamplingThreshold() const
+    {
+        return m_tailThreshold.load(std::memory_order_relaxed);
+    }
+
+    void setTailSamplingPercentile(double _percentile);
+    double tailSamplingPercentile() const;
+
+    bool startTriggeredCapture(const char* _filenamePrefix, uint32_t _beforeMs, uint32_t _afterMs, uint32_t _filesNumber);
+    uint32_t stopTriggeredCapture();
+    bool trigger();
+    bool setBlockTrigger(profiler::block_id_t _id, uint32_t _nanoseconds);
+
+    inline void setEventsBudget(uint32_t _eventsPerSecond)
+    {
+        m_eventsBudget.store(_eventsPerSecond, std::memory_order_release);
+    }
+
+    inline uint32_t eventsBudget() const
+    {
+        return m_eventsBudget.load(std::memory_order_relaxed);
+    }
+
+    inline void setFrameCpuTime(bool _enable)
+    {
+        m_frameCpuTime.store(_enable, std::memory_order_release);
+    }
+
+    inline bool frameCpuTime() const
+    {
+        return m_frameCpuTime.load(std::memory_order_relaxed);
+    }
+
+    inline int64_t cpuFrequency() const
+    {
+        return m_cpuFrequency.get();
+    }
+
+    inline profiler::ClockSource clockSource() const
+    {
+        return profiler::clock::current_source::get();
+    }
+
     void beginContextSwitch(profiler::thread_id_t _thread_id, profiler::timestamp_t _time, profiler::thread_id_t _target_thread_id, const char* _target_process, bool _lockSpin = true);
     void endContextSwitch(profiler::thread_id_t _thread_id, processid_t _process_id, profiler::timestamp_t _endtime, bool _lockSpin = true);
     void startListen(uint16_t _port);
@@ -428,24 +1135,51 @@ private:
     void disableEventTracer();
 
     char checkThreadExpired(ThreadStorage& _registeredThread);
+    void releaseThread(uint32_t _slot);
+    void finishFrame(ThreadStorage& _registeredThread, const profiler::Block& _frame);
+    void checkBlockTriggers(const profiler::Block& _block);
+#ifndef _WIN32
+    void readContextSwitchLog();
+#endif
+    void governEvents(ThreadStorage& _registeredThread, const profiler::Block& _block, uint32_t _budget);
+    void throttleDescriptor(profiler::block_id_t _id, uint32_t _factor);
+
+    /** Applies throttling of the events governor to the sampling rate of descriptor (see governEvents).
+
+    \retval false if blocks of the descriptor have been turned OFF by the governor. */
+    inline bool governed(profiler::block_id_t _id, uint16_t& _sampling) const
+    {
+        if (m_eventsBudget.load(std::memory_order_relaxed) == 0)
+            return true;
+
+        const uint32_t factor = m_governor.factor(_id);
+        if (factor < 2)
+            return true;
+
+        if (factor == GovernorTable::THROTTLED_OFF)
+            return false;
+
+        _sampling = static_cast<uint16_t>(std::min<uint32_t>(_sampling * factor, 0xffff));
+        return true;
+    }
+
+    bool closeBlock(profiler::Block& _block);
+    void reserveSamplingCounters(profiler::block_id_t _id);
+    void resetHistograms();
 
     void storeBlockForce(const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName, ::profiler::timestamp_t& _timestamp);
     void storeBlockForce2(const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName, ::profiler::timestamp_t _timestamp);
+    void storeInternalEvent(const profiler::Block& _event);
     void storeBlockForce2(ThreadStorage& _registeredThread, const profiler::BaseBlockDescriptor* _desc, const char* _runtimeName, ::profiler::timestamp_t _timestamp);
 
-    ThreadStorage& _threadStorage(profiler::thread_id_t _thread_id);
-    ThreadStorage* _findThreadStorage(profiler::thread_id_t _thread_id);
-
-    inline ThreadStorage& threadStorage(profiler::thread_id_t _thread_id)
+    inline ThreadStorage* threadStorage(profiler::thread_id_t _thread_id)
     {
-        guard_lock_t lock(m_spin);
-        return _threadStorage(_thread_id);
+        return m_threads.get(_thread_id);
     }
 
     inline ThreadStorage* findThreadStorage(profiler::thread_id_t _thread_id)
     {
-        guard_lock_t lock(m_spin);
-        return _findThreadStorage(_thread_id);
+        return m_threads.find(_thread_id);
     }
 };
 
@@ -58,11 +58,15 @@
 
 #include "easy/reader.h"
 #include "hashed_cstr.h"
+#include "compact_block.h"
+#include "mapped_file.h"
 #include <fstream>
 #include <sstream>
 #include <iterator>
+#include <limits>
 #include <algorithm>
 #include <unordered_map>
+#include <deque>
 #include <thread>
 
 //////////////////////////////////////////////////////////////////////////
@@ -75,6 +79,9 @@ extern const uint32_t EASY_CURRENT_VERSION;
 # define EASY_VERSION_INT(v_major, v_minor, v_patch) ((static_cast<uint32_t>(v_major) << 24) | (static_cast<uint32_t>(v_minor) << 16) | static_cast<uint32_t>(v_patch))
 const uint32_t MIN_COMPATIBLE_VERSION = EASY_VERSION_INT(0, 1, 0); ///< minimal compatible version (.prof file format was not changed seriously since this version)
 const uint32_t EASY_V_100 = EASY_VERSION_INT(1, 0, 0); ///< in v1.0.0 some additional data were added into .prof file
+const uint32_t EASY_V_110 = EASY_VERSION_INT(1, 1, 0); ///< in v1.1.0 header got descriptors offset, runtime names table, clock source and sections table,
+                                                        ///< block descriptors got sampling rate, minimum duration and flags,
+                                                        ///< blocks are written in compact encoding with extensions (see profiler::compact)
 # undef EASY_VERSION_INT
 
 const uint64_t TIME_FACTOR = 1000000000ULL;
@@ -112,6 +119,132 @@ inline bool isCompatibleVersion(uint32_t _version)
     return _version >= MIN_COMPATIBLE_VERSION;
 }
 
+struct RuntimeName
+{
+    const char* name; ///< Zero-terminated name
+    uint16_t  length;
+};
+
+typedef ::std::vector<RuntimeName> runtime_names_t;
+
+/** Returns pointer to the next _size bytes of the stream (copied into _buffer) or nullptr if the stream has ended. */
+inline const char* read_record(::std::stringstream& _inFile, uint16_t _size, ::std::vector<char>& _buffer)
+{
+    _buffer.resize(_size);
+    _inFile.read(_buffer.data(), _size);
+    return _inFile.eof() ? nullptr : _buffer.data();
+}
+
+/** Returns pointer to the next _size bytes of the mapped file without copying or nullptr if the file has ended. */
+inline const char* read_record(::profiler::MemoryStream& _inFile, uint16_t _size, ::std::vector<char>&)
+{
+    return _inFile.take(_size);
+}
+
+/** Reads block record of _size bytes into _data decoding it if necessary.
+
+\param _names Runtime names table read after block descriptors.
+\param _lastBegin Begin time of the previous compact record in the current list.
+\param _available Number of bytes available at _data.
+\param _buffer Temporary buffer for compact record (not used when reading mapped file).
+\param _nameId Runtime name id of the block (0 if block has no interned runtime name).
+\param _extensions Extensions which values follow decoded name (see profiler::compact::Extension).
+
+\retval Size of the block data written into _data or 0 if record is corrupted.
+*/
+template <class TStream>
+inline uint16_t read_block(TStream& _inFile, uint16_t _size, bool _compact, const runtime_names_t& _names,
+                           ::profiler::timestamp_t& _lastBegin, char* _data, uint64_t _available, ::std::vector<char>& _buffer, uint32_t& _nameId, uint8_t& _extensions)
+{
+    _nameId = 0;
+    _extensions = 0;
+
+    if (!_compact)
+    {
+        _inFile.read(_data, _size);
+        return _size;
+    }
+
+    const char* record = read_record(_inFile, _size, _buffer);
+    if (record == nullptr)
+        return 0;
+
+    ::profiler::compact::header header;
+    const auto header_size = ::profiler::compact::decode_header(record, _size, _lastBegin, header);
+    if (header_size == 0 || header_size != _size)
+        return 0;
+
+    const char* name = "";
+    uint16_t name_length = 0;
+    if (header.name_id != 0)
+    {
+        if (header.name_id > _names.size())
+            return 0;
+
+        const auto& runtime_name = _names[header.name_id - 1];
+        name = runtime_name.name;
+        name_length = runtime_name.length;
+        _nameId = header.name_id;
+    }
+
+    if (::profiler::compact::decoded_size(header, name_length) > _available)
+        return 0;
+
+    _extensions = header.extensions;
+    return ::profiler::compact::write_decoded(header, name, name_length, _data);
+}
+
+/** Returns total size of block descriptor fields which are absent in the file of given version. */
+inline uint16_t missing_descriptor_fields_size(uint32_t _version)
+{
+    if (_version >= EASY_V_110)
+        return 0;
+    return static_cast<uint16_t>(sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint8_t)); // sampling rate, minimum duration, flags
+}
+
+/** Reads block descriptor of _size bytes into _data.
+
+Fields which were added into descriptor in v1.1.0 (sampling rate, minimum duration and flags)
+are inserted with default values for older files.
+
+\retval Size of the descriptor written into _data.
+*/
+template <class TStream>
+inline uint16_t read_descriptor(TStream& _inFile, uint32_t _version, uint16_t _size, char* _data)
+{
+    const auto missing = missing_descriptor_fields_size(_version);
+    const auto shift = static_cast<uint16_t>(sizeof(::profiler::BaseBlockDescriptor) - missing);
+    if (missing == 0 || _size < shift)
+    {
+        _inFile.read(_data, _size);
+        return _size;
+    }
+
+    _inFile.read(_data, shift);
+
+    char* field = _data + shift;
+
+    const uint16_t sampling = 1;
+    memcpy(field, &sampling, sizeof(sampling));
+    field += sizeof(sampling);
+
+    const uint32_t minDuration = 0;
+    memcpy(field, &minDuration, sizeof(minDuration));
+    field += sizeof(minDuration);
+
+    *field = 0; // flags
+
+    _inFile.read(_data + sizeof(::profiler::BaseBlockDescriptor), _size - shift);
+
+    return _size + missing;
+}
+
+/** Returns size of the memory required for descriptors read by read_descriptor(). */
+inline uint64_t descriptors_memory(uint32_t _version, uint32_t _descriptorsNumber, uint64_t _fileMemorySize)
+{
+    return _fileMemorySize + static_cast<uint64_t>(_descriptorsNumber) * missing_descriptor_fields_size(_version);
+}
+
 inline void write(::std::stringstream& _stream, const char* _value, size_t _size)
 {
     _stream.write(_value, _size);
@@ -156,17 +289,6 @@ namespace profiler {
         }
     }
 
-    extern "C" PROFILER_API void release_stats(BlockStatistics*& _stats)
-    {
-        if (_stats == nullptr)
-            return;
-
-        if (--_stats->calls_number == 0)
-            delete _stats;
-
-        _stats = nullptr;
-    }
-
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -192,21 +314,66 @@ typedef ::std::unordered_map<::profiler::hashed_stdstring, ::profiler::BlockStat
 
 //////////////////////////////////////////////////////////////////////////
 
+/** Returns thread CPU time of the block limited by it's duration (clocks have different granularity). */
+inline ::profiler::timestamp_t block_cpu_time(const ::profiler::BlocksTree& _block)
+{
+    const auto duration = _block.node->duration();
+    const auto cpu_time = _block.cpu_time();
+    return cpu_time < duration ? cpu_time : duration;
+}
+
+/** Adds hardware counters and thread CPU time of the block (if it has them) scaled by sampling rate into statistics. */
+inline void add_extensions(::profiler::BlockStatistics& _stats, const ::profiler::BlocksTree& _current, uint16_t _sampling)
+{
+    const auto counters = _current.counters();
+    if (counters != nullptr)
+    {
+        _stats.counters.instructions += counters->instructions * _sampling;
+        _stats.counters.cycles += counters->cycles * _sampling;
+        _stats.counters.cache_misses += counters->cache_misses * _sampling;
+    }
+
+    if (_current.has_cpu_time)
+    {
+        _stats.total_cpu_time += block_cpu_time(_current) * _sampling;
+        _stats.cpu_timed_duration += _current.node->duration() * _sampling;
+    }
+}
+
+/** Adds thread CPU time of the top-level block into thread totals.
+
+If there are no context switches for the thread then it's wait time is estimated as off-CPU time of frames.
+*/
+inline void add_frame_cpu_time(::profiler::BlocksTreeRoot& _root, const ::profiler::BlocksTree& _frame)
+{
+    if (!_frame.has_cpu_time)
+        return;
+
+    const auto cpu_time = block_cpu_time(_frame);
+    _root.cpu_time += cpu_time;
+    if (_root.sync.empty())
+        _root.wait_time += _frame.node->duration() - cpu_time;
+}
+
 /** \brief Updates statistics for a profiler block.
 
-\param _stats_map Storage of statistics for blocks.
+\param _stats_map Statistics for blocks ids (or names for context switches).
+\param _storage Storage of the thread statistics where new statistics are created.
 \param _current Pointer to the current block.
-\param _stats Reference to the variable where pointer to the block statistics must be written.
 
 \note All blocks with similar name have the same pointer to statistics information.
 
 \note As all profiler block keeps a pointer to it's statistics, all similar blocks
 automatically receive statistics update.
 
+\note If only 1 of N invocations of the block was stored (see BaseBlockDescriptor::sampling()) then
+calls number, total duration, hardware counters and CPU time are scaled by N.
+
 */
-::profiler::BlockStatistics* update_statistics(StatsMap& _stats_map, const ::profiler::BlocksTree& _current, ::profiler::block_index_t _current_index, ::profiler::block_index_t _parent_index, const ::profiler::blocks_t& _blocks)
+::profiler::BlockStatistics* update_statistics(StatsMap& _stats_map, ::profiler::BlockStatisticsStorage& _storage, const ::profiler::BlocksTree& _current, ::profiler::block_index_t _current_index, ::profiler::block_index_t _parent_index, const ::profiler::descriptors_list_t& _descriptors)
 {
     auto duration = _current.node->duration();
+    const auto sampling = _descriptors[_current.node->id()]->sampling();
     //StatsMap::key_type key(_current.node->name());
     //auto it = _stats_map.find(key);
     auto it = _stats_map.find(_current.node->id());
@@ -216,21 +383,22 @@ automatically receive statistics update.
 
         auto stats = it->second; // write pointer to statistics into output (this is BlocksTree:: per_thread_stats or per_parent_stats or per_frame_stats)
 
-        ++stats->calls_number; // update calls number of this block
-        stats->total_duration += duration; // update summary duration of all block calls
+        stats->calls_number += sampling; // update calls number of this block
+        stats->total_duration += duration * sampling; // update summary duration of all block calls
+        add_extensions(*stats, _current, sampling);
 
-        if (duration > _blocks[stats->max_duration_block].node->duration())
+        if (duration > stats->max_duration)
         {
             // update max duration
             stats->max_duration_block = _current_index;
-            //stats->max_duration = duration;
+            stats->max_duration = duration;
         }
 
-        if (duration < _blocks[stats->min_duration_block].node->duration())
+        if (duration < stats->min_duration)
         {
             // update min duraton
             stats->min_duration_block = _current_index;
-            //stats->min_duration = duration;
+            stats->min_duration = duration;
         }
 
         // average duration is calculated inside average_duration() method by dividing total_duration to the calls_number
@@ -240,14 +408,17 @@ automatically receive statistics update.
 
     // This is first time the block appear in the file.
     // Create new statistics.
-    auto stats = new ::profiler::BlockStatistics(duration, _current_index, _parent_index);
+    auto stats = _storage.emplace(duration * sampling, _current_index, _parent_index);
+    stats->min_duration = stats->max_duration = duration;
+    stats->calls_number = sampling;
+    add_extensions(*stats, _current, sampling);
     //_stats_map.emplace(key, stats);
     _stats_map.emplace(_current.node->id(), stats);
 
     return stats;
 }
 
-::profiler::BlockStatistics* update_statistics(CsStatsMap& _stats_map, const ::profiler::BlocksTree& _current, ::profiler::block_index_t _current_index, ::profiler::block_index_t _parent_index, const ::profiler::blocks_t& _blocks)
+::profiler::BlockStatistics* update_statistics(CsStatsMap& _stats_map, ::profiler::BlockStatisticsStorage& _storage, const ::profiler::BlocksTree& _current, ::profiler::block_index_t _current_index, ::profiler::block_index_t _parent_index)
 {
     auto duration = _current.node->duration();
     CsStatsMap::key_type key(_current.node->name());
@@ -261,18 +432,18 @@ automatically receive statistics update.
         ++stats->calls_number; // update calls number of this block
         stats->total_duration += duration; // update summary duration of all block calls
 
-        if (duration > _blocks[stats->max_duration_block].node->duration())
+        if (duration > stats->max_duration)
         {
             // update max duration
             stats->max_duration_block = _current_index;
-            //stats->max_duration = duration;
+            stats->max_duration = duration;
         }
 
-        if (duration < _blocks[stats->min_duration_block].node->duration())
+        if (duration < stats->min_duration)
         {
             // update min duraton
             stats->min_duration_block = _current_index;
-            //stats->min_duration = duration;
+            stats->min_duration = duration;
         }
 
         // average duration is calculated inside average_duration() method by dividing total_duration to the calls_number
@@ -282,7 +453,7 @@ automatically receive statistics update.
 
     // This is first time the block appear in the file.
     // Create new statistics.
-    auto stats = new ::profiler::BlockStatistics(duration, _current_index, _parent_index);
+    auto stats = _storage.emplace(duration, _current_index, _parent_index);
     _stats_map.emplace(key, stats);
 
     return stats;
@@ -290,11 +461,11 @@ automatically receive statistics update.
 
 //////////////////////////////////////////////////////////////////////////
 
-void update_statistics_recursive(StatsMap& _stats_map, ::profiler::BlocksTree& _current, ::profiler::block_index_t _current_index, ::profiler::block_index_t _parent_index, ::profiler::blocks_t& _blocks)
+void update_statistics_recursive(StatsMap& _stats_map, ::profiler::BlockStatisticsStorage& _storage, ::profiler::BlocksTree& _current, ::profiler::block_index_t _current_index, ::profiler::block_index_t _parent_index, ::profiler::blocks_t& _blocks, const ::profiler::descriptors_list_t& _descriptors)
 {
-    _current.per_frame_stats = update_statistics(_stats_map, _current, _current_index, _parent_index, _blocks);
+    _current.per_frame_stats = update_statistics(_stats_map, _storage, _current, _current_index, _parent_index, _descriptors);
     for (auto i : _current.children)
-        update_statistics_recursive(_stats_map, _blocks[i], i, _parent_index, _blocks);
+        update_statistics_recursive(_stats_map, _storage, _blocks[i], i, _parent_index, _blocks, _descriptors);
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -334,518 +505,1600 @@ void validate_pointers(::std::atomic<int>& _progress, const char* _oldbase, ::pr
 
 //////////////////////////////////////////////////////////////////////////
 
-extern "C" {
+/** Entry of threads sections table (see ThreadSection in profile_manager.cpp). */
+struct SectionEntry
+{
+    ::profiler::timestamp_t       begin_time; ///< Minimum begin time of blocks and context switches
+    ::profiler::timestamp_t         end_time; ///< Maximum end time of blocks and context switches
+    uint64_t                          offset; ///< Position of the thread data relative to the header begin
+    uint64_t                     memory_size; ///< Summary size of decoded blocks and context switches
+    uint64_t                   memory_offset; ///< Position of decoded blocks in serialized blocks memory
+    ::profiler::timestamp_t  next_begin_time; ///< Minimum begin time of blocks of the next read sections of the thread (see trim_pending)
+    uint32_t                     sync_number; ///< Number of context switches
+    uint32_t                   blocks_number; ///< Number of blocks
+    ::profiler::thread_id_t        thread_id;
+};
+
+/** Parameters of blocks decoding which are the same for all threads. */
+struct ReaderContext
+{
+    const runtime_names_t&            runtime_names;
+    const ::profiler::descriptors_list_t& descriptors;
+    ::profiler::timestamp_t              begin_time;
+    uint64_t                          cpu_frequency;
+    double                        conversion_factor;
+    bool                                    compact; ///< Blocks are written in compact encoding (since v1.1.0)
+};
+
+/** Block with runtime name. Generated id is set after all threads are read (see assign_runtime_ids()). */
+struct NamedBlock
+{
+    ::profiler::block_index_t index;
+    uint32_t                name_id; ///< Interned runtime name id (0 if the name is written inside block record)
+};
 
-    PROFILER_API ::profiler::block_index_t fillTreesFromFile(::std::atomic<int>& progress, const char* filename,
-                                                             ::profiler::SerializedData& serialized_blocks,
-                                                             ::profiler::SerializedData& serialized_descriptors,
-                                                             ::profiler::descriptors_list_t& descriptors,
-                                                             ::profiler::blocks_t& blocks,
-                                                             ::profiler::thread_blocks_tree_t& threaded_trees,
-                                                             uint32_t& total_descriptors_number,
-                                                             bool gather_statistics,
-                                                             ::std::stringstream& _log)
+/** Indices of context switches [sync_begin, blocks_begin) and blocks [blocks_begin, blocks_end) of one thread section. */
+struct SectionBlocks
+{
+    ::profiler::thread_id_t     thread_id;
+    ::profiler::block_index_t  sync_begin;
+    ::profiler::block_index_t blocks_begin;
+    ::profiler::block_index_t   blocks_end;
+};
+
+/** Block which has no parent yet (parent is written after all it's children). */
+struct PendingBlock
+{
+    ::profiler::timestamp_t begin;
+    ::profiler::timestamp_t   end;
+    uint16_t              depth;
+};
+
+typedef ::std::unordered_map<::profiler::thread_id_t, ::std::vector<PendingBlock>, ::profiler::passthrough_hash> pending_blocks_t;
+
+/** Decoding state of one reader thread (see read_thread_section). */
+struct ReaderState
+{
+    pending_blocks_t           pending; ///< Not parented blocks of every thread (thread data could be split into several sections, see trim_pending)
+    ::std::vector<char>         record; ///< Temporary buffer for records
+    ::std::string                error;
+    uint32_t               read_number; ///< Number of read records including dropped ones
+    uint32_t           sections_number; ///< Number of entirely read sections
+    ::profiler::thread_id_t  thread_id; ///< Thread of the last read section
+
+    ReaderState() : read_number(0), sections_number(0), thread_id(0)
     {
-        auto oldprogress = progress.exchange(0, ::std::memory_order_release);
-        if (oldprogress < 0)
-        {
-            _log << "Reading was interrupted";
-            return 0;
-        }
+    }
+};
 
-        ::std::ifstream inFile(filename, ::std::fstream::binary);
-        if (!inFile.is_open())
-        {
-            _log << "Can not open file " << filename;
-            return 0;
-        }
+/** Blocks read by one reader thread. */
+struct ThreadsData : public ReaderState
+{
+    ::profiler::blocks_t            blocks;
+    ::profiler::thread_blocks_tree_t trees;
+    ::std::vector<NamedBlock>        named; ///< Blocks with runtime names in the order of reading
+    ::std::vector<SectionBlocks>  sections; ///< Read sections in the order of reading
+};
 
-        ::std::stringstream str;
+/** Builds blocks trees from records of thread sections (see read_thread_section and ProfileVisitor).
 
-        // Replace str buffer to inFile buffer to avoid redundant copying
-        typedef ::std::basic_iostream<::std::stringstream::char_type, ::std::stringstream::traits_type> stringstream_parent;
-        stringstream_parent& s = str;
-        auto oldbuf = s.rdbuf(inFile.rdbuf());
-        
-        // Read data from file
-        auto result = fillTreesFromStream(progress, str, serialized_blocks, serialized_descriptors, descriptors, blocks,
-                                          threaded_trees, total_descriptors_number, gather_statistics, _log);
+Ids of blocks are not changed here: blocks with runtime names are only collected into ThreadsData::named.
+*/
+class TreeBuilder
+{
+    ThreadsData&                                m_data;
+    const ::profiler::descriptors_list_t& m_descriptors;
+    ::profiler::BlocksTreeRoot*                 m_root;
+    SectionBlocks                            m_section;
 
-        // Restore old str buffer to avoid possible second memory free on stringstream destructor
-        s.rdbuf(oldbuf);
+public:
 
-        return result;
+    TreeBuilder(ThreadsData& _data, const ::profiler::descriptors_list_t& _descriptors)
+        : m_data(_data), m_descriptors(_descriptors), m_root(nullptr)
+    {
     }
 
-    //////////////////////////////////////////////////////////////////////////
-
-    PROFILER_API ::profiler::block_index_t fillTreesFromStream(::std::atomic<int>& progress, ::std::stringstream& inFile,
-                                                               ::profiler::SerializedData& serialized_blocks,
-                                                               ::profiler::SerializedData& serialized_descriptors,
-                                                               ::profiler::descriptors_list_t& descriptors,
-                                                               ::profiler::blocks_t& blocks,
-                                                               ::profiler::thread_blocks_tree_t& threaded_trees,
-                                                               uint32_t& total_descriptors_number,
-                                                               bool gather_statistics,
-                                                               ::std::stringstream& _log)
+    void onThreadBegin(::profiler::thread_id_t _id, const char* _name)
     {
-        EASY_FUNCTION(::profiler::colors::Cyan);
+        m_root = &m_data.trees[_id];
+        if (_name != nullptr)
+            m_root->thread_name = _name;
 
-        auto oldprogress = progress.exchange(0, ::std::memory_order_release);
-        if (oldprogress < 0)
-        {
-            _log << "Reading was interrupted";
-            return 0;
-        }
+        m_section.thread_id = _id;
+        m_section.sync_begin = static_cast<::profiler::block_index_t>(m_data.blocks.size());
+        m_section.blocks_begin = m_section.sync_begin;
+    }
 
-        uint32_t signature = 0;
-        inFile.read((char*)&signature, sizeof(uint32_t));
-        if (signature != PROFILER_SIGNATURE)
-        {
-            _log << "Wrong signature " << signature << "\nThis is not EasyProfiler file/stream.";
-            return 0;
-        }
+    void onContextSwitch(::profiler::thread_id_t, ::profiler::SerializedBlock& _cswitch)
+    {
+        const auto block_index = static_cast<::profiler::block_index_t>(m_data.blocks.size());
+        m_data.blocks.emplace_back();
+        m_data.blocks.back().node = &_cswitch;
 
-        uint32_t version = 0;
-        inFile.read((char*)&version, sizeof(uint32_t));
-        if (!isCompatibleVersion(version))
+        m_root->wait_time += _cswitch.duration();
+        m_root->sync.emplace_back(block_index);
+        m_section.blocks_begin = block_index + 1;
+    }
+
+    void onBlock(::profiler::thread_id_t, const ::profiler::VisitedBlock& _block)
+    {
+        auto& blocks = m_data.blocks;
+        auto& root = *m_root;
+
+        const auto block_index = static_cast<::profiler::block_index_t>(blocks.size());
+        blocks.emplace_back();
+        ::profiler::BlocksTree& tree = blocks.back();
+        tree.node = _block.node;
+        tree.depth = _block.depth;
+        tree.has_counters = _block.has_counters;
+        tree.has_cpu_time = _block.has_cpu_time;
+        tree.has_lock = _block.has_lock;
+        tree.has_flow = _block.has_flow;
+
+        if (_block.runtime_name_id != 0 || *tree.node->name() != 0)
+            m_data.named.push_back(NamedBlock {block_index, _block.runtime_name_id});
+
+        if (_block.children_number != 0)
         {
-            _log << "Incompatible version: v" << (version >> 24) << "." << ((version & 0x00ff0000) >> 16) << "." << (version & 0x0000ffff);
-            return 0;
+            // Children are the last not parented blocks
+            auto lower = root.children.end() - _block.children_number;
+            ::std::move(lower, root.children.end(), ::std::back_inserter(tree.children));
+            root.children.erase(lower, root.children.end());
         }
 
-        processid_t pid = 0;
-        if (version > EASY_V_100)
-            inFile.read((char*)&pid, sizeof(processid_t));
+        ++root.blocks_number;
+        root.children.emplace_back(block_index);
+        if (m_descriptors[tree.node->id()]->type() != ::profiler::BLOCK_TYPE_BLOCK)
+            root.events.emplace_back(block_index);
+    }
 
-        int64_t file_cpu_frequency = 0LL;
-        inFile.read((char*)&file_cpu_frequency, sizeof(int64_t));
-        uint64_t cpu_frequency = file_cpu_frequency;
-        const double conversion_factor = static_cast<double>(TIME_FACTOR) / static_cast<double>(cpu_frequency);
+    void onThreadEnd(::profiler::thread_id_t)
+    {
+        m_section.blocks_end = static_cast<::profiler::block_index_t>(m_data.blocks.size());
+        m_data.sections.push_back(m_section);
+    }
+};
 
-        ::profiler::timestamp_t begin_time = 0ULL;
-        ::profiler::timestamp_t end_time = 0ULL;
-        inFile.read((char*)&begin_time, sizeof(::profiler::timestamp_t));
-        inFile.read((char*)&end_time, sizeof(::profiler::timestamp_t));
-        if (cpu_frequency != 0)
-        {
-            EASY_CONVERT_TO_NANO(begin_time, cpu_frequency, conversion_factor);
-            EASY_CONVERT_TO_NANO(end_time, cpu_frequency, conversion_factor);
-        }
+/** Runs _func(i) for every i in [0, _number) on no more than hardware concurrency threads (including the current one). */
+template <class TFunc>
+static void parallel_for(size_t _number, TFunc _func)
+{
+    size_t threads_number = ::std::thread::hardware_concurrency();
+    if (threads_number > _number)
+        threads_number = _number;
 
-        uint32_t total_blocks_number = 0;
-        inFile.read((char*)&total_blocks_number, sizeof(uint32_t));
-        if (total_blocks_number == 0)
-        {
-            _log << "Profiled blocks number == 0";
-            return 0;
-        }
+    ::std::atomic<size_t> next(0);
+    auto worker = [&next, &_func, _number]()
+    {
+        for (size_t i = next.fetch_add(1, ::std::memory_order_relaxed); i < _number; i = next.fetch_add(1, ::std::memory_order_relaxed))
+            _func(i);
+    };
 
-        uint64_t memory_size = 0;
-        inFile.read((char*)&memory_size, sizeof(decltype(memory_size)));
-        if (memory_size == 0)
-        {
-            _log << "Wrong memory size == 0 for " << total_blocks_number << " blocks";
-            return 0;
-        }
+    ::std::vector<::std::thread> threads;
+    if (threads_number > 1)
+    {
+        threads.reserve(threads_number - 1);
+        for (size_t i = 1; i < threads_number; ++i)
+            threads.emplace_back(worker);
+    }
 
-        total_descriptors_number = 0;
-        inFile.read((char*)&total_descriptors_number, sizeof(uint32_t));
-        if (total_descriptors_number == 0)
-        {
-            _log << "Blocks description number == 0";
-            return 0;
-        }
+    worker();
 
-        uint64_t descriptors_memory_size = 0;
-        inFile.read((char*)&descriptors_memory_size, sizeof(decltype(descriptors_memory_size)));
-        if (descriptors_memory_size == 0)
-        {
-            _log << "Wrong memory size == 0 for " << total_descriptors_number << " blocks descriptions";
-            return 0;
-        }
+    for (auto& t : threads)
+        t.join();
+}
 
-        descriptors.reserve(total_descriptors_number);
-        //const char* olddata = append_regime ? serialized_descriptors.data() : nullptr;
-        serialized_descriptors.set(descriptors_memory_size);
-        //validate_pointers(progress, olddata, serialized_descriptors, descriptors, descriptors.size());
+/** Sets SectionEntry::next_begin_time for sections sorted by offset (all of them are read). */
+static void set_next_begin_times(::std::vector<SectionEntry>& _sections)
+{
+    ::std::unordered_map<::profiler::thread_id_t, ::profiler::timestamp_t, ::profiler::passthrough_hash> begin_times;
+    for (auto section = _sections.rbegin(); section != _sections.rend(); ++section)
+    {
+        auto it = begin_times.emplace(section->thread_id, ~0ULL).first;
+        section->next_begin_time = it->second;
+        if (section->blocks_number != 0 && section->begin_time < it->second)
+            it->second = section->begin_time;
+    }
+}
 
-        uint64_t i = 0;
-        while (!inFile.eof() && descriptors.size() < total_descriptors_number)
-        {
-            uint16_t sz = 0;
-            inFile.read((char*)&sz, sizeof(sz));
-            if (sz == 0)
-            {
-                descriptors.push_back(nullptr);
-                continue;
-            }
+/** Removes not parented blocks of the section's thread which can not be children of blocks of the next sections.
 
-            //if (i + sz > descriptors_memory_size) {
-            //    printf("FILE CORRUPTED\n");
-            //    return 0;
-            //}
+Parent begins not later than it's children, so only blocks begun not earlier than the next sections of the thread
+are kept: memory used by _state.pending is proportional to the number of blocks which could still get a parent
+instead of the number of top-level blocks of the thread.
+*/
+inline void trim_pending(ReaderState& _state, const SectionEntry& _section)
+{
+    auto it = _state.pending.find(_section.thread_id);
+    if (it == _state.pending.end())
+        return;
 
-            char* data = serialized_descriptors[i];
-            inFile.read(data, sz);
-            auto descriptor = reinterpret_cast<::profiler::SerializedBlockDescriptor*>(data);
-            descriptors.push_back(descriptor);
+    auto& pending = it->second;
+    auto last = pending.begin();
+    for (; last != pending.end() && last->begin < _section.next_begin_time; ++last);
 
-            i += sz;
-            auto oldprogress = progress.exchange(static_cast<int>(15 * i / descriptors_memory_size), ::std::memory_order_release);
-            if (oldprogress < 0)
-            {
-                _log << "Reading was interrupted";
-                return 0; // Loading interrupted
-            }
-        }
+    if (last == pending.end())
+        _state.pending.erase(it);
+    else
+        pending.erase(pending.begin(), last);
+}
 
-        typedef ::std::unordered_map<::profiler::thread_id_t, StatsMap, ::profiler::passthrough_hash> PerThreadStats;
-        PerThreadStats parent_statistics, frame_statistics;
-        IdMap identification_table;
+/** Reads threads sections table, sorts sections by offset and calculates their positions in decoded blocks memory. */
+template <class TStream>
+static void read_sections(TStream& inFile, uint32_t _sections_number, uint64_t cpu_frequency, double conversion_factor,
+                          ::std::vector<SectionEntry>& _sections)
+{
+    (void)conversion_factor;
 
-        blocks.reserve(total_blocks_number);
-        //olddata = append_regime ? serialized_blocks.data() : nullptr;
-        serialized_blocks.set(memory_size);
-        //validate_pointers(progress, olddata, serialized_blocks, blocks, blocks.size());
+    _sections.reserve(_sections_number);
+    for (uint32_t k = 0; k < _sections_number && !inFile.eof(); ++k)
+    {
+        SectionEntry section;
+        inFile.read((char*)&section.thread_id, sizeof(decltype(section.thread_id)));
+        inFile.read((char*)&section.offset, sizeof(decltype(section.offset)));
+        inFile.read((char*)&section.memory_size, sizeof(decltype(section.memory_size)));
+        inFile.read((char*)&section.sync_number, sizeof(decltype(section.sync_number)));
+        inFile.read((char*)&section.blocks_number, sizeof(decltype(section.blocks_number)));
+        inFile.read((char*)&section.begin_time, sizeof(decltype(section.begin_time)));
+        inFile.read((char*)&section.end_time, sizeof(decltype(section.end_time)));
+        if (inFile.eof())
+            break;
 
-        i = 0;
-        uint32_t read_number = 0;
-        ::profiler::block_index_t blocks_counter = 0;
-        ::std::vector<char> name;
-        while (!inFile.eof() && read_number < total_blocks_number)
+        if (cpu_frequency != 0)
         {
-            EASY_BLOCK("Read thread data", ::profiler::colors::DarkGreen);
-
-            ::profiler::thread_id_t thread_id = 0;
-            inFile.read((char*)&thread_id, sizeof(decltype(thread_id)));
+            EASY_CONVERT_TO_NANO(section.begin_time, cpu_frequency, conversion_factor);
+            EASY_CONVERT_TO_NANO(section.end_time, cpu_frequency, conversion_factor);
+        }
 
-            auto& root = threaded_trees[thread_id];
+        _sections.push_back(section);
+    }
 
-            uint16_t name_size = 0;
-            inFile.read((char*)&name_size, sizeof(uint16_t));
-            if (name_size != 0)
-            {
-                name.resize(name_size);
-                inFile.read(name.data(), name_size);
-                root.thread_name = name.data();
-            }
+    if (_sections.size() != _sections_number)
+    {
+        _sections.clear();
+        return;
+    }
 
-            CsStatsMap per_thread_statistics_cs;
+    ::std::sort(_sections.begin(), _sections.end(), [](const SectionEntry& _left, const SectionEntry& _right)
+    {
+        return _left.offset < _right.offset;
+    });
 
-            uint32_t blocks_number_in_thread = 0;
-            inFile.read((char*)&blocks_number_in_thread, sizeof(decltype(blocks_number_in_thread)));
-            auto threshold = read_number + blocks_number_in_thread;
-            while (!inFile.eof() && read_number < threshold)
-            {
-                EASY_BLOCK("Read context switch", ::profiler::colors::Green);
+    uint64_t memory_offset = 0;
+    for (auto& section : _sections)
+    {
+        section.memory_offset = memory_offset;
+        memory_offset += section.memory_size;
+    }
 
-                ++read_number;
+    set_next_begin_times(_sections);
+}
 
-                uint16_t sz = 0;
-                inFile.read((char*)&sz, sizeof(sz));
-                if (sz == 0)
-                {
-                    _log << "Bad CSwitch block size == 0";
-                    return 0;
-                }
+/** Returns true if threads sections table matches the header (threads could be read by sections). */
+inline bool validate_sections(const ::std::vector<SectionEntry>& _sections, uint64_t _memory_size, uint32_t _total_blocks_number)
+{
+    if (_sections.empty())
+        return false;
 
-                char* data = serialized_blocks[i];
-                inFile.read(data, sz);
-                i += sz;
-                auto baseData = reinterpret_cast<::profiler::SerializedBlock*>(data);
-                auto t_begin = reinterpret_cast<::profiler::timestamp_t*>(data);
-                auto t_end = t_begin + 1;
+    uint64_t memory_size = 0, blocks_number = 0;
+    for (const auto& section : _sections)
+    {
+        memory_size += section.memory_size;
+        blocks_number += static_cast<uint64_t>(section.sync_number) + section.blocks_number;
+    }
 
-                if (cpu_frequency != 0)
-                {
-                    EASY_CONVERT_TO_NANO(*t_begin, cpu_frequency, conversion_factor);
-                    EASY_CONVERT_TO_NANO(*t_end, cpu_frequency, conversion_factor);
-                }
+    return memory_size <= _memory_size && blocks_number == _total_blocks_number;
+}
 
-                if (*t_end > begin_time)
-                {
-                    if (*t_begin < begin_time)
-                        *t_begin = begin_time;
-
-                    blocks.emplace_back();
-                    ::profiler::BlocksTree& tree = blocks.back();
-                    tree.node = baseData;
-                    const auto block_index = blocks_counter++;
-
-                    root.wait_time += baseData->duration();
-                    root.sync.emplace_back(block_index);
-
-                    if (gather_statistics)
-                    {
-                        EASY_BLOCK("Gather per thread statistics", ::profiler::colors::Coral);
-                        tree.per_thread_stats = update_statistics(per_thread_statistics_cs, tree, block_index, thread_id, blocks);
-                    }
-                }
+/** Time window and threads to load (see loadRange). */
+struct TimeWindow
+{
+    const ::std::vector<::profiler::thread_id_t>& threads; ///< Threads to load (all threads if empty)
+    ::profiler::timestamp_t                         begin; ///< Nanoseconds from the capture begin
+    ::profiler::timestamp_t                           end; ///< Nanoseconds from the capture begin
+    ::profiler::timestamp_t                 capture_begin; ///< [out] Begin time of the whole capture
+    ::profiler::timestamp_t                   capture_end; ///< [out] End time of the whole capture
+};
+
+/** Leaves only sections which overlap time window [_begin, _end] and belong to one of _threads (any thread if _threads is empty).
+
+Parent block is written after all it's children, so parents of blocks of the selected section could be written into the next
+sections of the thread. Blocks section is also left if it has blocks begun before the end of blocks of previously left sections
+of the thread (it could have their parents), otherwise children would be loaded without their parents as top-level blocks.
+
+Positions of sections in decoded blocks memory are recalculated.
+\param _memory_size Summary size of decoded records of left sections.
+\param _blocks_number Summary number of blocks and context switches of left sections.
+*/
+static void select_sections(::std::vector<SectionEntry>& _sections, ::profiler::timestamp_t _begin, ::profiler::timestamp_t _end,
+                            const ::std::vector<::profiler::thread_id_t>& _threads, uint64_t& _memory_size, uint32_t& _blocks_number)
+{
+    // Maximum end time of blocks of left sections for every thread (sections are sorted by offset)
+    ::std::unordered_map<::profiler::thread_id_t, ::profiler::timestamp_t, ::profiler::passthrough_hash> blocks_end;
 
-                auto oldprogress = progress.exchange(20 + static_cast<int>(70 * i / memory_size), ::std::memory_order_release);
-                if (oldprogress < 0)
-                {
-                    _log << "Reading was interrupted";
-                    return 0; // Loading interrupted
-                }
-            }
+    size_t left = 0;
+    for (size_t i = 0; i < _sections.size(); ++i)
+    {
+        const auto section = _sections[i];
+        if (!_threads.empty() && ::std::find(_threads.begin(), _threads.end(), section.thread_id) == _threads.end())
+            continue;
 
-            if (inFile.eof())
-                break;
+        // Sections with no records are kept to keep names of all threads
+        bool selected = section.sync_number + section.blocks_number == 0 || !(section.end_time < _begin || section.begin_time > _end);
 
-            StatsMap per_thread_statistics;
+        if (section.blocks_number != 0)
+        {
+            auto it = blocks_end.find(section.thread_id);
+            if (it != blocks_end.end() && !(section.begin_time > it->second))
+                selected = true;
 
-            blocks_number_in_thread = 0;
-            inFile.read((char*)&blocks_number_in_thread, sizeof(decltype(blocks_number_in_thread)));
-            threshold = read_number + blocks_number_in_thread;
-            while (!inFile.eof() && read_number < threshold)
+            if (selected)
             {
-                EASY_BLOCK("Read block", ::profiler::colors::Green);
+                if (it == blocks_end.end())
+                    blocks_end.emplace(section.thread_id, section.end_time);
+                else if (it->second < section.end_time)
+                    it->second = section.end_time;
+            }
+        }
 
-                ++read_number;
+        if (selected)
+            _sections[left++] = section;
+    }
+
+    _sections.resize(left);
+
+    _memory_size = 0;
+    _blocks_number = 0;
+    for (auto& section : _sections)
+    {
+        section.memory_offset = _memory_size;
+        _memory_size += section.memory_size;
+        _blocks_number += section.sync_number + section.blocks_number;
+    }
+
+    set_next_begin_times(_sections);
+}
+
+/** Reads one thread section: thread name, context switches and blocks, and passes them to _visitor.
+
+Visitor gets onThreadBegin(), onContextSwitch(), onBlock() and onThreadEnd() calls (see ProfileVisitor).
+Nesting of blocks is resolved with _state.pending: blocks are written after all their children.
+
+\param _memory Memory for decoded blocks.
+\param _available Number of bytes available at _memory.
+\param _reuse_memory If true then every record is decoded at _memory (visitor does not keep decoded blocks).
+\param _used Number of bytes of decoded records.
+\param _report Called with number of decoded bytes from time to time, returns false if reading was interrupted.
+
+\retval false if the section is corrupted or reading was interrupted (see _state.error).
+*/
+template <class TStream, class TVisitor, class TReport>
+static bool read_thread_section(TStream& inFile, const ReaderContext& _context, ReaderState& _state, TVisitor& _visitor,
+                                char* _memory, uint64_t _available, bool _reuse_memory, uint64_t& _used, TReport& _report)
+{
+    EASY_BLOCK("Read thread data", ::profiler::colors::DarkGreen);
+
+    const auto& descriptors = _context.descriptors;
+    const auto cpu_frequency = _context.cpu_frequency;
+    const auto conversion_factor = _context.conversion_factor;
+    const auto begin_time = _context.begin_time;
+    (void)conversion_factor;
+
+    ::profiler::thread_id_t thread_id = 0;
+    inFile.read((char*)&thread_id, sizeof(decltype(thread_id)));
+    _state.thread_id = thread_id;
+
+    const char* thread_name = nullptr;
+    uint16_t name_size = 0;
+    inFile.read((char*)&name_size, sizeof(uint16_t));
+    if (name_size != 0)
+    {
+        _state.record.resize(name_size);
+        inFile.read(_state.record.data(), name_size);
+        _state.record.back() = 0;
+        thread_name = _state.record.data();
+    }
+
+    _visitor.onThreadBegin(thread_id, thread_name);
+
+    auto& pending = _state.pending[thread_id];
+
+    uint64_t i = 0, reported = 0;
+    uint32_t name_id = 0;
+    uint8_t extensions = 0;
+
+    ::profiler::timestamp_t last_begin = 0;
+    uint32_t blocks_number_in_thread = 0;
+    inFile.read((char*)&blocks_number_in_thread, sizeof(decltype(blocks_number_in_thread)));
+    for (uint32_t k = 0; k < blocks_number_in_thread && !inFile.eof(); ++k)
+    {
+        EASY_BLOCK("Read context switch", ::profiler::colors::Green);
+
+        ++_state.read_number;
+
+        uint16_t sz = 0;
+        inFile.read((char*)&sz, sizeof(sz));
+        if (sz == 0)
+        {
+            _state.error = "Bad CSwitch block size == 0";
+            return false;
+        }
+
+        const uint64_t shift = _reuse_memory ? 0 : i;
+        char* data = _memory + shift;
+        const auto data_size = read_block(inFile, sz, _context.compact, _context.runtime_names, last_begin, data, _available - shift, _state.record, name_id, extensions);
+        if (data_size == 0)
+        {
+            _state.error = "Bad CSwitch block record";
+            return false;
+        }
+
+        i += data_size;
+        auto baseData = reinterpret_cast<::profiler::SerializedBlock*>(data);
+        auto t_begin = reinterpret_cast<::profiler::timestamp_t*>(data);
+        auto t_end = t_begin + 1;
+
+        if (cpu_frequency != 0)
+        {
+            EASY_CONVERT_TO_NANO(*t_begin, cpu_frequency, conversion_factor);
+            EASY_CONVERT_TO_NANO(*t_end, cpu_frequency, conversion_factor);
+        }
+
+        if (*t_end > begin_time)
+        {
+            if (*t_begin < begin_time)
+                *t_begin = begin_time;
+
+            _visitor.onContextSwitch(thread_id, *baseData);
+        }
+
+        if ((k & 1023) == 1023)
+        {
+            if (!_report(i - reported))
+            {
+                _state.error = "Reading was interrupted";
+                return false; // Loading interrupted
+            }
+
+            reported = i;
+        }
+    }
+
+    if (inFile.eof())
+    {
+        _used = i;
+        return true;
+    }
+
+    last_begin = 0;
+    blocks_number_in_thread = 0;
+    inFile.read((char*)&blocks_number_in_thread, sizeof(decltype(blocks_number_in_thread)));
+    for (uint32_t k = 0; k < blocks_number_in_thread && !inFile.eof(); ++k)
+    {
+        EASY_BLOCK("Read block", ::profiler::colors::Green);
+
+        ++_state.read_number;
+
+        uint16_t sz = 0;
+        inFile.read((char*)&sz, sizeof(sz));
+        if (sz == 0)
+        {
+            _state.error = "Bad block size == 0";
+            return false;
+        }
+
+        const uint64_t shift = _reuse_memory ? 0 : i;
+        char* data = _memory + shift;
+        const auto data_size = read_block(inFile, sz, _context.compact, _context.runtime_names, last_begin, data, _available - shift, _state.record, name_id, extensions);
+        if (data_size == 0)
+        {
+            _state.error = "Bad block record";
+            return false;
+        }
+
+        i += data_size;
+        auto baseData = reinterpret_cast<::profiler::SerializedBlock*>(data);
+        if (baseData->id() >= descriptors.size())
+        {
+            _state.error = "Bad block id == " + ::std::to_string(baseData->id());
+            return false;
+        }
+
+        auto desc = descriptors[baseData->id()];
+        if (desc == nullptr)
+        {
+            _state.error = "Bad block id == " + ::std::to_string(baseData->id()) + ". Description is null.";
+            return false;
+        }
+
+        auto t_begin = reinterpret_cast<::profiler::timestamp_t*>(data);
+        auto t_end = t_begin + 1;
+
+        if (cpu_frequency != 0)
+        {
+            EASY_CONVERT_TO_NANO(*t_begin, cpu_frequency, conversion_factor);
+            EASY_CONVERT_TO_NANO(*t_end, cpu_frequency, conversion_factor);
+        }
+
+        if (*t_end >= begin_time)
+        {
+            if (*t_begin < begin_time)
+                *t_begin = begin_time;
+
+            ::profiler::VisitedBlock block;
+            block.node = baseData;
+            block.children_number = 0;
+            block.runtime_name_id = name_id;
+            block.depth = 0;
+            block.has_counters = (extensions & ::profiler::compact::EXTENSION_COUNTERS) != 0;
+            block.has_cpu_time = (extensions & ::profiler::compact::EXTENSION_CPU_TIME) != 0;
+            block.has_lock = (extensions & ::profiler::compact::EXTENSION_LOCK) != 0;
+            block.has_flow = (extensions & ::profiler::compact::EXTENSION_FLOW) != 0;
+
+            const auto mt0 = *t_begin;
+            // parent - starts earlier than last ends (and not later than last begins: lock blocks can overlap other blocks)
+            if (!pending.empty() && mt0 < pending.back().end && !(mt0 > pending.back().begin))
+            {
+                EASY_BLOCK("Find children", ::profiler::colors::Blue);
+                auto lower = pending.end() - 1;
+                for (; lower != pending.begin() && !(mt0 > (lower - 1)->begin); --lower);
+
+                for (auto child = lower; child != pending.end(); ++child)
+                {
+                    if (block.depth < child->depth)
+                        block.depth = child->depth;
+                }
+
+                ++block.depth;
+                block.children_number = static_cast<uint32_t>(pending.end() - lower);
+                pending.erase(lower, pending.end());
+            }
+
+            pending.push_back(PendingBlock {mt0, *t_end, block.depth});
+            _visitor.onBlock(thread_id, block);
+        }
+
+        if ((k & 1023) == 1023)
+        {
+            if (!_report(i - reported))
+            {
+                _state.error = "Reading was interrupted";
+                return false; // Loading interrupted
+            }
+
+            reported = i;
+        }
+    }
+
+    _visitor.onThreadEnd(thread_id);
+    ++_state.sections_number;
+    _used = i;
+
+    if (!_report(i - reported))
+    {
+        _state.error = "Reading was interrupted";
+        return false; // Loading interrupted
+    }
+
+    return true;
+}
+
+/** Returns true if read_thread_section() has read exactly the section from the sections table. */
+inline bool check_section(const ReaderState& _state, uint32_t _sections_number, uint32_t _read_number, const SectionEntry& _section)
+{
+    return _state.sections_number == _sections_number + 1 && _state.thread_id == _section.thread_id
+        && _state.read_number - _read_number == _section.sync_number + _section.blocks_number;
+}
+
+/** Reads threads sections one by one in the order of the file and passes records to _visitor.
+
+If threads sections table is not empty then only sections from the table are read (see loadRange).
+*/
+template <class TStream, class TVisitor>
+static bool read_blocks_sequentially(TStream& inFile, ::std::streampos _header_position, const ReaderContext& _context,
+                                     const ::std::vector<SectionEntry>& _sections, char* _memory, uint64_t _memory_size,
+                                     bool _reuse_memory, uint64_t _decoded_size, uint32_t _total_blocks_number,
+                                     ::std::atomic<int>& progress, ReaderState& _state, TVisitor& _visitor)
+{
+    uint64_t i = 0, done = 0;
+    auto report = [&progress, &done, _decoded_size](uint64_t _bytes) -> bool
+    {
+        done += _bytes;
+        return progress.exchange(20 + static_cast<int>(70 * done / _decoded_size), ::std::memory_order_release) >= 0;
+    };
+
+    if (!_sections.empty())
+    {
+        for (const auto& section : _sections)
+        {
+            const auto read_number = _state.read_number;
+            const auto sections_number = _state.sections_number;
+
+            inFile.seekg(_header_position + static_cast<::std::streamoff>(section.offset));
+
+            char* memory = _reuse_memory ? _memory : _memory + section.memory_offset;
+            const uint64_t available = _reuse_memory ? _memory_size : section.memory_size;
+
+            uint64_t used = 0;
+            if (!read_thread_section(inFile, _context, _state, _visitor, memory, available, _reuse_memory, used, report))
+                return false;
+
+            if (!check_section(_state, sections_number, read_number, section))
+            {
+                _state.error = "Bad thread section at " + ::std::to_string(section.offset);
+                return false;
+            }
+
+            trim_pending(_state, section);
+        }
+
+        return true;
+    }
+
+    while (!inFile.eof() && _state.read_number < _total_blocks_number)
+    {
+        char* memory = _reuse_memory ? _memory : _memory + i;
+        const uint64_t available = _reuse_memory ? _memory_size : _memory_size - i;
+
+        uint64_t used = 0;
+        if (!read_thread_section(inFile, _context, _state, _visitor, memory, available, _reuse_memory, used, report))
+            return false;
+        i += used;
+    }
+
+    return true;
+}
+
+/** Reads threads sections of the mapped file concurrently.
+
+All sections of one thread are read by one task in the order of the file (blocks of the same thread could be written
+several times, see startStreamingBlocksToFile), tasks are run on the bounded pool of threads.
+Blocks indices are assigned in the order of sections in the file, so they are the same as for sequential reading.
+*/
+static bool read_blocks_parallel(const ::profiler::MemoryStream& inFile, ::std::streampos _header_position, const ReaderContext& _context,
+                                 const ::std::vector<SectionEntry>& _sections, char* _memory, uint64_t _memory_size,
+                                 ::std::atomic<int>& progress, ThreadsData& _result)
+{
+    EASY_FUNCTION(::profiler::colors::DarkCyan);
+
+    // Group sections by threads (sections are sorted by offset)
+    ::std::vector<::std::vector<size_t> > tasks;
+    ::std::vector<uint64_t> tasks_memory;
+    {
+        ::std::unordered_map<::profiler::thread_id_t, size_t, ::profiler::passthrough_hash> thread_tasks;
+        for (size_t s = 0; s < _sections.size(); ++s)
+        {
+            auto it = thread_tasks.emplace(_sections[s].thread_id, tasks.size()).first;
+            if (it->second == tasks.size())
+            {
+                tasks.emplace_back();
+                tasks_memory.push_back(0);
+            }
+
+            tasks[it->second].push_back(s);
+            tasks_memory[it->second] += _sections[s].memory_size;
+        }
+    }
+
+    // Largest threads go first for better balance
+    ::std::vector<size_t> order(tasks.size());
+    for (size_t t = 0; t < order.size(); ++t)
+        order[t] = t;
+    ::std::sort(order.begin(), order.end(), [&tasks_memory](size_t _left, size_t _right)
+    {
+        return tasks_memory[_left] > tasks_memory[_right];
+    });
+
+    ::std::vector<ThreadsData> results(tasks.size());
+    ::std::atomic<uint64_t> done(0);
+    ::std::atomic<bool> failed(false);
+
+    parallel_for(order.size(), [&](size_t _index)
+    {
+        const auto t = order[_index];
+        auto& data = results[t];
+
+        auto report = [&progress, &done, &failed, _memory_size](uint64_t _bytes) -> bool
+        {
+            if (failed.load(::std::memory_order_acquire))
+                return false;
+
+            const auto decoded = done.fetch_add(_bytes, ::std::memory_order_relaxed) + _bytes;
+            if (progress.exchange(20 + static_cast<int>(70 * decoded / _memory_size), ::std::memory_order_release) < 0)
+            {
+                failed.store(true, ::std::memory_order_release);
+                return false;
+            }
+
+            return true;
+        };
+
+        uint32_t records = 0;
+        for (auto s : tasks[t])
+            records += _sections[s].sync_number + _sections[s].blocks_number;
+        data.blocks.reserve(records);
+        TreeBuilder builder(data, _context.descriptors);
+
+        for (auto s : tasks[t])
+        {
+            const auto& section = _sections[s];
+            const auto read_number = data.read_number;
+            const auto sections_number = data.sections_number;
+
+            ::profiler::MemoryStream stream(inFile.data(), inFile.size());
+            stream.seekg(_header_position + static_cast<::std::streamoff>(section.offset));
+
+            uint64_t used = 0;
+            if (!read_thread_section(stream, _context, data, builder, _memory + section.memory_offset, section.memory_size, false, used, report))
+            {
+                failed.store(true, ::std::memory_order_release);
+                return;
+            }
+
+            if (!check_section(data, sections_number, read_number, section))
+            {
+                data.error = "Bad thread section at " + ::std::to_string(section.offset);
+                failed.store(true, ::std::memory_order_release);
+                return;
+            }
+
+            trim_pending(data, section);
+        }
+    });
+
+    if (failed.load(::std::memory_order_acquire))
+    {
+        for (const auto& data : results)
+        {
+            if (!data.error.empty())
+            {
+                _result.error = data.error;
+                break;
+            }
+        }
+
+        if (_result.error.empty())
+            _result.error = "Reading was interrupted";
+
+        return false;
+    }
+
+    // Global index of the first block of each section: sections go in the order of the file
+    ::std::vector<::profiler::block_index_t> global_begin(_sections.size());
+    {
+        ::std::vector<const SectionBlocks*> read_sections(_sections.size());
+        for (size_t t = 0; t < tasks.size(); ++t)
+        {
+            for (size_t p = 0; p < tasks[t].size(); ++p)
+                read_sections[tasks[t][p]] = &results[t].sections[p];
+        }
+
+        ::profiler::block_index_t blocks_number = 0;
+        for (size_t s = 0; s < read_sections.size(); ++s)
+        {
+            global_begin[s] = blocks_number;
+            blocks_number += read_sections[s]->blocks_end - read_sections[s]->sync_begin;
+        }
+
+        _result.blocks.resize(blocks_number);
+    }
+
+    // Move blocks to their global positions and replace local indices with global ones
+    parallel_for(tasks.size(), [&](size_t t)
+    {
+        EASY_BLOCK("Merge thread blocks", ::profiler::colors::DarkGreen);
+
+        auto& data = results[t];
+        const auto& sections = data.sections;
+        auto global_index = [&](::profiler::block_index_t _local) -> ::profiler::block_index_t
+        {
+            auto it = ::std::upper_bound(sections.begin(), sections.end(), _local, [](::profiler::block_index_t _index, const SectionBlocks& _section)
+            {
+                return _index < _section.sync_begin;
+            });
+            --it;
+            return global_begin[tasks[t][it - sections.begin()]] + (_local - it->sync_begin);
+        };
+
+        for (size_t i = 0, n = data.blocks.size(); i < n; ++i)
+        {
+            auto& tree = data.blocks[i];
+            for (auto& child : tree.children)
+                child = global_index(child);
+            _result.blocks[global_index(static_cast<::profiler::block_index_t>(i))] = ::std::move(tree);
+        }
+
+        for (auto& it : data.trees)
+        {
+            auto& root = it.second;
+            for (auto& child : root.children)
+                child = global_index(child);
+            for (auto& cs : root.sync)
+                cs = global_index(cs);
+            for (auto& event : root.events)
+                event = global_index(event);
+        }
+
+        for (auto& named : data.named)
+            named.index = global_index(named.index);
+
+        for (size_t p = 0; p < sections.size(); ++p)
+        {
+            auto& section = data.sections[p];
+            const auto begin = global_begin[tasks[t][p]];
+            section.blocks_begin = begin + (section.blocks_begin - section.sync_begin);
+            section.blocks_end = begin + (section.blocks_end - section.sync_begin);
+            section.sync_begin = begin;
+        }
+
+        ::profiler::blocks_t().swap(data.blocks);
+    });
+
+    for (auto& data : results)
+    {
+        for (auto& it : data.trees)
+            _result.trees[it.first] = ::std::move(it.second);
+        _result.named.insert(_result.named.end(), data.named.begin(), data.named.end());
+        _result.sections.insert(_result.sections.end(), data.sections.begin(), data.sections.end());
+    }
+
+    ::std::sort(_result.named.begin(), _result.named.end(), [](const NamedBlock& _left, const NamedBlock& _right)
+    {
+        return _left.index < _right.index;
+    });
+
+    ::std::sort(_result.sections.begin(), _result.sections.end(), [](const SectionBlocks& _left, const SectionBlocks& _right)
+    {
+        return _left.sync_begin < _right.sync_begin;
+    });
+
+    return true;
+}
+
+/** Reads threads sequentially and builds blocks trees (threads of std::stringstream are always read this way). */
+template <class TStream>
+inline bool read_blocks(TStream& inFile, ::std::streampos _header_position, const ReaderContext& _context,
+                        const ::std::vector<SectionEntry>& _sections, char* _memory, uint64_t _memory_size,
+                        uint32_t _total_blocks_number, ::std::atomic<int>& progress, ThreadsData& _result)
+{
+    _result.blocks.reserve(_total_blocks_number);
+    TreeBuilder builder(_result, _context.descriptors);
+    return read_blocks_sequentially(inFile, _header_position, _context, _sections, _memory, _memory_size, false, _memory_size,
+                                    _total_blocks_number, progress, _result, builder);
+}
+
+/** Threads of the mapped file are read concurrently if the file has threads sections table. */
+inline bool read_blocks(::profiler::MemoryStream& inFile, ::std::streampos _header_position, const ReaderContext& _context,
+                        const ::std::vector<SectionEntry>& _sections, char* _memory, uint64_t _memory_size,
+                        uint32_t _total_blocks_number, ::std::atomic<int>& progress, ThreadsData& _result)
+{
+    if (_sections.empty() || ::std::thread::hardware_concurrency() < 2)
+        return read_blocks<::profiler::MemoryStream>(inFile, _header_position, _context, _sections, _memory, _memory_size, _total_blocks_number, progress, _result);
+    return read_blocks_parallel(inFile, _header_position, _context, _sections, _memory, _memory_size, progress, _result);
+}
+
+/** Generates ids for blocks with runtime names (blocks with the same name get the same id).
+
+Ids are generated in the order of blocks, so they do not depend on the order in which threads were read.
+*/
+static void assign_runtime_ids(const ::std::vector<NamedBlock>& _named, ::profiler::blocks_t& _blocks,
+                               ::profiler::descriptors_list_t& _descriptors, size_t _runtime_names_number)
+{
+    // Generated block ids for interned runtime names (name id - 1 -> block id)
+    const auto NO_ID = static_cast<::profiler::block_id_t>(-1);
+    ::std::vector<::profiler::block_id_t> runtime_names_ids(_runtime_names_number, NO_ID);
+    IdMap identification_table;
+
+    for (const auto& named : _named)
+    {
+        auto baseData = _blocks[named.index].node;
+
+        if (named.name_id != 0)
+        {
+            // Runtime names are interned by profiler: blocks with the same name id will have same generated id.
+            auto& id = runtime_names_ids[named.name_id - 1];
+            if (id == NO_ID)
+            {
+                id = static_cast<::profiler::block_id_t>(_descriptors.size());
+                if (_descriptors.capacity() == _descriptors.size())
+                    _descriptors.reserve((_descriptors.size() * 3) >> 1);
+                _descriptors.push_back(_descriptors[baseData->id()]);
+            }
+
+            baseData->setId(id);
+            continue;
+        }
+
+        // If block has runtime name then generate new id for such block.
+        // Blocks with the same name will have same id.
+
+        IdMap::key_type key(baseData->name());
+        auto it = identification_table.find(key);
+        if (it != identification_table.end())
+        {
+            // There is already block with such name, use it's id
+            baseData->setId(it->second);
+        }
+        else
+        {
+            // There were no blocks with such name, generate new id and save it in the table for further usage.
+            auto id = static_cast<::profiler::block_id_t>(_descriptors.size());
+            identification_table.emplace(key, id);
+            if (_descriptors.capacity() == _descriptors.size())
+                _descriptors.reserve((_descriptors.size() * 3) >> 1);
+            _descriptors.push_back(_descriptors[baseData->id()]);
+            baseData->setId(id);
+        }
+    }
+}
+
+/** Gathers statistics of all blocks of the thread in the order of reading, then statistics of frames (top-level blocks). */
+static void gather_thread_statistics(::profiler::BlocksTreeRoot& root, const ::std::vector<SectionBlocks>& _sections,
+                                     ::profiler::blocks_t& blocks, const ::profiler::descriptors_list_t& descriptors)
+{
+    StatsMap per_thread_statistics, per_parent_statistics, per_frame_statistics;
+    CsStatsMap per_thread_statistics_cs;
+
+    for (const auto& section : _sections)
+    {
+        EASY_BLOCK("Gather per thread statistics", ::profiler::colors::Coral);
+
+        for (auto i = section.sync_begin; i < section.blocks_begin; ++i)
+        {
+            auto& cs = blocks[i];
+            cs.per_thread_stats = update_statistics(per_thread_statistics_cs, root.statistics, cs, i, root.thread_id);
+        }
+
+        for (auto i = section.blocks_begin; i < section.blocks_end; ++i)
+        {
+            auto& tree = blocks[i];
+            if (!tree.children.empty())
+            {
+                per_parent_statistics.clear();
+                for (auto child_index : tree.children)
+                {
+                    auto& child = blocks[child_index];
+                    child.per_parent_stats = update_statistics(per_parent_statistics, root.statistics, child, child_index, i, descriptors);
+                }
+            }
+
+            tree.per_thread_stats = update_statistics(per_thread_statistics, root.statistics, tree, i, root.thread_id, descriptors);
+        }
+    }
+
+    per_parent_statistics.clear();
+
+    //::std::sort(root.sync.begin(), root.sync.end(), [&blocks](::profiler::block_index_t left, ::profiler::block_index_t right)
+    //{
+    //    return blocks[left].node->begin() < blocks[right].node->begin();
+    //});
+
+    ::profiler::block_index_t cs_index = 0;
+    for (auto i : root.children)
+    {
+        auto& frame = blocks[i];
+        frame.per_parent_stats = update_statistics(per_parent_statistics, root.statistics, frame, i, root.thread_id, descriptors);
+
+        per_frame_statistics.clear();
+        update_statistics_recursive(per_frame_statistics, root.statistics, frame, i, i, blocks, descriptors);
+
+        if (cs_index < root.sync.size())
+        {
+            CsStatsMap frame_stats_cs;
+            do {
+
+                auto j = root.sync[cs_index];
+                auto& cs = blocks[j];
+                if (cs.node->end() < frame.node->begin())
+                    continue;
+                if (cs.node->begin() > frame.node->end())
+                    break;
+                cs.per_frame_stats = update_statistics(frame_stats_cs, root.statistics, cs, j, i);
+
+            } while (++cs_index < root.sync.size());
+        }
+
+        if (root.depth < frame.depth)
+            root.depth = frame.depth;
+
+        root.profiled_time += frame.node->duration();
+        add_frame_cpu_time(root, frame);
+    }
+
+    ++root.depth;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+/** Header of .prof file and everything what precedes threads data (block descriptors, runtime names, threads sections table). */
+struct FileHeader
+{
+    ::std::vector<char>   runtime_names_data;
+    runtime_names_t            runtime_names;
+    ::std::vector<SectionEntry>     sections; ///< Empty if the file has no valid threads sections table
+    ::std::streampos         header_position;
+    ::profiler::timestamp_t       begin_time; ///< Capture begin time (in nanoseconds)
+    ::profiler::timestamp_t         end_time; ///< Capture end time (in nanoseconds)
+    uint64_t                   cpu_frequency;
+    double                 conversion_factor;
+    uint64_t                     memory_size; ///< Summary size of decoded blocks and context switches
+    uint32_t                         version;
+    processid_t                          pid;
+    uint32_t             total_blocks_number; ///< Number of blocks and context switches
+};
+
+/** Reads header, block descriptors, runtime names and threads sections table; the stream is left at the beginning of threads data. */
+template <class TStream>
+static bool read_file_header(::std::atomic<int>& progress, TStream& inFile, FileHeader& _header,
+                             ::profiler::SerializedData& serialized_descriptors,
+                             ::profiler::descriptors_list_t& descriptors,
+                             uint32_t& total_descriptors_number,
+                             ::std::stringstream& _log)
+{
+    const auto header_position = inFile.tellg();
+
+    uint32_t signature = 0;
+    inFile.read((char*)&signature, sizeof(uint32_t));
+    if (signature != PROFILER_SIGNATURE)
+    {
+        _log << "Wrong signature " << signature << "\nThis is not EasyProfiler file/stream.";
+        return false;
+    }
+
+    uint32_t version = 0;
+    inFile.read((char*)&version, sizeof(uint32_t));
+    if (!isCompatibleVersion(version))
+    {
+        _log << "Incompatible version: v" << (version >> 24) << "." << ((version & 0x00ff0000) >> 16) << "." << (version & 0x0000ffff);
+        return false;
+    }
+
+    processid_t pid = 0;
+    if (version > EASY_V_100)
+        inFile.read((char*)&pid, sizeof(processid_t));
+
+    int64_t file_cpu_frequency = 0LL;
+    inFile.read((char*)&file_cpu_frequency, sizeof(int64_t));
+    uint64_t cpu_frequency = file_cpu_frequency;
+    const double conversion_factor = static_cast<double>(TIME_FACTOR) / static_cast<double>(cpu_frequency);
+
+    ::profiler::timestamp_t begin_time = 0ULL;
+    ::profiler::timestamp_t end_time = 0ULL;
+    inFile.read((char*)&begin_time, sizeof(::profiler::timestamp_t));
+    inFile.read((char*)&end_time, sizeof(::profiler::timestamp_t));
+    if (cpu_frequency != 0)
+    {
+        EASY_CONVERT_TO_NANO(begin_time, cpu_frequency, conversion_factor);
+        EASY_CONVERT_TO_NANO(end_time, cpu_frequency, conversion_factor);
+    }
+
+    uint32_t total_blocks_number = 0;
+    inFile.read((char*)&total_blocks_number, sizeof(uint32_t));
+    if (total_blocks_number == 0)
+    {
+        _log << "Profiled blocks number == 0";
+        return false;
+    }
+
+    uint64_t memory_size = 0;
+    inFile.read((char*)&memory_size, sizeof(decltype(memory_size)));
+    if (memory_size == 0)
+    {
+        _log << "Wrong memory size == 0 for " << total_blocks_number << " blocks";
+        return false;
+    }
+
+    total_descriptors_number = 0;
+    inFile.read((char*)&total_descriptors_number, sizeof(uint32_t));
+    if (total_descriptors_number == 0)
+    {
+        _log << "Blocks description number == 0";
+        return false;
+    }
+
+    uint64_t descriptors_memory_size = 0;
+    inFile.read((char*)&descriptors_memory_size, sizeof(decltype(descriptors_memory_size)));
+    if (descriptors_memory_size == 0)
+    {
+        _log << "Wrong memory size == 0 for " << total_descriptors_number << " blocks descriptions";
+        return false;
+    }
+
+    // Block descriptors could be written after threads data (see startStreamingBlocksToFile)
+    uint64_t descriptors_offset = 0;
+    if (version >= EASY_V_110)
+        inFile.read((char*)&descriptors_offset, sizeof(decltype(descriptors_offset)));
+
+    uint32_t runtime_names_number = 0;
+    uint64_t runtime_names_memory_size = 0;
+    if (version >= EASY_V_110)
+    {
+        inFile.read((char*)&runtime_names_number, sizeof(uint32_t));
+        inFile.read((char*)&runtime_names_memory_size, sizeof(decltype(runtime_names_memory_size)));
+    }
+
+    // Clock source is informational only: cpu_frequency == 0 already means that timestamps are nanoseconds
+    uint8_t clock_source = ::profiler::CLOCK_SOURCE_AUTO;
+    if (version >= EASY_V_110)
+    {
+        inFile.read((char*)&clock_source, sizeof(uint8_t));
+        if (clock_source >= ::profiler::CLOCK_SOURCES_NUMBER)
+        {
+            _log << "Unknown clock source " << static_cast<int>(clock_source);
+            return false;
+        }
+    }
+
+    // Table of threads sections is written at the end of the file (see read_blocks_parallel)
+    uint32_t sections_number = 0;
+    uint64_t sections_offset = 0;
+    if (version >= EASY_V_110)
+    {
+        inFile.read((char*)&sections_number, sizeof(uint32_t));
+        inFile.read((char*)&sections_offset, sizeof(decltype(sections_offset)));
+    }
+
+    const auto threads_position = inFile.tellg();
+    if (descriptors_offset != 0)
+        inFile.seekg(header_position + static_cast<::std::streamoff>(descriptors_offset));
+
+    descriptors.reserve(total_descriptors_number);
+    //const char* olddata = append_regime ? serialized_descriptors.data() : nullptr;
+    serialized_descriptors.set(descriptors_memory(version, total_descriptors_number, descriptors_memory_size));
+    //validate_pointers(progress, olddata, serialized_descriptors, descriptors, descriptors.size());
+
+    uint64_t i = 0;
+    while (!inFile.eof() && descriptors.size() < total_descriptors_number)
+    {
+        uint16_t sz = 0;
+        inFile.read((char*)&sz, sizeof(sz));
+        if (sz == 0)
+        {
+            descriptors.push_back(nullptr);
+            continue;
+        }
+
+        //if (i + sz > descriptors_memory_size) {
+        //    printf("FILE CORRUPTED\n");
+        //    return false;
+        //}
 
-                uint16_t sz = 0;
-                inFile.read((char*)&sz, sizeof(sz));
-                if (sz == 0)
-                {
-                    _log << "Bad block size == 0";
-                    return 0;
-                }
+        char* data = serialized_descriptors[i];
+        sz = read_descriptor(inFile, version, sz, data);
+        auto descriptor = reinterpret_cast<::profiler::SerializedBlockDescriptor*>(data);
+        descriptors.push_back(descriptor);
 
-                char* data = serialized_blocks[i];
-                inFile.read(data, sz);
-                i += sz;
-                auto baseData = reinterpret_cast<::profiler::SerializedBlock*>(data);
-                if (baseData->id() >= total_descriptors_number)
-                {
-                    _log << "Bad block id == " << baseData->id();
-                    return 0;
-                }
+        i += sz;
+        auto oldprogress = progress.exchange(static_cast<int>(15 * i / descriptors_memory_size), ::std::memory_order_release);
+        if (oldprogress < 0)
+        {
+            _log << "Reading was interrupted";
+            return false; // Loading interrupted
+        }
+    }
 
-                auto desc = descriptors[baseData->id()];
-                if (desc == nullptr)
-                {
-                    _log << "Bad block id == " << baseData->id() << ". Description is null.";
-                    return 0;
-                }
+    // Runtime names table follows block descriptors
+    auto& runtime_names_data = _header.runtime_names_data;
+    auto& runtime_names = _header.runtime_names;
+    runtime_names_data.resize(static_cast<size_t>(runtime_names_memory_size));
+    runtime_names.reserve(runtime_names_number);
+    for (uint64_t offset = 0; !inFile.eof() && runtime_names.size() < runtime_names_number;)
+    {
+        uint16_t sz = 0;
+        inFile.read((char*)&sz, sizeof(sz));
+        if (sz == 0 || offset + sz > runtime_names_memory_size)
+        {
+            _log << "Bad runtime name size == " << sz;
+            return false;
+        }
 
-                auto t_begin = reinterpret_cast<::profiler::timestamp_t*>(data);
-                auto t_end = t_begin + 1;
+        char* data = runtime_names_data.data() + offset;
+        inFile.read(data, sz);
+        data[sz - 1] = 0;
+        runtime_names.push_back(RuntimeName {data, static_cast<uint16_t>(sz - 1)});
 
-                if (cpu_frequency != 0)
-                {
-                    EASY_CONVERT_TO_NANO(*t_begin, cpu_frequency, conversion_factor);
-                    EASY_CONVERT_TO_NANO(*t_end, cpu_frequency, conversion_factor);
-                }
+        offset += sz;
+    }
 
-                if (*t_end >= begin_time)
-                {
-                    if (*t_begin < begin_time)
-                        *t_begin = begin_time;
-
-                    blocks.emplace_back();
-                    ::profiler::BlocksTree& tree = blocks.back();
-                    tree.node = baseData;
-                    const auto block_index = blocks_counter++;
-
-                    if (*tree.node->name() != 0)
-                    {
-                        // If block has runtime name then generate new id for such block.
-                        // Blocks with the same name will have same id.
-
-                        IdMap::key_type key(tree.node->name());
-                        auto it = identification_table.find(key);
-                        if (it != identification_table.end())
-                        {
-                            // There is already block with such name, use it's id
-                            baseData->setId(it->second);
-                        }
-                        else
-                        {
-                            // There were no blocks with such name, generate new id and save it in the table for further usage.
-                            auto id = static_cast<::profiler::block_id_t>(descriptors.size());
-                            identification_table.emplace(key, id);
-                            if (descriptors.capacity() == descriptors.size())
-                                descriptors.reserve((descriptors.size() * 3) >> 1);
-                            descriptors.push_back(descriptors[baseData->id()]);
-                            baseData->setId(id);
-                        }
-                    }
-
-                    if (!root.children.empty())
-                    {
-                        auto& back = blocks[root.children.back()];
-                        auto t1 = back.node->end();
-                        auto mt0 = tree.node->begin();
-                        if (mt0 < t1)//parent - starts earlier than last ends
-                        {
-                            //auto lower = ::std::lower_bound(root.children.begin(), root.children.end(), tree);
-                            /**/
-                            EASY_BLOCK("Find children", ::profiler::colors::Blue);
-                            auto rlower1 = ++root.children.rbegin();
-                            for (; rlower1 != root.children.rend() && !(mt0 > blocks[*rlower1].node->begin()); ++rlower1);
-                            auto lower = rlower1.base();
-                            ::std::move(lower, root.children.end(), ::std::back_inserter(tree.children));
-
-                            root.children.erase(lower, root.children.end());
-                            EASY_END_BLOCK;
-
-                            if (gather_statistics)
-                            {
-                                EASY_BLOCK("Gather statistic within parent", ::profiler::colors::Magenta);
-                                auto& per_parent_statistics = parent_statistics[thread_id];
-                                per_parent_statistics.clear();
-
-                                //per_parent_statistics.reserve(tree.children.size());     // this gives slow-down on Windows
-                                //per_parent_statistics.reserve(tree.children.size() * 2); // this gives no speed-up on Windows
-                                // TODO: check this behavior on Linux
-
-                                for (auto i : tree.children)
-                                {
-                                    auto& child = blocks[i];
-                                    child.per_parent_stats = update_statistics(per_parent_statistics, child, i, block_index, blocks);
-                                    if (tree.depth < child.depth)
-                                        tree.depth = child.depth;
-                                }
-                            }
-                            else
-                            {
-                                for (auto i : tree.children)
-                                {
-                                    const auto& child = blocks[i];
-                                    if (tree.depth < child.depth)
-                                        tree.depth = child.depth;
-                                }
-                            }
-
-                            ++tree.depth;
-                        }
-                    }
-
-                    ++root.blocks_number;
-                    root.children.emplace_back(block_index);// ::std::move(tree));
-                    if (desc->type() == ::profiler::BLOCK_TYPE_EVENT)
-                        root.events.emplace_back(block_index);
-
-
-                    if (gather_statistics)
-                    {
-                        EASY_BLOCK("Gather per thread statistics", ::profiler::colors::Coral);
-                        tree.per_thread_stats = update_statistics(per_thread_statistics, tree, block_index, thread_id, blocks);
-                    }
-                }
+    if (descriptors_offset != 0)
+        inFile.seekg(threads_position);
 
-                auto oldprogress = progress.exchange(20 + static_cast<int>(70 * i / memory_size), ::std::memory_order_release);
-                if (oldprogress < 0)
-                {
-                    _log << "Reading was interrupted";
-                    return 0; // Loading interrupted
-                }
-            }
+    auto& sections = _header.sections;
+    if (sections_offset != 0)
+    {
+        const auto blocks_position = inFile.tellg();
+        inFile.seekg(header_position + static_cast<::std::streamoff>(sections_offset));
+        read_sections(inFile, sections_number, cpu_frequency, conversion_factor, sections);
+        inFile.seekg(blocks_position);
+    }
+
+    if (!validate_sections(sections, memory_size, total_blocks_number))
+        sections.clear(); // Read threads sequentially
+
+    _header.header_position = header_position;
+    _header.begin_time = begin_time;
+    _header.end_time = end_time;
+    _header.cpu_frequency = cpu_frequency;
+    _header.conversion_factor = conversion_factor;
+    _header.memory_size = memory_size;
+    _header.version = version;
+    _header.pid = pid;
+    _header.total_blocks_number = total_blocks_number;
+
+    return true;
+}
+
+/** Parameters of blocks decoding for the file. */
+inline ReaderContext make_context(const FileHeader& _header, const ::profiler::descriptors_list_t& _descriptors)
+{
+    const auto version = _header.version;
+    return ReaderContext {
+        _header.runtime_names, _descriptors, _header.begin_time, _header.cpu_frequency, _header.conversion_factor,
+        version >= EASY_V_110
+    };
+}
+
+/** Reads blocks and descriptors from the stream or the mapped file (see fillTreesFromStream and fillTreesFromFile).
+
+\param _window If not nullptr then only threads sections overlapping the time window are read (see loadRange).
+*/
+template <class TStream>
+static ::profiler::block_index_t fillTrees(::std::atomic<int>& progress, TStream& inFile,
+                                           ::profiler::SerializedData& serialized_blocks,
+                                           ::profiler::SerializedData& serialized_descriptors,
+                                           ::profiler::descriptors_list_t& descriptors,
+                                           ::profiler::blocks_t& blocks,
+                                           ::profiler::thread_blocks_tree_t& threaded_trees,
+                                           uint32_t& total_descriptors_number,
+                                           bool gather_statistics,
+                                           ::std::stringstream& _log,
+                                           TimeWindow* _window = nullptr)
+{
+    EASY_FUNCTION(::profiler::colors::Cyan);
+
+    auto oldprogress = progress.exchange(0, ::std::memory_order_release);
+    if (oldprogress < 0)
+    {
+        _log << "Reading was interrupted";
+        return 0;
+    }
+
+    FileHeader header;
+    if (!read_file_header(progress, inFile, header, serialized_descriptors, descriptors, total_descriptors_number, _log))
+        return 0;
+
+    auto& sections = header.sections;
+    const auto begin_time = header.begin_time;
+    auto memory_size = header.memory_size;
+    auto total_blocks_number = header.total_blocks_number;
+
+    if (_window != nullptr)
+    {
+        _window->capture_begin = begin_time;
+        _window->capture_end = header.end_time;
+
+        if (sections.empty())
+        {
+            _log << "File has no threads sections table (written before v1.1.0?), it can be loaded only entirely";
+            return 0;
         }
 
-        if (progress.load(::std::memory_order_acquire) < 0)
+        const auto max_time = ::std::numeric_limits<::profiler::timestamp_t>::max() - begin_time;
+        select_sections(sections, begin_time + ::std::min(_window->begin, max_time), begin_time + ::std::min(_window->end, max_time),
+                        _window->threads, memory_size, total_blocks_number);
+
+        if (total_blocks_number == 0)
         {
-            _log << "Reading was interrupted";
-            return 0; // Loading interrupted
+            _log << "No profiled blocks in the time window";
+            return 0;
         }
+    }
+
+    //olddata = append_regime ? serialized_blocks.data() : nullptr;
+    serialized_blocks.set(memory_size);
+    //validate_pointers(progress, olddata, serialized_blocks, blocks, blocks.size());
+
+    const auto context = make_context(header, descriptors);
+
+    ThreadsData result;
+    if (!read_blocks(inFile, header.header_position, context, sections, serialized_blocks.data(), memory_size, total_blocks_number, progress, result))
+    {
+        _log << result.error;
+        return 0;
+    }
 
-        EASY_BLOCK("Gather statistics for roots", ::profiler::colors::Purple);
-        if (gather_statistics)
+    blocks.swap(result.blocks);
+    for (auto& it : result.trees)
+        threaded_trees[it.first] = ::std::move(it.second);
+    result.trees.clear();
+
+    assign_runtime_ids(result.named, blocks, descriptors, header.runtime_names.size());
+
+    if (progress.load(::std::memory_order_acquire) < 0)
+    {
+        _log << "Reading was interrupted";
+        return 0; // Loading interrupted
+    }
+
+    EASY_BLOCK("Gather statistics for roots", ::profiler::colors::Purple);
+    if (gather_statistics)
+    {
+        ::std::vector<::profiler::BlocksTreeRoot*> roots;
+        ::std::unordered_map<::profiler::thread_id_t, size_t, ::profiler::passthrough_hash> root_indices;
+        roots.reserve(threaded_trees.size());
+        for (auto& it : threaded_trees)
         {
-            ::std::vector<::std::thread> statistics_threads;
-            statistics_threads.reserve(threaded_trees.size());
+            it.second.thread_id = it.first;
+            root_indices.emplace(it.first, roots.size());
+            roots.push_back(&it.second);
+        }
 
-            for (auto& it : threaded_trees)
-            {
-                auto& root = it.second;
-                root.thread_id = it.first;
-                //root.tree.shrink_to_fit();
+        // Sections of each thread in the order of reading
+        ::std::vector<::std::vector<SectionBlocks> > roots_sections(roots.size());
+        for (const auto& section : result.sections)
+            roots_sections[root_indices[section.thread_id]].push_back(section);
 
-                auto& per_frame_statistics = frame_statistics[root.thread_id];
-                auto& per_parent_statistics = parent_statistics[it.first];
-                per_parent_statistics.clear();
+        ::std::atomic<int> j(0);
+        const int n = static_cast<int>(roots.size());
+        parallel_for(roots.size(), [&](size_t k)
+        {
+            gather_thread_statistics(*roots[k], roots_sections[k], blocks, descriptors);
+            progress.store(90 + (10 * ++j) / n, ::std::memory_order_release);
+        });
+    }
+    else
+    {
+        int j = 0, n = static_cast<int>(threaded_trees.size());
+        for (auto& it : threaded_trees)
+        {
+            auto& root = it.second;
+            root.thread_id = it.first;
 
-                statistics_threads.emplace_back(::std::thread([&per_parent_statistics, &per_frame_statistics, &blocks](::profiler::BlocksTreeRoot& root)
-                {
-                    //::std::sort(root.sync.begin(), root.sync.end(), [&blocks](::profiler::block_index_t left, ::profiler::block_index_t right)
-                    //{
-                    //    return blocks[left].node->begin() < blocks[right].node->begin();
-                    //});
-
-                    ::profiler::block_index_t cs_index = 0;
-                    for (auto i : root.children)
-                    {
-                        auto& frame = blocks[i];
-                        frame.per_parent_stats = update_statistics(per_parent_statistics, frame, i, root.thread_id, blocks);
-
-                        per_frame_statistics.clear();
-                        update_statistics_recursive(per_frame_statistics, frame, i, i, blocks);
-
-                        if (cs_index < root.sync.size())
-                        {
-                            CsStatsMap frame_stats_cs;
-                            do {
-
-                                auto j = root.sync[cs_index];
-                                auto& cs = blocks[j];
-                                if (cs.node->end() < frame.node->begin())
-                                    continue;
-                                if (cs.node->begin() > frame.node->end())
-                                    break;
-                                cs.per_frame_stats = update_statistics(frame_stats_cs, cs, cs_index, i, blocks);
-
-                            } while (++cs_index < root.sync.size());
-                        }
-
-                        if (root.depth < frame.depth)
-                            root.depth = frame.depth;
-
-                        root.profiled_time += frame.node->duration();
-                    }
-
-                    ++root.depth;
-                }, ::std::ref(root)));
-            }
+            //::std::sort(root.sync.begin(), root.sync.end(), [&blocks](::profiler::block_index_t left, ::profiler::block_index_t right)
+            //{
+            //    return blocks[left].node->begin() < blocks[right].node->begin();
+            //});
 
-            int j = 0, n = static_cast<int>(statistics_threads.size());
-            for (auto& t : statistics_threads)
+            //root.tree.shrink_to_fit();
+            for (auto i : root.children)
             {
-                t.join();
-                progress.store(90 + (10 * ++j) / n, ::std::memory_order_release);
+                auto& frame = blocks[i];
+                if (root.depth < frame.depth)
+                    root.depth = frame.depth;
+                root.profiled_time += frame.node->duration();
+                add_frame_cpu_time(root, frame);
             }
+
+            ++root.depth;
+
+            progress.store(90 + (10 * ++j) / n, ::std::memory_order_release);
+        }
+    }
+    // No need to delete BlockStatistics instances - they are owned by BlocksTreeRoot::statistics
+
+    return static_cast<::profiler::block_index_t>(blocks.size());
+}
+
+/** Reads the file in one pass passing everything to _visitor without building blocks trees (see readProfile). */
+template <class TStream>
+static bool readProfileData(::std::atomic<int>& progress, TStream& inFile, ::profiler::ProfileVisitor& _visitor, ::std::stringstream& _log)
+{
+    EASY_FUNCTION(::profiler::colors::Cyan);
+
+    auto oldprogress = progress.exchange(0, ::std::memory_order_release);
+    if (oldprogress < 0)
+    {
+        _log << "Reading was interrupted";
+        return false;
+    }
+
+    ::profiler::SerializedData serialized_descriptors;
+    ::profiler::descriptors_list_t descriptors;
+    uint32_t total_descriptors_number = 0;
+
+    FileHeader header;
+    if (!read_file_header(progress, inFile, header, serialized_descriptors, descriptors, total_descriptors_number, _log))
+        return false;
+
+    const ::profiler::ProfileHeader profile {header.begin_time, header.end_time, header.cpu_frequency, header.version,
+                                             header.pid, header.total_blocks_number, total_descriptors_number};
+    _visitor.onHeader(profile);
+    _visitor.onDescriptors(descriptors);
+
+    if (header.total_blocks_number != 0)
+    {
+        // Every record is decoded into the same buffer: decoded record size is limited by 64 KB
+        ::std::vector<char> record(1 << 16);
+
+        ReaderState state;
+        if (!read_blocks_sequentially(inFile, header.header_position, make_context(header, descriptors), header.sections,
+                                      record.data(), record.size(), true, header.memory_size, header.total_blocks_number,
+                                      progress, state, _visitor))
+        {
+            _log << state.error;
+            return false;
+        }
+    }
+
+    if (progress.exchange(100, ::std::memory_order_release) < 0)
+    {
+        _log << "Reading was interrupted";
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+extern "C" {
+
+    PROFILER_API ::profiler::block_index_t fillTreesFromFile(::std::atomic<int>& progress, const char* filename,
+                                                             ::profiler::SerializedData& serialized_blocks,
+                                                             ::profiler::SerializedData& serialized_descriptors,
+                                                             ::profiler::descriptors_list_t& descriptors,
+                                                             ::profiler::blocks_t& blocks,
+                                                             ::profiler::thread_blocks_tree_t& threaded_trees,
+                                                             uint32_t& total_descriptors_number,
+                                                             bool gather_statistics,
+                                                             ::std::stringstream& _log)
+    {
+        auto oldprogress = progress.exchange(0, ::std::memory_order_release);
+        if (oldprogress < 0)
+        {
+            _log << "Reading was interrupted";
+            return 0;
+        }
+
+        // Parse records directly from the mapped file (no per-record stream reads and copies)
+        ::profiler::MappedFile mappedFile;
+        if (mappedFile.open(filename))
+        {
+            ::profiler::MemoryStream inFile(mappedFile.data(), mappedFile.size());
+            return fillTrees(progress, inFile, serialized_blocks, serialized_descriptors, descriptors, blocks,
+                             threaded_trees, total_descriptors_number, gather_statistics, _log);
+        }
+
+        ::std::ifstream inFile(filename, ::std::fstream::binary);
+        if (!inFile.is_open())
+        {
+            _log << "Can not open file " << filename;
+            return 0;
+        }
+
+        ::std::stringstream str;
+
+        // Replace str buffer to inFile buffer to avoid redundant copying
+        typedef ::std::basic_iostream<::std::stringstream::char_type, ::std::stringstream::traits_type> stringstream_parent;
+        stringstream_parent& s = str;
+        auto oldbuf = s.rdbuf(inFile.rdbuf());
+        
+        // Read data from file
+        auto result = fillTreesFromStream(progress, str, serialized_blocks, serialized_descriptors, descriptors, blocks,
+                                          threaded_trees, total_descriptors_number, gather_statistics, _log);
+
+        // Restore old str buffer to avoid possible second memory free on stringstream destructor
+        s.rdbuf(oldbuf);
+
+        return result;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
+    PROFILER_API ::profiler::block_index_t fillTreesFromStream(::std::atomic<int>& progress, ::std::stringstream& inFile,
+                                                               ::profiler::SerializedData& serialized_blocks,
+                                                               ::profiler::SerializedData& serialized_descriptors,
+                                                               ::profiler::descriptors_list_t& descriptors,
+                                                               ::profiler::blocks_t& blocks,
+                                                               ::profiler::thread_blocks_tree_t& threaded_trees,
+                                                               uint32_t& total_descriptors_number,
+                                                               bool gather_statistics,
+                                                               ::std::stringstream& _log)
+    {
+        return fillTrees(progress, inFile, serialized_blocks, serialized_descriptors, descriptors, blocks,
+                         threaded_trees, total_descriptors_number, gather_statistics, _log);
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
+    PROFILER_API ::profiler::block_index_t loadRange(::std::atomic<int>& progress, const char* filename,
+                                                     ::profiler::timestamp_t begin, ::profiler::timestamp_t end,
+                                                     const ::std::vector<::profiler::thread_id_t>& threads,
+                                                     ::profiler::SerializedData& serialized_blocks,
+                                                     ::profiler::SerializedData& serialized_descriptors,
+                                                     ::profiler::descriptors_list_t& descriptors,
+                                                     ::profiler::blocks_t& blocks,
+                                                     ::profiler::thread_blocks_tree_t& threaded_trees,
+                                                     uint32_t& total_descriptors_number,
+                                                     ::profiler::timestamp_t& capture_begin,
+                                                     ::profiler::timestamp_t& capture_end,
+                                                     bool gather_statistics,
+                                                     ::std::stringstream& _log)
+    {
+        auto oldprogress = progress.exchange(0, ::std::memory_order_release);
+        if (oldprogress < 0)
+        {
+            _log << "Reading was interrupted";
+            return 0;
+        }
+
+        TimeWindow window {threads, begin, end, 0, 0};
+        ::profiler::block_index_t result = 0;
+
+        ::profiler::MappedFile mappedFile;
+        if (mappedFile.open(filename))
+        {
+            ::profiler::MemoryStream inFile(mappedFile.data(), mappedFile.size());
+            result = fillTrees(progress, inFile, serialized_blocks, serialized_descriptors, descriptors, blocks,
+                               threaded_trees, total_descriptors_number, gather_statistics, _log, &window);
         }
         else
         {
-            int j = 0, n = static_cast<int>(threaded_trees.size());
-            for (auto& it : threaded_trees)
+            ::std::ifstream inFile(filename, ::std::fstream::binary);
+            if (!inFile.is_open())
             {
-                auto& root = it.second;
-                root.thread_id = it.first;
+                _log << "Can not open file " << filename;
+                return 0;
+            }
 
-                //::std::sort(root.sync.begin(), root.sync.end(), [&blocks](::profiler::block_index_t left, ::profiler::block_index_t right)
-                //{
-                //    return blocks[left].node->begin() < blocks[right].node->begin();
-                //});
+            ::std::stringstream str;
 
-                //root.tree.shrink_to_fit();
-                for (auto i : root.children)
-                {
-                    auto& frame = blocks[i];
-                    if (root.depth < frame.depth)
-                        root.depth = frame.depth;
-                    root.profiled_time += frame.node->duration();
-                }
+            // Replace str buffer to inFile buffer to avoid redundant copying
+            typedef ::std::basic_iostream<::std::stringstream::char_type, ::std::stringstream::traits_type> stringstream_parent;
+            stringstream_parent& s = str;
+            auto oldbuf = s.rdbuf(inFile.rdbuf());
 
-                ++root.depth;
+            result = fillTrees(progress, str, serialized_blocks, serialized_descriptors, descriptors, blocks,
+                               threaded_trees, total_descriptors_number, gather_statistics, _log, &window);
 
-                progress.store(90 + (10 * ++j) / n, ::std::memory_order_release);
-            }
+            // Restore old str buffer to avoid possible second memory free on stringstream destructor
+            s.rdbuf(oldbuf);
+        }
+
+        capture_begin = window.capture_begin;
+        capture_end = window.capture_end;
+
+        return result;
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
+    PROFILER_API bool readProfile(::std::atomic<int>& progress, ::std::stringstream& inFile,
+                                  ::profiler::ProfileVisitor& visitor, ::std::stringstream& _log)
+    {
+        return readProfileData(progress, inFile, visitor, _log);
+    }
+
+    PROFILER_API bool readProfileFromFile(::std::atomic<int>& progress, const char* filename,
+                                          ::profiler::ProfileVisitor& visitor, ::std::stringstream& _log)
+    {
+        ::profiler::MappedFile mappedFile;
+        if (mappedFile.open(filename))
+        {
+            ::profiler::MemoryStream inFile(mappedFile.data(), mappedFile.size());
+            return readProfileData(progress, inFile, visitor, _log);
+        }
+
+        ::std::ifstream inFile(filename, ::std::fstream::binary);
+        if (!inFile.is_open())
+        {
+            _log << "Can not open file " << filename;
+            return false;
         }
-        // No need to delete BlockStatistics instances - they will be deleted inside BlocksTree destructors
 
-        return blocks_counter;
+        ::std::stringstream str;
+
+        // Replace str buffer to inFile buffer to avoid redundant copying
+        typedef ::std::basic_iostream<::std::stringstream::char_type, ::std::stringstream::traits_type> stringstream_parent;
+        stringstream_parent& s = str;
+        auto oldbuf = s.rdbuf(inFile.rdbuf());
+
+        const auto result = readProfileData(progress, str, visitor, _log);
+
+        // Restore old str buffer to avoid possible second memory free on stringstream destructor
+        s.rdbuf(oldbuf);
+
+        return result;
     }
 
     //////////////////////////////////////////////////////////////////////////
@@ -893,7 +2146,7 @@ extern "C" {
 
         descriptors.reserve(total_descriptors_number);
         //const char* olddata = append_regime ? serialized_descriptors.data() : nullptr;
-        serialized_descriptors.set(descriptors_memory_size);
+        serialized_descriptors.set(descriptors_memory(version, total_descriptors_number, descriptors_memory_size));
         //validate_pointers(progress, olddata, serialized_descriptors, descriptors, descriptors.size());
 
         uint64_t i = 0;
@@ -913,7 +2166,7 @@ extern "C" {
             //}
 
             char* data = serialized_descriptors[i];
-            inFile.read(data, sz);
+            sz = read_descriptor(inFile, version, sz, data);
             auto descriptor = reinterpret_cast<::profiler::SerializedBlockDescriptor*>(data);
             descriptors.push_back(descriptor);
 
@@ -931,6 +2184,134 @@ extern "C" {
 
     //////////////////////////////////////////////////////////////////////////
 
+    PROFILER_API void collectLockStatistics(const ::profiler::blocks_t& _blocks,
+                                            const ::profiler::descriptors_list_t& _descriptors,
+                                            ::profiler::locks_statistics_t& _locks)
+    {
+        _locks.clear();
+
+        ::std::unordered_map<uint64_t, size_t, ::profiler::passthrough_hash> indices;
+        for (size_t i = 0, n = _blocks.size(); i < n; ++i)
+        {
+            const auto& block = _blocks[i];
+            if (!block.has_lock || block.node->id() >= _descriptors.size() || _descriptors[block.node->id()] == nullptr)
+                continue;
+
+            const auto lock_id = block.lock_id();
+            auto it = indices.find(lock_id);
+            if (it == indices.end())
+            {
+                it = indices.emplace(lock_id, _locks.size()).first;
+                _locks.emplace_back(lock_id);
+            }
+
+            auto& stats = _locks[it->second];
+            const auto desc = _descriptors[block.node->id()];
+            const auto sampling = desc->sampling();
+            const auto duration = block.node->duration();
+
+            if (desc->flags() & ::profiler::BLOCK_FLAG_LOCK_WAIT)
+            {
+                stats.contentions += sampling;
+                stats.total_wait += duration * sampling;
+                if (duration > stats.max_wait)
+                {
+                    stats.max_wait = duration;
+                    stats.max_wait_block = static_cast<::profiler::block_index_t>(i);
+                }
+            }
+            else if (desc->flags() & ::profiler::BLOCK_FLAG_LOCK_HOLD)
+            {
+                stats.acquisitions += sampling;
+                stats.total_hold += duration * sampling;
+                if (duration > stats.max_hold)
+                    stats.max_hold = duration;
+            }
+        }
+
+        ::std::sort(_locks.begin(), _locks.end(), [](const ::profiler::LockStatistics& _left, const ::profiler::LockStatistics& _right)
+        {
+            return _left.total_wait > _right.total_wait;
+        });
+    }
+
+    PROFILER_API void collectFlows(const ::profiler::blocks_t& _blocks,
+                                   const ::profiler::descriptors_list_t& _descriptors,
+                                   const ::profiler::thread_blocks_tree_t& _trees,
+                                   ::profiler::flows_t& _flows)
+    {
+        _flows.clear();
+
+        struct FlowEvent
+        {
+            ::profiler::timestamp_t time;
+            ::profiler::block_index_t block;
+            ::profiler::thread_id_t thread;
+            bool begin;
+        };
+
+        // Flow events can be nested into any block, so all trees are traversed
+        ::std::vector<FlowEvent> events;
+        ::std::vector<::profiler::block_index_t> stack;
+        for (const auto& thread : _trees)
+        {
+            stack.assign(thread.second.children.begin(), thread.second.children.end());
+            while (!stack.empty())
+            {
+                const auto index = stack.back();
+                stack.pop_back();
+
+                const auto& block = _blocks[index];
+                stack.insert(stack.end(), block.children.begin(), block.children.end());
+
+                if (!block.has_flow || block.node->id() >= _descriptors.size() || _descriptors[block.node->id()] == nullptr)
+                    continue;
+
+                const auto type = _descriptors[block.node->id()]->type();
+                if (type == ::profiler::BLOCK_TYPE_FLOW_BEGIN || type == ::profiler::BLOCK_TYPE_FLOW_END)
+                    events.push_back(FlowEvent {block.node->begin(), index, thread.first, type == ::profiler::BLOCK_TYPE_FLOW_BEGIN});
+            }
+        }
+
+        // Begin goes before end with the same time
+        ::std::sort(events.begin(), events.end(), [](const FlowEvent& _left, const FlowEvent& _right)
+        {
+            return _left.time < _right.time || (_left.time == _right.time && _left.begin && !_right.begin);
+        });
+
+        // Indices of not linked flow begins in order of their time
+        ::std::unordered_map<uint64_t, ::std::deque<size_t>, ::profiler::passthrough_hash> opened;
+        for (const auto& event : events)
+        {
+            const auto flow_id = _blocks[event.block].flow_id();
+            if (event.begin)
+            {
+                opened[flow_id].push_back(_flows.size());
+                _flows.push_back(::profiler::Flow {flow_id, event.block, event.block, event.thread, event.thread, 0});
+                continue;
+            }
+
+            auto it = opened.find(flow_id);
+            if (it == opened.end() || it->second.empty())
+                continue;
+
+            auto& flow = _flows[it->second.front()];
+            it->second.pop_front();
+
+            flow.end_block = event.block;
+            flow.end_thread = event.thread;
+            flow.latency = event.time - _blocks[flow.begin_block].node->begin();
+        }
+
+        // Remove flows without end (their end_block is not changed)
+        _flows.erase(::std::remove_if(_flows.begin(), _flows.end(), [](const ::profiler::Flow& _flow)
+        {
+            return _flow.end_block == _flow.begin_block;
+        }), _flows.end());
+    }
+
+    //////////////////////////////////////////////////////////////////////////
+
 }
 
 #undef EASY_CONVERT_TO_NANO
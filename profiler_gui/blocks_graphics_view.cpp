@@ -283,6 +283,8 @@ void EasyTimelineIndicatorItem::paint(QPainter* _painter, const QStyleOptionGrap
 EasyGraphicsView::EasyGraphicsView(QWidget* _parent)
     : Parent(_parent)
     , m_beginTime(::std::numeric_limits<decltype(m_beginTime)>::max())
+    , m_captureBeginTime(0)
+    , m_captureEndTime(0)
     , m_sceneWidth(0)
     , m_scale(1)
     , m_offset(0)
@@ -385,8 +387,19 @@ void EasyGraphicsView::clear()
     emit intervalChanged(m_selectedBlocks, m_beginTime, 0, 0, false);
 }
 
-void EasyGraphicsView::setTree(const ::profiler::thread_blocks_tree_t& _blocksTree)
+void EasyGraphicsView::setCaptureRange(::profiler::timestamp_t _beginTime, ::profiler::timestamp_t _endTime)
 {
+    m_captureBeginTime = _beginTime;
+    m_captureEndTime = _endTime;
+}
+
+void EasyGraphicsView::setTree(const ::profiler::thread_blocks_tree_t& _blocksTree, bool _keepViewport)
+{
+    // remember current viewport to restore it for the next time window of the same capture
+    const bool keepViewport = _keepViewport && !m_bEmpty;
+    const auto scale = m_scale;
+    const auto offset = m_offset;
+
     // clear scene
     clear();
 
@@ -436,6 +449,13 @@ void EasyGraphicsView::setTree(const ::profiler::thread_blocks_tree_t& _blocksTr
             mainTree = threadTree.first;
     }
 
+    if (m_captureEndTime > m_captureBeginTime)
+    {
+        // Only a time window of the capture is loaded: scene covers the whole capture to let scroll to other windows
+        m_beginTime = m_captureBeginTime;
+        finish = m_captureEndTime;
+    }
+
     const decltype(m_beginTime) additional_offset = (finish - m_beginTime) / 20; // Additional 5% before first block and after last block
     finish += additional_offset;
     m_beginTime -= ::std::min(m_beginTime, additional_offset);
@@ -523,7 +543,7 @@ void EasyGraphicsView::setTree(const ::profiler::thread_blocks_tree_t& _blocksTr
     // Setting flags
     m_bEmpty = false;
 
-    scaleTo(BASE_SCALE);
+    scaleTo(keepViewport ? scale : BASE_SCALE);
 
 
     emit treeChanged();
@@ -533,7 +553,11 @@ void EasyGraphicsView::setTree(const ::profiler::thread_blocks_tree_t& _blocksTr
         longestItem = mainThreadItem;
     }
 
-    if (longestItem != nullptr)
+    if (keepViewport)
+    {
+        m_pScrollbar->setValue(offset);
+    }
+    else if (longestItem != nullptr)
     {
         EASY_GLOBALS.selected_thread = longestItem->threadId();
         emit EASY_GLOBALS.events.selectedThreadChanged(longestItem->threadId());
@@ -736,6 +760,12 @@ void EasyGraphicsView::repaintScene()
 {
     scene()->update(m_visibleSceneRect);
     emit sceneUpdated();
+
+    if (!m_bEmpty)
+    {
+        const auto left = m_beginTime + position2time(m_offset);
+        emit visibleRangeChanged(left, left + position2time(m_visibleSceneRect.width() / m_scale));
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -1447,12 +1477,19 @@ void EasyGraphicsView::onIdleTimeout()
                 }
                 else
                 {
-                    lay->addWidget(new EasyBoldLabel("User defined event", widget), row, 0, 1, 2, Qt::AlignHCenter);
+                    lay->addWidget(new EasyBoldLabel(itemBlock.has_flow ? "Flow event" : "User defined event", widget), row, 0, 1, 2, Qt::AlignHCenter);
                     ++row;
 
                     lay->addWidget(new QLabel("Name:", widget), row, 0, Qt::AlignRight);
                     lay->addWidget(new QLabel(name, widget), row, 1, Qt::AlignLeft);
                     ++row;
+
+                    if (itemBlock.has_flow)
+                    {
+                        lay->addWidget(new QLabel("Flow id:", widget), row, 0, Qt::AlignRight);
+                        lay->addWidget(new QLabel(QString::number(itemBlock.flow_id()), widget), row, 1, Qt::AlignLeft);
+                        ++row;
+                    }
                 }
 
                 if (itemBlock.per_thread_stats)
@@ -1506,6 +1543,26 @@ void EasyGraphicsView::onIdleTimeout()
                             ++row;
                         }
 
+                        if (itemBlock.has_cpu_time)
+                        {
+                            const auto cpu_time = ::std::min(itemBlock.cpu_time(), duration);
+                            const auto cpu_percent = duration == 0 ? 100. : ::profiler_gui::percentReal(cpu_time, duration);
+                            lay->addWidget(new QLabel("CPU time:", widget), row, 0, Qt::AlignRight);
+                            lay->addWidget(new QLabel(QString("%1 (%2%)").arg(::profiler_gui::timeStringRealNs(EASY_GLOBALS.time_units, cpu_time, 3)).arg(QString::number(cpu_percent, 'g', 3)), widget), row, 1, 1, 3, Qt::AlignLeft);
+                            ++row;
+
+                            lay->addWidget(new QLabel("Off-CPU time:", widget), row, 0, Qt::AlignRight);
+                            lay->addWidget(new QLabel(::profiler_gui::timeStringRealNs(EASY_GLOBALS.time_units, duration - cpu_time, 3), widget), row, 1, 1, 3, Qt::AlignLeft);
+                            ++row;
+                        }
+
+                        if (itemBlock.has_lock)
+                        {
+                            lay->addWidget(new QLabel("Lock:", widget), row, 0, Qt::AlignRight);
+                            lay->addWidget(new QLabel(QString("0x%1").arg(itemBlock.lock_id(), 0, 16), widget), row, 1, 1, 3, Qt::AlignLeft);
+                            ++row;
+                        }
+
                         lay->addWidget(new EasyBoldLabel("-------- Statistics --------", widget), row, 0, 1, 5, Qt::AlignHCenter);
                         lay->addWidget(new QLabel("per ", widget), row + 1, 0, Qt::AlignRight);
                         lay->addWidget(new QLabel("This %:", widget), row + 2, 0, Qt::AlignRight);
@@ -120,6 +120,8 @@ private:
     QTimer                          m_idleTimer; ///< 
     QRectF                   m_visibleSceneRect; ///< Visible scene rectangle
     ::profiler::timestamp_t         m_beginTime; ///< Begin time of profiler session. Used to reduce values of all begin and end times of profiler blocks.
+    ::profiler::timestamp_t  m_captureBeginTime; ///< Begin time of the whole capture if only a time window of the file is loaded (see EasyFileReader::loadRange)
+    ::profiler::timestamp_t    m_captureEndTime; ///< End time of the whole capture if only a time window of the file is loaded (0 if whole file is loaded)
     qreal                          m_sceneWidth; ///< 
     qreal                               m_scale; ///< Current scale
     qreal                              m_offset; ///< Have to use manual offset for all scene content instead of using scrollbars because QScrollBar::value is 32-bit integer :(
@@ -169,7 +171,8 @@ public:
     void setScrollbar(EasyGraphicsScrollbar* _scrollbar);
     void clear();
 
-    void setTree(const ::profiler::thread_blocks_tree_t& _blocksTree);
+    void setCaptureRange(::profiler::timestamp_t _beginTime, ::profiler::timestamp_t _endTime);
+    void setTree(const ::profiler::thread_blocks_tree_t& _blocksTree, bool _keepViewport = false);
 
     const Items& getItems() const;
 
@@ -180,6 +183,7 @@ signals:
     void sceneUpdated();
     void treeChanged();
     void intervalChanged(const ::profiler_gui::TreeBlocks& _blocks, ::profiler::timestamp_t _session_begin_time, ::profiler::timestamp_t _left, ::profiler::timestamp_t _right, bool _strict);
+    void visibleRangeChanged(::profiler::timestamp_t _left, ::profiler::timestamp_t _right);
 
 private:
 
@@ -54,10 +54,13 @@
 #include <QSettings>
 #include <QLabel>
 #include <QLineEdit>
+#include <QInputDialog>
 #include <QToolBar>
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QTimer>
+#include <algorithm>
+#include <limits>
 #include <thread>
 #include "descriptors_tree_widget.h"
 #include "globals.h"
@@ -298,6 +301,11 @@ void EasyDescTreeWidget::contextMenuEvent(QContextMenuEvent* _event)
         submenu->setEnabled(EASY_GLOBALS.connected);
         if (!EASY_GLOBALS.connected)
             submenu->setTitle(QString("%1 (connection needed)").arg(submenu->title()));
+
+        action = menu.addAction(QString("Min duration (%1 ns)...").arg(desc.minDuration()));
+        action->setToolTip("Do not store blocks of this type\nshorter than this threshold.");
+        action->setEnabled(EASY_GLOBALS.connected);
+        connect(action, &QAction::triggered, this, &This::onBlockMinDurationChangeClicked);
     }
 
     menu.exec(QCursor::pos());
@@ -523,6 +531,28 @@ void EasyDescTreeWidget::onBlockStatusChangeClicked(bool _checked)
     }
 }
 
+void EasyDescTreeWidget::onBlockMinDurationChangeClicked(bool)
+{
+    if (!EASY_GLOBALS.connected)
+        return;
+
+    auto item = currentItem();
+    if (item == nullptr || item->parent() == nullptr)
+        return;
+
+    auto& desc = easyDescriptor(static_cast<EasyDescWidgetItem*>(item)->desc());
+
+    // Threshold is edited in microseconds with nanoseconds precision: int spin box can not hold all uint32_t nanoseconds
+    bool ok = false;
+    const auto value = QInputDialog::getDouble(this, "Min duration", QString("Do not store \"%1\" blocks shorter than (us):").arg(desc.name()),
+                                               desc.minDuration() * 1e-3, 0, static_cast<double>(std::numeric_limits<uint32_t>::max()) * 1e-3, 3, &ok);
+    if (!ok)
+        return;
+
+    desc.setMinDuration(static_cast<uint32_t>(std::min(value * 1e3 + 0.5, static_cast<double>(std::numeric_limits<uint32_t>::max()))));
+    emit EASY_GLOBALS.events.blockMinDurationChanged(desc.id(), desc.minDuration());
+}
+
 void EasyDescTreeWidget::onBlockStatusChange(::profiler::block_id_t _id, ::profiler::EasyBlockStatus _status)
 {
     if (m_bLocked)
@@ -127,6 +127,7 @@ private slots:
 
     void onSearchColumnChange(bool);
     void onBlockStatusChangeClicked(bool);
+    void onBlockMinDurationChangeClicked(bool);
     void onCurrentItemChange(QTreeWidgetItem* _item, QTreeWidgetItem* _prev);
     void onItemExpand(QTreeWidgetItem* _item);
     void onDoubleClick(QTreeWidgetItem* _item, int _column);
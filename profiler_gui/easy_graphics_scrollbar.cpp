@@ -755,7 +755,7 @@ void EasyHystogramItem::setSource(::profiler::thread_id_t _thread_id, const ::pr
                 if (w > m_maxDuration)
                     m_maxDuration = w;
 
-                if (w < m_minDuration && easyDescriptor(easyBlock(item.block).tree.node->id()).type() != ::profiler::BLOCK_TYPE_EVENT)
+                if (w < m_minDuration && easyDescriptor(easyBlock(item.block).tree.node->id()).type() == ::profiler::BLOCK_TYPE_BLOCK)
                     m_minDuration = w;
             }
         }
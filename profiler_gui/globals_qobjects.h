@@ -52,6 +52,7 @@ namespace profiler_gui {
         void selectedBlockIdChanged(::profiler::block_id_t _id);
         void itemsExpandStateChanged();
         void blockStatusChanged(::profiler::block_id_t _id, ::profiler::EasyBlockStatus _status);
+        void blockMinDurationChanged(::profiler::block_id_t _id, uint32_t _nanoseconds);
         void connectionChanged(bool _connected);
         void blocksRefreshRequired(bool);
         void timelineMarkerChanged();
@@ -48,8 +48,10 @@
 *                   : along with this program.If not, see <http://www.gnu.org/licenses/>.
 ************************************************************************/
 
+#include <algorithm>
 #include <chrono>
 #include <fstream>
+#include <limits>
 
 #include <QApplication>
 #include <QCoreApplication>
@@ -74,8 +76,10 @@
 #include <QLineEdit>
 #include <QLabel>
 #include <QDialog>
+#include <QInputDialog>
 #include <QVBoxLayout>
 #include <QFile>
+#include <QFileInfo>
 #include <QDragEnterEvent>
 #include <QDragMoveEvent>
 #include <QDragLeaveEvent>
@@ -101,6 +105,8 @@
 
 const int LOADER_TIMER_INTERVAL = 40;
 const auto NETWORK_CACHE_FILE = "easy_profiler_stream.cache";
+const qint64 LAZY_LOADING_FILE_SIZE = 512LL << 20; ///< Files of this size or bigger are loaded by time windows
+const ::profiler::timestamp_t LAZY_LOADING_WINDOW = 10000000000ULL; ///< Maximum loaded time window of such files (10 seconds)
 
 //////////////////////////////////////////////////////////////////////////
 
@@ -475,6 +481,11 @@ EasyMainWindow::EasyMainWindow() : Parent(), m_lastAddress("localhost"), m_lastP
     m_eventTracingPriorityAction->setEnabled(false);
     connect(m_eventTracingPriorityAction, &QAction::triggered, this, &This::onEventTracingPriorityChange);
 
+    m_minBlockDurationAction = submenu->addAction("Min block duration...");
+    m_minBlockDurationAction->setToolTip("Do not store blocks shorter than this threshold.");
+    m_minBlockDurationAction->setEnabled(false);
+    connect(m_minBlockDurationAction, &QAction::triggered, this, &This::onMinBlockDurationClicked);
+
 
     submenu = menu->addMenu("Encoding");
     actionGroup = new QActionGroup(this);
@@ -521,6 +532,7 @@ EasyMainWindow::EasyMainWindow() : Parent(), m_lastAddress("localhost"), m_lastP
 
 
     connect(graphicsView->view(), &EasyGraphicsView::intervalChanged, treeWidget->tree(), &EasyTreeWidget::setTreeBlocks);
+    connect(graphicsView->view(), &EasyGraphicsView::visibleRangeChanged, this, &This::onVisibleRangeChanged);
     connect(&m_readerTimer, &QTimer::timeout, this, &This::onFileReaderTimeout);
     connect(&m_listenerTimer, &QTimer::timeout, this, &This::onListenerTimerTimeout);
     
@@ -542,6 +554,7 @@ EasyMainWindow::EasyMainWindow() : Parent(), m_lastAddress("localhost"), m_lastP
     }
 
     connect(&EASY_GLOBALS.events, &::profiler_gui::EasyGlobalSignals::blockStatusChanged, this, &This::onBlockStatusChange);
+    connect(&EASY_GLOBALS.events, &::profiler_gui::EasyGlobalSignals::blockMinDurationChanged, this, &This::onBlockMinDurationChange);
     connect(&EASY_GLOBALS.events, &::profiler_gui::EasyGlobalSignals::blocksRefreshRequired, this, &This::onGetBlockDescriptionsClicked);
 }
 
@@ -628,7 +641,13 @@ void EasyMainWindow::loadFile(const QString& filename)
     m_progress->setValue(0);
     m_progress->show();
     m_readerTimer.start(LOADER_TIMER_INTERVAL);
-    m_reader.load(filename);
+    m_bLoadingNextWindow = false;
+
+    // Huge captures are loaded by time windows: the first window now, others are paged in on scrolling (see onVisibleRangeChanged)
+    if (QFileInfo(filename).size() >= LAZY_LOADING_FILE_SIZE)
+        m_reader.loadRange(filename, 0, LAZY_LOADING_WINDOW);
+    else
+        m_reader.load(filename);
 }
 
 void EasyMainWindow::readStream(::std::stringstream& data)
@@ -740,6 +759,7 @@ void EasyMainWindow::clear()
     m_deleteAction->setEnabled(false);
 
     m_bNetworkFileRegime = false;
+    m_pagedFile.clear();
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -1106,6 +1126,7 @@ void EasyMainWindow::setDisconnected(bool _showMessage)
 
     m_eventTracingEnableAction->setEnabled(false);
     m_eventTracingPriorityAction->setEnabled(false);
+    m_minBlockDurationAction->setEnabled(false);
 
     emit EASY_GLOBALS.events.connectionChanged(false);
 
@@ -1169,11 +1190,39 @@ void EasyMainWindow::onFileReaderTimeout()
 {
     if (m_reader.done())
     {
+        const bool nextWindow = m_bLoadingNextWindow;
+        m_bLoadingNextWindow = false;
+
         auto nblocks = m_reader.size();
+        if (nblocks == 0 && m_reader.isRange())
+        {
+            if (nextWindow)
+            {
+                // No blocks inside the next time window: keep current blocks and do not request this window again
+                m_windowBegin = m_reader.rangeBegin();
+                m_windowEnd = m_reader.rangeEnd();
+                m_reader.interrupt();
+                m_readerTimer.stop();
+                m_progress->setValue(100);
+                return;
+            }
+
+            // File has no threads sections table (or no blocks in the first window): load it entirely
+            const QString filename = m_reader.filename();
+            m_reader.load(filename);
+            return;
+        }
+
         if (nblocks != 0)
         {
             static_cast<EasyHierarchyWidget*>(m_treeWidget->widget())->clear(true);
 
+            const bool isRange = m_reader.isRange();
+            const auto windowBegin = m_reader.rangeBegin();
+            const auto windowEnd = m_reader.rangeEnd();
+            const auto captureBegin = m_reader.captureBegin();
+            const auto captureEnd = m_reader.captureEnd();
+
             ::profiler::SerializedData serialized_blocks;
             ::profiler::SerializedData serialized_descriptors;
             ::profiler::descriptors_list_t descriptors;
@@ -1193,7 +1242,7 @@ void EasyMainWindow::onFileReaderTimeout()
             }
 
             m_bNetworkFileRegime = !m_reader.isFile();
-            if (!m_bNetworkFileRegime)
+            if (!m_bNetworkFileRegime && !nextWindow)
             {
                 auto index = m_lastFiles.indexOf(filename, 0);
                 if (index == -1)
@@ -1211,10 +1260,23 @@ void EasyMainWindow::onFileReaderTimeout()
                     m_loadActionMenu->insertAction(fileActions.front(), action);
                 }
             }
+            if (isRange)
+            {
+                m_pagedFile = filename;
+                m_captureBegin = captureBegin;
+                m_windowBegin = windowBegin;
+                m_windowEnd = windowEnd;
+            }
+            else
+            {
+                m_pagedFile.clear();
+            }
+
             m_serializedBlocks = ::std::move(serialized_blocks);
             m_serializedDescriptors = ::std::move(serialized_descriptors);
             m_descriptorsNumberInFile = descriptorsNumberInFile;
-            EASY_GLOBALS.selected_thread = 0;
+            if (!nextWindow)
+                EASY_GLOBALS.selected_thread = 0;
             ::profiler_gui::set_max(EASY_GLOBALS.selected_block);
             ::profiler_gui::set_max(EASY_GLOBALS.selected_block_id);
             EASY_GLOBALS.profiler_blocks.swap(threads_map);
@@ -1231,7 +1293,12 @@ void EasyMainWindow::onFileReaderTimeout()
 #endif
             }
 
-            static_cast<EasyGraphicsViewWidget*>(m_graphicsView->widget())->view()->setTree(EASY_GLOBALS.profiler_blocks);
+            auto view = static_cast<EasyGraphicsViewWidget*>(m_graphicsView->widget())->view();
+            if (isRange)
+                view->setCaptureRange(captureBegin, captureEnd);
+            else
+                view->setCaptureRange(0, 0);
+            view->setTree(EASY_GLOBALS.profiler_blocks, nextWindow);
 
 #if EASY_GUI_USE_DESCRIPTORS_DOCK_WINDOW != 0
             static_cast<EasyDescWidget*>(m_descTreeWidget->widget())->build();
@@ -1277,6 +1344,30 @@ void EasyMainWindow::onFileReaderTimeout()
     }
 }
 
+void EasyMainWindow::onVisibleRangeChanged(::profiler::timestamp_t _left, ::profiler::timestamp_t _right)
+{
+    if (m_pagedFile.isEmpty() || m_readerTimer.isActive())
+        return; // Whole file is loaded or the reader is busy
+
+    // Visible part of the scene in nanoseconds from the capture begin
+    const auto left = _left > m_captureBegin ? _left - m_captureBegin : 0;
+    const auto right = _right > left + m_captureBegin ? _right - m_captureBegin : left;
+    if (left >= m_windowBegin && right <= m_windowEnd)
+        return;
+
+    // Window around the center of the visible part (visible part with margins, but not wider than LAZY_LOADING_WINDOW)
+    const auto halfWidth = ::std::min(right - left, LAZY_LOADING_WINDOW / 2);
+    const auto center = left + (right - left) / 2;
+    const auto begin = center > halfWidth ? center - halfWidth : 0;
+    const auto end = center + halfWidth;
+    if (begin >= m_windowBegin && end <= m_windowEnd)
+        return; // Scene is zoomed out wider than maximum window and this window is loaded already
+
+    m_bLoadingNextWindow = true;
+    m_readerTimer.start(LOADER_TIMER_INTERVAL);
+    m_reader.loadRange(m_pagedFile, begin, end);
+}
+
 void EasyMainWindow::onFileReaderCancel()
 {
     m_readerTimer.stop();
@@ -1302,6 +1393,11 @@ const bool EasyFileReader::isFile() const
     return m_isFile;
 }
 
+bool EasyFileReader::isRange() const
+{
+    return m_isRange;
+}
+
 bool EasyFileReader::done() const
 {
     return m_bDone.load(::std::memory_order_acquire);
@@ -1322,11 +1418,32 @@ const QString& EasyFileReader::filename() const
     return m_filename;
 }
 
+::profiler::timestamp_t EasyFileReader::rangeBegin() const
+{
+    return m_rangeBegin;
+}
+
+::profiler::timestamp_t EasyFileReader::rangeEnd() const
+{
+    return m_rangeEnd;
+}
+
+::profiler::timestamp_t EasyFileReader::captureBegin() const
+{
+    return m_captureBegin;
+}
+
+::profiler::timestamp_t EasyFileReader::captureEnd() const
+{
+    return m_captureEnd;
+}
+
 void EasyFileReader::load(const QString& _filename)
 {
     interrupt();
 
     m_isFile = true;
+    m_isRange = false;
     m_filename = _filename;
     m_thread = ::std::thread([this](bool _enableStatistics) {
         m_size.store(fillTreesFromFile(m_progress, m_filename.toStdString().c_str(), m_serializedBlocks, m_serializedDescriptors,
@@ -1336,11 +1453,31 @@ void EasyFileReader::load(const QString& _filename)
     }, EASY_GLOBALS.enable_statistics);
 }
 
+void EasyFileReader::loadRange(const QString& _filename, ::profiler::timestamp_t _begin, ::profiler::timestamp_t _end)
+{
+    interrupt();
+
+    m_isFile = true;
+    m_isRange = true;
+    m_filename = _filename;
+    m_rangeBegin = _begin;
+    m_rangeEnd = _end;
+    m_thread = ::std::thread([this](bool _enableStatistics) {
+        const ::std::vector<::profiler::thread_id_t> allThreads;
+        m_size.store(::loadRange(m_progress, m_filename.toStdString().c_str(), m_rangeBegin, m_rangeEnd, allThreads,
+            m_serializedBlocks, m_serializedDescriptors, m_descriptors, m_blocks, m_blocksTree, m_descriptorsNumberInFile,
+            m_captureBegin, m_captureEnd, _enableStatistics, m_errorMessage), ::std::memory_order_release);
+        m_progress.store(100, ::std::memory_order_release);
+        m_bDone.store(true, ::std::memory_order_release);
+    }, EASY_GLOBALS.enable_statistics);
+}
+
 void EasyFileReader::load(::std::stringstream& _stream)
 {
     interrupt();
 
     m_isFile = false;
+    m_isRange = false;
     m_filename.clear();
 
 #if defined(__GNUC__) && __GNUC__ < 5 && !defined(__llvm__)
@@ -1421,6 +1558,22 @@ void EasyMainWindow::onEventTracingEnableChange(bool _checked)
         m_listener.send(profiler::net::BoolMessage(profiler::net::MESSAGE_TYPE_EVENT_TRACING_STATUS, _checked));
 }
 
+void EasyMainWindow::onMinBlockDurationClicked(bool)
+{
+    if (!EASY_GLOBALS.connected)
+        return;
+
+    // Threshold is edited in microseconds with nanoseconds precision: int spin box can not hold all uint32_t nanoseconds
+    bool ok = false;
+    const auto value = QInputDialog::getDouble(this, "Min block duration", "Do not store blocks shorter than (us):",
+                                               m_minBlockDuration * 1e-3, 0, static_cast<double>(std::numeric_limits<uint32_t>::max()) * 1e-3, 3, &ok);
+    if (!ok)
+        return;
+
+    m_minBlockDuration = static_cast<uint32_t>(std::min(value * 1e3 + 0.5, static_cast<double>(std::numeric_limits<uint32_t>::max())));
+    m_listener.send(profiler::net::Uint32Message(profiler::net::MESSAGE_TYPE_MIN_BLOCK_DURATION, m_minBlockDuration));
+}
+
 //////////////////////////////////////////////////////////////////////////
 
 void EasyMainWindow::onFrameTimeEditFinish()
@@ -1551,6 +1704,7 @@ void EasyMainWindow::onConnectClicked(bool)
 
     m_eventTracingEnableAction->setEnabled(true);
     m_eventTracingPriorityAction->setEnabled(true);
+    m_minBlockDurationAction->setEnabled(true);
 
     m_eventTracingEnableAction->setChecked(reply.isEventTracingEnabled);
     m_eventTracingPriorityAction->setChecked(reply.isLowPriorityEventTracing);
@@ -1760,6 +1914,12 @@ void EasyMainWindow::onBlockStatusChange(::profiler::block_id_t _id, ::profiler:
         m_listener.send(profiler::net::BlockStatusMessage(_id, static_cast<uint8_t>(_status)));
 }
 
+void EasyMainWindow::onBlockMinDurationChange(::profiler::block_id_t _id, uint32_t _nanoseconds)
+{
+    if (EASY_GLOBALS.connected)
+        m_listener.send(profiler::net::BlockMinDurationMessage(_id, _nanoseconds));
+}
+
 //////////////////////////////////////////////////////////////////////////
 
 EasySocketListener::EasySocketListener() : m_receivedSize(0), m_port(0), m_regime(LISTENER_IDLE)
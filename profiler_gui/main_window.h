@@ -89,7 +89,12 @@ class EasyFileReader Q_DECL_FINAL
     ::std::atomic_bool                         m_bDone; ///< 
     ::std::atomic<int>                      m_progress; ///< 
     ::std::atomic<unsigned int>                 m_size; ///< 
+    ::profiler::timestamp_t            m_rangeBegin = 0; ///< Begin of the loaded time window in nanoseconds from the capture begin (see loadRange)
+    ::profiler::timestamp_t              m_rangeEnd = 0; ///< End of the loaded time window in nanoseconds from the capture begin
+    ::profiler::timestamp_t          m_captureBegin = 0; ///< Begin time of the whole capture (set by loadRange)
+    ::profiler::timestamp_t            m_captureEnd = 0; ///< End time of the whole capture (set by loadRange)
     bool                              m_isFile = false; ///< 
+    bool                             m_isRange = false; ///< Only a time window of the file is loaded
 
 public:
 
@@ -97,12 +102,18 @@ public:
     ~EasyFileReader();
 
     const bool isFile() const;
+    bool isRange() const;
     bool done() const;
     int progress() const;
     unsigned int size() const;
     const QString& filename() const;
+    ::profiler::timestamp_t rangeBegin() const;
+    ::profiler::timestamp_t rangeEnd() const;
+    ::profiler::timestamp_t captureBegin() const;
+    ::profiler::timestamp_t captureEnd() const;
 
     void load(const QString& _filename);
+    void loadRange(const QString& _filename, ::profiler::timestamp_t _begin, ::profiler::timestamp_t _end);
     void load(::std::stringstream& _stream);
     void interrupt();
     void get(::profiler::SerializedData& _serializedBlocks, ::profiler::SerializedData& _serializedDescriptors,
@@ -197,6 +208,10 @@ protected:
     ::profiler::SerializedData m_serializedDescriptors;
     EasyFileReader                            m_reader;
     EasySocketListener                      m_listener;
+    QString                                m_pagedFile; ///< File which is loaded by time windows (empty if whole file is loaded)
+    ::profiler::timestamp_t            m_captureBegin = 0; ///< Begin time of the paged file capture
+    ::profiler::timestamp_t             m_windowBegin = 0; ///< Loaded time window of the paged file (nanoseconds from the capture begin)
+    ::profiler::timestamp_t               m_windowEnd = 0; ///< 
 
     class QLineEdit* m_addressEdit = nullptr;
     class QLineEdit* m_portEdit = nullptr;
@@ -210,10 +225,13 @@ protected:
     class QAction* m_connectAction = nullptr;
     class QAction* m_eventTracingEnableAction = nullptr;
     class QAction* m_eventTracingPriorityAction = nullptr;
+    class QAction* m_minBlockDurationAction = nullptr;
 
     uint32_t m_descriptorsNumberInFile = 0;
+    uint32_t m_minBlockDuration = 0;
     uint16_t m_lastPort = 0;
     bool m_bNetworkFileRegime = false;
+    bool m_bLoadingNextWindow = false;
 
 public:
 
@@ -249,6 +267,7 @@ protected slots:
     void onMinSizeChange(int _value);
     void onNarrowSizeChange(int _value);
     void onFileReaderTimeout();
+    void onVisibleRangeChanged(::profiler::timestamp_t _left, ::profiler::timestamp_t _right);
     void onListenerTimerTimeout();
     void onFileReaderCancel();
     void onEditBlocksClicked(bool);
@@ -259,9 +278,11 @@ protected slots:
     void onConnectClicked(bool);
     void onEventTracingPriorityChange(bool _checked);
     void onEventTracingEnableChange(bool _checked);
+    void onMinBlockDurationClicked(bool);
     void onFrameTimeEditFinish();
 
     void onBlockStatusChange(::profiler::block_id_t _id, ::profiler::EasyBlockStatus _status);
+    void onBlockMinDurationChange(::profiler::block_id_t _id, uint32_t _nanoseconds);
 
 private:
 
@@ -0,0 +1,40 @@
+#!/usr/bin/env python3
+"""Converts legacy text context switch log (written by context_switch_logger.stp) into binary format
+parsed by EasyProfiler (see easy_profiler_core/cswitch_log.h).
+
+Usage: convert_context_switch_log.py <text log> <binary log>
+"""
+
+import struct
+import sys
+
+SIGNATURE = 0x53435A45  # "EZCS"
+VERSION = 1
+NAME_RECORD = 0xFFFFFFFFFFFFFFFF
+
+
+def convert(src, dst):
+    names = {}
+    records = 0
+    with open(src, 'r', errors='replace') as fin, open(dst, 'wb') as fout:
+        fout.write(struct.pack('<II', SIGNATURE, VERSION))
+        for line in fin:
+            fields = line.split()
+            if len(fields) != 5:
+                continue
+            timestamp, thread_from, thread_to, name, process_to = fields
+            name_id = names.get(name)
+            if name_id is None:
+                name_id = names[name] = len(names)
+                data = name.encode() + b'\0'
+                fout.write(struct.pack('<QIIII', NAME_RECORD, name_id, len(data), 0, 0))
+                fout.write(data + b'\0' * (-len(data) % 8))
+            fout.write(struct.pack('<QIIII', int(timestamp), int(thread_from), int(thread_to), int(process_to), name_id))
+            records += 1
+    return records
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    print('Converted %d context switches' % convert(sys.argv[1], sys.argv[2]))